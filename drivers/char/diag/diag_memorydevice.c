@@ -22,6 +22,8 @@
 #include <linux/delay.h>
 #include <linux/kmemleak.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
 #include "diagchar.h"
 #include "diag_memorydevice.h"
 #include "diagfwd_bridge.h"
@@ -135,9 +137,115 @@ void diag_md_close_all(void)
 	diag_ws_reset(DIAG_WS_MUX);
 }
 
+struct diag_md_ring *diag_md_ring_alloc(unsigned long size)
+{
+	struct diag_md_ring *ring;
+	void *base;
+
+	if (!is_power_of_2(size) || size < DIAG_MD_RING_MIN_SIZE ||
+	    size > DIAG_MD_RING_MAX_SIZE)
+		return ERR_PTR(-EINVAL);
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return ERR_PTR(-ENOMEM);
+
+	base = vmalloc_user(PAGE_SIZE + size);
+	if (!base) {
+		kfree(ring);
+		return ERR_PTR(-ENOMEM);
+	}
+	ring->hdr = base;
+	ring->data = base + PAGE_SIZE;
+	ring->size = size;
+	ring->hdr->size = size;
+
+	return ring;
+}
+
+void diag_md_ring_free(struct diag_md_ring *ring)
+{
+	if (!ring)
+		return;
+	vfree(ring->hdr);
+	kfree(ring);
+}
+
+int diag_md_ring_mmap(struct diag_md_ring *ring, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff ||
+	    vma->vm_end - vma->vm_start != PAGE_SIZE + ring->size)
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, ring->hdr, 0);
+}
+
+bool diag_md_ring_pending(struct diag_md_ring *ring)
+{
+	/* orders the reader's tail update before the check of head */
+	smp_mb();
+	return READ_ONCE(ring->hdr->tail) != READ_ONCE(ring->head);
+}
+
+/*
+ * Appends a record to the ring, called with md_session_lock held.  Returns
+ * 1 if the reader may be waiting for data and has to be woken up, 0 if not
+ * or -ENOSPC if the record was dropped.  tail is written by the reader and
+ * only trusted as far as the checks here go.
+ */
+static int diag_md_ring_write(struct diag_md_ring *ring, int token,
+			      unsigned char *buf, int len)
+{
+	struct diag_md_ring_hdr *hdr = ring->hdr;
+	struct diag_md_ring_rec *rec;
+	uint32_t old_head = ring->head;
+	uint32_t head = old_head;
+	uint32_t tail = READ_ONCE(hdr->tail);
+	uint32_t need = ALIGN(sizeof(*rec) + len, DIAG_MD_RING_ALIGN);
+	uint32_t off = head & (ring->size - 1);
+	uint32_t used = head - tail;
+	uint32_t pad = 0;
+
+	/* the reader is done with the data up to tail before we reuse it */
+	smp_mb();
+
+	if (ring->size - off < need)
+		pad = ring->size - off;
+	if (used > ring->size || need > ring->size ||
+	    used + pad + need > ring->size) {
+		WRITE_ONCE(hdr->dropped, hdr->dropped + 1);
+		return -ENOSPC;
+	}
+
+	if (pad) {
+		rec = (struct diag_md_ring_rec *)(ring->data + off);
+		rec->token = 0;
+		rec->len = DIAG_MD_RING_PAD;
+		head += pad;
+		off = 0;
+	}
+
+	rec = (struct diag_md_ring_rec *)(ring->data + off);
+	rec->token = token;
+	rec->len = len;
+	memcpy(rec + 1, buf, len);
+	head += need;
+
+	ring->head = head;
+	smp_store_release(&hdr->head, head);
+
+	/*
+	 * The reader may have caught up with old_head since tail was read
+	 * above and gone to sleep before seeing the new head.  Pairs with
+	 * the barrier in diag_md_ring_pending().
+	 */
+	smp_mb();
+	return READ_ONCE(hdr->tail) == old_head;
+}
+
 int diag_md_write(int id, unsigned char *buf, int len, int ctx)
 {
-	int i, peripheral, pid = 0;
+	int i, err, peripheral, pid = 0;
 	uint8_t found = 0;
 	unsigned long flags;
 	struct diag_md_info *ch = NULL;
@@ -167,6 +275,31 @@ int diag_md_write(int id, unsigned char *buf, int len, int ctx)
 		return -EINVAL;
 	}
 
+	/*
+	 * With a ring the data is copied there once and the buffer goes
+	 * straight back to its owner, instead of waiting in the table for
+	 * the client to read() it.
+	 */
+	if (session_info->md_ring) {
+		err = diag_md_ring_write(session_info->md_ring,
+					 diag_get_remote(id), buf, len);
+		mutex_unlock(&driver->md_session_lock);
+
+		spin_lock_irqsave(&ch->lock, flags);
+		if (ch->ops && ch->ops->write_done)
+			ch->ops->write_done(buf, len, ctx,
+					    DIAG_MEMORY_DEVICE_MODE);
+		spin_unlock_irqrestore(&ch->lock, flags);
+
+		/*
+		 * The buffer is back with its owner either way, drops are
+		 * only reported through the ring header.
+		 */
+		if (err > 0)
+			wake_up_interruptible(&driver->wait_q);
+		return 0;
+	}
+
 	spin_lock_irqsave(&ch->lock, flags);
 	for (i = 0; i < ch->num_tbl_entries && !found; i++) {
 		if (ch->tbl[i].buf != buf)
@@ -27,6 +27,8 @@
 #define NUM_DIAG_MD_DEV		DIAG_MD_BRIDGE_LAST
 #endif
 
+struct vm_area_struct;
+
 struct diag_buf_tbl_t {
 	unsigned char *buf;
 	int len;
@@ -44,6 +46,18 @@ struct diag_md_info {
 	struct diag_mux_ops *ops;
 };
 
+/*
+ * A memory device mode ring shared with a client, see struct
+ * diag_md_ring_hdr.  head is the driver's copy, the one in the shared
+ * header is only published for the reader.
+ */
+struct diag_md_ring {
+	struct diag_md_ring_hdr *hdr;
+	unsigned char *data;
+	uint32_t size;
+	uint32_t head;
+};
+
 extern struct diag_md_info diag_md[NUM_DIAG_MD_DEV];
 
 int diag_md_init(void);
@@ -57,4 +71,8 @@ int diag_md_close_peripheral(int id, uint8_t peripheral);
 int diag_md_write(int id, unsigned char *buf, int len, int ctx);
 int diag_md_copy_to_user(char __user *buf, int *pret, size_t buf_size,
 			 struct diag_md_session_t *info);
+struct diag_md_ring *diag_md_ring_alloc(unsigned long size);
+void diag_md_ring_free(struct diag_md_ring *ring);
+int diag_md_ring_mmap(struct diag_md_ring *ring, struct vm_area_struct *vma);
+bool diag_md_ring_pending(struct diag_md_ring *ring);
 #endif
@@ -22,6 +22,7 @@
 #include <linux/sched.h>
 #include <linux/ratelimit.h>
 #include <linux/timer.h>
+#include <linux/poll.h>
 #include <linux/sched.h>
 #ifdef CONFIG_DIAG_OVER_USB
 #include <linux/usb/usbdiag.h>
@@ -58,6 +59,8 @@ MODULE_LICENSE("GPL v2");
 struct diagchar_dev *driver;
 struct diagchar_priv {
 	int pid;
+	struct diag_md_ring *md_ring;
+	bool removed;
 };
 
 #define USER_SPACE_RAW_DATA	0
@@ -274,7 +277,7 @@ void diag_add_client(int i, struct file *file)
 	struct diagchar_priv *diagpriv_data;
 
 	driver->client_map[i].pid = current->tgid;
-	diagpriv_data = kmalloc(sizeof(struct diagchar_priv),
+	diagpriv_data = kzalloc(sizeof(struct diagchar_priv),
 							GFP_KERNEL);
 	if (diagpriv_data)
 		diagpriv_data->pid = current->tgid;
@@ -518,6 +521,25 @@ static void diag_close_logging_process(const int pid)
 	mutex_unlock(&driver->diagchar_mutex);
 }
 
+/*
+ * Detaches the ring of this file from its logging session.  The memory
+ * stays with the file until release, as the client may still have it
+ * mapped.
+ */
+static void diag_md_ring_detach(struct diagchar_priv *diagpriv_data)
+{
+	struct diag_md_session_t *session_info;
+
+	if (!diagpriv_data->md_ring)
+		return;
+
+	mutex_lock(&driver->md_session_lock);
+	session_info = diag_md_session_get_pid(diagpriv_data->pid);
+	if (session_info && session_info->md_ring == diagpriv_data->md_ring)
+		session_info->md_ring = NULL;
+	mutex_unlock(&driver->md_session_lock);
+}
+
 static int diag_remove_client_entry(struct file *file)
 {
 	int i = -1;
@@ -553,6 +575,7 @@ static int diag_remove_client_entry(struct file *file)
 	mutex_unlock(&driver->dci_mutex);
 
 	diag_close_logging_process(current->tgid);
+	diag_md_ring_detach(diagpriv_data);
 
 	/* Delete the pkt response table entry for the exiting process */
 	diag_cmd_remove_reg_by_pid(current->tgid);
@@ -566,6 +589,11 @@ static int diag_remove_client_entry(struct file *file)
 		if (diagpriv_data && diagpriv_data->pid ==
 						driver->client_map[i].pid) {
 			driver->client_map[i].pid = 0;
+			/* a ring is freed by diagchar_close() */
+			if (diagpriv_data->md_ring) {
+				diagpriv_data->removed = true;
+				break;
+			}
 			kfree(diagpriv_data);
 			diagpriv_data = NULL;
 			file->private_data = 0;
@@ -578,11 +606,22 @@ static int diag_remove_client_entry(struct file *file)
 }
 static int diagchar_close(struct inode *inode, struct file *file)
 {
-	int ret;
+	struct diagchar_priv *diagpriv_data = file->private_data;
+	int ret = 0;
 
 	DIAG_LOG(DIAG_DEBUG_USERSPACE, "diag: %s process exit with pid = %d\n",
 		current->comm, current->tgid);
-	ret = diag_remove_client_entry(file);
+	/* a DEINIT read may have removed the client already */
+	if (!diagpriv_data || !diagpriv_data->removed)
+		ret = diag_remove_client_entry(file);
+
+	/* nothing can map the ring any more */
+	diagpriv_data = file->private_data;
+	if (diagpriv_data && diagpriv_data->md_ring) {
+		diag_md_ring_free(diagpriv_data->md_ring);
+		kfree(diagpriv_data);
+		file->private_data = NULL;
+	}
 
 	return ret;
 }
@@ -2604,6 +2643,49 @@ static int diag_ioctl_cmd_dereg(void)
 	return 0;
 }
 
+/*
+ * Attaches the memory device ring of this file to the caller's logging
+ * session, allocating a ring of @ioarg bytes on first use.  The ring
+ * belongs to the file, so that it outlives both the session and any
+ * mapping of it.
+ */
+static int diag_ioctl_md_ring(struct file *filp, unsigned long ioarg)
+{
+	struct diagchar_priv *diagpriv_data = filp->private_data;
+	struct diag_md_session_t *session_info;
+	struct diag_md_ring *ring = NULL;
+	int err = 0;
+
+	if (!diagpriv_data || diagpriv_data->removed)
+		return -EINVAL;
+
+	if (!READ_ONCE(diagpriv_data->md_ring)) {
+		ring = diag_md_ring_alloc(ioarg);
+		if (IS_ERR(ring))
+			return PTR_ERR(ring);
+	}
+
+	mutex_lock(&driver->md_session_lock);
+	session_info = diag_md_session_get_pid(current->tgid);
+	if (!session_info || session_info->md_ring) {
+		err = -EINVAL;
+		goto out;
+	}
+	if (!diagpriv_data->md_ring) {
+		if (!ring) {
+			err = -EAGAIN;
+			goto out;
+		}
+		diagpriv_data->md_ring = ring;
+		ring = NULL;
+	}
+	session_info->md_ring = diagpriv_data->md_ring;
+out:
+	mutex_unlock(&driver->md_session_lock);
+	diag_md_ring_free(ring);
+	return err;
+}
+
 #ifdef CONFIG_COMPAT
 /*
  * @sync_obj_name: name of the synchronization object associated with this proc
@@ -2779,6 +2861,9 @@ long diagchar_compat_ioctl(struct file *filp,
 		else
 			result = 0;
 		break;
+	case DIAG_IOCTL_MD_RING:
+		result = diag_ioctl_md_ring(filp, ioarg);
+		break;
 	}
 	return result;
 }
@@ -2929,6 +3014,9 @@ long diagchar_ioctl(struct file *filp,
 		else
 			result = 0;
 		break;
+	case DIAG_IOCTL_MD_RING:
+		result = diag_ioctl_md_ring(filp, ioarg);
+		break;
 	}
 	return result;
 }
@@ -4086,10 +4174,48 @@ static int diag_real_time_info_init(void)
 	return 0;
 }
 
+static int diagchar_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct diagchar_priv *diagpriv_data = file->private_data;
+	struct diag_md_ring *ring;
+
+	ring = diagpriv_data ? READ_ONCE(diagpriv_data->md_ring) : NULL;
+	if (!ring)
+		return -EINVAL;
+
+	return diag_md_ring_mmap(ring, vma);
+}
+
+static unsigned int diagchar_poll(struct file *file, poll_table *wait)
+{
+	struct diagchar_priv *diagpriv_data = file->private_data;
+	struct diag_md_ring *ring;
+	unsigned int mask = 0;
+	int i;
+
+	poll_wait(file, &driver->wait_q, wait);
+
+	ring = diagpriv_data ? READ_ONCE(diagpriv_data->md_ring) : NULL;
+	if (ring && diag_md_ring_pending(ring))
+		mask |= POLLIN | POLLRDNORM;
+
+	mutex_lock(&driver->diagchar_mutex);
+	for (i = 0; i < driver->num_clients; i++) {
+		if (driver->client_map[i].pid == current->tgid &&
+		    atomic_read(&driver->data_ready_notif[i]) > 0)
+			mask |= POLLIN | POLLRDNORM;
+	}
+	mutex_unlock(&driver->diagchar_mutex);
+
+	return mask;
+}
+
 static const struct file_operations diagcharfops = {
 	.owner = THIS_MODULE,
 	.read = diagchar_read,
 	.write = diagchar_write,
+	.mmap = diagchar_mmap,
+	.poll = diagchar_poll,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl = diagchar_compat_ioctl,
 #endif
@@ -4195,6 +4321,8 @@ static int __init diagchar_init(void)
 		return -ENOMEM;
 	kmemleak_not_leak(driver);
 
+	diag_hdlc_selftest();
+
 	timer_in_progress = 0;
 	diag_init_transport();
 	DIAG_LOG(DIAG_DEBUG_MUX, "Transport type set to %d\n",
@@ -20,6 +20,8 @@
 #include <linux/uaccess.h>
 #include <linux/ratelimit.h>
 #include <linux/crc-ccitt.h>
+#include <linux/kernel.h>
+#include <asm/unaligned.h>
 #include "diagchar_hdlc.h"
 #include "diagchar.h"
 
@@ -31,6 +33,34 @@ MODULE_LICENSE("GPL v2");
 #define CRC_16_L_STEP(xx_crc, xx_c) \
 	crc_ccitt_byte(xx_crc, xx_c)
 
+/* Nonzero if any byte of the word @v is zero */
+#define HDLC_HAS_ZERO(v) \
+	(((v) - REPEAT_BYTE(0x01)) & ~(v) & REPEAT_BYTE(0x80))
+
+/*
+ * Returns the number of bytes from @p on, up to @max, which need no
+ * escaping.  Whole words are tested for CONTROL_CHAR and ESC_CHAR at
+ * once, so that the clean runs making up most of the traffic are found
+ * without looking at each byte, and then copied and CRCed in one go.
+ */
+static size_t diag_hdlc_clean_run(const uint8_t *p, size_t max)
+{
+	unsigned long v;
+	size_t n = 0;
+
+	while (n + sizeof(v) <= max) {
+		v = get_unaligned((const unsigned long *)(p + n));
+		if (HDLC_HAS_ZERO(v ^ REPEAT_BYTE(CONTROL_CHAR)) ||
+		    HDLC_HAS_ZERO(v ^ REPEAT_BYTE(ESC_CHAR)))
+			break;
+		n += sizeof(v);
+	}
+	while (n < max && p[n] != CONTROL_CHAR && p[n] != ESC_CHAR)
+		n++;
+
+	return n;
+}
+
 void diag_hdlc_encode(struct diag_send_desc_type *src_desc,
 		      struct diag_hdlc_dest_type *enc)
 {
@@ -42,6 +72,7 @@ void diag_hdlc_encode(struct diag_send_desc_type *src_desc,
 	unsigned char src_byte = 0;
 	enum diag_send_state_enum_type state;
 	unsigned int used = 0;
+	size_t run;
 
 	if (!src_desc || !enc)
 		return;
@@ -69,27 +100,32 @@ void diag_hdlc_encode(struct diag_send_desc_type *src_desc,
 		 * of 2 dest bytes for an escaped byte
 		 */
 		while (src <= src_last && dest <= dest_last) {
+			run = diag_hdlc_clean_run(src,
+					min_t(size_t, src_last - src + 1,
+					      dest_last - dest + 1));
+			if (run) {
+				crc = crc_ccitt(crc, src, run);
+				memcpy(dest, src, run);
+				src += run;
+				dest += run;
+				used += run;
+				continue;
+			}
 
+			/* src_byte needs escaping */
 			src_byte = *src++;
-			if ((src_byte == CONTROL_CHAR) ||
-			    (src_byte == ESC_CHAR)) {
-				/* If the escape character is not the
-				 * last byte
-				 */
-				if (dest != dest_last) {
-					crc = CRC_16_L_STEP(crc, src_byte);
-					*dest++ = ESC_CHAR;
-					used++;
-					*dest++ = src_byte ^ ESC_MASK;
-					used++;
-				} else {
-					src--;
-					break;
-				}
-			} else {
+			/* If the escape character is not the
+			 * last byte
+			 */
+			if (dest != dest_last) {
 				crc = CRC_16_L_STEP(crc, src_byte);
-				*dest++ = src_byte;
+				*dest++ = ESC_CHAR;
+				used++;
+				*dest++ = src_byte ^ ESC_MASK;
 				used++;
+			} else {
+				src--;
+				break;
 			}
 		}
 
@@ -156,6 +192,7 @@ int diag_hdlc_decode(struct diag_hdlc_decode_type *hdlc)
 
 	unsigned int len = 0;
 	unsigned int i;
+	unsigned int run;
 	uint8_t src_byte;
 
 	int pkt_bnd = HDLC_INCOMPLETE;
@@ -176,6 +213,20 @@ int diag_hdlc_decode(struct diag_hdlc_decode_type *hdlc)
 		dest_length = hdlc->dest_size - hdlc->dest_idx;
 
 		for (i = 0; i < src_length; i++) {
+			if (!hdlc->escaping) {
+				run = diag_hdlc_clean_run(&src_ptr[i],
+						min(src_length - i,
+						    dest_length - len));
+				if (run) {
+					memcpy(&dest_ptr[len], &src_ptr[i],
+					       run);
+					len += run;
+					i += run;
+					if (len >= dest_length ||
+					    i == src_length)
+						break;
+				}
+			}
 
 			src_byte = src_ptr[i];
 
@@ -249,3 +300,302 @@ int crc_check(uint8_t *buf, uint16_t len)
 
 	return 0;
 }
+
+#ifdef CONFIG_DIAG_HDLC_SELFTEST
+
+#include <linux/random.h>
+#include <linux/slab.h>
+
+#define HDLC_TEST_ROUNDS	2000
+#define HDLC_TEST_MAX_LEN	2048
+
+/* The byte at a time encoder and decoder the above are checked against */
+static void diag_hdlc_encode_ref(struct diag_send_desc_type *src_desc,
+				 struct diag_hdlc_dest_type *enc)
+{
+	uint8_t *dest = enc->dest;
+	uint8_t *dest_last = enc->dest_last;
+	const uint8_t *src = src_desc->pkt;
+	const uint8_t *src_last = src_desc->last;
+	enum diag_send_state_enum_type state = src_desc->state;
+	unsigned char src_byte;
+	uint16_t crc;
+
+	if (state == DIAG_STATE_START) {
+		crc = CRC_16_L_SEED;
+		state++;
+	} else {
+		crc = enc->crc;
+	}
+
+	while (src <= src_last && dest <= dest_last) {
+		src_byte = *src++;
+		if ((src_byte == CONTROL_CHAR) || (src_byte == ESC_CHAR)) {
+			if (dest == dest_last) {
+				src--;
+				break;
+			}
+			crc = CRC_16_L_STEP(crc, src_byte);
+			*dest++ = ESC_CHAR;
+			*dest++ = src_byte ^ ESC_MASK;
+		} else {
+			crc = CRC_16_L_STEP(crc, src_byte);
+			*dest++ = src_byte;
+		}
+	}
+
+	if (src > src_last) {
+		if (state == DIAG_STATE_BUSY) {
+			if (src_desc->terminate) {
+				crc = ~crc;
+				state++;
+			} else {
+				state = DIAG_STATE_COMPLETE;
+			}
+		}
+
+		while (dest <= dest_last && state >= DIAG_STATE_CRC1 &&
+		       state < DIAG_STATE_TERM) {
+			src_byte = crc & 0xFF;
+			if ((src_byte == CONTROL_CHAR) ||
+			    (src_byte == ESC_CHAR)) {
+				if (dest == dest_last)
+					break;
+				*dest++ = ESC_CHAR;
+				*dest++ = src_byte ^ ESC_MASK;
+			} else {
+				*dest++ = src_byte;
+			}
+			crc >>= 8;
+			state++;
+		}
+
+		if (state == DIAG_STATE_TERM && dest_last >= dest) {
+			*dest++ = CONTROL_CHAR;
+			state++;
+		}
+	}
+
+	enc->dest = dest;
+	enc->crc = crc;
+	src_desc->pkt = src;
+	src_desc->state = state;
+}
+
+static int diag_hdlc_decode_ref(struct diag_hdlc_decode_type *hdlc)
+{
+	uint8_t *src_ptr = &hdlc->src_ptr[hdlc->src_idx];
+	uint8_t *dest_ptr = &hdlc->dest_ptr[hdlc->dest_idx];
+	unsigned int src_length = hdlc->src_size - hdlc->src_idx;
+	unsigned int dest_length = hdlc->dest_size - hdlc->dest_idx;
+	int msg_start = (hdlc->src_idx == 0) ? 1 : 0;
+	int pkt_bnd = HDLC_INCOMPLETE;
+	unsigned int len = 0;
+	unsigned int i;
+	uint8_t src_byte;
+
+	for (i = 0; i < src_length; i++) {
+		src_byte = src_ptr[i];
+
+		if (hdlc->escaping) {
+			dest_ptr[len++] = src_byte ^ ESC_MASK;
+			hdlc->escaping = 0;
+		} else if (src_byte == ESC_CHAR) {
+			if (i == (src_length - 1)) {
+				hdlc->escaping = 1;
+				i++;
+				break;
+			}
+			dest_ptr[len++] = src_ptr[++i] ^ ESC_MASK;
+		} else if (src_byte == CONTROL_CHAR) {
+			if (msg_start && i == 0 && src_length > 1)
+				continue;
+			dest_ptr[len++] = src_byte;
+			i++;
+			pkt_bnd = HDLC_COMPLETE;
+			break;
+		} else {
+			dest_ptr[len++] = src_byte;
+		}
+
+		if (len >= dest_length) {
+			i++;
+			break;
+		}
+	}
+
+	hdlc->src_idx += i;
+	hdlc->dest_idx += len;
+
+	return pkt_bnd;
+}
+
+/* Encodes @len bytes of @src into @out, at most @chunk bytes per call */
+static int hdlc_test_encode(const uint8_t *src, size_t len, bool terminate,
+			    size_t chunk, uint8_t *out, size_t out_size,
+			    bool ref)
+{
+	struct diag_send_desc_type send = {
+		.pkt = src,
+		.last = src + len - 1,
+		.state = DIAG_STATE_START,
+		.terminate = terminate,
+	};
+	struct diag_hdlc_dest_type enc = { };
+	uint8_t *dest = out;
+	size_t room;
+
+	while (send.state != DIAG_STATE_COMPLETE) {
+		room = min_t(size_t, chunk, out + out_size - dest);
+		if (room < 2)
+			return -ENOSPC;
+		enc.dest = dest;
+		enc.dest_last = dest + room - 1;
+		if (ref)
+			diag_hdlc_encode_ref(&send, &enc);
+		else
+			diag_hdlc_encode(&send, &enc);
+		dest = enc.dest;
+	}
+
+	return dest - out;
+}
+
+/*
+ * Decodes @len bytes of @src into @out, handing the decoder @chunk bytes
+ * of source at a time and at most @chunk bytes of room.
+ */
+static int hdlc_test_decode(uint8_t *src, size_t len, size_t chunk,
+			    uint8_t *out, size_t out_size, bool ref)
+{
+	struct diag_hdlc_decode_type hdlc = { };
+	size_t pos, olen = 0;
+
+	for (pos = 0; pos < len; pos += hdlc.src_size) {
+		hdlc.src_ptr = src + pos;
+		hdlc.src_idx = 0;
+		hdlc.src_size = min(chunk, len - pos);
+
+		while (hdlc.src_idx < hdlc.src_size) {
+			hdlc.dest_ptr = out + olen;
+			hdlc.dest_idx = 0;
+			hdlc.dest_size = min(chunk, out_size - olen);
+			if (!hdlc.dest_size)
+				return -ENOSPC;
+			if (ref)
+				diag_hdlc_decode_ref(&hdlc);
+			else
+				diag_hdlc_decode(&hdlc);
+			olen += hdlc.dest_idx;
+		}
+	}
+
+	return olen;
+}
+
+/* Random bytes, with escapes frequent enough to hit every path */
+static void hdlc_test_fill(uint8_t *buf, size_t len)
+{
+	size_t i;
+
+	prandom_bytes(buf, len);
+	for (i = 0; i < len; i++)
+		if (!(buf[i] & 0x7))
+			buf[i] = (buf[i] & 0x8) ? CONTROL_CHAR : ESC_CHAR;
+}
+
+static size_t hdlc_test_chunk(size_t max)
+{
+	/* mostly small pieces, sometimes everything at once */
+	if (!(prandom_u32() & 0x3))
+		return max;
+	return 2 + prandom_u32_max(64);
+}
+
+/*
+ * Runs random packets, cut at random places, through the encoder and the
+ * decoder and compares the results and the CRC against the byte at a
+ * time versions.
+ */
+void diag_hdlc_selftest(void)
+{
+	size_t enc_size = 2 * HDLC_TEST_MAX_LEN + 8;
+	uint8_t *src, *enc, *enc_ref, *dec, *dec_ref;
+	int round, len, off, n, n_ref, errors = 0;
+	size_t chunk;
+	bool terminate;
+	uint16_t crc, crc_ref;
+
+	src = kmalloc(HDLC_TEST_MAX_LEN + 8, GFP_KERNEL);
+	enc = kmalloc(enc_size, GFP_KERNEL);
+	enc_ref = kmalloc(enc_size, GFP_KERNEL);
+	dec = kmalloc(enc_size, GFP_KERNEL);
+	dec_ref = kmalloc(enc_size, GFP_KERNEL);
+	if (!src || !enc || !enc_ref || !dec || !dec_ref) {
+		pr_err("diag: hdlc self test, out of memory\n");
+		goto out;
+	}
+
+	for (round = 0; round < HDLC_TEST_ROUNDS; round++) {
+		len = 1 + prandom_u32_max(HDLC_TEST_MAX_LEN);
+		off = prandom_u32_max(8);
+		terminate = prandom_u32() & 1;
+		hdlc_test_fill(src, len + off);
+
+		crc = crc_ccitt(CRC_16_L_SEED, src + off, len);
+		for (crc_ref = CRC_16_L_SEED, n = 0; n < len; n++)
+			crc_ref = CRC_16_L_STEP(crc_ref, src[off + n]);
+		if (crc != crc_ref) {
+			pr_err("diag: hdlc self test, crc %04x expected %04x, len %d off %d\n",
+			       crc, crc_ref, len, off);
+			errors++;
+		}
+
+		chunk = hdlc_test_chunk(enc_size);
+		n = hdlc_test_encode(src + off, len, terminate, chunk,
+				     enc, enc_size, false);
+		n_ref = hdlc_test_encode(src + off, len, terminate, chunk,
+					 enc_ref, enc_size, true);
+		if (n != n_ref || n < 0 || memcmp(enc, enc_ref, n)) {
+			pr_err("diag: hdlc self test, encode mismatch, len %d off %d chunk %zu\n",
+			       len, off, chunk);
+			errors++;
+			continue;
+		}
+
+		chunk = hdlc_test_chunk(n);
+		n = hdlc_test_decode(enc, n_ref, chunk, dec, enc_size, false);
+		n_ref = hdlc_test_decode(enc_ref, n_ref, chunk, dec_ref,
+					 enc_size, true);
+		if (n != n_ref || n < 0 || memcmp(dec, dec_ref, n)) {
+			pr_err("diag: hdlc self test, decode mismatch, len %d chunk %zu\n",
+			       len, chunk);
+			errors++;
+			continue;
+		}
+
+		/* a terminated packet decodes to itself, its CRC and 0x7E */
+		if (terminate && (n != len + HDLC_FOOTER_LEN ||
+				  memcmp(dec, src + off, len) ||
+				  crc_check(dec, n))) {
+			pr_err("diag: hdlc self test, round trip failed, len %d\n",
+			       len);
+			errors++;
+		}
+	}
+
+	if (errors)
+		pr_err("diag: hdlc self test, %d of %d rounds failed\n",
+		       errors, HDLC_TEST_ROUNDS);
+	else
+		pr_info("diag: hdlc self test passed, %d rounds\n",
+			HDLC_TEST_ROUNDS);
+out:
+	kfree(dec_ref);
+	kfree(dec);
+	kfree(enc_ref);
+	kfree(enc);
+	kfree(src);
+}
+
+#endif /* CONFIG_DIAG_HDLC_SELFTEST */
@@ -56,6 +56,14 @@ int diag_hdlc_decode(struct diag_hdlc_decode_type *hdlc);
 
 int crc_check(uint8_t *buf, uint16_t len);
 
+#ifdef CONFIG_DIAG_HDLC_SELFTEST
+void diag_hdlc_selftest(void);
+#else
+static inline void diag_hdlc_selftest(void)
+{
+}
+#endif
+
 #define ESC_CHAR     0x7D
 #define ESC_MASK     0x20
 
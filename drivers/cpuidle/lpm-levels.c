@@ -82,6 +82,12 @@ module_param_named(print_parsed_dt, print_parsed_dt, bool, 0664);
 static bool sleep_disabled = true;
 module_param_named(sleep_disabled, sleep_disabled, bool, 0664);
 
+static bool lpm_prediction = true;
+module_param_named(lpm_prediction, lpm_prediction, bool, 0664);
+
+static DEFINE_PER_CPU(struct cpu_history, cpu_hist);
+static DEFINE_PER_CPU(struct hrtimer, histtimer);
+
 /**
  * msm_cpuidle_get_deep_idle_latency - Get deep idle latency value
  *
@@ -270,6 +276,193 @@ static void msm_pm_set_timer(uint32_t modified_time_us)
 	hrtimer_start(&lpm_hrtimer, modified_ktime, HRTIMER_MODE_REL_PINNED);
 }
 
+static enum hrtimer_restart histtimer_fn(struct hrtimer *h)
+{
+	return HRTIMER_NORESTART;
+}
+
+static void histtimer_start(uint32_t time_us)
+{
+	uint64_t time_ns = time_us * NSEC_PER_USEC;
+	ktime_t hist_ktime = ns_to_ktime(time_ns);
+	struct hrtimer *cpu_histtimer = this_cpu_ptr(&histtimer);
+
+	cpu_histtimer->function = histtimer_fn;
+	hrtimer_start(cpu_histtimer, hist_ktime, HRTIMER_MODE_REL_PINNED);
+}
+
+static void histtimer_cancel(void)
+{
+	struct hrtimer *cpu_histtimer = this_cpu_ptr(&histtimer);
+
+	if (hrtimer_is_queued(cpu_histtimer))
+		hrtimer_try_to_cancel(cpu_histtimer);
+}
+
+/*
+ * Map an idle duration to the deepest enabled cpu level whose minimum
+ * residency it covers.
+ */
+static int pred_bin(struct lpm_cpu *cpu, uint32_t *min_residency,
+		uint32_t duration_us)
+{
+	int i, bin = 0;
+
+	for (i = 1; i < cpu->nlevels; i++) {
+		if (!min_residency[i])
+			continue;
+
+		if (duration_us < min_residency[i])
+			break;
+
+		bin = i;
+	}
+
+	return bin;
+}
+
+/*
+ * Return the expected idle duration if the history says that the CPU is
+ * more likely to be woken up by something other than the next timer
+ * before the timer-selected level pays off, or 0 to go by the timer alone.
+ */
+static uint32_t lpm_cpuidle_predict(struct cpuidle_device *dev,
+		struct lpm_cpu *cpu, uint32_t sleep_us)
+{
+	struct cpu_history *history = &per_cpu(cpu_hist, dev->cpu);
+	uint32_t *min_residency = get_per_cpu_min_residency(dev->cpu);
+	uint32_t early = 0, max_early = 0, sum = 0, predicted;
+	int i, timer_bin, early_bin = 0, count = 0;
+
+	history->sleep_us = sleep_us;
+	history->htime = 0;
+	WRITE_ONCE(history->pred_wakeup, 0);
+
+	timer_bin = pred_bin(cpu, min_residency, sleep_us);
+	if (!timer_bin)
+		return 0;
+
+	for (i = 0; i < timer_bin; i++) {
+		early += history->bins[i].misses;
+		if (history->bins[i].misses > max_early) {
+			max_early = history->bins[i].misses;
+			early_bin = i;
+		}
+	}
+
+	if (early <= history->bins[timer_bin].hits +
+			history->bins[timer_bin].misses)
+		return 0;
+
+	/*
+	 * Early wakeups dominate. Use the average of the recent intervals
+	 * that were too short for the timer-selected level if they are the
+	 * majority, else the upper boundary of the most likely early bin.
+	 */
+	for (i = 0; i < PRED_INTERVALS; i++) {
+		uint32_t interval = history->intervals[i];
+
+		if (interval && interval < min_residency[timer_bin]) {
+			sum += interval;
+			count++;
+		}
+	}
+
+	if (count > PRED_INTERVALS / 2) {
+		predicted = sum / count;
+	} else {
+		predicted = min_residency[timer_bin] - 1;
+		for (i = early_bin + 1; i < timer_bin; i++) {
+			if (min_residency[i]) {
+				predicted = min_residency[i] - 1;
+				break;
+			}
+		}
+	}
+
+	predicted = max_t(uint32_t, predicted, 1);
+	WRITE_ONCE(history->pred_wakeup,
+			ktime_to_us(ktime_get()) + predicted);
+
+	return predicted;
+}
+
+/*
+ * Account the idle period that just ended against the bins of the cpu
+ * history, and forget the prediction made for it.
+ */
+static void lpm_cpuidle_reflect(struct cpuidle_device *dev,
+		struct lpm_cpu *cpu, int idx, uint32_t residency_us,
+		bool success)
+{
+	struct cpu_history *history = &per_cpu(cpu_hist, dev->cpu);
+	uint32_t *min_residency = get_per_cpu_min_residency(dev->cpu);
+	uint32_t latency_us = cpu->levels[idx].pwr.latency_us;
+	uint32_t measured_us;
+	int i, timer_bin, bin;
+
+	if (history->htime)
+		histtimer_cancel();
+
+	if (!success || !history->sleep_us)
+		goto out;
+
+	/*
+	 * Being woken up by our own history timer means that the prediction
+	 * was wrong and the CPU would have slept until the next timer.
+	 */
+	if (history->htime && residency_us >= history->htime)
+		measured_us = history->sleep_us;
+	else
+		measured_us = residency_us > latency_us ?
+				residency_us - latency_us : 0;
+
+	timer_bin = pred_bin(cpu, min_residency, history->sleep_us);
+	bin = pred_bin(cpu, min_residency, measured_us);
+
+	for (i = 0; i < cpu->nlevels; i++) {
+		history->bins[i].hits -=
+			history->bins[i].hits >> PRED_DECAY_SHIFT;
+		history->bins[i].misses -=
+			history->bins[i].misses >> PRED_DECAY_SHIFT;
+	}
+
+	if (bin >= timer_bin)
+		history->bins[timer_bin].hits += PRED_PULSE;
+	else
+		history->bins[bin].misses += PRED_PULSE;
+
+	history->intervals[history->interval_idx] = measured_us;
+	history->interval_idx = (history->interval_idx + 1) % PRED_INTERVALS;
+out:
+	history->sleep_us = 0;
+	history->htime = 0;
+	WRITE_ONCE(history->pred_wakeup, 0);
+}
+
+/*
+ * Return the shortest predicted idle duration of the CPUs voting for the
+ * cluster, or 0 if none of them expects an early wakeup.
+ */
+static uint32_t cluster_predict(struct lpm_cluster *cluster)
+{
+	uint64_t now = ktime_to_us(ktime_get());
+	uint64_t predicted = ~0ULL;
+	int cpu;
+
+	for_each_cpu(cpu, &cluster->num_children_in_sync) {
+		uint64_t wakeup = READ_ONCE(per_cpu(cpu_hist, cpu).pred_wakeup);
+
+		/* a prediction in the past was wrong, disregard it */
+		if (wakeup <= now)
+			continue;
+
+		predicted = min(predicted, wakeup - now);
+	}
+
+	return predicted == ~0ULL ? 0 : (uint32_t)predicted;
+}
+
 static inline bool is_cpu_biased(int cpu)
 {
 	u64 now = sched_clock();
@@ -308,6 +501,9 @@ static int cpu_power_select(struct cpuidle_device *dev,
 	if (is_cpu_biased(dev->cpu) && (!cpu_isolated(dev->cpu)))
 		goto done_select;
 
+	if (lpm_prediction && cpu->lpm_prediction)
+		predicted = lpm_cpuidle_predict(dev, cpu, sleep_us);
+
 	for (i = 0; i < cpu->nlevels; i++) {
 		struct lpm_cpu_level *level = &cpu->levels[i];
 		struct power_params *pwr_params = &level->pwr;
@@ -344,10 +540,24 @@ static int cpu_power_select(struct cpuidle_device *dev,
 
 		if (next_wakeup_us <= max_residency[i])
 			break;
+
+		/*
+		 * The timer would allow a deeper level but an early wakeup is
+		 * expected. Arm the history timer so that a wrong prediction
+		 * does not leave the CPU in a shallow level until the timer.
+		 */
+		if (predicted && predicted <= max_residency[i]) {
+			htime = predicted + cpu->tmr_add;
+			break;
+		}
 	}
 
-	if (modified_time_us)
+	if (modified_time_us) {
 		msm_pm_set_timer(modified_time_us);
+	} else if (htime && htime < next_wakeup_us) {
+		per_cpu(cpu_hist, dev->cpu).htime = htime;
+		histtimer_start(htime);
+	}
 
 done_select:
 	trace_cpu_power_select(best_level, sleep_us, latency_us, next_event_us);
@@ -412,13 +622,23 @@ static int cluster_select(struct lpm_cluster *cluster, bool from_idle)
 	int i;
 	struct cpumask mask;
 	uint32_t latency_us = ~0U;
-	uint32_t sleep_us;
+	uint32_t sleep_us, predicted;
 
 	if (!cluster)
 		return -EINVAL;
 
 	sleep_us = (uint32_t)get_cluster_sleep_time(cluster, from_idle);
 
+	/*
+	 * Misses are bounded by the history timers of the CPUs whose own
+	 * level was restricted by their prediction.
+	 */
+	if (from_idle && lpm_prediction && cluster->lpm_prediction) {
+		predicted = cluster_predict(cluster);
+		if (predicted && predicted < sleep_us)
+			sleep_us = predicted;
+	}
+
 	if (cpumask_and(&mask, cpu_online_mask, &cluster->child_cpus))
 		latency_us = pm_qos_request_for_cpumask(PM_QOS_CPU_DMA_LATENCY,
 							&mask);
@@ -790,6 +1010,7 @@ static int lpm_cpuidle_enter(struct cpuidle_device *dev,
 	cluster_unprepare(cpu->parent, cpumask, idx, true, end_time, success);
 	cpu_unprepare(cpu, idx, true);
 	dev->last_residency = ktime_us_delta(ktime_get(), start);
+	lpm_cpuidle_reflect(dev, cpu, idx, dev->last_residency, success);
 	trace_cpu_idle_exit(idx, success);
 	local_irq_enable();
 	return idx;
@@ -1091,6 +1312,10 @@ static int lpm_probe(struct platform_device *pdev)
 	suspend_set_ops(&lpm_suspend_ops);
 	freeze_set_ops(&lpm_freeze_ops);
 	hrtimer_init(&lpm_hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	for_each_possible_cpu(cpu) {
+		cpu_histtimer = &per_cpu(histtimer, cpu);
+		hrtimer_init(cpu_histtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	}
 
 	register_cluster_lpm_stats(lpm_root_node, NULL);
 
@@ -25,6 +25,9 @@
 #define STDDEV_HIGH 1000
 #define PREMATURE_CNT_LOW 1
 #define PREMATURE_CNT_HIGH 5
+#define PRED_PULSE 1024
+#define PRED_DECAY_SHIFT 3
+#define PRED_INTERVALS 8
 
 struct power_params {
 	uint32_t latency_us;		/* Enter + Exit latency */
@@ -99,6 +102,27 @@ struct cluster_history {
 	int flag;
 };
 
+/*
+ * Per-CPU idle duration history used for wakeup prediction. Observed idle
+ * durations are binned against the cpu level boundaries (min_residency).
+ * A wakeup landing in the same bin as the timer-predicted sleep length is
+ * a hit for that bin, an earlier one is a miss for the bin it landed in.
+ * Both decay geometrically so that recent behaviour dominates.
+ */
+struct pred_bin {
+	uint32_t hits;
+	uint32_t misses;
+};
+
+struct cpu_history {
+	struct pred_bin bins[NR_LPM_LEVELS];
+	uint32_t intervals[PRED_INTERVALS];
+	int interval_idx;
+	uint32_t sleep_us;
+	uint32_t htime;
+	uint64_t pred_wakeup;
+};
+
 struct lpm_cluster {
 	struct list_head list;
 	struct list_head child;
@@ -297,6 +297,10 @@ define_show_state_function(target_residency)
 define_show_state_function(power_usage)
 define_show_state_ull_function(usage)
 define_show_state_ull_function(time)
+define_show_state_ull_function(hits)
+define_show_state_ull_function(misses)
+define_show_state_ull_function(early)
+define_show_state_ull_function(late)
 define_show_state_str_function(name)
 define_show_state_str_function(desc)
 define_show_state_ull_function(disable)
@@ -309,6 +313,10 @@ define_one_state_ro(residency, show_state_target_residency);
 define_one_state_ro(power, show_state_power_usage);
 define_one_state_ro(usage, show_state_usage);
 define_one_state_ro(time, show_state_time);
+define_one_state_ro(hits, show_state_hits);
+define_one_state_ro(misses, show_state_misses);
+define_one_state_ro(early, show_state_early);
+define_one_state_ro(late, show_state_late);
 define_one_state_rw(disable, show_state_disable, store_state_disable);
 
 static struct attribute *cpuidle_state_default_attrs[] = {
@@ -319,6 +327,10 @@ static struct attribute *cpuidle_state_default_attrs[] = {
 	&attr_power.attr,
 	&attr_usage.attr,
 	&attr_time.attr,
+	&attr_hits.attr,
+	&attr_misses.attr,
+	&attr_early.attr,
+	&attr_late.attr,
 	&attr_disable.attr,
 	NULL
 };
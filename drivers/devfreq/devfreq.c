@@ -192,6 +192,52 @@ int devfreq_update_status(struct devfreq *devfreq, unsigned long freq)
 }
 EXPORT_SYMBOL(devfreq_update_status);
 
+/**
+ * devfreq_apply_opp_hints() - Filter a governor request through OPP hints
+ * @devfreq:	the devfreq instance
+ * @freq:	the frequency requested by the governor
+ *
+ * Returns the frequency to use. Requests to lower the frequency are held
+ * back while the current OPP hasn't reached its minimum residency, or when
+ * they fall within its hysteresis band.
+ */
+static unsigned long devfreq_apply_opp_hints(struct devfreq *devfreq,
+					     unsigned long freq)
+{
+	unsigned long prev = devfreq->previous_freq;
+	struct devfreq_opp_hint *hint;
+	int lev;
+
+	if (!devfreq->opp_hints || !prev || freq >= prev)
+		return freq;
+
+	lev = devfreq_get_freq_level(devfreq, prev);
+	if (lev < 0)
+		return freq;
+
+	hint = &devfreq->opp_hints[lev];
+	if (time_before(jiffies, devfreq->last_trans +
+			msecs_to_jiffies(hint->min_residency_ms)) ||
+	    (u64)freq * 100 >= (u64)prev * (100 - hint->hyst_pct)) {
+		devfreq->hint_holds++;
+		return prev;
+	}
+
+	return freq;
+}
+
+/**
+ * devfreq_account_decision() - Account the latency of a governor decision
+ * @devfreq:	the devfreq instance
+ * @us:		time get_target_freq() took, in microseconds
+ */
+static void devfreq_account_decision(struct devfreq *devfreq, s64 us)
+{
+	int bucket = us > 0 ? fls64(us) : 0;
+
+	devfreq->lat_hist[min(bucket, DEVFREQ_LAT_BUCKETS - 1)]++;
+}
+
 /**
  * find_devfreq_governor() - find devfreq governor from name
  * @name:	name of the governor
@@ -269,10 +315,16 @@ int update_devfreq(struct devfreq *devfreq)
 		/* Use the max freq for max boosts */
 		freq = ULONG_MAX;
 	} else {
+		ktime_t start = ktime_get();
+
 		/* Reevaluate the proper frequency */
 		err = devfreq->governor->get_target_freq(devfreq, &freq);
+		devfreq_account_decision(devfreq,
+					 ktime_us_delta(ktime_get(), start));
 		if (err)
 			return err;
+
+		freq = devfreq_apply_opp_hints(devfreq, freq);
 	}
 
 	/*
@@ -316,6 +368,8 @@ int update_devfreq(struct devfreq *devfreq)
 			dev_err(&devfreq->dev,
 				"Couldn't update frequency transition information.\n");
 
+	if (freq != devfreq->previous_freq)
+		devfreq->last_trans = jiffies;
 	devfreq->previous_freq = freq;
 	return err;
 }
@@ -614,6 +668,16 @@ struct devfreq *devfreq_add_device(struct device *dev,
 						GFP_KERNEL);
 	devfreq->last_stat_updated = jiffies;
 
+	devfreq->opp_hints = devm_kcalloc(&devfreq->dev,
+					  devfreq->profile->max_state,
+					  sizeof(*devfreq->opp_hints),
+					  GFP_KERNEL);
+	if (devfreq->opp_hints && profile->opp_hints)
+		memcpy(devfreq->opp_hints, profile->opp_hints,
+		       sizeof(*devfreq->opp_hints) *
+		       devfreq->profile->max_state);
+	devfreq->last_trans = jiffies;
+
 	srcu_init_notifier_head(&devfreq->transition_notifier_list);
 
 	mutex_unlock(&devfreq->lock);
@@ -989,6 +1053,10 @@ static ssize_t governor_store(struct device *dev, struct device_attribute *attr,
 	prev_gov = df->governor;
 	df->governor = governor;
 	strncpy(df->governor_name, governor->name, DEVFREQ_NAME_LEN);
+	mutex_lock(&df->lock);
+	memset(df->lat_hist, 0, sizeof(df->lat_hist));
+	df->hint_holds = 0;
+	mutex_unlock(&df->lock);
 	ret = df->governor->event_handler(df, DEVFREQ_GOV_START, NULL);
 	if (ret) {
 		dev_warn(dev, "%s: Governor %s not started(%d)\n",
@@ -1269,6 +1337,87 @@ static ssize_t trans_stat_show(struct device *dev,
 }
 static DEVICE_ATTR_RO(trans_stat);
 
+static ssize_t opp_hints_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct devfreq *devfreq = to_devfreq(dev);
+	unsigned int max_state = devfreq->profile->max_state;
+	ssize_t len;
+	int i;
+
+	if (!devfreq->opp_hints)
+		return sprintf(buf, "Not Supported.\n");
+
+	len = sprintf(buf, "%10s %16s %8s\n", "freq", "min_residency_ms",
+		      "hyst_pct");
+
+	mutex_lock(&devfreq->lock);
+	for (i = 0; i < max_state; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%10lu %16u %8u\n",
+				 devfreq->profile->freq_table[i],
+				 devfreq->opp_hints[i].min_residency_ms,
+				 devfreq->opp_hints[i].hyst_pct);
+	mutex_unlock(&devfreq->lock);
+
+	return len;
+}
+
+static ssize_t opp_hints_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct devfreq *devfreq = to_devfreq(dev);
+	unsigned int residency, hyst;
+	unsigned long freq;
+	int lev;
+
+	if (!devfreq->opp_hints)
+		return -EINVAL;
+
+	if (sscanf(buf, "%lu %u %u", &freq, &residency, &hyst) != 3)
+		return -EINVAL;
+
+	if (hyst > 100)
+		return -EINVAL;
+
+	lev = devfreq_get_freq_level(devfreq, freq);
+	if (lev < 0)
+		return lev;
+
+	mutex_lock(&devfreq->lock);
+	devfreq->opp_hints[lev].min_residency_ms = residency;
+	devfreq->opp_hints[lev].hyst_pct = hyst;
+	mutex_unlock(&devfreq->lock);
+
+	return count;
+}
+static DEVICE_ATTR_RW(opp_hints);
+
+static ssize_t decision_latency_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct devfreq *devfreq = to_devfreq(dev);
+	unsigned int hist[DEVFREQ_LAT_BUCKETS];
+	unsigned int holds;
+	ssize_t len;
+	int i;
+
+	mutex_lock(&devfreq->lock);
+	memcpy(hist, devfreq->lat_hist, sizeof(hist));
+	holds = devfreq->hint_holds;
+	len = sprintf(buf, "governor: %s\n", devfreq->governor ?
+		      devfreq->governor->name : "none");
+	mutex_unlock(&devfreq->lock);
+
+	for (i = 0; i < DEVFREQ_LAT_BUCKETS - 1; i++)
+		len += sprintf(buf + len, "<%uus: %u\n", 1U << i, hist[i]);
+	len += sprintf(buf + len, ">=%uus: %u\n", 1U << i, hist[i]);
+	len += sprintf(buf + len, "held by hints: %u\n", holds);
+
+	return len;
+}
+static DEVICE_ATTR_RO(decision_latency);
+
 static struct attribute *devfreq_attrs[] = {
 	&dev_attr_governor.attr,
 	&dev_attr_available_governors.attr,
@@ -1279,6 +1428,8 @@ static struct attribute *devfreq_attrs[] = {
 	&dev_attr_min_freq.attr,
 	&dev_attr_max_freq.attr,
 	&dev_attr_trans_stat.attr,
+	&dev_attr_opp_hints.attr,
+	&dev_attr_decision_latency.attr,
 	NULL,
 };
 ATTRIBUTE_GROUPS(devfreq);
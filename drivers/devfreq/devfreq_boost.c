@@ -10,29 +10,85 @@
 #include <linux/input.h>
 #include <linux/kthread.h>
 
+/*
+ * Frame boost tuning. A frame that takes at least FRAME_UP_PCT of its
+ * deadline raises the boost by one frequency step (two if the deadline was
+ * missed). The boost is lowered by one step after FRAME_DOWN_FRAMES
+ * consecutive frames finish within FRAME_DOWN_PCT of the deadline, and
+ * every FRAME_IDLE_MS while no frames are being completed.
+ */
+#define FRAME_UP_PCT		80
+#define FRAME_DOWN_PCT		50
+#define FRAME_DOWN_FRAMES	4
+#define FRAME_IDLE_MS		50
+
 enum {
 	SCREEN_OFF,
 	INPUT_BOOST,
 	MAX_BOOST
 };
 
+enum {
+	RES_NONE,
+	RES_INPUT,
+	RES_FRAME,
+	RES_MAX,
+	RES_SCREEN_OFF,
+	NR_RES
+};
+
+struct frame_stats {
+	unsigned long frames;
+	unsigned long near_miss;
+	unsigned long missed;
+};
+
 struct boost_dev {
 	struct devfreq *df;
 	struct delayed_work input_unboost;
 	struct delayed_work max_unboost;
+	struct delayed_work frame_unboost;
 	wait_queue_head_t boost_waitq;
 	atomic_long_t max_boost_expires;
 	unsigned long boost_freq;
 	unsigned long state;
+	spinlock_t frame_lock;
+	ktime_t frame_start;
+	unsigned int frame_deadline_us;
+	unsigned int frame_level;
+	unsigned int frame_relaxed;
+	struct frame_stats fstats;
+	spinlock_t stats_lock;
+	ktime_t res_last;
+	int res_curr;
+	u64 residency[NR_RES];
+	struct kobject *kobj;
 };
 
 struct df_boost_drv {
 	struct boost_dev devices[DEVFREQ_MAX];
 	struct notifier_block fb_notif;
+	struct kobject *kobj;
+};
+
+static const char *const df_device_names[DEVFREQ_MAX] = {
+	[DEVFREQ_MSM_CPUBW] = "cpubw",
+#ifdef CONFIG_DEVFREQ_BOOST_TEST
+	[DEVFREQ_BOOST_TEST] = "test",
+#endif
+};
+
+static const char *const res_names[NR_RES] = {
+	[RES_NONE] = "none",
+	[RES_INPUT] = "input",
+	[RES_FRAME] = "frame",
+	[RES_MAX] = "max",
+	[RES_SCREEN_OFF] = "screen_off"
 };
 
 static void devfreq_input_unboost(struct work_struct *work);
 static void devfreq_max_unboost(struct work_struct *work);
+static void devfreq_frame_unboost(struct work_struct *work);
 
 #define BOOST_DEV_INIT(b, dev, freq) .devices[dev] = {				\
 	.input_unboost =							\
@@ -41,14 +97,23 @@ static void devfreq_max_unboost(struct work_struct *work);
 	.max_unboost =								\
 		__DELAYED_WORK_INITIALIZER((b).devices[dev].max_unboost,	\
 					   devfreq_max_unboost, 0),		\
+	.frame_unboost =							\
+		__DELAYED_WORK_INITIALIZER((b).devices[dev].frame_unboost,	\
+					   devfreq_frame_unboost, 0),		\
 	.boost_waitq =								\
 		__WAIT_QUEUE_HEAD_INITIALIZER((b).devices[dev].boost_waitq),	\
-	.boost_freq = freq							\
+	.boost_freq = freq,							\
+	.frame_lock = __SPIN_LOCK_UNLOCKED((b).devices[dev].frame_lock),	\
+	.frame_deadline_us = CONFIG_DEVFREQ_FRAME_DEADLINE_US,			\
+	.stats_lock = __SPIN_LOCK_UNLOCKED((b).devices[dev].stats_lock)	\
 }
 
 static struct df_boost_drv df_boost_drv_g __read_mostly = {
 	BOOST_DEV_INIT(df_boost_drv_g, DEVFREQ_MSM_CPUBW,
-		       CONFIG_DEVFREQ_MSM_CPUBW_BOOST_FREQ)
+		       CONFIG_DEVFREQ_MSM_CPUBW_BOOST_FREQ),
+#ifdef CONFIG_DEVFREQ_BOOST_TEST
+	BOOST_DEV_INIT(df_boost_drv_g, DEVFREQ_BOOST_TEST, 0),
+#endif
 };
 
 static void __devfreq_boost_kick(struct boost_dev *b)
@@ -101,6 +166,91 @@ void devfreq_boost_kick_max(enum df_device device, unsigned int duration_ms)
 	__devfreq_boost_kick_max(d->devices + device, duration_ms);
 }
 
+static void __devfreq_boost_frame_start(struct boost_dev *b)
+{
+	unsigned long flags;
+
+	if (!READ_ONCE(b->df) || test_bit(SCREEN_OFF, &b->state))
+		return;
+
+	spin_lock_irqsave(&b->frame_lock, flags);
+	b->frame_start = ktime_get();
+	spin_unlock_irqrestore(&b->frame_lock, flags);
+}
+
+void devfreq_boost_frame_start(enum df_device device)
+{
+	struct df_boost_drv *d = &df_boost_drv_g;
+
+	__devfreq_boost_frame_start(d->devices + device);
+}
+
+static void __devfreq_boost_frame_end(struct boost_dev *b)
+{
+	struct devfreq *df = READ_ONCE(b->df);
+	unsigned int old_level, new_level, max_level;
+	unsigned long flags;
+	u64 frame_us, deadline_us;
+
+	if (!df || test_bit(SCREEN_OFF, &b->state))
+		return;
+
+	/* Nothing to step through without a populated frequency table */
+	if (!df->profile->max_state)
+		return;
+	max_level = df->profile->max_state - 1;
+
+	spin_lock_irqsave(&b->frame_lock, flags);
+	if (!ktime_to_ns(b->frame_start)) {
+		spin_unlock_irqrestore(&b->frame_lock, flags);
+		return;
+	}
+
+	frame_us = ktime_us_delta(ktime_get(), b->frame_start);
+	deadline_us = b->frame_deadline_us;
+	b->frame_start = ktime_set(0, 0);
+	b->fstats.frames++;
+	old_level = b->frame_level;
+
+	if (frame_us * 100 >= deadline_us * FRAME_UP_PCT) {
+		/* Close to missing the deadline, ramp up right away */
+		if (frame_us > deadline_us) {
+			b->fstats.missed++;
+			b->frame_level += 2;
+		} else {
+			b->fstats.near_miss++;
+			b->frame_level++;
+		}
+		b->frame_level = min(b->frame_level, max_level);
+		b->frame_relaxed = 0;
+	} else if (frame_us * 100 < deadline_us * FRAME_DOWN_PCT) {
+		/* Plenty of slack, step down gradually */
+		if (++b->frame_relaxed >= FRAME_DOWN_FRAMES) {
+			if (b->frame_level)
+				b->frame_level--;
+			b->frame_relaxed = 0;
+		}
+	} else {
+		b->frame_relaxed = 0;
+	}
+	new_level = b->frame_level;
+	spin_unlock_irqrestore(&b->frame_lock, flags);
+
+	if (new_level)
+		mod_delayed_work(system_unbound_wq, &b->frame_unboost,
+				 msecs_to_jiffies(FRAME_IDLE_MS));
+
+	if (new_level != old_level)
+		wake_up(&b->boost_waitq);
+}
+
+void devfreq_boost_frame_end(enum df_device device)
+{
+	struct df_boost_drv *d = &df_boost_drv_g;
+
+	__devfreq_boost_frame_end(d->devices + device);
+}
+
 void devfreq_register_boost_device(enum df_device device, struct devfreq *df)
 {
 	struct df_boost_drv *d = &df_boost_drv_g;
@@ -129,22 +279,75 @@ static void devfreq_max_unboost(struct work_struct *work)
 	wake_up(&b->boost_waitq);
 }
 
-static void devfreq_update_boosts(struct boost_dev *b, unsigned long state)
+static void devfreq_frame_unboost(struct work_struct *work)
+{
+	struct boost_dev *b = container_of(to_delayed_work(work),
+					   typeof(*b), frame_unboost);
+	unsigned long flags;
+	bool rearm;
+
+	/* No frames are being completed, keep stepping down */
+	spin_lock_irqsave(&b->frame_lock, flags);
+	if (b->frame_level)
+		b->frame_level--;
+	b->frame_relaxed = 0;
+	rearm = b->frame_level;
+	spin_unlock_irqrestore(&b->frame_lock, flags);
+
+	if (rearm)
+		queue_delayed_work(system_unbound_wq, &b->frame_unboost,
+				   msecs_to_jiffies(FRAME_IDLE_MS));
+	wake_up(&b->boost_waitq);
+}
+
+static void devfreq_account_residency(struct boost_dev *b, int res)
+{
+	ktime_t now = ktime_get();
+	unsigned long flags;
+
+	spin_lock_irqsave(&b->stats_lock, flags);
+	if (ktime_to_ns(b->res_last))
+		b->residency[b->res_curr] += ktime_us_delta(now, b->res_last);
+	b->res_last = now;
+	b->res_curr = res;
+	spin_unlock_irqrestore(&b->stats_lock, flags);
+}
+
+static void devfreq_update_boosts(struct boost_dev *b, unsigned long state,
+				  unsigned int frame_level)
 {
 	struct devfreq *df = b->df;
+	int res;
 
 	mutex_lock(&df->lock);
 	if (test_bit(SCREEN_OFF, &state)) {
 		df->min_freq = df->profile->freq_table[0];
 		df->max_boost = false;
+		res = RES_SCREEN_OFF;
 	} else {
-		df->min_freq = test_bit(INPUT_BOOST, &state) ?
-			       min(b->boost_freq, df->max_freq) :
-			       df->profile->freq_table[0];
+		unsigned long min_freq = df->profile->freq_table[0];
+
+		if (test_bit(INPUT_BOOST, &state))
+			min_freq = max(min_freq, b->boost_freq);
+		if (frame_level)
+			min_freq = max(min_freq,
+				       df->profile->freq_table[frame_level]);
+		df->min_freq = min(min_freq, df->max_freq);
 		df->max_boost = test_bit(MAX_BOOST, &state);
+
+		if (df->max_boost)
+			res = RES_MAX;
+		else if (frame_level)
+			res = RES_FRAME;
+		else if (test_bit(INPUT_BOOST, &state))
+			res = RES_INPUT;
+		else
+			res = RES_NONE;
 	}
 	update_devfreq(df);
 	mutex_unlock(&df->lock);
+
+	devfreq_account_residency(b, res);
 }
 
 static int devfreq_boost_thread(void *data)
@@ -154,22 +357,27 @@ static int devfreq_boost_thread(void *data)
 	};
 	struct boost_dev *b = data;
 	unsigned long old_state = 0;
+	unsigned int old_level = 0;
 
 	sched_setscheduler_nocheck(current, SCHED_FIFO, &sched_max_rt_prio);
 
 	while (1) {
 		bool should_stop = false;
 		unsigned long curr_state;
+		unsigned int curr_level;
 
 		wait_event(b->boost_waitq,
 			(curr_state = READ_ONCE(b->state)) != old_state ||
+			(curr_level = READ_ONCE(b->frame_level)) != old_level ||
 			(should_stop = kthread_should_stop()));
 
 		if (should_stop)
 			break;
 
+		curr_level = READ_ONCE(b->frame_level);
 		old_state = curr_state;
-		devfreq_update_boosts(b, curr_state);
+		old_level = curr_level;
+		devfreq_update_boosts(b, curr_state, curr_level);
 	}
 
 	return 0;
@@ -195,6 +403,12 @@ static int fb_notifier_cb(struct notifier_block *nb, unsigned long action,
 				CONFIG_DEVFREQ_WAKE_BOOST_DURATION_MS);
 		} else {
 			set_bit(SCREEN_OFF, &b->state);
+			cancel_delayed_work(&b->frame_unboost);
+			spin_lock_irq(&b->frame_lock);
+			b->frame_level = 0;
+			b->frame_relaxed = 0;
+			b->frame_start = ktime_set(0, 0);
+			spin_unlock_irq(&b->frame_lock);
 			wake_up(&b->boost_waitq);
 		}
 	}
@@ -202,6 +416,148 @@ static int fb_notifier_cb(struct notifier_block *nb, unsigned long action,
 	return NOTIFY_OK;
 }
 
+static struct boost_dev *kobj_to_boost_dev(struct kobject *kobj)
+{
+	struct df_boost_drv *d = &df_boost_drv_g;
+	int i;
+
+	for (i = 0; i < DEVFREQ_MAX; i++) {
+		if (d->devices[i].kobj == kobj)
+			break;
+	}
+
+	return d->devices + i;
+}
+
+static ssize_t frame_start_store(struct kobject *kobj,
+				 struct kobj_attribute *attr, const char *buf,
+				 size_t count)
+{
+	__devfreq_boost_frame_start(kobj_to_boost_dev(kobj));
+	return count;
+}
+
+static ssize_t frame_end_store(struct kobject *kobj,
+			       struct kobj_attribute *attr, const char *buf,
+			       size_t count)
+{
+	__devfreq_boost_frame_end(kobj_to_boost_dev(kobj));
+	return count;
+}
+
+static ssize_t frame_deadline_us_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	struct boost_dev *b = kobj_to_boost_dev(kobj);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(b->frame_deadline_us));
+}
+
+static ssize_t frame_deadline_us_store(struct kobject *kobj,
+				       struct kobj_attribute *attr,
+				       const char *buf, size_t count)
+{
+	struct boost_dev *b = kobj_to_boost_dev(kobj);
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (!val)
+		return -EINVAL;
+
+	WRITE_ONCE(b->frame_deadline_us, val);
+	return count;
+}
+
+static ssize_t boost_stats_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	struct boost_dev *b = kobj_to_boost_dev(kobj);
+	u64 residency[NR_RES];
+	struct frame_stats fstats;
+	unsigned int level;
+	unsigned long flags;
+	ssize_t len = 0;
+	int i;
+
+	spin_lock_irqsave(&b->stats_lock, flags);
+	memcpy(residency, b->residency, sizeof(residency));
+	if (ktime_to_ns(b->res_last))
+		residency[b->res_curr] += ktime_us_delta(ktime_get(),
+							 b->res_last);
+	spin_unlock_irqrestore(&b->stats_lock, flags);
+
+	spin_lock_irqsave(&b->frame_lock, flags);
+	fstats = b->fstats;
+	level = b->frame_level;
+	spin_unlock_irqrestore(&b->frame_lock, flags);
+
+	for (i = 0; i < NR_RES; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s_ms %llu\n",
+				 res_names[i],
+				 div_u64(residency[i], USEC_PER_MSEC));
+
+	len += scnprintf(buf + len, PAGE_SIZE - len,
+			 "frames %lu\nnear_miss %lu\nmissed %lu\nframe_level %u\n",
+			 fstats.frames, fstats.near_miss, fstats.missed, level);
+	return len;
+}
+
+static struct kobj_attribute frame_start_attr = __ATTR_WO(frame_start);
+static struct kobj_attribute frame_end_attr = __ATTR_WO(frame_end);
+static struct kobj_attribute frame_deadline_us_attr =
+	__ATTR(frame_deadline_us, 0644, frame_deadline_us_show,
+	       frame_deadline_us_store);
+static struct kobj_attribute boost_stats_attr = __ATTR_RO(boost_stats);
+
+static struct attribute *boost_attrs[] = {
+	&frame_start_attr.attr,
+	&frame_end_attr.attr,
+	&frame_deadline_us_attr.attr,
+	&boost_stats_attr.attr,
+	NULL
+};
+
+static const struct attribute_group boost_attr_group = {
+	.attrs = boost_attrs
+};
+
+static int devfreq_boost_sysfs_init(struct df_boost_drv *d)
+{
+	int i, ret;
+
+	d->kobj = kobject_create_and_add("devfreq_boost", kernel_kobj);
+	if (!d->kobj)
+		return -ENOMEM;
+
+	for (i = 0; i < DEVFREQ_MAX; i++) {
+		struct boost_dev *b = d->devices + i;
+
+		b->kobj = kobject_create_and_add(df_device_names[i], d->kobj);
+		if (!b->kobj) {
+			ret = -ENOMEM;
+			goto put_kobjs;
+		}
+
+		ret = sysfs_create_group(b->kobj, &boost_attr_group);
+		if (ret) {
+			kobject_put(b->kobj);
+			goto put_kobjs;
+		}
+	}
+
+	return 0;
+
+put_kobjs:
+	while (i--)
+		kobject_put(d->devices[i].kobj);
+	kobject_put(d->kobj);
+	return ret;
+}
+
 static void devfreq_boost_input_event(struct input_handle *handle,
 				      unsigned int type, unsigned int code,
 				      int value)
@@ -315,6 +671,11 @@ static int __init devfreq_boost_init(void)
 		goto unregister_handler;
 	}
 
+	/* The frame boost interface is optional, don't fail without it */
+	ret = devfreq_boost_sysfs_init(d);
+	if (ret)
+		pr_err("Failed to create sysfs interface, err: %d\n", ret);
+
 	return 0;
 
 unregister_handler:
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Dummy devfreq device for exercising devfreq_boost without hardware.
+ *
+ * The device has a made up frequency table and runs the powersave governor,
+ * so its frequency is the boost floor set by devfreq_boost. Report frames
+ * through /sys/kernel/devfreq_boost/test/frame_start and frame_end, and read
+ * the resulting frequency from /sys/class/devfreq/devfreq-boost-test/cur_freq.
+ */
+
+#define pr_fmt(fmt) "devfreq_boost_test: " fmt
+
+#include <linux/devfreq_boost.h>
+#include <linux/err.h>
+#include <linux/platform_device.h>
+
+static unsigned long test_freq_table[] = {
+	100000, 200000, 400000, 800000, 1600000
+};
+
+static unsigned long test_cur_freq = 100000;
+
+static int test_target(struct device *dev, unsigned long *freq, u32 flags)
+{
+	unsigned int i;
+
+	/* Lowest table frequency at or above the request */
+	for (i = 0; i < ARRAY_SIZE(test_freq_table) - 1; i++) {
+		if (test_freq_table[i] >= *freq)
+			break;
+	}
+
+	*freq = test_freq_table[i];
+	test_cur_freq = *freq;
+	return 0;
+}
+
+static int test_get_cur_freq(struct device *dev, unsigned long *freq)
+{
+	*freq = test_cur_freq;
+	return 0;
+}
+
+static struct devfreq_dev_profile test_profile = {
+	.initial_freq = 100000,
+	.target = test_target,
+	.get_cur_freq = test_get_cur_freq,
+	.freq_table = test_freq_table,
+	.max_state = ARRAY_SIZE(test_freq_table),
+};
+
+static int __init devfreq_boost_test_init(void)
+{
+	struct platform_device *pdev;
+	struct devfreq *df;
+
+	pdev = platform_device_register_simple("devfreq-boost-test", -1,
+					       NULL, 0);
+	if (IS_ERR(pdev))
+		return PTR_ERR(pdev);
+
+	df = devfreq_add_device(&pdev->dev, &test_profile, "powersave", NULL);
+	if (IS_ERR(df)) {
+		pr_err("Failed to add devfreq device, err: %ld\n", PTR_ERR(df));
+		platform_device_unregister(pdev);
+		return PTR_ERR(df);
+	}
+
+	devfreq_register_boost_device(DEVFREQ_BOOST_TEST, df);
+	return 0;
+}
+late_initcall(devfreq_boost_test_init);
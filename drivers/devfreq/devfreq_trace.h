@@ -37,6 +37,32 @@ TRACE_EVENT(devfreq_msg,
 	)
 );
 
+TRACE_EVENT(bw_memlat_update,
+	TP_PROTO(const char *name, unsigned long lat_mbps,
+		 unsigned long bw_mbps, unsigned long pred_mbps,
+		 unsigned long vote),
+	TP_ARGS(name, lat_mbps, bw_mbps, pred_mbps, vote),
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(unsigned long, lat_mbps)
+		__field(unsigned long, bw_mbps)
+		__field(unsigned long, pred_mbps)
+		__field(unsigned long, vote)
+	),
+	TP_fast_assign(
+		__assign_str(name, name);
+		__entry->lat_mbps = lat_mbps;
+		__entry->bw_mbps = bw_mbps;
+		__entry->pred_mbps = pred_mbps;
+		__entry->vote = vote;
+	),
+	TP_printk(
+		"dev: %s, lat_mbps=%lu, bw_mbps=%lu, pred_mbps=%lu, vote=%lu",
+		__get_str(name), __entry->lat_mbps, __entry->bw_mbps,
+		__entry->pred_mbps, __entry->vote
+	)
+);
+
 #endif /* _DEVFREQ_TRACE_H */
 
 /* This part must be outside protection */
@@ -21,6 +21,7 @@
 #include <linux/delay.h>
 #include <linux/ktime.h>
 #include <linux/time.h>
+#include <linux/math64.h>
 #include <linux/err.h>
 #include <linux/errno.h>
 #include <linux/mutex.h>
@@ -33,9 +34,24 @@
 
 #include <trace/events/power.h>
 
+#define CREATE_TRACE_POINTS
+#include "devfreq_trace.h"
+
+/* Bytes moved on the bus for each counted L2 miss */
+#define MEMLAT_LINE_SIZE	64
+
 struct memlat_node {
 	unsigned int ratio_ceil;
 	unsigned int stall_floor;
+	unsigned int io_percent;
+	unsigned int hyst_pct;
+	unsigned int down_count;
+	unsigned int ramp_pct;
+	unsigned long prev_bw;
+	unsigned long vote;
+	unsigned int down_cnt;
+	bool bw_rising;
+	ktime_t prev_ts;
 	bool mon_started;
 	bool already_zero;
 	struct list_head list;
@@ -48,6 +64,9 @@ struct memlat_node {
 static LIST_HEAD(memlat_list);
 static DEFINE_MUTEX(list_lock);
 
+static struct devfreq_governor devfreq_gov_bw_memlat;
+static struct attribute_group bw_memlat_dev_attr_group;
+
 static int memlat_use_cnt;
 static int compute_use_cnt;
 static DEFINE_MUTEX(state_lock);
@@ -176,6 +195,14 @@ static void stop_monitor(struct devfreq *df)
 	hw->stop_hwmon(hw);
 }
 
+static struct attribute_group *node_attr_grp(struct devfreq *df,
+					     struct memlat_node *node)
+{
+	if (df->governor == &devfreq_gov_bw_memlat)
+		return &bw_memlat_dev_attr_group;
+	return node->attr_grp;
+}
+
 static int gov_start(struct devfreq *df)
 {
 	int ret = 0;
@@ -190,6 +217,29 @@ static int gov_start(struct devfreq *df)
 	}
 	hw = node->hw;
 
+	if (df->governor == &devfreq_gov_bw_memlat &&
+	    node->gov != &devfreq_gov_memlat) {
+		dev_err(dev, "HW monitor doesn't support bandwidth voting!\n");
+		return -ENODEV;
+	}
+
+	/*
+	 * bw_memlat compares its bandwidth estimate with the latency vote, so
+	 * the device has to vote in MBps. That is the case for devbw devices,
+	 * whose frequencies and core-dev-table entries are all IB in MBps.
+	 */
+	if (df->governor == &devfreq_gov_bw_memlat &&
+	    !of_device_is_compatible(dev->of_node, "qcom,devbw")) {
+		dev_err(dev, "bw_memlat needs a device voting in MBps!\n");
+		return -EINVAL;
+	}
+
+	node->prev_bw = 0;
+	node->vote = 0;
+	node->down_cnt = 0;
+	node->bw_rising = false;
+	node->prev_ts = ktime_get();
+
 	hw->df = df;
 	node->orig_data = df->data;
 	df->data = node;
@@ -197,7 +247,7 @@ static int gov_start(struct devfreq *df)
 	if (start_monitor(df))
 		goto err_start;
 
-	ret = sysfs_create_group(&df->dev.kobj, node->attr_grp);
+	ret = sysfs_create_group(&df->dev.kobj, node_attr_grp(df, node));
 	if (ret)
 		goto err_sysfs;
 
@@ -217,24 +267,21 @@ static void gov_stop(struct devfreq *df)
 	struct memlat_node *node = df->data;
 	struct memlat_hwmon *hw = node->hw;
 
-	sysfs_remove_group(&df->dev.kobj, node->attr_grp);
+	sysfs_remove_group(&df->dev.kobj, node_attr_grp(df, node));
 	stop_monitor(df);
 	df->data = node->orig_data;
 	node->orig_data = NULL;
 	hw->df = NULL;
 }
 
-static int devfreq_memlat_get_freq(struct devfreq *df,
-					unsigned long *freq)
+static unsigned long memlat_lat_vote(struct devfreq *df,
+				     struct memlat_node *node)
 {
 	int i, lat_dev = 0;
-	struct memlat_node *node = df->data;
 	struct memlat_hwmon *hw = node->hw;
 	unsigned long max_freq = 0;
 	unsigned int ratio;
 
-	hw->get_cnt(hw);
-
 	for (i = 0; i < hw->num_cores; i++) {
 		ratio = hw->core_stats[i].inst_count;
 
@@ -277,12 +324,93 @@ static int devfreq_memlat_get_freq(struct devfreq *df,
 
 	node->already_zero = !max_freq;
 
-	*freq = max_freq;
+	return max_freq;
+}
+
+static int devfreq_memlat_get_freq(struct devfreq *df,
+					unsigned long *freq)
+{
+	struct memlat_node *node = df->data;
+	struct memlat_hwmon *hw = node->hw;
+
+	hw->get_cnt(hw);
+
+	*freq = memlat_lat_vote(df, node);
+	return 0;
+}
+
+/*
+ * The bw_memlat governor combines the latency vote of mem_latency with a
+ * bandwidth vote derived from the same L2 miss counters, so that a single
+ * decision is made for the bus instead of two governors fighting over it.
+ *
+ * Once the bandwidth request has risen for two samples in a row it is
+ * extrapolated by ramp_pct of its last increase, so that the bus stays
+ * ahead of a growing load without overshooting on a single step. The vote
+ * goes up immediately but only comes down once the combined request has
+ * stayed more than hyst_pct below it for down_count samples in a row.
+ */
+static int devfreq_bw_memlat_get_freq(struct devfreq *df,
+				      unsigned long *freq)
+{
+	struct memlat_node *node = df->data;
+	struct memlat_hwmon *hw = node->hw;
+	unsigned long lat_mbps, bw_mbps, req_mbps, pred_mbps, target;
+	u64 bytes = 0;
+	ktime_t now;
+	s64 us;
+	int i;
+
+	hw->get_cnt(hw);
+
+	now = ktime_get();
+	us = max_t(s64, ktime_us_delta(now, node->prev_ts), 1);
+	node->prev_ts = now;
+
+	/* On a devbw device the mapped latency vote is an IB vote in MBps */
+	lat_mbps = memlat_lat_vote(df, node);
+
+	for (i = 0; i < hw->num_cores; i++)
+		bytes += (u64)hw->core_stats[i].mem_count * MEMLAT_LINE_SIZE;
+
+	/* Bytes per microsecond are MBps */
+	bw_mbps = div64_u64(bytes, us);
+	req_mbps = mult_frac(bw_mbps, 100, node->io_percent);
+
+	pred_mbps = req_mbps;
+	if (req_mbps > node->prev_bw && node->bw_rising)
+		pred_mbps += mult_frac(req_mbps - node->prev_bw,
+				       node->ramp_pct, 100);
+	node->bw_rising = req_mbps > node->prev_bw;
+	node->prev_bw = req_mbps;
+
+	target = max(lat_mbps, pred_mbps);
+
+	if (target >= node->vote) {
+		node->vote = target;
+		node->down_cnt = 0;
+	} else if (target * 100 < node->vote * (100 - node->hyst_pct)) {
+		if (++node->down_cnt >= node->down_count) {
+			node->vote = target;
+			node->down_cnt = 0;
+		}
+	} else {
+		node->down_cnt = 0;
+	}
+
+	trace_bw_memlat_update(dev_name(df->dev.parent), lat_mbps, bw_mbps,
+			       pred_mbps, node->vote);
+
+	*freq = node->vote;
 	return 0;
 }
 
 gov_attr(ratio_ceil, 1U, 10000U);
 gov_attr(stall_floor, 0U, 100U);
+gov_attr(io_percent, 1U, 100U);
+gov_attr(hyst_pct, 0U, 100U);
+gov_attr(down_count, 1U, 100U);
+gov_attr(ramp_pct, 0U, 200U);
 
 static struct attribute *memlat_dev_attr[] = {
 	&dev_attr_ratio_ceil.attr,
@@ -291,6 +419,17 @@ static struct attribute *memlat_dev_attr[] = {
 	NULL,
 };
 
+static struct attribute *bw_memlat_dev_attr[] = {
+	&dev_attr_ratio_ceil.attr,
+	&dev_attr_stall_floor.attr,
+	&dev_attr_io_percent.attr,
+	&dev_attr_hyst_pct.attr,
+	&dev_attr_down_count.attr,
+	&dev_attr_ramp_pct.attr,
+	&dev_attr_freq_map.attr,
+	NULL,
+};
+
 static struct attribute *compute_dev_attr[] = {
 	&dev_attr_freq_map.attr,
 	NULL,
@@ -301,6 +440,11 @@ static struct attribute_group memlat_dev_attr_group = {
 	.attrs = memlat_dev_attr,
 };
 
+static struct attribute_group bw_memlat_dev_attr_group = {
+	.name = "bw_memlat",
+	.attrs = bw_memlat_dev_attr,
+};
+
 static struct attribute_group compute_dev_attr_group = {
 	.name = "compute",
 	.attrs = compute_dev_attr,
@@ -352,6 +496,12 @@ static struct devfreq_governor devfreq_gov_memlat = {
 	.event_handler = devfreq_memlat_ev_handler,
 };
 
+static struct devfreq_governor devfreq_gov_bw_memlat = {
+	.name = "bw_memlat",
+	.get_target_freq = devfreq_bw_memlat_get_freq,
+	.event_handler = devfreq_memlat_ev_handler,
+};
+
 static struct devfreq_governor devfreq_gov_compute = {
 	.name = "compute",
 	.get_target_freq = devfreq_memlat_get_freq,
@@ -413,6 +563,10 @@ static struct memlat_node *register_common(struct device *dev,
 		return ERR_PTR(-ENOMEM);
 
 	node->ratio_ceil = 10;
+	node->io_percent = 80;
+	node->hyst_pct = 10;
+	node->down_count = 3;
+	node->ramp_pct = 50;
 	node->hw = hw;
 
 	hw->freq_map = init_core_dev_map(dev, "qcom,core-dev-table");
@@ -473,8 +627,14 @@ int register_memlat(struct device *dev, struct memlat_hwmon *hw)
 	node->gov = &devfreq_gov_memlat;
 	node->attr_grp = &memlat_dev_attr_group;
 
-	if (!memlat_use_cnt)
+	if (!memlat_use_cnt) {
 		ret = devfreq_add_governor(&devfreq_gov_memlat);
+		if (!ret) {
+			ret = devfreq_add_governor(&devfreq_gov_bw_memlat);
+			if (ret)
+				devfreq_remove_governor(&devfreq_gov_memlat);
+		}
+	}
 	if (!ret)
 		memlat_use_cnt++;
 	mutex_unlock(&state_lock);
@@ -0,0 +1,371 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define pr_fmt(fmt) "PSY-CACHE: %s: " fmt, __func__
+
+#include <linux/bitmap.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/sysfs.h>
+#include <linux/workqueue.h>
+#include "psy-cache.h"
+
+/**
+ * Snapshot of the integer properties of a power supply.
+ *
+ * Everything from @seq on is what the "snapshot" binary sysfs file
+ * returns, so userspace can pick up all properties with a single read.
+ *
+ * @seq:       Number of the flush that took the snapshot.
+ * @num_props: Number of entries in @props.
+ * @stamp_ns:  Monotonic time the snapshot was taken at.
+ * @props:     Property and value pairs.
+ */
+struct psy_snapshot {
+	struct rcu_head		rcu;
+	u32			seq;
+	u32			num_props;
+	u64			stamp_ns;
+	struct {
+		u32		prop;
+		s32		intval;
+	} props[];
+};
+
+/**
+ * Coalescing state of a power supply.
+ *
+ * @window_ms:     Time power_supply_changed() is held back to collect
+ *                 further events.
+ * @max_age_ns:    Age up to which psy_cache_get_property() serves the
+ *                 snapshot, 0 if it never does.
+ * @flush_work:    Takes the snapshot and notifies at the end of a window.
+ * @snap:          Last snapshot, published under RCU.
+ * @seq:           Number of flushes so far.
+ * @events:        Number of change events, flushed or not.
+ * @snapshot_attr: The "snapshot" binary sysfs file.
+ * @all_props:     The "snapshot" file has been read, snapshot every
+ *                 integer property.
+ * @wanted:        Indices into desc->properties that have been read
+ *                 through psy_cache_get_property().
+ */
+struct psy_cache {
+	struct list_head	node;
+	struct rcu_head		rcu;
+	struct power_supply	*psy;
+	unsigned int		window_ms;
+	u64			max_age_ns;
+	struct delayed_work	flush_work;
+	struct psy_snapshot __rcu *snap;
+	u32			seq;
+	atomic_t		events;
+	struct bin_attribute	snapshot_attr;
+	bool			all_props;
+	unsigned long		wanted[];
+};
+
+static LIST_HEAD(psy_cache_list);
+static DEFINE_SPINLOCK(psy_cache_lock);
+
+static struct psy_cache *psy_cache_find(struct power_supply *psy)
+{
+	struct psy_cache *cache;
+
+	list_for_each_entry_rcu(cache, &psy_cache_list, node)
+		if (cache->psy == psy)
+			return cache;
+
+	return NULL;
+}
+
+static bool psy_prop_is_int(enum power_supply_property psp)
+{
+	return psp < POWER_SUPPLY_PROP_MODEL_NAME;
+}
+
+static int psy_cache_prop_index(struct psy_cache *cache,
+				enum power_supply_property psp)
+{
+	const struct power_supply_desc *desc = cache->psy->desc;
+	int i;
+
+	for (i = 0; i < desc->num_properties; i++)
+		if (desc->properties[i] == psp)
+			return i;
+
+	return -EINVAL;
+}
+
+/*
+ * Reading a property may mean a round trip to the fuel gauge, so only the
+ * ones somebody reads from the cache are snapshot.
+ */
+static void psy_cache_refresh(struct psy_cache *cache)
+{
+	const struct power_supply_desc *desc = cache->psy->desc;
+	bool all_props = READ_ONCE(cache->all_props);
+	union power_supply_propval val;
+	struct psy_snapshot *snap, *old;
+	int i, n = 0;
+
+	if (!all_props && bitmap_empty(cache->wanted, desc->num_properties))
+		return;
+
+	snap = kmalloc(sizeof(*snap) + desc->num_properties *
+		       sizeof(snap->props[0]), GFP_KERNEL);
+	if (!snap)
+		return;
+
+	for (i = 0; i < desc->num_properties; i++) {
+		if (!psy_prop_is_int(desc->properties[i]))
+			continue;
+
+		if (!all_props && !test_bit(i, cache->wanted))
+			continue;
+
+		if (power_supply_get_property(cache->psy, desc->properties[i],
+					      &val))
+			continue;
+
+		snap->props[n].prop = desc->properties[i];
+		snap->props[n].intval = val.intval;
+		n++;
+	}
+
+	snap->seq = ++cache->seq;
+	snap->num_props = n;
+	snap->stamp_ns = ktime_get_ns();
+
+	/* The flush work is the only writer */
+	old = rcu_dereference_protected(cache->snap, true);
+	rcu_assign_pointer(cache->snap, snap);
+	if (old)
+		kfree_rcu(old, rcu);
+}
+
+static void psy_cache_flush_work(struct work_struct *work)
+{
+	struct psy_cache *cache = container_of(work, struct psy_cache,
+					       flush_work.work);
+
+	psy_cache_refresh(cache);
+	pr_debug("%s: flush %u after %d events\n", cache->psy->desc->name,
+		 cache->seq, atomic_read(&cache->events));
+
+	power_supply_changed(cache->psy);
+}
+
+/**
+ * psy_cache_changed(): Coalescing replacement for power_supply_changed()
+ *
+ * @psy: The power supply that changed
+ *
+ * The first event arms a flush at the end of the window of @psy, later
+ * events of the same window are folded into it. Supplies without a cache
+ * are notified right away.
+ */
+void psy_cache_changed(struct power_supply *psy)
+{
+	struct psy_cache *cache;
+
+	if (!psy)
+		return;
+
+	rcu_read_lock();
+	cache = psy_cache_find(psy);
+	if (cache) {
+		atomic_inc(&cache->events);
+		queue_delayed_work(system_power_efficient_wq,
+				   &cache->flush_work,
+				   msecs_to_jiffies(cache->window_ms));
+	}
+	rcu_read_unlock();
+
+	if (!cache)
+		power_supply_changed(psy);
+}
+
+/**
+ * psy_cache_get_property(): Read a property from the last snapshot
+ *
+ * @psy: The power supply to read from
+ * @psp: The property to read
+ * @val: The value read
+ *
+ * The snapshot is only used while no change is pending on @psy and it is
+ * younger than the max_age_ms @psy was registered with. Drivers only report
+ * events, not every new measurement, so anything older may be stale.
+ * Otherwise, and for properties the snapshot doesn't hold, this calls into
+ * the driver like power_supply_get_property(). A property missing from the
+ * snapshot is added to the ones taken from the next flush on.
+ */
+int psy_cache_get_property(struct power_supply *psy,
+			   enum power_supply_property psp,
+			   union power_supply_propval *val)
+{
+	struct psy_snapshot *snap = NULL;
+	struct psy_cache *cache;
+	int i;
+
+	rcu_read_lock();
+	cache = psy_cache_find(psy);
+	if (!cache || !cache->max_age_ns) {
+		rcu_read_unlock();
+		return power_supply_get_property(psy, psp, val);
+	}
+
+	if (!delayed_work_pending(&cache->flush_work))
+		snap = rcu_dereference(cache->snap);
+	if (snap && ktime_get_ns() - snap->stamp_ns >= cache->max_age_ns)
+		snap = NULL;
+
+	for (i = 0; snap && i < snap->num_props; i++) {
+		if (snap->props[i].prop == psp) {
+			val->intval = snap->props[i].intval;
+			rcu_read_unlock();
+			return 0;
+		}
+	}
+
+	i = psy_cache_prop_index(cache, psp);
+	if (i >= 0 && !test_bit(i, cache->wanted))
+		set_bit(i, cache->wanted);
+	rcu_read_unlock();
+
+	return power_supply_get_property(psy, psp, val);
+}
+
+static ssize_t psy_cache_snapshot_read(struct file *filp,
+				       struct kobject *kobj,
+				       struct bin_attribute *attr,
+				       char *buf, loff_t off, size_t count)
+{
+	struct psy_cache *cache = container_of(attr, struct psy_cache,
+					       snapshot_attr);
+	struct psy_snapshot *snap;
+	ssize_t len = 0;
+
+	if (!READ_ONCE(cache->all_props))
+		WRITE_ONCE(cache->all_props, true);
+
+	rcu_read_lock();
+	snap = rcu_dereference(cache->snap);
+	if (snap)
+		len = memory_read_from_buffer(buf, count, &off, &snap->seq,
+				sizeof(*snap) - offsetof(struct psy_snapshot, seq)
+				+ snap->num_props * sizeof(snap->props[0]));
+	rcu_read_unlock();
+
+	return len;
+}
+
+static void psy_cache_release(void *data)
+{
+	struct psy_cache *cache = data;
+	struct psy_snapshot *snap;
+
+	sysfs_remove_bin_file(&cache->psy->dev.kobj, &cache->snapshot_attr);
+
+	spin_lock(&psy_cache_lock);
+	list_del_rcu(&cache->node);
+	spin_unlock(&psy_cache_lock);
+
+	/* Deliver what is still pending before the supply goes away */
+	if (cancel_delayed_work_sync(&cache->flush_work))
+		power_supply_changed(cache->psy);
+
+	snap = rcu_dereference_protected(cache->snap, true);
+	if (snap)
+		kfree_rcu(snap, rcu);
+	kfree_rcu(cache, rcu);
+}
+
+/**
+ * devm_psy_cache_register(): Coalesce the change events of a power supply
+ *
+ * @dev:        The device owning @psy
+ * @psy:        The power supply
+ * @window_ms:  Time to collect change events for before notifying
+ * @max_age_ms: Age up to which psy_cache_get_property() serves a snapshot,
+ *              such as the measurement period of @psy. 0 never serves one.
+ *
+ * Makes psy_cache_changed() on @psy coalesce events over @window_ms and
+ * take a snapshot of the integer properties on each flush, served by
+ * psy_cache_get_property() and the "snapshot" binary sysfs file. Only the
+ * properties read through the cache are snapshot, all of them once the
+ * sysfs file has been read, which is empty until the flush after that.
+ * Must be called after @psy is registered, the cache is released before it.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int devm_psy_cache_register(struct device *dev, struct power_supply *psy,
+			    unsigned int window_ms, unsigned int max_age_ms)
+{
+	struct psy_cache *cache;
+	int rc;
+
+	cache = kzalloc(sizeof(*cache) + BITS_TO_LONGS(psy->desc->num_properties)
+			* sizeof(unsigned long), GFP_KERNEL);
+	if (!cache)
+		return -ENOMEM;
+
+	cache->psy = psy;
+	cache->window_ms = window_ms;
+	cache->max_age_ns = (u64)max_age_ms * NSEC_PER_MSEC;
+	atomic_set(&cache->events, 0);
+	INIT_DELAYED_WORK(&cache->flush_work, psy_cache_flush_work);
+
+	sysfs_bin_attr_init(&cache->snapshot_attr);
+	cache->snapshot_attr.attr.name = "snapshot";
+	cache->snapshot_attr.attr.mode = 0444;
+	cache->snapshot_attr.read = psy_cache_snapshot_read;
+
+	rc = sysfs_create_bin_file(&psy->dev.kobj, &cache->snapshot_attr);
+	if (rc < 0) {
+		pr_err("Couldn't create snapshot for %s rc=%d\n",
+		       psy->desc->name, rc);
+		kfree(cache);
+		return rc;
+	}
+
+	spin_lock(&psy_cache_lock);
+	list_add_rcu(&cache->node, &psy_cache_list);
+	spin_unlock(&psy_cache_lock);
+
+	return devm_add_action_or_reset(dev, psy_cache_release, cache);
+}
+
+/**
+ * devm_psy_cache_unregister(): Release the cache of a power supply early
+ *
+ * @dev: The device owning @psy
+ * @psy: The power supply
+ *
+ * For drivers unregistering @psy themselves instead of leaving it to
+ * devres.
+ */
+void devm_psy_cache_unregister(struct device *dev, struct power_supply *psy)
+{
+	struct psy_cache *cache;
+
+	rcu_read_lock();
+	cache = psy_cache_find(psy);
+	rcu_read_unlock();
+
+	if (!cache)
+		return;
+
+	devm_remove_action(dev, psy_cache_release, cache);
+	psy_cache_release(cache);
+}
@@ -0,0 +1,24 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __PSY_CACHE_H
+#define __PSY_CACHE_H
+#include <linux/device.h>
+#include <linux/power_supply.h>
+
+int devm_psy_cache_register(struct device *dev, struct power_supply *psy,
+			    unsigned int window_ms, unsigned int max_age_ms);
+void devm_psy_cache_unregister(struct device *dev, struct power_supply *psy);
+void psy_cache_changed(struct power_supply *psy);
+int psy_cache_get_property(struct power_supply *psy,
+			   enum power_supply_property psp,
+			   union power_supply_propval *val);
+#endif
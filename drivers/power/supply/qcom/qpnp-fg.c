@@ -37,6 +37,7 @@
 #include <linux/string_helpers.h>
 #include <linux/alarmtimer.h>
 #include <linux/qpnp/qpnp-revid.h>
+#include "psy-cache.h"
 
 /* Register offsets */
 
@@ -74,6 +75,7 @@
 #define QPNP_FG_DEV_NAME "qcom,qpnp-fg"
 #define MEM_IF_TIMEOUT_MS	5000
 #define FG_CYCLE_MS		1500
+#define FG_PSY_COALESCE_MS	50
 #define BUCKET_COUNT		8
 #define BUCKET_SOC_PCT		(256 / BUCKET_COUNT)
 
@@ -4418,7 +4420,7 @@ static void fg_restore_battery_info(struct fg_chip *chip)
 	}
 
 	if (chip->power_supply_registered)
-		power_supply_changed(chip->bms_psy);
+		psy_cache_changed(chip->bms_psy);
 
 	if (fg_debug_mask & FG_STATUS)
 		pr_info("Restored battery info!\n");
@@ -5259,7 +5261,7 @@ static irqreturn_t fg_vbatt_low_handler(int irq, void *_chip)
 		}
 	}
 	if (chip->power_supply_registered)
-		power_supply_changed(chip->bms_psy);
+		psy_cache_changed(chip->bms_psy);
 out:
 	return IRQ_HANDLED;
 }
@@ -5292,7 +5294,7 @@ static irqreturn_t fg_batt_missing_irq_handler(int irq, void *_chip)
 				batt_missing ? "missing" : "present");
 
 	if (chip->power_supply_registered)
-		power_supply_changed(chip->bms_psy);
+		psy_cache_changed(chip->bms_psy);
 	return IRQ_HANDLED;
 }
 
@@ -5377,7 +5379,7 @@ static irqreturn_t fg_soc_irq_handler(int irq, void *_chip)
 	schedule_work(&chip->battery_age_work);
 
 	if (chip->power_supply_registered)
-		power_supply_changed(chip->bms_psy);
+		psy_cache_changed(chip->bms_psy);
 
 	if (chip->rslow_comp.chg_rs_to_rslow > 0 &&
 			chip->rslow_comp.chg_rslow_comp_c1 > 0 &&
@@ -5446,7 +5448,7 @@ static irqreturn_t fg_first_soc_irq_handler(int irq, void *_chip)
 		schedule_work(&chip->dump_sram);
 
 	if (chip->power_supply_registered)
-		power_supply_changed(chip->bms_psy);
+		psy_cache_changed(chip->bms_psy);
 
 	complete_all(&chip->first_soc_done);
 
@@ -6564,7 +6566,7 @@ static int fg_batt_profile_init(struct fg_chip *chip)
 	estimate_battery_age(chip, &chip->actual_cap_uah);
 	schedule_work(&chip->status_change_work);
 	if (chip->power_supply_registered)
-		power_supply_changed(chip->bms_psy);
+		psy_cache_changed(chip->bms_psy);
 	fg_relax(&chip->profile_wakeup_source);
 	pr_info("Battery SOC: %d, V: %duV\n", get_prop_capacity(chip),
 		fg_data[FG_DATA_VOLTAGE].value);
@@ -6581,7 +6583,7 @@ static int fg_batt_profile_init(struct fg_chip *chip)
 	}
 
 	if (chip->power_supply_registered)
-		power_supply_changed(chip->bms_psy);
+		psy_cache_changed(chip->bms_psy);
 	fg_relax(&chip->profile_wakeup_source);
 	return rc;
 update:
@@ -6621,7 +6623,7 @@ static void check_empty_work(struct work_struct *work)
 			chip->soc_empty = false;
 
 		if (chip->power_supply_registered)
-			power_supply_changed(chip->bms_psy);
+			psy_cache_changed(chip->bms_psy);
 
 		if (!chip->vbat_low_irq_enabled) {
 			enable_irq(chip->batt_irq[VBATT_LOW].irq);
@@ -6633,7 +6635,7 @@ static void check_empty_work(struct work_struct *work)
 			pr_info("EMPTY SOC high\n");
 		chip->soc_empty = true;
 		if (chip->power_supply_registered)
-			power_supply_changed(chip->bms_psy);
+			psy_cache_changed(chip->bms_psy);
 	}
 
 out:
@@ -7465,6 +7467,7 @@ static void fg_cancel_all_works(struct fg_chip *chip)
 static void fg_cleanup(struct fg_chip *chip)
 {
 	fg_cancel_all_works(chip);
+	devm_psy_cache_unregister(chip->dev, chip->bms_psy);
 	power_supply_unregister(chip->bms_psy);
 	mutex_destroy(&chip->rslow_comp.lock);
 	mutex_destroy(&chip->rw_lock);
@@ -8885,6 +8888,13 @@ static int fg_probe(struct platform_device *pdev)
 		goto of_init_fail;
 	}
 	chip->power_supply_registered = true;
+
+	/* readings are only served cached within one fg cycle */
+	rc = devm_psy_cache_register(chip->dev, chip->bms_psy,
+				     FG_PSY_COALESCE_MS, FG_CYCLE_MS);
+	if (rc < 0)
+		pr_err("failed to set up bms event coalescing rc = %d\n", rc);
+
 	/*
 	 * Just initialize the batt_psy_name here. Power supply
 	 * will be obtained later.
@@ -8920,6 +8930,7 @@ static int fg_probe(struct platform_device *pdev)
 
 #ifdef CONFIG_DEBUG_FS
 power_supply_unregister:
+	devm_psy_cache_unregister(chip->dev, chip->bms_psy);
 	power_supply_unregister(chip->bms_psy);
 #endif
 cancel_work:
@@ -43,6 +43,7 @@
 #include <linux/ktime.h>
 #include <linux/extcon.h>
 #include <linux/pmic-voter.h>
+#include "psy-cache.h"
 
 /* Mask/Bit helpers */
 #define _SMB_MASK(BITS, POS) \
@@ -1013,6 +1014,23 @@ static int set_property_on_fg(struct smbchg_chip *chip,
 	return rc;
 }
 
+/*
+ * Charger interrupts come in bursts around insertion, removal and charge
+ * state changes. Fold their power supply notifications into one per
+ * window, a failure only costs the coalescing.
+ */
+#define SMBCHG_PSY_COALESCE_MS	50
+static void smbchg_psy_cache_register(struct smbchg_chip *chip,
+				struct power_supply *psy)
+{
+	int rc;
+
+	rc = devm_psy_cache_register(chip->dev, psy, SMBCHG_PSY_COALESCE_MS, 0);
+	if (rc < 0)
+		dev_err(chip->dev, "Couldn't set up %s event coalescing rc = %d\n",
+			psy->desc->name, rc);
+}
+
 static int get_property_from_fg(struct smbchg_chip *chip,
 		enum power_supply_property prop, int *val)
 {
@@ -1027,7 +1045,7 @@ static int get_property_from_fg(struct smbchg_chip *chip,
 		return -EINVAL;
 	}
 
-	rc = power_supply_get_property(chip->bms_psy, prop, &ret);
+	rc = psy_cache_get_property(chip->bms_psy, prop, &ret);
 	if (rc) {
 		pr_smb(PR_STATUS,
 			"bms psy doesn't support reading prop %d rc = %d\n",
@@ -1590,7 +1608,7 @@ static void smbchg_usb_update_online_work(struct work_struct *work)
 	if (chip->usb_online != online) {
 		pr_smb(PR_MISC, "setting usb psy online = %d\n", online);
 		chip->usb_online = online;
-		power_supply_changed(chip->usb_psy);
+		psy_cache_changed(chip->usb_psy);
 	}
 	mutex_unlock(&chip->usb_set_online_lock);
 }
@@ -2507,7 +2525,7 @@ static int dc_suspend_vote_cb(struct votable *votable,
 		return rc;
 
 	if (chip->dc_psy_type != -EINVAL && chip->dc_psy)
-		power_supply_changed(chip->dc_psy);
+		psy_cache_changed(chip->dc_psy);
 
 	return rc;
 }
@@ -4525,7 +4543,7 @@ static int smbchg_change_usb_supply_type(struct smbchg_chip *chip,
 		chip->usb_psy_d.type = chip->usb_supply_type;
 
 	if (!chip->skip_usb_notification)
-		power_supply_changed(chip->usb_psy);
+		psy_cache_changed(chip->usb_psy);
 
 	/* set the correct buck switching frequency */
 	rc = smbchg_set_optimal_charging_mode(chip, type);
@@ -4599,7 +4617,7 @@ static void smbchg_hvdcp_det_work(struct work_struct *work)
 		smbchg_change_usb_supply_type(chip,
 				POWER_SUPPLY_TYPE_USB_HVDCP);
 		if (chip->batt_psy)
-			power_supply_changed(chip->batt_psy);
+			psy_cache_changed(chip->batt_psy);
 		smbchg_aicl_deglitch_wa_check(chip);
 	}
 	smbchg_relax(chip, PM_DETECT_HVDCP);
@@ -4735,7 +4753,7 @@ static void handle_usb_removal(struct smbchg_chip *chip)
 
 	pr_smb(PR_MISC, "setting usb psy health UNKNOWN\n");
 	chip->usb_health = POWER_SUPPLY_HEALTH_UNKNOWN;
-	power_supply_changed(chip->usb_psy);
+	psy_cache_changed(chip->usb_psy);
 
 	if (parallel_psy && chip->parallel_charger_detected) {
 		pval.intval = false;
@@ -4813,7 +4831,7 @@ static void handle_usb_insertion(struct smbchg_chip *chip)
 		chip->usb_health = chip->very_weak_charger
 				? POWER_SUPPLY_HEALTH_UNSPEC_FAILURE
 				: POWER_SUPPLY_HEALTH_GOOD;
-		power_supply_changed(chip->usb_psy);
+		psy_cache_changed(chip->usb_psy);
 	}
 	schedule_work(&chip->usb_set_online_work);
 
@@ -5013,7 +5031,7 @@ static void increment_aicl_count(struct smbchg_chip *chip)
 			pr_smb(PR_MISC,
 				"setting usb psy health UNSPEC_FAILURE\n");
 			chip->usb_health = POWER_SUPPLY_HEALTH_UNSPEC_FAILURE;
-			power_supply_changed(chip->usb_psy);
+			psy_cache_changed(chip->usb_psy);
 			schedule_work(&chip->usb_set_online_work);
 		}
 	}
@@ -5993,7 +6011,7 @@ static int smbchg_battery_set_property(struct power_supply *psy,
 	case POWER_SUPPLY_PROP_CAPACITY:
 		chip->fake_battery_soc = val->intval;
 		if (chip->batt_psy)
-			power_supply_changed(chip->batt_psy);
+			psy_cache_changed(chip->batt_psy);
 		break;
 	case POWER_SUPPLY_PROP_SYSTEM_TEMP_LEVEL:
 		smbchg_system_temp_level_set(chip, val->intval);
@@ -6048,7 +6066,7 @@ static int smbchg_battery_set_property(struct power_supply *psy,
 	case POWER_SUPPLY_PROP_ALLOW_HVDCP3:
 		if (chip->allow_hvdcp3_detection != val->intval) {
 			chip->allow_hvdcp3_detection = !!val->intval;
-			power_supply_changed(chip->batt_psy);
+			psy_cache_changed(chip->batt_psy);
 		}
 		break;
 	default:
@@ -6302,7 +6320,7 @@ static irqreturn_t batt_hot_handler(int irq, void *_chip)
 	pr_smb(PR_INTERRUPT, "triggered: 0x%02x\n", reg);
 	smbchg_parallel_usb_check_ok(chip);
 	if (chip->batt_psy)
-		power_supply_changed(chip->batt_psy);
+		psy_cache_changed(chip->batt_psy);
 	smbchg_charging_status_change(chip);
 	smbchg_wipower_check(chip);
 	set_property_on_fg(chip, POWER_SUPPLY_PROP_HEALTH,
@@ -6320,7 +6338,7 @@ static irqreturn_t batt_cold_handler(int irq, void *_chip)
 	pr_smb(PR_INTERRUPT, "triggered: 0x%02x\n", reg);
 	smbchg_parallel_usb_check_ok(chip);
 	if (chip->batt_psy)
-		power_supply_changed(chip->batt_psy);
+		psy_cache_changed(chip->batt_psy);
 	smbchg_charging_status_change(chip);
 	smbchg_wipower_check(chip);
 	set_property_on_fg(chip, POWER_SUPPLY_PROP_HEALTH,
@@ -6338,7 +6356,7 @@ static irqreturn_t batt_warm_handler(int irq, void *_chip)
 	pr_smb(PR_INTERRUPT, "triggered: 0x%02x\n", reg);
 	smbchg_parallel_usb_check_ok(chip);
 	if (chip->batt_psy)
-		power_supply_changed(chip->batt_psy);
+		psy_cache_changed(chip->batt_psy);
 	set_property_on_fg(chip, POWER_SUPPLY_PROP_HEALTH,
 			get_prop_batt_health(chip));
 	return IRQ_HANDLED;
@@ -6354,7 +6372,7 @@ static irqreturn_t batt_cool_handler(int irq, void *_chip)
 	pr_smb(PR_INTERRUPT, "triggered: 0x%02x\n", reg);
 	smbchg_parallel_usb_check_ok(chip);
 	if (chip->batt_psy)
-		power_supply_changed(chip->batt_psy);
+		psy_cache_changed(chip->batt_psy);
 	set_property_on_fg(chip, POWER_SUPPLY_PROP_HEALTH,
 			get_prop_batt_health(chip));
 	return IRQ_HANDLED;
@@ -6369,7 +6387,7 @@ static irqreturn_t batt_pres_handler(int irq, void *_chip)
 	chip->batt_present = !(reg & BAT_MISSING_BIT);
 	pr_smb(PR_INTERRUPT, "triggered: 0x%02x\n", reg);
 	if (chip->batt_psy)
-		power_supply_changed(chip->batt_psy);
+		psy_cache_changed(chip->batt_psy);
 	smbchg_charging_status_change(chip);
 	set_property_on_fg(chip, POWER_SUPPLY_PROP_HEALTH,
 			get_prop_batt_health(chip));
@@ -6404,7 +6422,7 @@ static irqreturn_t chg_error_handler(int irq, void *_chip)
 
 	smbchg_parallel_usb_check_ok(chip);
 	if (chip->batt_psy)
-		power_supply_changed(chip->batt_psy);
+		psy_cache_changed(chip->batt_psy);
 	smbchg_charging_status_change(chip);
 	smbchg_wipower_check(chip);
 	return IRQ_HANDLED;
@@ -6420,7 +6438,7 @@ static irqreturn_t fastchg_handler(int irq, void *_chip)
 		smbchg_parallel_usb_check_ok(chip);
 	}
 	if (chip->batt_psy)
-		power_supply_changed(chip->batt_psy);
+		psy_cache_changed(chip->batt_psy);
 	smbchg_charging_status_change(chip);
 	smbchg_wipower_check(chip);
 	return IRQ_HANDLED;
@@ -6449,7 +6467,7 @@ static irqreturn_t chg_term_handler(int irq, void *_chip)
 
 	smbchg_parallel_usb_check_ok(chip);
 	if (chip->batt_psy)
-		power_supply_changed(chip->batt_psy);
+		psy_cache_changed(chip->batt_psy);
 	smbchg_charging_status_change(chip);
 
 	return IRQ_HANDLED;
@@ -6465,7 +6483,7 @@ static irqreturn_t taper_handler(int irq, void *_chip)
 	pr_smb(PR_INTERRUPT, "triggered: 0x%02x\n", reg);
 	smbchg_parallel_usb_taper(chip);
 	if (chip->batt_psy)
-		power_supply_changed(chip->batt_psy);
+		psy_cache_changed(chip->batt_psy);
 	smbchg_charging_status_change(chip);
 	smbchg_wipower_check(chip);
 	return IRQ_HANDLED;
@@ -6480,7 +6498,7 @@ static irqreturn_t recharge_handler(int irq, void *_chip)
 	pr_smb(PR_INTERRUPT, "triggered: 0x%02x\n", reg);
 	smbchg_parallel_usb_check_ok(chip);
 	if (chip->batt_psy)
-		power_supply_changed(chip->batt_psy);
+		psy_cache_changed(chip->batt_psy);
 	smbchg_charging_status_change(chip);
 	return IRQ_HANDLED;
 }
@@ -6493,7 +6511,7 @@ static irqreturn_t wdog_timeout_handler(int irq, void *_chip)
 	smbchg_read(chip, &reg, chip->misc_base + RT_STS, 1);
 	pr_warn_ratelimited("wdog timeout rt_stat = 0x%02x\n", reg);
 	if (chip->batt_psy)
-		power_supply_changed(chip->batt_psy);
+		psy_cache_changed(chip->batt_psy);
 	smbchg_charging_status_change(chip);
 	return IRQ_HANDLED;
 }
@@ -6531,7 +6549,7 @@ static irqreturn_t dcin_uv_handler(int irq, void *_chip)
 		/* dc changed */
 		chip->dc_present = dc_present;
 		if (chip->dc_psy_type != -EINVAL && chip->batt_psy)
-			power_supply_changed(chip->dc_psy);
+			psy_cache_changed(chip->dc_psy);
 		smbchg_charging_status_change(chip);
 		smbchg_aicl_deglitch_wa_check(chip);
 		chip->vbat_above_headroom = false;
@@ -6563,7 +6581,7 @@ static irqreturn_t usbin_ov_handler(int irq, void *_chip)
 		chip->usb_ov_det = true;
 		pr_smb(PR_MISC, "setting usb psy health OV\n");
 		chip->usb_health = POWER_SUPPLY_HEALTH_OVERVOLTAGE;
-		power_supply_changed(chip->usb_psy);
+		psy_cache_changed(chip->usb_psy);
 	} else {
 		chip->usb_ov_det = false;
 		/* If USB is present, then handle the USB insertion */
@@ -6657,7 +6675,7 @@ static irqreturn_t usbin_uv_handler(int irq, void *_chip)
 		}
 		pr_smb(PR_MISC, "setting usb psy health UNSPEC_FAILURE\n");
 		chip->usb_health = POWER_SUPPLY_HEALTH_UNSPEC_FAILURE;
-		power_supply_changed(chip->usb_psy);
+		psy_cache_changed(chip->usb_psy);
 		schedule_work(&chip->usb_set_online_work);
 	}
 
@@ -6798,7 +6816,7 @@ static irqreturn_t aicl_done_handler(int irq, void *_chip)
 		smbchg_parallel_usb_check_ok(chip);
 
 	if (chip->aicl_complete && chip->batt_psy)
-		power_supply_changed(chip->batt_psy);
+		psy_cache_changed(chip->batt_psy);
 
 	return IRQ_HANDLED;
 }
@@ -8512,6 +8530,7 @@ static int smbchg_probe(struct platform_device *pdev)
 		rc = PTR_ERR(chip->usb_psy);
 		goto votables_cleanup;
 	}
+	smbchg_psy_cache_register(chip, chip->usb_psy);
 
 	rc = smbchg_hw_init(chip);
 	if (rc < 0) {
@@ -8548,6 +8567,7 @@ static int smbchg_probe(struct platform_device *pdev)
 			PTR_ERR(chip->batt_psy));
 		goto out;
 	}
+	smbchg_psy_cache_register(chip, chip->batt_psy);
 
 	if (chip->dc_psy_type != -EINVAL) {
 		chip->dc_psy_d.name = "dc";
@@ -8573,6 +8593,7 @@ static int smbchg_probe(struct platform_device *pdev)
 				PTR_ERR(chip->dc_psy));
 			goto out;
 		}
+		smbchg_psy_cache_register(chip, chip->dc_psy);
 	}
 	chip->allow_hvdcp3_detection = true;
 
@@ -2532,6 +2532,15 @@ static int dummy_rx_rt_unvote(struct glink_transport_if *if_ptr)
 	return -EOPNOTSUPP;
 }
 
+/**
+ * dummy_tx_batch() - a dummy tx_batch() for transports that don't define one
+ * @if_ptr:	The transport to transmit on.
+ * @begin:	True at the start of a run of tx() calls, false at its end.
+ */
+static void dummy_tx_batch(struct glink_transport_if *if_ptr, bool begin)
+{
+}
+
 /**
  * notif_if_up_all_xprts() - Check and notify existing transport state if up
  * @notif_info:	Data structure containing transport information to be notified.
@@ -4127,6 +4136,8 @@ int glink_core_register_transport(struct glink_transport_if *if_ptr,
 		if_ptr->rx_rt_vote = dummy_rx_rt_vote;
 	if (!if_ptr->rx_rt_unvote)
 		if_ptr->rx_rt_unvote = dummy_rx_rt_unvote;
+	if (!if_ptr->tx_batch)
+		if_ptr->tx_batch = dummy_tx_batch;
 	xprt_ptr->capabilities = 0;
 	xprt_ptr->ops = if_ptr;
 	spin_lock_init(&xprt_ptr->xprt_ctx_lock_lhb1);
@@ -4304,6 +4315,7 @@ static struct glink_core_xprt_ctx *glink_create_dummy_xprt_ctx(
 	if_ptr->get_power_vote_ramp_time = dummy_get_power_vote_ramp_time;
 	if_ptr->power_vote = dummy_power_vote;
 	if_ptr->power_unvote = dummy_power_unvote;
+	if_ptr->tx_batch = dummy_tx_batch;
 
 	xprt_ptr->ops = if_ptr;
 	xprt_ptr->log_ctx = log_ctx;
@@ -5698,6 +5710,10 @@ static int glink_scheduler_tx(struct channel_ctx *ctx,
 /**
  * tx_func()	Transmit Kthread
  * @work:	Linux kthread work structure
+ *
+ * All the packets sent in one run are bracketed by the tx_batch() transport
+ * operation, so that a transport can signal the remote side once for a run
+ * instead of once per packet.
  */
 static void tx_func(struct kthread_work *work)
 {
@@ -5712,6 +5728,7 @@ static void tx_func(struct kthread_work *work)
 			struct glink_core_xprt_ctx, tx_kwork);
 
 	GLINK_PERF("%s: worker starting\n", __func__);
+	xprt_ptr->ops->tx_batch(xprt_ptr->ops, true);
 
 	while (1) {
 		prio = xprt_ptr->num_priority - 1;
@@ -5720,6 +5737,7 @@ static void tx_func(struct kthread_work *work)
 			if (prio == 0) {
 				spin_unlock_irqrestore(
 					&xprt_ptr->tx_ready_lock_lhb3, flags);
+				xprt_ptr->ops->tx_batch(xprt_ptr->ops, false);
 				return;
 			}
 			prio--;
@@ -5795,6 +5813,7 @@ static void tx_func(struct kthread_work *work)
 		transmitted_successfully = true;
 		rwref_put(&ch_ptr->ch_state_lhb2);
 	}
+	xprt_ptr->ops->tx_batch(xprt_ptr->ops, false);
 	glink_pm_qos_unvote(xprt_ptr);
 	GLINK_PERF("%s: worker exiting\n", __func__);
 }
@@ -143,6 +143,7 @@ static struct ctl_ch_info ctl_ch_tbl[] = {
 	{"LOOPBACK_CTL_APSS", "cdsp", "smem"},
 	{"LOOPBACK_CTL_APSS", "spss", "mailbox"},
 	{"LOOPBACK_CTL_APSS", "wdsp", "spi"},
+	{"LOOPBACK_CTL_APSS", "loopback", "smem"},
 };
 
 static DEFINE_MUTEX(ctl_ch_list_lock);
@@ -17,6 +17,7 @@
 #include <linux/io.h>
 #include <linux/ipc_logging.h>
 #include <linux/irq.h>
+#include <linux/irq_work.h>
 #include <linux/kernel.h>
 #include <linux/kthread.h>
 #include <linux/list.h>
@@ -53,6 +54,8 @@
 #define RPM_FIFO_ADDR_ALIGN_BYTES 3
 #define TRACER_PKT_FEATURE BIT(2)
 #define DEFERRED_CMDS_THRESHOLD 25
+#define TX_BATCH_MAX 16 /* writes per irq while the core sends a batch */
+#define RX_BUDGET 64 /* commands processed before yielding the rx path */
 #define NUM_LOG_PAGES	4
 
 /**
@@ -152,6 +155,10 @@ struct mailbox_config_info {
  * @irq_line:			The incoming interrupt line.
  * @tx_irq_count:		Number of interrupts triggered.
  * @rx_irq_count:		Number of interrupts received.
+ * @tx_irq_coalesced:		Number of fifo writes whose interrupt was
+ *				merged into a later one.
+ * @rx_budget_exhausted:	Number of times the irq handler left the rest of
+ *				the rx fifo to @kworker.
  * @tx_ch_desc:			Reference to the channel description structure
  *				for tx in SMEM for this edge.
  * @rx_ch_desc:			Reference to the channel description structure
@@ -171,6 +178,12 @@ struct mailbox_config_info {
  * @tx_blocked_signal_sent:	Flag to indicate the flush signal has already
  *				been sent, and a response is pending from the
  *				remote side.  Protected by @write_lock.
+ * @tx_batch_owner:		The task sending a batch of packets for the
+ *				core, the interrupt for its writes may be held
+ *				back.  Protected by @write_lock.
+ * @tx_batch_pending:		Number of writes of @tx_batch_owner since the
+ *				last interrupt was sent.  Protected by
+ *				@write_lock.
  * @debug_mask			mask to set debugging level.
  * @kwork:			Work to be executed when an irq is received.
  * @kworker:			Handle to the entity processing of
@@ -184,12 +197,19 @@ struct mailbox_config_info {
  * @deferred_cmds:		List of deferred commands that need to be
  *				processed in process context.
  * @deferred_cmds_cnt:		Number of deferred commands in queue.
+ * @rx_deferred:		@kworker is draining the rx fifo after the irq
+ *				handler ran out of budget, incoming interrupts
+ *				only need to look after tx.
  * @rt_vote_lock:		Serialize access to RT rx votes
  * @rt_votes:			Vote count for RT rx thread priority
  * @num_pw_states:		Size of @ramp_time_us.
  * @ramp_time_us:		Array of ramp times in microseconds where array
  *				index position represents a power state.
  * @mailbox:			Mailbox transport channel description reference.
+ * @peer:			The other edge of a software loopback pair.  Its
+ *				tx fifo is our rx fifo and our interrupts are
+ *				raised on it through its @irq_work.
+ * @irq_work:			Runs irq_handler() for a software loopback edge.
  * @log_ctx:			Pointer to log context.
  */
 struct edge_info {
@@ -204,6 +224,8 @@ struct edge_info {
 	uint32_t irq_line;
 	uint32_t tx_irq_count;
 	uint32_t rx_irq_count;
+	uint32_t tx_irq_coalesced;
+	uint32_t rx_budget_exhausted;
 	struct channel_desc *tx_ch_desc;
 	struct channel_desc *rx_ch_desc;
 	void __iomem *tx_fifo;
@@ -216,6 +238,8 @@ struct edge_info {
 	wait_queue_head_t tx_blocked_queue;
 	bool tx_resume_needed;
 	bool tx_blocked_signal_sent;
+	struct task_struct *tx_batch_owner;
+	uint32_t tx_batch_pending;
 	unsigned int debug_mask;
 	struct kthread_work kwork;
 	struct kthread_worker kworker;
@@ -225,12 +249,15 @@ struct edge_info {
 	spinlock_t rx_lock;
 	struct list_head deferred_cmds;
 	uint32_t deferred_cmds_cnt;
+	bool rx_deferred;
 	spinlock_t rt_vote_lock;
 	uint32_t rt_votes;
 	uint32_t num_pw_states;
 	uint32_t readback;
 	unsigned long *ramp_time_us;
 	struct mailbox_config_info *mailbox;
+	struct edge_info *peer;
+	struct irq_work irq_work;
 	void *log_ctx;
 };
 
@@ -299,12 +326,50 @@ static void send_irq(struct edge_info *einfo)
 	 */
 	einfo->readback = einfo->tx_ch_desc->write_index;
 	wmb();
+	if (einfo->peer) {
+		irq_work_queue(&einfo->peer->irq_work);
+		einfo->tx_irq_count++;
+		return;
+	}
 	writel_relaxed(einfo->out_irq_mask, einfo->out_irq_reg);
 	if (einfo->remote_proc_id != SMEM_SPSS)
 		writel_relaxed(0, einfo->out_irq_reg);
 	einfo->tx_irq_count++;
 }
 
+/**
+ * tx_signal() - signal the remote side that the tx fifo has new data
+ * @einfo:	The concerned edge, with the write_lock held.
+ *
+ * While the core sends a batch of packets, the interrupt for the writes of
+ * the batching task is held back and sent once for the batch from tx_batch(),
+ * or once every TX_BATCH_MAX writes so that the remote side can start
+ * draining a long batch.  Writes of any other context signal at once, which
+ * covers the held back writes as well.
+ */
+static void tx_signal(struct edge_info *einfo)
+{
+	if (einfo->tx_batch_owner == current && !in_interrupt() &&
+	    ++einfo->tx_batch_pending < TX_BATCH_MAX) {
+		einfo->tx_irq_coalesced++;
+		return;
+	}
+	einfo->tx_batch_pending = 0;
+	send_irq(einfo);
+}
+
+/**
+ * tx_signal_flush() - send an interrupt held back by tx_signal()
+ * @einfo:	The concerned edge, with the write_lock held.
+ */
+static void tx_signal_flush(struct edge_info *einfo)
+{
+	if (!einfo->tx_batch_pending)
+		return;
+	einfo->tx_batch_pending = 0;
+	send_irq(einfo);
+}
+
 /**
  * read_from_fifo() - memcpy from fifo memory
  * @dest:	Destination address.
@@ -597,7 +662,7 @@ static int fifo_write(struct edge_info *einfo, const void *data, int len)
 	 */
 	wmb();
 	einfo->tx_ch_desc->write_index = write_index;
-	send_irq(einfo);
+	tx_signal(einfo);
 
 	return orig_len - len;
 }
@@ -644,7 +709,7 @@ static int fifo_write_complex(struct edge_info *einfo,
 	 */
 	wmb();
 	einfo->tx_ch_desc->write_index = write_index;
-	send_irq(einfo);
+	tx_signal(einfo);
 
 	return orig_len - len1 - len2 - len3;
 }
@@ -658,8 +723,10 @@ static int fifo_write_complex(struct edge_info *einfo,
  * cleared some space by reading some data.  This function relies upon the
  * assumption that fifo_write_avail() will reserve some space so that the flush
  * signal command can always be put into the transmit fifo, even when "everyone"
- * else thinks that the transmit fifo is truely full.  This function assumes
- * that it is called with the write_lock already locked.
+ * else thinks that the transmit fifo is truely full.  Any interrupt held back
+ * by tx_signal() is sent as well, as the remote side has to drain the fifo for
+ * us to make progress.  This function assumes that it is called with the
+ * write_lock already locked.
  */
 static void send_tx_blocked_signal(struct edge_info *einfo)
 {
@@ -679,6 +746,7 @@ static void send_tx_blocked_signal(struct edge_info *einfo)
 		einfo->tx_blocked_signal_sent = true;
 		fifo_write(einfo, &read_notif_req, sizeof(read_notif_req));
 	}
+	tx_signal_flush(einfo);
 }
 
 /**
@@ -866,7 +934,10 @@ static bool queue_cmd(struct edge_info *einfo, void *cmd, void *data)
  */
 static bool get_rx_fifo(struct edge_info *einfo)
 {
-	if (einfo->mailbox) {
+	if (einfo->peer) {
+		einfo->rx_fifo = einfo->peer->tx_fifo;
+		einfo->rx_fifo_size = einfo->peer->tx_fifo_size;
+	} else if (einfo->mailbox) {
 		einfo->rx_fifo = &einfo->mailbox->fifo[einfo->mailbox->tx_size];
 		einfo->rx_fifo_size = einfo->mailbox->rx_size;
 	} else {
@@ -951,6 +1022,7 @@ static void __rx_worker(struct edge_info *einfo, bool atomic_ctx)
 	struct deferred_cmd *d_cmd;
 	void *cmd_data;
 	bool ret = false;
+	int budget = RX_BUDGET;
 
 	rcu_id = srcu_read_lock(&einfo->use_ref);
 
@@ -998,6 +1070,26 @@ static void __rx_worker(struct edge_info *einfo, bool atomic_ctx)
 		    einfo->deferred_cmds_cnt >= DEFERRED_CMDS_THRESHOLD)
 			break;
 
+		/*
+		 * Bound the time spent with the rx_lock held: the irq handler
+		 * hands the rest of a busy fifo over to the kworker, which
+		 * gives the cpu away between budgets.
+		 */
+		if (!budget--) {
+			if (atomic_ctx) {
+				einfo->rx_deferred = true;
+				einfo->rx_budget_exhausted++;
+				kthread_queue_work(&einfo->kworker,
+							&einfo->kwork);
+				break;
+			}
+			spin_unlock_irqrestore(&einfo->rx_lock, flags);
+			cond_resched();
+			spin_lock_irqsave(&einfo->rx_lock, flags);
+			budget = RX_BUDGET;
+			continue;
+		}
+
 		if (!atomic_ctx && !list_empty(&einfo->deferred_cmds)) {
 			d_cmd = list_first_entry(&einfo->deferred_cmds,
 						struct deferred_cmd, list_node);
@@ -1286,6 +1378,19 @@ static void rx_worker(struct kthread_work *work)
 
 	einfo = container_of(work, struct edge_info, kwork);
 	__rx_worker(einfo, false);
+
+	/*
+	 * Hand the fifo back to the irq handler.  Data that arrived after the
+	 * fifo was drained had its interrupt skipped, so look once more.
+	 */
+	if (READ_ONCE(einfo->rx_deferred)) {
+		WRITE_ONCE(einfo->rx_deferred, false);
+		smp_mb();
+		if (fifo_read_avail(einfo) && !einfo->in_ssr) {
+			WRITE_ONCE(einfo->rx_deferred, true);
+			kthread_queue_work(&einfo->kworker, &einfo->kwork);
+		}
+	}
 }
 
 irqreturn_t irq_handler(int irq, void *priv)
@@ -1295,7 +1400,10 @@ irqreturn_t irq_handler(int irq, void *priv)
 	if (einfo->rx_reset_reg)
 		writel_relaxed(einfo->out_irq_mask, einfo->rx_reset_reg);
 
-	__rx_worker(einfo, true);
+	if (READ_ONCE(einfo->rx_deferred))
+		tx_wakeup_worker(einfo);
+	else
+		__rx_worker(einfo, true);
 	einfo->rx_irq_count++;
 
 	return IRQ_HANDLED;
@@ -1626,6 +1734,8 @@ static int ssr(struct glink_transport_if *if_ptr)
 
 	einfo->tx_resume_needed = false;
 	einfo->tx_blocked_signal_sent = false;
+	einfo->tx_batch_pending = 0;
+	einfo->rx_deferred = false;
 	einfo->rx_fifo = NULL;
 	einfo->rx_fifo_size = 0;
 	einfo->tx_ch_desc->write_index = 0;
@@ -2260,6 +2370,27 @@ static int rx_rt_unvote(struct glink_transport_if *if_ptr)
 	return ret;
 }
 
+/**
+ * tx_batch() - start or end a batch of packets sent by the core
+ * @if_ptr:	The transport the packets are sent on.
+ * @begin:	True at the start of the batch, false at its end.
+ *
+ * The calling task becomes the batch owner, the remote side is signalled
+ * for its writes once at the end of the batch, see tx_signal().
+ */
+static void tx_batch(struct glink_transport_if *if_ptr, bool begin)
+{
+	struct edge_info *einfo;
+	unsigned long flags;
+
+	einfo = container_of(if_ptr, struct edge_info, xprt_if);
+	spin_lock_irqsave(&einfo->write_lock, flags);
+	einfo->tx_batch_owner = begin ? current : NULL;
+	if (!begin && !einfo->in_ssr)
+		tx_signal_flush(einfo);
+	spin_unlock_irqrestore(&einfo->write_lock, flags);
+}
+
 /**
  * negotiate_features_v1() - determine what features of a version can be used
  * @if_ptr:	The transport for which features are negotiated for.
@@ -2308,6 +2439,7 @@ static void init_xprt_if(struct edge_info *einfo)
 	einfo->xprt_if.power_unvote = power_unvote;
 	einfo->xprt_if.rx_rt_vote = rx_rt_vote;
 	einfo->xprt_if.rx_rt_unvote = rx_rt_unvote;
+	einfo->xprt_if.tx_batch = tx_batch;
 }
 
 /**
@@ -3213,11 +3345,15 @@ ID|EDGE      |TX READ   |TX WRITE  |TX SIZE   |RX READ   |RX WRITE  |RX SIZE
 						einfo->rx_fifo_size);
 
 	seq_puts(s, "\nInterrupt information:\n");
-	seq_printf(s, "%-10s|%-10s|%-10s\n", "EDGE", "TX INT", "RX INT");
-	seq_puts(s, "--------------------------------\n");
-	seq_printf(s, "%-10s|0x%08X|0x%08X\n", einfo->xprt_cfg.edge,
+	seq_printf(s, "%-10s|%-10s|%-10s|%-10s|%-10s\n", "EDGE", "TX INT",
+				"RX INT", "TX COAL", "RX DEFER");
+	seq_puts(s, "------------------------------------------------------\n");
+	seq_printf(s, "%-10s|0x%08X|0x%08X|0x%08X|0x%08X\n",
+						einfo->xprt_cfg.edge,
 						einfo->tx_irq_count,
-						einfo->rx_irq_count);
+						einfo->rx_irq_count,
+						einfo->tx_irq_coalesced,
+						einfo->rx_budget_exhausted);
 }
 
 /**
@@ -3254,6 +3390,163 @@ static void register_debugfs_info(struct edge_info *einfo)
 }
 #endif /* CONFIG_DEBUG_FS */
 
+#ifdef CONFIG_MSM_GLINK_SMEM_LOOPBACK_XPRT
+#define LOOPBACK_EDGE		"loopback"
+#define LOOPBACK_CLIENT_EDGE	"loopback_client"
+
+/**
+ * struct loopback_shm - the "shared memory" of a software loopback pair
+ * @desc:	Channel descriptors, the tx descriptor of one edge is the rx
+ *		descriptor of the other.
+ * @fifo:	The fifos, the tx fifo of one edge is the rx fifo of the other.
+ */
+struct loopback_shm {
+	struct channel_desc desc[2];
+	void *fifo[2];
+};
+
+/**
+ * loopback_irq_work() - deliver an interrupt raised on a software edge
+ * @work:	The irq_work of the edge.
+ */
+static void loopback_irq_work(struct irq_work *work)
+{
+	struct edge_info *einfo = container_of(work, struct edge_info,
+					       irq_work);
+
+	irq_handler(0, einfo);
+}
+
+/**
+ * loopback_edge_init() - set up one edge of a software loopback pair
+ * @einfo:	The edge to set up.
+ * @name:	The edge name.
+ * @shm:	The memory shared with the peer edge.
+ * @side:	Which of the descriptors and fifos of @shm this edge transmits
+ *		on, the peer transmits on the other.
+ * @peer:	The other edge of the pair.
+ *
+ * Return: 0 on success, standard error code otherwise.
+ */
+static int loopback_edge_init(struct edge_info *einfo, const char *name,
+			      struct loopback_shm *shm, int side,
+			      struct edge_info *peer)
+{
+	int rc;
+
+	init_xprt_cfg(einfo, name);
+	init_xprt_if(einfo);
+	spin_lock_init(&einfo->write_lock);
+	init_waitqueue_head(&einfo->tx_blocked_queue);
+	kthread_init_work(&einfo->kwork, rx_worker);
+	kthread_init_worker(&einfo->kworker);
+	init_irq_work(&einfo->irq_work, loopback_irq_work);
+	einfo->read_from_fifo = read_from_fifo;
+	einfo->write_to_fifo = write_to_fifo;
+	init_srcu_struct(&einfo->use_ref);
+	spin_lock_init(&einfo->rx_lock);
+	INIT_LIST_HEAD(&einfo->deferred_cmds);
+	spin_lock_init(&einfo->rt_vote_lock);
+
+	einfo->peer = peer;
+	einfo->tx_ch_desc = &shm->desc[side];
+	einfo->rx_ch_desc = &shm->desc[!side];
+	einfo->tx_fifo = shm->fifo[side];
+	einfo->tx_fifo_size = SZ_16K;
+
+	einfo->task = kthread_run(kthread_worker_fn, &einfo->kworker,
+						"smem_native_%s", name);
+	if (IS_ERR(einfo->task)) {
+		rc = PTR_ERR(einfo->task);
+		pr_err("%s: kthread_run failed %d\n", __func__, rc);
+		return rc;
+	}
+
+	rc = glink_core_register_transport(&einfo->xprt_if, &einfo->xprt_cfg);
+	if (rc) {
+		pr_err("%s: glink core register transport failed: %d\n",
+								__func__, rc);
+		kthread_stop(einfo->task);
+		return rc;
+	}
+	return 0;
+}
+
+/**
+ * loopback_edge_debug_init() - set up logging and debugfs of a software edge
+ * @einfo:	The edge, registered with the core.
+ */
+static void loopback_edge_debug_init(struct edge_info *einfo)
+{
+	char log_name[GLINK_NAME_SIZE*2+7] = {0};
+
+	einfo->debug_mask = QCOM_GLINK_DEBUG_ENABLE;
+	snprintf(log_name, sizeof(log_name), "%s_%s_xprt",
+			einfo->xprt_cfg.edge, einfo->xprt_cfg.name);
+	einfo->log_ctx = ipc_log_context_create(NUM_LOG_PAGES, log_name, 0);
+	if (!einfo->log_ctx)
+		GLINK_ERR("%s: unable to create log context for [%s:%s]\n",
+			__func__, einfo->xprt_cfg.edge,
+			einfo->xprt_cfg.name);
+	register_debugfs_info(einfo);
+}
+
+/**
+ * glink_smem_loopback_init() - create the software loopback edge pair
+ *
+ * The two edges run the complete native transport against each other over
+ * kernel memory, what one writes to its tx fifo the other reads from its rx
+ * fifo, and interrupts are raised with irq_work.  The loopback server
+ * serves the LOOPBACK_EDGE edge, test clients use LOOPBACK_CLIENT_EDGE.
+ *
+ * Return: 0 on success, standard error code otherwise.
+ */
+static int __init glink_smem_loopback_init(void)
+{
+	struct edge_info *einfo;
+	struct loopback_shm *shm;
+	int rc = -ENOMEM;
+
+	einfo = kcalloc(2, sizeof(*einfo), GFP_KERNEL);
+	shm = kzalloc(sizeof(*shm), GFP_KERNEL);
+	if (!einfo || !shm)
+		goto alloc_fail;
+	shm->fifo[0] = kzalloc(SZ_16K, GFP_KERNEL);
+	shm->fifo[1] = kzalloc(SZ_16K, GFP_KERNEL);
+	if (!shm->fifo[0] || !shm->fifo[1])
+		goto alloc_fail;
+
+	rc = loopback_edge_init(&einfo[0], LOOPBACK_EDGE, shm, 0, &einfo[1]);
+	if (rc)
+		goto alloc_fail;
+	rc = loopback_edge_init(&einfo[1], LOOPBACK_CLIENT_EDGE, shm, 1,
+				&einfo[0]);
+	if (rc) {
+		glink_core_unregister_transport(&einfo[0].xprt_if);
+		kthread_stop(einfo[0].task);
+		goto alloc_fail;
+	}
+
+	loopback_edge_debug_init(&einfo[0]);
+	loopback_edge_debug_init(&einfo[1]);
+
+	/* fake an interrupt on both edges to bring the links up */
+	irq_handler(0, &einfo[0]);
+	irq_handler(0, &einfo[1]);
+	return 0;
+
+alloc_fail:
+	if (shm) {
+		kfree(shm->fifo[0]);
+		kfree(shm->fifo[1]);
+	}
+	kfree(shm);
+	kfree(einfo);
+	return rc;
+}
+late_initcall(glink_smem_loopback_init);
+#endif /* CONFIG_MSM_GLINK_SMEM_LOOPBACK_XPRT */
+
 static const struct of_device_id smem_match_table[] = {
 	{ .compatible = "qcom,glink-smem-native-xprt" },
 	{},
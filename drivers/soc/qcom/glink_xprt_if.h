@@ -144,6 +144,8 @@ struct glink_transport_if {
 	int (*power_unvote)(struct glink_transport_if *if_ptr);
 	int (*rx_rt_vote)(struct glink_transport_if *if_ptr);
 	int (*rx_rt_unvote)(struct glink_transport_if *if_ptr);
+	/* Optional */
+	void (*tx_batch)(struct glink_transport_if *if_ptr, bool begin);
 	/*
 	 * Keep data pointers at the end of the structure after all function
 	 * pointer to allow for in-place initialization.
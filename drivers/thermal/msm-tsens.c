@@ -33,6 +33,24 @@ static int tsens_get_temp(void *data, int *temp)
 	return tmdev->ops->get_temp(s, temp);
 }
 
+static int tsens_get_temps(void **data, int *temps, int count)
+{
+	struct tsens_sensor *s = data[0];
+	struct tsens_device *tmdev = s->tmdev;
+	int i, rc;
+
+	if (tmdev->ops->get_temps)
+		return tmdev->ops->get_temps(tmdev, data, temps, count);
+
+	for (i = 0; i < count; i++) {
+		rc = tmdev->ops->get_temp(data[i], &temps[i]);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
 static int tsens_set_trip_temp(void *data, int low_temp, int high_temp)
 {
 	struct tsens_sensor *s = data;
@@ -99,6 +117,7 @@ MODULE_DEVICE_TABLE(of, tsens_table);
 
 static struct thermal_zone_of_device_ops tsens_tm_thermal_zone_ops = {
 	.get_temp = tsens_get_temp,
+	.get_temps = tsens_get_temps,
 	.set_trips = tsens_set_trip_temp,
 };
 
@@ -59,6 +59,7 @@ struct __thermal_bind_params {
 /**
  * struct __sensor_param - Holds individual sensor data
  * @sensor_data: sensor driver private data passed as input argument
+ * @dev: sensor device, zones reading the same one are polled together
  * @ops: sensor driver ops
  * @trip_high: last trip high value programmed in the sensor driver
  * @trip_low: last trip low value programmed in the sensor driver
@@ -67,6 +68,7 @@ struct __thermal_bind_params {
  */
 struct __sensor_param {
 	void *sensor_data;
+	struct device *dev;
 	const struct thermal_zone_of_device_ops *ops;
 	int trip_high, trip_low;
 	struct mutex lock;
@@ -207,6 +209,55 @@ static int of_thermal_get_temp(struct thermal_zone_device *tz,
 	return data->senps->ops->get_temp(data->senps->sensor_data, temp);
 }
 
+static struct device *of_thermal_get_sensor_dev(struct thermal_zone_device *tz)
+{
+	struct __thermal_zone *data = tz->devdata;
+
+	return data->senps ? data->senps->dev : NULL;
+}
+
+static int of_thermal_get_temps(struct thermal_zone_device **tzs, int *temps,
+				int count)
+{
+	struct __thermal_zone *data = tzs[0]->devdata;
+	const struct thermal_zone_of_device_ops *ops;
+	void **sensors;
+	int i, ret = -EINVAL;
+
+	if (!data->senps || !data->senps->ops->get_temps)
+		return -EINVAL;
+
+	ops = data->senps->ops;
+
+	sensors = kcalloc(count, sizeof(*sensors), GFP_KERNEL);
+	if (!sensors)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		data = tzs[i]->devdata;
+		if (tzs[i]->ops->get_temps != of_thermal_get_temps ||
+		    !data->senps || data->senps->ops != ops)
+			goto out;
+		sensors[i] = data->senps->sensor_data;
+	}
+
+	ret = ops->get_temps(sensors, temps, count);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < count; i++) {
+		data = tzs[i]->devdata;
+		if (data->mode == THERMAL_DEVICE_DISABLED)
+			temps[i] = tzs[i]->tzp->tracks_low ?
+					THERMAL_TEMP_INVALID_LOW :
+					THERMAL_TEMP_INVALID;
+	}
+
+out:
+	kfree(sensors);
+	return ret;
+}
+
 static int of_thermal_set_trips(struct thermal_zone_device *tz,
 				int inp_low, int inp_high)
 {
@@ -731,6 +782,12 @@ thermal_zone_of_add_sensor(struct device_node *zone,
 	if (sens_param->ops->set_emul_temp)
 		tzd->ops->set_emul_temp = of_thermal_set_emul_temp;
 
+	if (sens_param->dev) {
+		tzd->ops->get_sensor_dev = of_thermal_get_sensor_dev;
+		if (sens_param->ops->get_temps)
+			tzd->ops->get_temps = of_thermal_get_temps;
+	}
+
 	list_add_tail(&tz->list, &sens_param->first_tz);
 	mutex_unlock(&tzd->lock);
 
@@ -792,6 +849,7 @@ thermal_zone_of_sensor_register(struct device *dev, int sensor_id, void *data,
 		return ERR_PTR(-ENOMEM);
 	}
 	sens_param->sensor_data = data;
+	sens_param->dev = dev;
 	sens_param->ops = ops;
 	INIT_LIST_HEAD(&sens_param->first_tz);
 	sens_param->trip_high = INT_MAX;
@@ -876,7 +934,24 @@ void thermal_zone_of_sensor_unregister(struct device *dev,
 	if (!tz)
 		return;
 
+	/*
+	 * Stop the batched polling of the zones before the sensor data
+	 * goes away.
+	 */
 	head = &tz->senps->first_tz;
+	list_for_each_entry(tz, head, list) {
+		pos = tz->tzd;
+		/* no rejoining a group once it is left */
+		mutex_lock(&pos->lock);
+		pos->ops->get_sensor_dev = NULL;
+		mutex_unlock(&pos->lock);
+		/* the group work calls get_temps under thermal_poll_lock */
+		thermal_poll_group_leave(pos);
+		mutex_lock(&pos->lock);
+		pos->ops->get_temps = NULL;
+		mutex_unlock(&pos->lock);
+	}
+
 	list_for_each_entry_safe(tz, next, head, list) {
 		pos = tz->tzd;
 		mutex_lock(&pos->lock);
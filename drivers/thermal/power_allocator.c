@@ -30,6 +30,20 @@
 #define int_to_frac(x) ((x) << FRAC_BITS)
 #define frac_to_int(x) ((x) >> FRAC_BITS)
 
+/*
+ * Thermal model of the predictive allocator. Coefficients are fixed-point
+ * numbers with MODEL_FRAC_BITS of fraction, the bias feature is MODEL_BIAS
+ * millicelsius, the learning rate is 1 / (1 << MODEL_MU_SHIFT), the model
+ * is used once it has seen MODEL_WARMUP periods and it looks MODEL_HORIZON
+ * periods ahead.
+ */
+#define MODEL_FRAC_BITS 16
+#define MODEL_ONE (1LL << MODEL_FRAC_BITS)
+#define MODEL_BIAS 1000
+#define MODEL_MU_SHIFT 2
+#define MODEL_WARMUP 20
+#define MODEL_HORIZON 10
+
 /**
  * mul_frac() - multiply two fixed-point numbers
  * @x:	first multiplicand
@@ -56,6 +70,17 @@ static inline s64 div_frac(s64 x, s64 y)
 	return div_s64(x << FRAC_BITS, y);
 }
 
+/**
+ * struct thermal_model - online first order RC model of a thermal zone
+ * @w:		fitted coefficients for the power, the temperature relative
+ *		to the control temperature and the bias
+ * @samples:	number of periods the model has been fitted on
+ */
+struct thermal_model {
+	s64 w[3];
+	unsigned int samples;
+};
+
 /**
  * struct power_allocator_params - parameters for the power allocator governor
  * @allocated_tzp:	whether we have allocated tzp for this thermal zone and
@@ -70,6 +95,13 @@ static inline s64 div_frac(s64 x, s64 y)
  * @trip_max_desired_temperature:	last passive trip point of the thermal
  *					zone.  The temperature we are
  *					controlling for.
+ * @predictive:	whether the power budget comes from the thermal model
+ *		instead of the PID controller
+ * @model:	online thermal model of the zone
+ * @have_sample:	whether @last_temp and @last_power hold the previous
+ *			period
+ * @last_temp:	temperature at the start of the previous period
+ * @last_power:	power the actors could use in the previous period
  */
 struct power_allocator_params {
 	bool allocated_tzp;
@@ -77,6 +109,11 @@ struct power_allocator_params {
 	s32 prev_err;
 	int trip_switch_on;
 	int trip_max_desired_temperature;
+	bool predictive;
+	struct thermal_model model;
+	bool have_sample;
+	int last_temp;
+	u32 last_power;
 };
 
 /**
@@ -258,6 +295,132 @@ static u32 pid_controller(struct thermal_zone_device *tz,
 	return power_range;
 }
 
+/**
+ * model_update() - fit the thermal model on the last period
+ * @params:	governor data of the thermal zone
+ * @temp:	current temperature of the thermal zone
+ * @control_temp:	the target temperature in millicelsius
+ *
+ * The zone is modelled as a discrete first order RC circuit:
+ *
+ *	T[k+1] - T[k] = a * P[k] - b * (T[k] - Tc) + c
+ *
+ * where a = period / C, b = period / (R * C) and c accounts for the
+ * ambient temperature.  The coefficients are fitted by normalized least
+ * mean squares, so the model keeps following changes in the cooling
+ * conditions of the device (in hand, in a pocket, on a charger).
+ */
+static void model_update(struct power_allocator_params *params, int temp,
+			 int control_temp)
+{
+	struct thermal_model *m = &params->model;
+	s64 x[3], err, norm = 0;
+	int i;
+
+	if (!params->have_sample)
+		return;
+
+	x[0] = params->last_power;
+	x[1] = params->last_temp - control_temp;
+	x[2] = MODEL_BIAS;
+
+	err = temp - params->last_temp;
+	for (i = 0; i < ARRAY_SIZE(x); i++) {
+		err -= div_s64(m->w[i] * x[i], MODEL_ONE);
+		norm += x[i] * x[i];
+	}
+
+	for (i = 0; i < ARRAY_SIZE(x); i++)
+		m->w[i] += div64_s64(err * x[i] * MODEL_ONE, norm) >>
+			   MODEL_MU_SHIFT;
+
+	if (m->samples < UINT_MAX)
+		m->samples++;
+}
+
+/**
+ * model_power_budget() - power budget from the thermal model
+ * @tz:	thermal zone we are operating in
+ * @control_temp:	the target temperature in millicelsius
+ * @budget:	output: the power budget in mW, which may be negative
+ *
+ * Holding the power P constant over the horizon of H periods, the model
+ * predicts
+ *
+ *	T[H] - Tc = g * (T[0] - Tc) + (a * P + c) * s
+ *
+ * with r = 1 - b, g = r^H and s = 1 + r + ... + r^(H-1).  The budget is
+ * the highest P for which the predicted temperature at the horizon stays
+ * at or below @control_temp.
+ *
+ * Return: 0 on success, -EAGAIN if the model isn't trained or physically
+ * plausible yet.
+ */
+static int model_power_budget(struct thermal_zone_device *tz,
+			      int control_temp, s64 *budget)
+{
+	struct power_allocator_params *params = tz->governor_data;
+	struct thermal_model *m = &params->model;
+	s64 a = m->w[0], r = MODEL_ONE + m->w[1];
+	s64 c = div_s64(m->w[2] * MODEL_BIAS, MODEL_ONE);
+	s64 g = MODEL_ONE, sum = 0, num, den;
+	int i;
+
+	if (m->samples < MODEL_WARMUP || a <= 0 || r <= 0 || r > MODEL_ONE)
+		return -EAGAIN;
+
+	for (i = 0; i < MODEL_HORIZON; i++) {
+		sum += g;
+		g = div_s64(g * r, MODEL_ONE);
+	}
+
+	num = -g * (tz->temperature - control_temp) - c * sum;
+	den = div_s64(a * sum, MODEL_ONE);
+	if (den <= 0)
+		return -EAGAIN;
+
+	*budget = div64_s64(num, den);
+	return 0;
+}
+
+/**
+ * model_controller() - model predictive controller
+ * @tz:	thermal zone we are operating in
+ * @control_temp:	the target temperature in millicelsius
+ * @max_allocatable_power:	maximum allocatable power for this thermal zone
+ *
+ * Fit the thermal model on the last period and allocate the power that
+ * keeps the predicted temperature under @control_temp at the horizon.
+ * Unlike the PID controller this reacts to the heating trend before the
+ * temperature overshoots, instead of throttling hard afterwards.  The PID
+ * controller is used until the model is usable.
+ *
+ * Return: The power budget for the next period.
+ */
+static u32 model_controller(struct thermal_zone_device *tz,
+			    int control_temp,
+			    u32 max_allocatable_power)
+{
+	struct power_allocator_params *params = tz->governor_data;
+	struct thermal_model *m = &params->model;
+	s64 budget = 0;
+	bool fallback;
+
+	model_update(params, tz->temperature, control_temp);
+
+	fallback = model_power_budget(tz, control_temp, &budget) < 0;
+	if (!fallback)
+		budget = clamp(budget, (s64)0, (s64)max_allocatable_power);
+	else
+		budget = pid_controller(tz, control_temp,
+					max_allocatable_power);
+
+	trace_thermal_power_allocator_model(tz, m->w[0], -m->w[1], m->w[2],
+					    m->samples, budget, fallback);
+
+	return budget;
+}
+
 /**
  * divvy_up_power() - divvy the allocated power between the actors
  * @req_power:	each actor's requested power
@@ -415,13 +578,19 @@ static int allocate_power(struct thermal_zone_device *tz,
 		i++;
 	}
 
-	power_range = pid_controller(tz, control_temp, max_allocatable_power);
+	if (params->predictive)
+		power_range = model_controller(tz, control_temp,
+					       max_allocatable_power);
+	else
+		power_range = pid_controller(tz, control_temp,
+					     max_allocatable_power);
 
 	divvy_up_power(weighted_req_power, max_power, num_actors,
 		       total_weighted_req_power, power_range, granted_power,
 		       extra_actor_power);
 
 	total_granted_power = 0;
+	params->last_power = 0;
 	i = 0;
 	list_for_each_entry(instance, &tz->thermal_instances, tz_node) {
 		if (instance->trip != trip_max_desired_temperature)
@@ -433,10 +602,14 @@ static int allocate_power(struct thermal_zone_device *tz,
 		power_actor_set_power(instance->cdev, instance,
 				      granted_power[i]);
 		total_granted_power += granted_power[i];
+		params->last_power += min(req_power[i], granted_power[i]);
 
 		i++;
 	}
 
+	params->last_temp = tz->temperature;
+	params->have_sample = true;
+
 	trace_thermal_power_allocator(tz, req_power, total_req_power,
 				      granted_power, total_granted_power,
 				      num_actors, power_range,
@@ -539,15 +712,18 @@ static void allow_maximum_power(struct thermal_zone_device *tz)
 }
 
 /**
- * power_allocator_bind() - bind the power_allocator governor to a thermal zone
+ * __power_allocator_bind() - bind the power allocator to a thermal zone
  * @tz:	thermal zone to bind it to
+ * @predictive:	whether to use the thermal model instead of the PID
+ *		controller
  *
  * Initialize the PID controller parameters and bind it to the thermal
  * zone.
  *
  * Return: 0 on success, or -ENOMEM if we ran out of memory.
  */
-static int power_allocator_bind(struct thermal_zone_device *tz)
+static int __power_allocator_bind(struct thermal_zone_device *tz,
+				  bool predictive)
 {
 	int ret;
 	struct power_allocator_params *params;
@@ -583,6 +759,7 @@ static int power_allocator_bind(struct thermal_zone_device *tz)
 	}
 
 	reset_pid_controller(params);
+	params->predictive = predictive;
 
 	tz->governor_data = params;
 
@@ -594,6 +771,16 @@ static int power_allocator_bind(struct thermal_zone_device *tz)
 	return ret;
 }
 
+static int power_allocator_bind(struct thermal_zone_device *tz)
+{
+	return __power_allocator_bind(tz, false);
+}
+
+static int power_predictive_bind(struct thermal_zone_device *tz)
+{
+	return __power_allocator_bind(tz, true);
+}
+
 static void power_allocator_unbind(struct thermal_zone_device *tz)
 {
 	struct power_allocator_params *params = tz->governor_data;
@@ -627,6 +814,7 @@ static int power_allocator_throttle(struct thermal_zone_device *tz, int trip)
 	if (!ret && (tz->temperature < switch_on_temp)) {
 		tz->passive = 0;
 		reset_pid_controller(params);
+		params->have_sample = false;
 		allow_maximum_power(tz);
 		return 0;
 	}
@@ -652,12 +840,30 @@ static struct thermal_governor thermal_gov_power_allocator = {
 	.throttle	= power_allocator_throttle,
 };
 
+static struct thermal_governor thermal_gov_power_predictive = {
+	.name		= "power_predictive",
+	.bind_to_tz	= power_predictive_bind,
+	.unbind_from_tz	= power_allocator_unbind,
+	.throttle	= power_allocator_throttle,
+};
+
 int thermal_gov_power_allocator_register(void)
 {
-	return thermal_register_governor(&thermal_gov_power_allocator);
+	int ret;
+
+	ret = thermal_register_governor(&thermal_gov_power_allocator);
+	if (ret)
+		return ret;
+
+	ret = thermal_register_governor(&thermal_gov_power_predictive);
+	if (ret)
+		thermal_unregister_governor(&thermal_gov_power_allocator);
+
+	return ret;
 }
 
 void thermal_gov_power_allocator_unregister(void)
 {
+	thermal_unregister_governor(&thermal_gov_power_predictive);
 	thermal_unregister_governor(&thermal_gov_power_allocator);
 }
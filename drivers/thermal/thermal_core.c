@@ -38,6 +38,8 @@
 #include <net/netlink.h>
 #include <net/genetlink.h>
 #include <linux/suspend.h>
+#include <linux/seqlock.h>
+#include <linux/ktime.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/thermal.h>
@@ -68,6 +70,33 @@ static struct thermal_governor *def_governor;
 
 static struct workqueue_struct *thermal_passive_wq;
 
+#define THERMAL_TEMP_CACHE_NS	(CONFIG_THERMAL_TEMP_CACHE_MS * NSEC_PER_MSEC)
+
+/**
+ * struct thermal_poll_group - thermal zones polled together
+ * @node:	node in thermal_poll_groups
+ * @dev:	sensor device the zones read their temperature from
+ * @delay:	polling interval of the zones in milliseconds
+ * @nr_zones:	number of zones in @zones
+ * @zones:	zones of the group
+ * @poll_work:	delayed work reading all the zones of the group
+ *
+ * Zones reading the channels of the same sensor device at the same
+ * interval share one wakeup, and their temperatures are read in a single
+ * batch when the sensor driver supports it.
+ */
+struct thermal_poll_group {
+	struct list_head node;
+	struct device *dev;
+	int delay;
+	int nr_zones;
+	struct list_head zones;
+	struct delayed_work poll_work;
+};
+
+static LIST_HEAD(thermal_poll_groups);
+static DEFINE_MUTEX(thermal_poll_lock);
+
 static struct thermal_governor *__find_governor(const char *name)
 {
 	struct thermal_governor *pos;
@@ -396,10 +425,181 @@ static void bind_tz(struct thermal_zone_device *tz)
 	mutex_unlock(&thermal_list_lock);
 }
 
+static void thermal_zone_publish_temp(struct thermal_zone_device *tz, int temp)
+{
+	write_seqlock(&tz->cache_lock);
+	tz->cache_temp = temp;
+	tz->cache_stamp = ktime_get_ns();
+	write_sequnlock(&tz->cache_lock);
+}
+
+static bool thermal_zone_cached_temp(struct thermal_zone_device *tz, int *temp,
+				     u64 max_age)
+{
+	unsigned int seq;
+	u64 stamp;
+	int val;
+
+	do {
+		seq = read_seqbegin(&tz->cache_lock);
+		val = tz->cache_temp;
+		stamp = tz->cache_stamp;
+	} while (read_seqretry(&tz->cache_lock, seq));
+
+	if (!stamp || ktime_get_ns() - stamp >= max_age)
+		return false;
+
+	*temp = val;
+	return true;
+}
+
+static unsigned long thermal_poll_jiffies(int delay)
+{
+	if (delay > 1000)
+		return round_jiffies(msecs_to_jiffies(delay));
+
+	return msecs_to_jiffies(delay);
+}
+
+static void thermal_poll_group_work(struct work_struct *work)
+{
+	struct thermal_poll_group *group = container_of(work,
+						struct thermal_poll_group,
+						poll_work.work);
+	struct thermal_zone_device *tz, **tzs = NULL;
+	int *temps = NULL;
+	bool batched = false;
+	int i = 0;
+
+	mutex_lock(&thermal_poll_lock);
+
+	if (!group->nr_zones)
+		goto unlock;
+
+	tz = list_first_entry(&group->zones, struct thermal_zone_device,
+			      poll_node);
+	if (group->nr_zones > 1 && tz->ops->get_temps) {
+		tzs = kcalloc(group->nr_zones, sizeof(*tzs), GFP_KERNEL);
+		temps = kcalloc(group->nr_zones, sizeof(*temps), GFP_KERNEL);
+	}
+
+	if (tzs && temps) {
+		list_for_each_entry(tz, &group->zones, poll_node)
+			tzs[i++] = tz;
+
+		batched = !tzs[0]->ops->get_temps(tzs, temps, i);
+		while (batched && i--)
+			thermal_zone_publish_temp(tzs[i], temps[i]);
+	}
+
+	/*
+	 * The zones pick the fresh readings up from their temperature
+	 * cache, so they don't touch the sensor again.
+	 */
+	list_for_each_entry(tz, &group->zones, poll_node)
+		mod_delayed_work(system_freezable_power_efficient_wq,
+				 &tz->poll_queue, 0);
+
+	trace_thermal_poll_group(group->dev, group->delay, group->nr_zones,
+				 batched);
+
+	mod_delayed_work(system_freezable_power_efficient_wq,
+			 &group->poll_work, thermal_poll_jiffies(group->delay));
+unlock:
+	mutex_unlock(&thermal_poll_lock);
+
+	kfree(tzs);
+	kfree(temps);
+}
+
+void thermal_poll_group_leave(struct thermal_zone_device *tz)
+{
+	struct thermal_poll_group *group;
+
+	mutex_lock(&thermal_poll_lock);
+
+	group = tz->poll_group;
+	if (!group) {
+		mutex_unlock(&thermal_poll_lock);
+		return;
+	}
+
+	list_del_init(&tz->poll_node);
+	tz->poll_group = NULL;
+
+	/* The last zone out tears the group down */
+	if (--group->nr_zones)
+		group = NULL;
+	else
+		list_del(&group->node);
+
+	mutex_unlock(&thermal_poll_lock);
+
+	if (group) {
+		cancel_delayed_work_sync(&group->poll_work);
+		kfree(group);
+	}
+}
+
+static int thermal_poll_group_join(struct thermal_zone_device *tz,
+				   struct device *dev, int delay)
+{
+	struct thermal_poll_group *group;
+
+	mutex_lock(&thermal_poll_lock);
+	group = tz->poll_group;
+	mutex_unlock(&thermal_poll_lock);
+
+	if (group && group->dev == dev && group->delay == delay)
+		return 0;
+
+	thermal_poll_group_leave(tz);
+
+	mutex_lock(&thermal_poll_lock);
+
+	list_for_each_entry(group, &thermal_poll_groups, node)
+		if (group->dev == dev && group->delay == delay)
+			goto found;
+
+	group = kzalloc(sizeof(*group), GFP_KERNEL);
+	if (!group) {
+		mutex_unlock(&thermal_poll_lock);
+		return -ENOMEM;
+	}
+
+	group->dev = dev;
+	group->delay = delay;
+	INIT_LIST_HEAD(&group->zones);
+	INIT_DEFERRABLE_WORK(&group->poll_work, thermal_poll_group_work);
+	list_add_tail(&group->node, &thermal_poll_groups);
+	mod_delayed_work(system_freezable_power_efficient_wq,
+			 &group->poll_work, thermal_poll_jiffies(delay));
+found:
+	list_add_tail(&tz->poll_node, &group->zones);
+	group->nr_zones++;
+	tz->poll_group = group;
+
+	mutex_unlock(&thermal_poll_lock);
+
+	return 0;
+}
+
 static void thermal_zone_device_set_polling(struct workqueue_struct *queue,
 					    struct thermal_zone_device *tz,
 					    int delay)
 {
+	struct device *dev = NULL;
+
+	if (delay && tz->ops->get_sensor_dev)
+		dev = tz->ops->get_sensor_dev(tz);
+
+	if (dev && !thermal_poll_group_join(tz, dev, delay)) {
+		cancel_delayed_work(&tz->poll_queue);
+		return;
+	}
+
+	thermal_poll_group_leave(tz);
+
 	if (delay > 1000)
 		mod_delayed_work(system_freezable_power_efficient_wq,
 				 &tz->poll_queue,
@@ -482,17 +682,8 @@ static void handle_thermal_trip(struct thermal_zone_device *tz, int trip)
 	trace_thermal_handle_trip(tz, trip);
 }
 
-/**
- * thermal_zone_get_temp() - returns the temperature of a thermal zone
- * @tz: a valid pointer to a struct thermal_zone_device
- * @temp: a valid pointer to where to store the resulting temperature.
- *
- * When a valid thermal zone reference is passed, it will fetch its
- * temperature and fill @temp.
- *
- * Return: On success returns 0, an error code otherwise
- */
-int thermal_zone_get_temp(struct thermal_zone_device *tz, int *temp)
+static int __thermal_zone_get_temp(struct thermal_zone_device *tz, int *temp,
+				   u64 max_age)
 {
 	int ret = -EINVAL;
 	int count;
@@ -502,9 +693,22 @@ int thermal_zone_get_temp(struct thermal_zone_device *tz, int *temp)
 	if (!tz || IS_ERR(tz) || !tz->ops->get_temp)
 		goto exit;
 
+	/* Serve a recent reading without taking the zone lock */
+	if (!READ_ONCE(tz->emul_temperature) &&
+	    thermal_zone_cached_temp(tz, temp, max_age)) {
+		trace_thermal_query_temp(tz, *temp);
+		return 0;
+	}
+
 	mutex_lock(&tz->lock);
 
-	ret = tz->ops->get_temp(tz, temp);
+	if (!thermal_zone_cached_temp(tz, temp, max_age)) {
+		ret = tz->ops->get_temp(tz, temp);
+		if (!ret)
+			thermal_zone_publish_temp(tz, *temp);
+	} else {
+		ret = 0;
+	}
 
 	if (IS_ENABLED(CONFIG_THERMAL_EMULATION) && tz->emul_temperature) {
 		for (count = 0; count < tz->trips; count++) {
@@ -529,6 +733,22 @@ int thermal_zone_get_temp(struct thermal_zone_device *tz, int *temp)
 exit:
 	return ret;
 }
+
+/**
+ * thermal_zone_get_temp() - returns the temperature of a thermal zone
+ * @tz: a valid pointer to a struct thermal_zone_device
+ * @temp: a valid pointer to where to store the resulting temperature.
+ *
+ * When a valid thermal zone reference is passed, it will fetch its
+ * temperature and fill @temp. A reading younger than
+ * CONFIG_THERMAL_TEMP_CACHE_MS is returned without touching the sensor.
+ *
+ * Return: On success returns 0, an error code otherwise
+ */
+int thermal_zone_get_temp(struct thermal_zone_device *tz, int *temp)
+{
+	return __thermal_zone_get_temp(tz, temp, THERMAL_TEMP_CACHE_NS);
+}
 EXPORT_SYMBOL_GPL(thermal_zone_get_temp);
 
 void thermal_zone_set_trips(struct thermal_zone_device *tz)
@@ -595,11 +815,11 @@ static void store_temperature(struct thermal_zone_device *tz, int temp)
 			tz->last_temperature, tz->temperature);
 }
 
-static void update_temperature(struct thermal_zone_device *tz)
+static void update_temperature(struct thermal_zone_device *tz, u64 max_age)
 {
 	int temp, ret;
 
-	ret = thermal_zone_get_temp(tz, &temp);
+	ret = __thermal_zone_get_temp(tz, &temp, max_age);
 	if (ret) {
 		if (ret != -EAGAIN)
 			dev_dbg(&tz->device,
@@ -647,8 +867,9 @@ void thermal_zone_device_update_temp(struct thermal_zone_device *tz,
 }
 EXPORT_SYMBOL(thermal_zone_device_update_temp);
 
-void thermal_zone_device_update(struct thermal_zone_device *tz,
-				enum thermal_notify_event event)
+static void __thermal_zone_device_update(struct thermal_zone_device *tz,
+					 enum thermal_notify_event event,
+					 u64 max_age)
 {
 	int count;
 
@@ -660,7 +881,7 @@ void thermal_zone_device_update(struct thermal_zone_device *tz,
 		return;
 
 	trace_thermal_device_update(tz, event);
-	update_temperature(tz);
+	update_temperature(tz, max_age);
 
 	thermal_zone_set_trips(tz);
 
@@ -669,6 +890,16 @@ void thermal_zone_device_update(struct thermal_zone_device *tz,
 	for (count = 0; count < tz->trips; count++)
 		handle_thermal_trip(tz, count);
 }
+
+/*
+ * Updates from sensor interrupts and the sysfs knobs always read the
+ * sensor, the cached reading only serves the polling work.
+ */
+void thermal_zone_device_update(struct thermal_zone_device *tz,
+				enum thermal_notify_event event)
+{
+	__thermal_zone_device_update(tz, event, 0);
+}
 EXPORT_SYMBOL_GPL(thermal_zone_device_update);
 
 static void thermal_zone_device_check(struct work_struct *work)
@@ -676,7 +907,14 @@ static void thermal_zone_device_check(struct work_struct *work)
 	struct thermal_zone_device *tz = container_of(work, struct
 						      thermal_zone_device,
 						      poll_queue.work);
-	thermal_zone_device_update(tz, THERMAL_EVENT_UNSPECIFIED);
+	int delay = tz->passive ? tz->passive_delay : tz->polling_delay;
+
+	/*
+	 * Only use a reading taken within this polling period, which is
+	 * the batch read of the zone's poll group.
+	 */
+	__thermal_zone_device_update(tz, THERMAL_EVENT_UNSPECIFIED,
+				     (u64)delay * NSEC_PER_MSEC / 2);
 }
 
 /* sys I/F for thermal zone */
@@ -2193,6 +2431,7 @@ struct thermal_zone_device *thermal_zone_device_register(const char *type,
 	INIT_LIST_HEAD(&tz->thermal_instances);
 	idr_init(&tz->idr);
 	mutex_init(&tz->lock);
+	seqlock_init(&tz->cache_lock);
 	result = get_idr(&thermal_tz_idr, &thermal_idr_lock, &tz->id);
 	if (result) {
 		kfree(tz);
@@ -2315,6 +2554,7 @@ struct thermal_zone_device *thermal_zone_device_register(const char *type,
 	bind_tz(tz);
 
 	INIT_DEFERRABLE_WORK(&(tz->poll_queue), thermal_zone_device_check);
+	INIT_LIST_HEAD(&tz->poll_node);
 
 	thermal_zone_device_reset(tz);
 	/* Update the new thermal zone and mark it as already updated. */
@@ -2377,6 +2617,7 @@ void thermal_zone_device_unregister(struct thermal_zone_device *tz)
 
 	mutex_unlock(&thermal_list_lock);
 
+	thermal_poll_group_leave(tz);
 	cancel_delayed_work_sync(&tz->poll_queue);
 
 	if (tz->type[0])
@@ -78,27 +78,29 @@ static void msm_tsens_convert_temp(int last_temp, int *temp)
 	*temp = last_temp * TSENS_TM_SCALE_DECI_MILLIDEG;
 }
 
-static int tsens2xxx_get_temp(struct tsens_sensor *sensor, int *temp)
+static int tsens2xxx_ready(struct tsens_device *tmdev)
 {
-	struct tsens_device *tmdev = NULL;
 	unsigned int code;
-	void __iomem *sensor_addr, *trdy;
-	int last_temp = 0, last_temp2 = 0, last_temp3 = 0;
 
-	if (!sensor)
-		return -EINVAL;
-
-	tmdev = sensor->tmdev;
-	sensor_addr = TSENS_TM_SN_STATUS(tmdev->tsens_tm_addr);
-	trdy = TSENS_TM_TRDY(tmdev->tsens_tm_addr);
-
-	code = readl_relaxed_no_log(trdy);
+	code = readl_relaxed_no_log(TSENS_TM_TRDY(tmdev->tsens_tm_addr));
 	if (!((code & TSENS_TM_TRDY_FIRST_ROUND_COMPLETE) >>
 			TSENS_TM_TRDY_FIRST_ROUND_COMPLETE_SHIFT)) {
 		pr_err("TSENS device first round not complete0x%x\n", code);
 		return -ENODATA;
 	}
 
+	return 0;
+}
+
+static int __tsens2xxx_get_temp(struct tsens_sensor *sensor, int *temp)
+{
+	struct tsens_device *tmdev = sensor->tmdev;
+	unsigned int code;
+	void __iomem *sensor_addr;
+	int last_temp = 0, last_temp2 = 0, last_temp3 = 0;
+
+	sensor_addr = TSENS_TM_SN_STATUS(tmdev->tsens_tm_addr);
+
 	code = readl_relaxed_no_log(sensor_addr +
 			(sensor->hw_id << TSENS_STATUS_ADDR_OFFSET));
 	last_temp = code & TSENS_TM_SN_LAST_TEMP_MASK;
@@ -142,6 +144,39 @@ static int tsens2xxx_get_temp(struct tsens_sensor *sensor, int *temp)
 	return 0;
 }
 
+static int tsens2xxx_get_temp(struct tsens_sensor *sensor, int *temp)
+{
+	int rc;
+
+	if (!sensor)
+		return -EINVAL;
+
+	rc = tsens2xxx_ready(sensor->tmdev);
+	if (rc)
+		return rc;
+
+	return __tsens2xxx_get_temp(sensor, temp);
+}
+
+/* Read several channels with a single round completion check */
+static int tsens2xxx_get_temps(struct tsens_device *tmdev, void **sensors,
+			       int *temps, int count)
+{
+	int i, rc;
+
+	rc = tsens2xxx_ready(tmdev);
+	if (rc)
+		return rc;
+
+	for (i = 0; i < count; i++) {
+		rc = __tsens2xxx_get_temp(sensors[i], &temps[i]);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
 static int tsens_tm_activate_trip_type(struct tsens_sensor *tm_sensor,
 			int trip, enum thermal_trip_activation_mode mode)
 {
@@ -639,6 +674,7 @@ static int tsens2xxx_register_interrupts(struct tsens_device *tmdev)
 static const struct tsens_ops ops_tsens2xxx = {
 	.hw_init	= tsens2xxx_hw_init,
 	.get_temp	= tsens2xxx_get_temp,
+	.get_temps	= tsens2xxx_get_temps,
 	.set_trips	= tsens2xxx_set_trip_temp,
 	.interrupts_reg	= tsens2xxx_register_interrupts,
 	.dbg		= tsens2xxx_dbg,
@@ -24,6 +24,7 @@
 #include <linux/hid.h>
 #include <linux/module.h>
 #include <linux/uio.h>
+#include <linux/scatterlist.h>
 #include <linux/ipc_logging.h>
 #include <linux/freezer.h>
 #include <asm/unaligned.h>
@@ -225,6 +226,9 @@ struct ffs_epfile {
 	struct ffs_buffer		*read_buffer;
 #define READ_BUFFER_DROP ((struct ffs_buffer *)ERR_PTR(-ESHUTDOWN))
 
+	/* Requests kept queued by FUNCTIONFS_PREQUEUE_READS, P: mutex */
+	struct ffs_prequeue		*prequeue;
+
 	char				name[5];
 
 	unsigned char			in;	/* P: ffs->eps_lock */
@@ -240,6 +244,26 @@ struct ffs_buffer {
 	char storage[];
 };
 
+/*
+ * The requests of an OUT endpoint in pre-queued mode.  They complete in
+ * the order they were queued, so counting completions is enough to know
+ * whether reqs[head] is done.
+ */
+struct ffs_prequeue {
+	struct usb_ep *ep;
+	wait_queue_head_t wait;
+	unsigned queued;		/* P: epfile->mutex */
+	atomic_t completed;
+	unsigned head;			/* P: epfile->mutex */
+	unsigned count;
+	struct usb_request *reqs[];
+};
+
+#define FFS_PREQUEUE_MAX	64
+#define FFS_PREQUEUE_MAX_LEN	(1 << 20)
+/* kmalloc()ed buffers held by one endpoint */
+#define FFS_PREQUEUE_MAX_BYTES	(4 << 20)
+
 /*  ffs_io_data structure ***************************************************/
 
 struct ffs_io_data {
@@ -252,14 +276,25 @@ struct ffs_io_data {
 	char *buf;
 
 	struct mm_struct *mm;
-	struct work_struct work;
 
 	struct usb_ep *ep;
 	struct usb_request *req;
 
+	/* user pages the request points at instead of buf */
+	bool use_sg;
+	struct sg_table sgt;
+	struct llist_node done;
+
 	struct ffs_data *ffs;
 };
 
+/*
+ * Transfers at least this big go straight from/to the user's pages on
+ * controllers that can do scatter-gather; below it the bounce buffer is
+ * cheaper than pinning.
+ */
+#define FFS_SG_MIN_LEN		(4 * PAGE_SIZE)
+
 struct ffs_desc_helper {
 	struct ffs_data *ffs;
 	unsigned interfaces_count;
@@ -861,17 +896,94 @@ static ssize_t ffs_copy_to_iter(void *data, int data_len, struct iov_iter *iter)
 	return ret;
 }
 
-static void ffs_user_copy_worker(struct work_struct *work)
+/* Releases the pages pinned by ffs_build_sg_list(). */
+static void ffs_free_sg_list(struct ffs_io_data *io_data)
+{
+	struct scatterlist *sg;
+	int i;
+
+	for_each_sg(io_data->sgt.sgl, sg, io_data->sgt.nents, i) {
+		if (io_data->read)
+			set_page_dirty_lock(sg_page(sg));
+		put_page(sg_page(sg));
+	}
+	sg_free_table(&io_data->sgt);
+	io_data->use_sg = false;
+}
+
+/*
+ * Pins the user pages behind io_data->data and describes them in
+ * io_data->sgt, so that the request can be queued without a bounce
+ * buffer.  io_data->data itself is left untouched.
+ */
+static int ffs_build_sg_list(struct ffs_io_data *io_data)
+{
+	struct iov_iter iter = io_data->data;
+	struct scatterlist *sg, *last = NULL;
+	int npages = iov_iter_npages(&iter, INT_MAX);
+	unsigned nents = 0;
+	int ret;
+
+	ret = sg_alloc_table(&io_data->sgt, npages, GFP_KERNEL);
+	if (ret)
+		return ret;
+
+	sg = io_data->sgt.sgl;
+	while (iov_iter_count(&iter)) {
+		struct page *pages[16];
+		size_t start;
+		ssize_t bytes;
+		int i, n;
+
+		bytes = iov_iter_get_pages(&iter, pages, LONG_MAX,
+					   ARRAY_SIZE(pages), &start);
+		if (bytes <= 0) {
+			ret = bytes ? bytes : -EFAULT;
+			goto fail;
+		}
+		iov_iter_advance(&iter, bytes);
+
+		n = DIV_ROUND_UP(start + bytes, PAGE_SIZE);
+		for (i = 0; i < n; i++) {
+			size_t len = min_t(size_t, bytes, PAGE_SIZE - start);
+
+			if (WARN_ON(!sg)) {
+				for (; i < n; i++)
+					put_page(pages[i]);
+				ret = -EINVAL;
+				goto fail;
+			}
+			sg_set_page(sg, pages[i], len, start);
+			last = sg;
+			sg = sg_next(sg);
+			nents++;
+			bytes -= len;
+			start = 0;
+		}
+	}
+
+	sg_mark_end(last);
+	io_data->sgt.nents = nents;
+	io_data->use_sg = true;
+	return 0;
+
+fail:
+	io_data->sgt.nents = nents;
+	io_data->use_sg = true;
+	ffs_free_sg_list(io_data);
+	return ret;
+}
+
+static void ffs_aio_complete_one(struct ffs_io_data *io_data)
 {
-	struct ffs_io_data *io_data = container_of(work, struct ffs_io_data,
-						   work);
 	int ret = io_data->req->status ? io_data->req->status :
 					 io_data->req->actual;
-	bool kiocb_has_eventfd = io_data->kiocb->ki_flags & IOCB_EVENTFD;
 
 	ffs_log("enter: ret %d", ret);
 
-	if (io_data->read && ret > 0) {
+	if (io_data->use_sg) {
+		ffs_free_sg_list(io_data);
+	} else if (io_data->read && ret > 0) {
 		mm_segment_t oldfs = get_fs();
 
 		set_fs(USER_DS);
@@ -883,9 +995,6 @@ static void ffs_user_copy_worker(struct work_struct *work)
 
 	io_data->kiocb->ki_complete(io_data->kiocb, ret, ret);
 
-	if (io_data->ffs->ffs_eventfd && !kiocb_has_eventfd)
-		eventfd_signal(io_data->ffs->ffs_eventfd, 1);
-
 	usb_ep_free_request(io_data->ep, io_data->req);
 
 	if (io_data->read)
@@ -896,17 +1005,45 @@ static void ffs_user_copy_worker(struct work_struct *work)
 	ffs_log("exit");
 }
 
+/*
+ * Completes all AIO requests that finished since the last run, in the
+ * order they finished.  Each of them holds a reference to ffs, which is
+ * only dropped once the eventfd has been signalled for the whole batch.
+ */
+static void ffs_aio_complete_work(struct work_struct *work)
+{
+	struct ffs_data *ffs = container_of(work, struct ffs_data, aio_work);
+	struct llist_node *done = llist_del_all(&ffs->aio_done);
+	struct ffs_io_data *io_data, *next;
+	unsigned nr = 0, nr_signal = 0;
+
+	done = llist_reverse_order(done);
+	llist_for_each_entry_safe(io_data, next, done, done) {
+		if (!(io_data->kiocb->ki_flags & IOCB_EVENTFD))
+			nr_signal++;
+		ffs_aio_complete_one(io_data);
+		nr++;
+	}
+
+	if (ffs->ffs_eventfd && nr_signal)
+		eventfd_signal(ffs->ffs_eventfd, nr_signal);
+
+	while (nr--)
+		ffs_data_put(ffs);
+}
+
 static void ffs_epfile_async_io_complete(struct usb_ep *_ep,
 					 struct usb_request *req)
 {
 	struct ffs_io_data *io_data = req->context;
+	struct ffs_data *ffs = io_data->ffs;
 
 	ENTER();
 
 	ffs_log("enter");
 
-	INIT_WORK(&io_data->work, ffs_user_copy_worker);
-	schedule_work(&io_data->work);
+	if (llist_add(&io_data->done, &ffs->aio_done))
+		schedule_work(&ffs->aio_work);
 
 	ffs_log("exit");
 }
@@ -993,6 +1130,180 @@ static ssize_t __ffs_epfile_read_data(struct ffs_epfile *epfile,
 	return ret;
 }
 
+static void ffs_prequeue_complete(struct usb_ep *_ep, struct usb_request *req)
+{
+	struct ffs_prequeue *pq = req->context;
+
+	atomic_inc(&pq->completed);
+	wake_up(&pq->wait);
+}
+
+/* Assumes epfile->mutex is held. */
+static void ffs_epfile_prequeue_stop(struct ffs_epfile *epfile)
+{
+	struct ffs_prequeue *pq = epfile->prequeue;
+	unsigned long flags;
+	unsigned i;
+
+	if (!pq)
+		return;
+	epfile->prequeue = NULL;
+
+	/* requests already given back are simply not found */
+	spin_lock_irqsave(&epfile->ffs->eps_lock, flags);
+	for (i = 0; i < pq->count; i++)
+		usb_ep_dequeue(pq->ep, pq->reqs[i]);
+	spin_unlock_irqrestore(&epfile->ffs->eps_lock, flags);
+	wait_event(pq->wait, atomic_read(&pq->completed) == pq->queued);
+
+	for (i = 0; i < pq->count; i++) {
+		kfree(pq->reqs[i]->buf);
+		usb_ep_free_request(pq->ep, pq->reqs[i]);
+	}
+	kfree(pq);
+}
+
+/*
+ * Serves a read from the oldest pre-queued request and queues it again.
+ * Assumes epfile->mutex is held.
+ */
+static ssize_t __ffs_epfile_read_prequeued(struct ffs_epfile *epfile,
+					   struct iov_iter *iter,
+					   unsigned nonblock)
+{
+	struct ffs_prequeue *pq = epfile->prequeue;
+	struct usb_request *req = pq->reqs[pq->head];
+	/* every request is queued again right away, so count are in flight */
+	unsigned done = pq->queued - pq->count + 1;
+	ssize_t ret;
+	int err;
+
+	if (nonblock && atomic_read(&pq->completed) < done)
+		return -EAGAIN;
+	ret = wait_event_interruptible(pq->wait,
+				       atomic_read(&pq->completed) >= done);
+	if (ret)
+		return ret;
+
+	ret = req->status ? req->status : req->actual;
+	if (req->status == -ESHUTDOWN || req->status == -ECONNRESET) {
+		/* the endpoint went away, start over once it is back */
+		ffs_epfile_prequeue_stop(epfile);
+		return -ESHUTDOWN;
+	}
+	if (ret > 0)
+		ret = __ffs_epfile_read_data(epfile, req->buf, ret, iter);
+
+	spin_lock_irq(&epfile->ffs->eps_lock);
+	if (epfile->ep && epfile->ep->ep == pq->ep)
+		err = usb_ep_queue(pq->ep, req, GFP_ATOMIC);
+	else
+		err = -ESHUTDOWN;
+	spin_unlock_irq(&epfile->ffs->eps_lock);
+
+	if (unlikely(err)) {
+		ffs_epfile_prequeue_stop(epfile);
+		return ret ? ret : err;
+	}
+	pq->queued++;
+	pq->head = (pq->head + 1) % pq->count;
+	return ret;
+}
+
+static long ffs_epfile_prequeue(struct ffs_epfile *epfile,
+				struct usb_functionfs_prequeue __user *arg)
+{
+	struct usb_functionfs_prequeue p;
+	struct ffs_prequeue *pq;
+	struct usb_ep *ep;
+	unsigned i;
+	int ret;
+
+	if (copy_from_user(&p, arg, sizeof(p)))
+		return -EFAULT;
+	if (p.count > FFS_PREQUEUE_MAX ||
+	    (p.count && (!p.length || p.length > FFS_PREQUEUE_MAX_LEN)) ||
+	    p.count * p.length > FFS_PREQUEUE_MAX_BYTES)
+		return -EINVAL;
+
+	ret = mutex_lock_interruptible(&epfile->mutex);
+	if (ret)
+		return ret;
+
+	ffs_epfile_prequeue_stop(epfile);
+	if (!p.count)
+		goto out;
+
+	spin_lock_irq(&epfile->ffs->eps_lock);
+	if (!epfile->ep || epfile->in || epfile->isoc) {
+		ret = epfile->ep ? -EINVAL : -ENODEV;
+		spin_unlock_irq(&epfile->ffs->eps_lock);
+		goto out;
+	}
+	ep = epfile->ep->ep;
+	p.length = usb_ep_align_maybe(epfile->ffs->gadget, ep, p.length);
+	spin_unlock_irq(&epfile->ffs->eps_lock);
+	/* rounding up to maxpacket may push the total past the limit */
+	if (p.count * p.length > FFS_PREQUEUE_MAX_BYTES) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	pq = kzalloc(sizeof(*pq) + p.count * sizeof(pq->reqs[0]), GFP_KERNEL);
+	if (!pq) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	pq->ep = ep;
+	pq->count = p.count;
+	init_waitqueue_head(&pq->wait);
+	atomic_set(&pq->completed, 0);
+
+	for (i = 0; i < p.count; i++) {
+		struct usb_request *req = usb_ep_alloc_request(ep, GFP_KERNEL);
+
+		if (!req)
+			goto nomem;
+		req->buf = kmalloc(p.length, GFP_KERNEL);
+		if (!req->buf) {
+			usb_ep_free_request(ep, req);
+			goto nomem;
+		}
+		req->length = p.length;
+		req->context = pq;
+		req->complete = ffs_prequeue_complete;
+		pq->reqs[i] = req;
+	}
+
+	epfile->prequeue = pq;
+	spin_lock_irq(&epfile->ffs->eps_lock);
+	for (i = 0; i < p.count; i++) {
+		if (!epfile->ep || epfile->ep->ep != ep)
+			ret = -ESHUTDOWN;
+		else
+			ret = usb_ep_queue(ep, pq->reqs[i], GFP_ATOMIC);
+		if (ret)
+			break;
+		pq->queued++;
+	}
+	spin_unlock_irq(&epfile->ffs->eps_lock);
+
+	if (ret)
+		ffs_epfile_prequeue_stop(epfile);
+	goto out;
+
+nomem:
+	while (i--) {
+		kfree(pq->reqs[i]->buf);
+		usb_ep_free_request(ep, pq->reqs[i]);
+	}
+	kfree(pq);
+	ret = -ENOMEM;
+out:
+	mutex_unlock(&epfile->mutex);
+	return ret;
+}
+
 static ssize_t ffs_epfile_io(struct file *file, struct ffs_io_data *io_data)
 {
 	struct ffs_epfile *epfile = file->private_data;
@@ -1002,6 +1313,7 @@ static ssize_t ffs_epfile_io(struct file *file, struct ffs_io_data *io_data)
 	ssize_t ret, data_len = -EINVAL;
 	int halt;
 	size_t extra_buf_alloc = 0;
+	bool sg_ok = false;
 
 	ffs_log("enter: epfile name %s epfile err %d (%s)", epfile->name,
 		atomic_read(&epfile->error), io_data->read ? "READ" : "WRITE");
@@ -1074,6 +1386,17 @@ static ssize_t ffs_epfile_io(struct file *file, struct ffs_io_data *io_data)
 				goto error_mutex;
 		}
 
+		/* Pre-queued requests own the OUT data stream */
+		if (io_data->read && epfile->prequeue) {
+			if (io_data->aio)
+				ret = -EBUSY;
+			else
+				ret = __ffs_epfile_read_prequeued(epfile,
+						&io_data->data,
+						file->f_flags & O_NONBLOCK);
+			goto error_mutex;
+		}
+
 		/*
 		 * if we _do_ wait above, the epfile->ffs->gadget might be NULL
 		 * before the waiting completes, so do not assign to 'gadget'
@@ -1094,22 +1417,43 @@ static ssize_t ffs_epfile_io(struct file *file, struct ffs_io_data *io_data)
 		 */
 		if (io_data->read)
 			data_len = usb_ep_align_maybe(gadget, ep->ep, data_len);
+		/*
+		 * A synchronous read finding the request still queued by an
+		 * interrupted one picks that up, so it must use a buffer.
+		 */
+		sg_ok = !(io_data->read && ep->is_busy && !io_data->aio);
 		spin_unlock_irq(&epfile->ffs->eps_lock);
 
 		extra_buf_alloc = gadget->extra_buf_alloc;
-		if (!io_data->read)
-			data = kmalloc(data_len + extra_buf_alloc,
-					GFP_KERNEL);
-		else
-			data = kmalloc(data_len, GFP_KERNEL);
-		if (unlikely(!data)) {
-			ret = -ENOMEM;
-			goto error_mutex;
-		}
-		if (!io_data->read &&
-		    copy_from_iter(data, data_len, &io_data->data) != data_len) {
-			ret = -EFAULT;
-			goto error_mutex;
+
+		/*
+		 * Large user buffers are pinned and handed to sg capable
+		 * controllers as they are.  Reads need the buffer to be
+		 * aligned already, as there is nowhere to put excess data.
+		 */
+		if (sg_ok && gadget->sg_supported && !extra_buf_alloc &&
+		    !epfile->isoc && iter_is_iovec(&io_data->data) &&
+		    data_len >= FFS_SG_MIN_LEN &&
+		    data_len == iov_iter_count(&io_data->data) &&
+		    !ffs_build_sg_list(io_data)) {
+			if (!io_data->read)
+				iov_iter_advance(&io_data->data, data_len);
+		} else {
+			if (!io_data->read)
+				data = kmalloc(data_len + extra_buf_alloc,
+						GFP_KERNEL);
+			else
+				data = kmalloc(data_len, GFP_KERNEL);
+			if (unlikely(!data)) {
+				ret = -ENOMEM;
+				goto error_mutex;
+			}
+			if (!io_data->read &&
+			    copy_from_iter(data, data_len,
+					   &io_data->data) != data_len) {
+				ret = -EFAULT;
+				goto error_mutex;
+			}
 		}
 	}
 
@@ -1144,6 +1488,8 @@ static ssize_t ffs_epfile_io(struct file *file, struct ffs_io_data *io_data)
 		req = ep->req;
 		req->buf      = data;
 		req->length   = data_len;
+		req->sg       = io_data->use_sg ? io_data->sgt.sgl : NULL;
+		req->num_sgs  = io_data->use_sg ? io_data->sgt.nents : 0;
 		ret           = 0;
 		req->complete = ffs_epfile_io_complete;
 
@@ -1212,7 +1558,9 @@ static ssize_t ffs_epfile_io(struct file *file, struct ffs_io_data *io_data)
 		if (epfile->ep == ep)
 			ret = ep->status;
 		spin_unlock_irq(&epfile->ffs->eps_lock);
-		if (io_data->read && ret > 0)
+		if (io_data->read && ret > 0 && io_data->use_sg)
+			iov_iter_advance(&io_data->data, ret);
+		else if (io_data->read && ret > 0)
 			ret = __ffs_epfile_read_data(epfile, data, ep->status,
 						     &io_data->data);
 		goto error_mutex;
@@ -1221,6 +1569,10 @@ static ssize_t ffs_epfile_io(struct file *file, struct ffs_io_data *io_data)
 	} else {
 		req->buf      = data;
 		req->length   = data_len;
+		if (io_data->use_sg) {
+			req->sg      = io_data->sgt.sgl;
+			req->num_sgs = io_data->sgt.nents;
+		}
 
 		io_data->buf = data;
 		io_data->ep = ep->ep;
@@ -1230,17 +1582,21 @@ static ssize_t ffs_epfile_io(struct file *file, struct ffs_io_data *io_data)
 		req->context  = io_data;
 		req->complete = ffs_epfile_async_io_complete;
 
+		/* dropped once the request has been completed to the user */
+		ffs_data_get(epfile->ffs);
 		ret = usb_ep_queue(ep->ep, req, GFP_ATOMIC);
 		if (unlikely(ret)) {
 			io_data->req = NULL;
 			usb_ep_free_request(ep->ep, req);
-			goto error_lock;
+			spin_unlock_irq(&epfile->ffs->eps_lock);
+			ffs_data_put(epfile->ffs);
+			goto error_mutex;
 		}
 
 		ret = -EIOCBQUEUED;
 		/*
 		 * Do not kfree the buffer in this function.  It will be freed
-		 * by ffs_user_copy_worker.
+		 * by ffs_aio_complete_one.
 		 */
 		data = NULL;
 	}
@@ -1250,6 +1606,8 @@ static ssize_t ffs_epfile_io(struct file *file, struct ffs_io_data *io_data)
 error_mutex:
 	mutex_unlock(&epfile->mutex);
 error:
+	if (io_data->use_sg && ret != -EIOCBQUEUED)
+		ffs_free_sg_list(io_data);
 	kfree(data);
 
 	ffs_log("exit: ret %zu", ret);
@@ -1424,6 +1782,9 @@ ffs_epfile_release(struct inode *inode, struct file *file)
 	ENTER();
 
 	atomic_set(&epfile->opened, 0);
+	mutex_lock(&epfile->mutex);
+	ffs_epfile_prequeue_stop(epfile);
+	mutex_unlock(&epfile->mutex);
 	__ffs_epfile_read_buffer_free(epfile);
 	ffs_log("enter:state %d setup_state %d flag %lu", epfile->ffs->state,
 		epfile->ffs->setup_state, epfile->ffs->flags);
@@ -1454,6 +1815,10 @@ static long ffs_epfile_ioctl(struct file *file, unsigned code,
 	if (WARN_ON(epfile->ffs->state != FFS_ACTIVE))
 		return -ENODEV;
 
+	/* Sleeps, so not handled under eps_lock with the rest */
+	if (code == FUNCTIONFS_PREQUEUE_READS)
+		return ffs_epfile_prequeue(epfile, (void __user *)value);
+
 	spin_lock_irq(&epfile->ffs->eps_lock);
 	if (likely(epfile->ep)) {
 		switch (code) {
@@ -1998,6 +2363,8 @@ static struct ffs_data *ffs_data_new(void)
 	init_completion(&ffs->ep0req_completion);
 	init_completion(&ffs->epout_completion);
 	init_completion(&ffs->epin_completion);
+	init_llist_head(&ffs->aio_done);
+	INIT_WORK(&ffs->aio_work, ffs_aio_complete_work);
 
 	/* XXX REVISIT need to update it in some places, or do we? */
 	ffs->ev.can_stall = 1;
@@ -30,6 +30,8 @@
 #include <linux/debugfs.h>
 #include <linux/types.h>
 #include <linux/file.h>
+#include <linux/pagemap.h>
+#include <linux/scatterlist.h>
 #include <linux/device.h>
 #include <linux/miscdevice.h>
 #include <linux/ipc_logging.h>
@@ -74,9 +76,16 @@
 
 /* number of tx and rx requests to allocate */
 #define MTP_TX_REQ_MAX 8
-#define RX_REQ_MAX 2
+#define MTP_RX_REQS 4
+#define RX_REQ_MAX 8
 #define INTR_REQ_MAX 5
 
+/*
+ * scatterlist entries of a tx request sending page cache pages: the data
+ * header, plus one more page as the data need not start page aligned
+ */
+#define MTP_TX_SG_NENTS(len)	(DIV_ROUND_UP(len, PAGE_SIZE) + 2)
+
 /* ID for Microsoft MTP OS String */
 #define MTP_OS_STRING_ID   0xEE
 
@@ -102,6 +111,14 @@ module_param(mtp_tx_req_len, uint, 0644);
 unsigned int mtp_tx_reqs = MTP_TX_REQ_MAX;
 module_param(mtp_tx_reqs, uint, 0644);
 
+/* number of rx requests kept queued while receiving a file */
+unsigned int mtp_rx_reqs = MTP_RX_REQS;
+module_param(mtp_rx_reqs, uint, 0644);
+
+/* send files straight from the page cache on sg capable controllers */
+static bool mtp_zero_copy = true;
+module_param(mtp_zero_copy, bool, 0644);
+
 static const char mtp_shortname[] = DRIVER_NAME "_usb";
 
 struct mtp_dev {
@@ -127,6 +144,7 @@ struct mtp_dev {
 	wait_queue_head_t write_wq;
 	wait_queue_head_t intr_wq;
 	struct usb_request *rx_req[RX_REQ_MAX];
+	/* count of completed rx requests */
 	int rx_done;
 
 	/* for processing MTP_SEND_FILE, MTP_RECEIVE_FILE and
@@ -153,6 +171,7 @@ struct mtp_dev {
 	unsigned int mtp_rx_req_len;
 	unsigned int mtp_tx_req_len;
 	unsigned int mtp_tx_reqs;
+	unsigned int mtp_rx_reqs;
 	struct mutex  read_mutex;
 };
 
@@ -424,10 +443,27 @@ static void mtp_request_free(struct usb_request *req, struct usb_ep *ep)
 {
 	if (req) {
 		kfree(req->buf);
+		/* scatterlist of a zero-copy tx request */
+		kfree(req->context);
 		usb_ep_free_request(ep, req);
 	}
 }
 
+/* drop the page cache pages a zero-copy tx request was pointed at */
+static void mtp_request_put_pages(struct usb_request *req)
+{
+	struct scatterlist *sg;
+	int i;
+
+	for_each_sg(req->sg, sg, req->num_sgs, i) {
+		/* the data header lives in req->buf */
+		if (sg_virt(sg) != req->buf)
+			put_page(sg_page(sg));
+	}
+	req->sg = NULL;
+	req->num_sgs = 0;
+}
+
 static inline int mtp_lock(atomic_t *excl)
 {
 	if (atomic_inc_return(excl) == 1) {
@@ -479,6 +515,8 @@ static void mtp_complete_in(struct usb_ep *ep, struct usb_request *req)
 	if (req->status != 0 && dev->state != STATE_OFFLINE)
 		dev->state = STATE_ERROR;
 
+	if (req->num_sgs)
+		mtp_request_put_pages(req);
 	mtp_req_put(dev, &dev->tx_idle, req);
 
 	wake_up(&dev->write_wq);
@@ -488,7 +526,7 @@ static void mtp_complete_out(struct usb_ep *ep, struct usb_request *req)
 {
 	struct mtp_dev *dev = _mtp_dev;
 
-	dev->rx_done = 1;
+	dev->rx_done++;
 	if (req->status != 0 && dev->state != STATE_OFFLINE)
 		dev->state = STATE_ERROR;
 
@@ -562,6 +600,11 @@ static int mtp_create_bulk_endpoints(struct mtp_dev *dev,
 			goto retry_tx_alloc;
 		}
 		req->complete = mtp_complete_in;
+		/* without a scatterlist the request just copies */
+		if (cdev->gadget->sg_supported)
+			req->context = kmalloc_array(
+				MTP_TX_SG_NENTS(dev->mtp_tx_req_len),
+				sizeof(struct scatterlist), GFP_KERNEL);
 		mtp_req_put(dev, &dev->tx_idle, req);
 	}
 
@@ -575,13 +618,15 @@ static int mtp_create_bulk_endpoints(struct mtp_dev *dev,
 		dev->mtp_rx_req_len = MTP_BULK_BUFFER_SIZE;
 
 retry_rx_alloc:
-	for (i = 0; i < RX_REQ_MAX; i++) {
+	for (i = 0; i < dev->mtp_rx_reqs; i++) {
 		req = mtp_request_new(dev->ep_out, dev->mtp_rx_req_len);
 		if (!req) {
 			if (dev->mtp_rx_req_len <= MTP_BULK_BUFFER_SIZE)
 				goto fail;
-			for (--i; i >= 0; i--)
+			for (--i; i >= 0; i--) {
 				mtp_request_free(dev->rx_req[i], dev->ep_out);
+				dev->rx_req[i] = NULL;
+			}
 			dev->mtp_rx_req_len = MTP_BULK_BUFFER_SIZE;
 			goto retry_rx_alloc;
 		}
@@ -815,6 +860,87 @@ static ssize_t mtp_write(struct file *fp, const char __user *buf,
 	return r;
 }
 
+/*
+ * Can send_file_work() point its requests at the page cache pages of @filp
+ * rather than copying the file into them?
+ */
+static bool mtp_can_zero_copy(struct mtp_dev *dev, struct file *filp)
+{
+	struct inode *inode = file_inode(filp);
+
+	return mtp_zero_copy && dev->cdev && dev->cdev->gadget->sg_supported &&
+		S_ISREG(inode->i_mode) && !IS_DAX(inode) &&
+		!(filp->f_flags & O_DIRECT) &&
+		filp->f_mapping->a_ops->readpage;
+}
+
+/*
+ * Point @req at the page cache pages holding up to @len bytes of @filp
+ * from *@offset, behind the @hdr_size bytes of data header in req->buf.
+ * The pages are read ahead as a regular read would, and stay referenced
+ * until the request completes.  Returns the number of file bytes mapped,
+ * which is short at EOF, or a negative error if nothing could be read.
+ */
+static int mtp_map_file_pages(struct mtp_dev *dev, struct usb_request *req,
+		struct file *filp, loff_t *offset, int hdr_size, int len)
+{
+	struct address_space *mapping = filp->f_mapping;
+	struct scatterlist *sg = req->context;
+	loff_t isize = i_size_read(mapping->host);
+	pgoff_t index, last;
+	int nents = 0, mapped = 0;
+
+	if (len <= 0 || *offset >= isize)
+		return 0;
+	if (len > isize - *offset)
+		len = isize - *offset;
+
+	sg_init_table(sg, MTP_TX_SG_NENTS(dev->mtp_tx_req_len));
+	if (hdr_size)
+		sg_set_buf(&sg[nents++], req->buf, hdr_size);
+
+	index = *offset >> PAGE_SHIFT;
+	last = (*offset + len - 1) >> PAGE_SHIFT;
+	while (mapped < len) {
+		unsigned int poff = offset_in_page(*offset + mapped);
+		unsigned int n = min_t(unsigned int, PAGE_SIZE - poff,
+				       len - mapped);
+		struct page *page;
+
+		page = find_get_page(mapping, index);
+		if (!page) {
+			page_cache_sync_readahead(mapping, &filp->f_ra, filp,
+						  index, last + 1 - index);
+			page = find_get_page(mapping, index);
+		} else if (PageReadahead(page)) {
+			page_cache_async_readahead(mapping, &filp->f_ra, filp,
+						   page, index,
+						   last + 1 - index);
+		}
+		if (!page || !PageUptodate(page)) {
+			if (page)
+				put_page(page);
+			page = read_mapping_page(mapping, index, filp);
+			if (IS_ERR(page)) {
+				if (!mapped)
+					return PTR_ERR(page);
+				break;
+			}
+		}
+
+		sg_set_page(&sg[nents++], page, n, poff);
+		mapped += n;
+		index++;
+	}
+
+	sg_mark_end(&sg[nents - 1]);
+	req->sg = sg;
+	req->num_sgs = nents;
+	*offset += mapped;
+	file_accessed(filp);
+	return mapped;
+}
+
 /* read from a local file and write to USB */
 static void send_file_work(struct work_struct *data)
 {
@@ -828,6 +954,7 @@ static void send_file_work(struct work_struct *data)
 	int xfer, ret, hdr_size;
 	int r = 0;
 	int sendZLP = 0;
+	bool zero_copy;
 	ktime_t start_time;
 
 	/* read our parameters */
@@ -841,7 +968,8 @@ static void send_file_work(struct work_struct *data)
 		return;
 	}
 
-	mtp_log("(%lld %lld)\n", offset, count);
+	zero_copy = mtp_can_zero_copy(dev, filp);
+	mtp_log("(%lld %lld) zero_copy:%d\n", offset, count, zero_copy);
 
 	if (dev->xfer_send_header) {
 		hdr_size = sizeof(struct mtp_data_header);
@@ -897,8 +1025,12 @@ static void send_file_work(struct work_struct *data)
 					__cpu_to_le32(dev->xfer_transaction_id);
 		}
 		start_time = ktime_get();
-		ret = vfs_read(filp, req->buf + hdr_size, xfer - hdr_size,
-								&offset);
+		if (zero_copy && req->context)
+			ret = mtp_map_file_pages(dev, req, filp, &offset,
+						 hdr_size, xfer - hdr_size);
+		else
+			ret = vfs_read(filp, req->buf + hdr_size,
+				       xfer - hdr_size, &offset);
 		if (ret < 0) {
 			r = ret;
 			break;
@@ -927,8 +1059,10 @@ static void send_file_work(struct work_struct *data)
 		req = 0;
 	}
 
-	if (req)
+	if (req) {
+		mtp_request_put_pages(req);
 		mtp_req_put(dev, &dev->tx_idle, req);
+	}
 
 	mtp_log("returning %d state:%d\n", r, dev->state);
 	/* write the result */
@@ -941,11 +1075,15 @@ static void receive_file_work(struct work_struct *data)
 {
 	struct mtp_dev *dev = container_of(data, struct mtp_dev,
 						receive_file_work);
-	struct usb_request *read_req = NULL, *write_req = NULL;
+	struct usb_request *req;
+	struct iovec iov[RX_REQ_MAX];
 	struct file *filp;
 	loff_t offset;
-	int64_t count;
-	int ret, cur_buf = 0;
+	int64_t count, to_queue;
+	unsigned int nr_reqs = dev->mtp_rx_reqs, depth;
+	unsigned int head = 0, tail = 0, inflight = 0, completed = 0;
+	int ret, nr_iov;
+	size_t bytes;
 	int r = 0;
 	ktime_t start_time;
 
@@ -965,96 +1103,88 @@ static void receive_file_work(struct work_struct *data)
 		mtp_log("- count(%lld) not multiple of mtu(%d)\n",
 						count, dev->ep_out->maxpacket);
 
-	while (count > 0 || write_req) {
-		if (count > 0) {
-			mutex_lock(&dev->read_mutex);
-			if (dev->state == STATE_OFFLINE) {
-				r = -EIO;
-				mutex_unlock(&dev->read_mutex);
-				break;
-			}
-			/* queue a request */
-			read_req = dev->rx_req[cur_buf];
-			cur_buf = (cur_buf + 1) % RX_REQ_MAX;
-
-			/* some h/w expects size to be aligned to ep's MTU */
-			read_req->length = dev->mtp_rx_req_len;
+	/*
+	 * Keep up to mtp_rx_reqs reads queued while earlier data is written
+	 * out, but never queue more than the host is going to send: a read
+	 * past the end of the data phase would swallow the next command.
+	 * If xfer_file_length is 0xFFFFFFFF, then we read until we get a
+	 * short packet and cannot know that, so only one read is queued.
+	 */
+	depth = count == 0xFFFFFFFF ? 1 : nr_reqs;
+	to_queue = count;
+	dev->rx_done = 0;
 
-			dev->rx_done = 0;
+	while (count > 0) {
+		mutex_lock(&dev->read_mutex);
+		if (dev->state == STATE_OFFLINE) {
+			r = -EIO;
 			mutex_unlock(&dev->read_mutex);
-			ret = usb_ep_queue(dev->ep_out, read_req, GFP_KERNEL);
+			break;
+		}
+		while (inflight < depth && to_queue > 0) {
+			req = dev->rx_req[tail];
+			/* some h/w expects size to be aligned to ep's MTU */
+			req->length = dev->mtp_rx_req_len;
+			ret = usb_ep_queue(dev->ep_out, req, GFP_KERNEL);
 			if (ret < 0) {
 				r = -EIO;
 				if (dev->state != STATE_OFFLINE)
 					dev->state = STATE_ERROR;
 				break;
 			}
+			tail = (tail + 1) % nr_reqs;
+			inflight++;
+			if (count != 0xFFFFFFFF)
+				to_queue -= req->length;
 		}
+		mutex_unlock(&dev->read_mutex);
+		if (r)
+			break;
 
-		if (write_req) {
-			mtp_log("rx %pK %d\n", write_req, write_req->actual);
-			start_time = ktime_get();
-			mutex_lock(&dev->read_mutex);
-			if (dev->state == STATE_OFFLINE) {
+		/* wait for the oldest read to complete */
+		ret = wait_event_interruptible(dev->read_wq,
+			READ_ONCE(dev->rx_done) != completed ||
+			dev->state != STATE_BUSY);
+		if (dev->state == STATE_CANCELED
+				|| dev->state == STATE_OFFLINE) {
+			if (dev->state == STATE_OFFLINE)
 				r = -EIO;
-				mutex_unlock(&dev->read_mutex);
-				break;
-			}
-			ret = vfs_write(filp, write_req->buf, write_req->actual,
-				&offset);
-			mtp_log("vfs_write %d\n", ret);
-			if (ret != write_req->actual) {
-				r = -EIO;
-				mutex_unlock(&dev->read_mutex);
-				if (dev->state != STATE_OFFLINE)
-					dev->state = STATE_ERROR;
-				break;
-			}
-			mutex_unlock(&dev->read_mutex);
-			dev->perf[dev->dbg_write_index].vfs_wtime =
-				ktime_to_us(ktime_sub(ktime_get(), start_time));
-			dev->perf[dev->dbg_write_index].vfs_wbytes = ret;
-			dev->dbg_write_index =
-				(dev->dbg_write_index + 1) % MAX_ITERATION;
-			write_req = NULL;
+			else
+				r = -ECANCELED;
+			break;
+		}
+		if (ret < 0) {
+			r = ret;
+			break;
 		}
 
-		if (read_req) {
-			/* wait for our last read to complete */
-			ret = wait_event_interruptible(dev->read_wq,
-				dev->rx_done || dev->state != STATE_BUSY);
-			if (dev->state == STATE_CANCELED
-					|| dev->state == STATE_OFFLINE) {
-				if (dev->state == STATE_OFFLINE)
-					r = -EIO;
-				else
-					r = -ECANCELED;
-				if (!dev->rx_done)
-					usb_ep_dequeue(dev->ep_out, read_req);
-				break;
-			}
+		mutex_lock(&dev->read_mutex);
+		if (dev->state == STATE_OFFLINE) {
+			r = -EIO;
+			mutex_unlock(&dev->read_mutex);
+			break;
+		}
 
-			if (read_req->status) {
-				r = read_req->status;
+		/* write out everything that has arrived in one go */
+		nr_iov = 0;
+		bytes = 0;
+		while (inflight && READ_ONCE(dev->rx_done) != completed) {
+			req = dev->rx_req[head];
+			if (req->status) {
+				r = req->status;
 				break;
 			}
+			head = (head + 1) % nr_reqs;
+			inflight--;
+			completed++;
 
-			mutex_lock(&dev->read_mutex);
-			if (dev->state == STATE_OFFLINE) {
-				r = -EIO;
-				mutex_unlock(&dev->read_mutex);
-				break;
-			}
 			/* Check if we aligned the size due to MTU constraint */
-			if (count < read_req->length)
-				read_req->actual = (read_req->actual > count ?
-						count : read_req->actual);
-			/* if xfer_file_length is 0xFFFFFFFF, then we read until
-			 * we get a zero length packet
-			 */
+			if (count < req->length)
+				req->actual = (req->actual > count ?
+						count : req->actual);
 			if (count != 0xFFFFFFFF)
-				count -= read_req->actual;
-			if (read_req->actual < read_req->length) {
+				count -= req->actual;
+			if (req->actual < req->length) {
 				/*
 				 * short packet is used to signal EOF for
 				 * sizes > 4 gig
@@ -1063,10 +1193,44 @@ static void receive_file_work(struct work_struct *data)
 				count = 0;
 			}
 
-			write_req = read_req;
-			read_req = NULL;
+			mtp_log("rx %pK %d\n", req, req->actual);
+			iov[nr_iov].iov_base = (void __user *)req->buf;
+			iov[nr_iov].iov_len = req->actual;
+			bytes += req->actual;
+			nr_iov++;
+			if (!count)
+				break;
+		}
+		if (r) {
 			mutex_unlock(&dev->read_mutex);
+			break;
 		}
+
+		if (bytes) {
+			start_time = ktime_get();
+			ret = vfs_writev(filp, (const struct iovec __user *)iov,
+					 nr_iov, &offset, 0);
+			mtp_log("vfs_writev %d\n", ret);
+			if (ret != bytes) {
+				r = -EIO;
+				mutex_unlock(&dev->read_mutex);
+				if (dev->state != STATE_OFFLINE)
+					dev->state = STATE_ERROR;
+				break;
+			}
+			dev->perf[dev->dbg_write_index].vfs_wtime =
+				ktime_to_us(ktime_sub(ktime_get(), start_time));
+			dev->perf[dev->dbg_write_index].vfs_wbytes = ret;
+			dev->dbg_write_index =
+				(dev->dbg_write_index + 1) % MAX_ITERATION;
+		}
+		mutex_unlock(&dev->read_mutex);
+	}
+
+	/* reads still queued after an error or an early short packet */
+	while (inflight--) {
+		usb_ep_dequeue(dev->ep_out, dev->rx_req[head]);
+		head = (head + 1) % nr_reqs;
 	}
 
 	mtp_log("returning %d\n", r);
@@ -1457,6 +1621,7 @@ mtp_function_bind(struct usb_configuration *c, struct usb_function *f)
 	dev->mtp_rx_req_len = mtp_rx_req_len;
 	dev->mtp_tx_req_len = mtp_tx_req_len;
 	dev->mtp_tx_reqs = mtp_tx_reqs;
+	dev->mtp_rx_reqs = clamp_t(unsigned int, mtp_rx_reqs, 1, RX_REQ_MAX);
 	/* allocate interface ID(s) */
 	id = usb_interface_id(c, f);
 	if (id < 0)
@@ -1530,8 +1695,11 @@ mtp_function_unbind(struct usb_configuration *c, struct usb_function *f)
 	mutex_lock(&dev->read_mutex);
 	while ((req = mtp_req_get(dev, &dev->tx_idle)))
 		mtp_request_free(req, dev->ep_in);
-	for (i = 0; i < RX_REQ_MAX; i++)
+	/* only mtp_rx_reqs were allocated at bind, the rest may be stale */
+	for (i = 0; i < dev->mtp_rx_reqs; i++) {
 		mtp_request_free(dev->rx_req[i], dev->ep_out);
+		dev->rx_req[i] = NULL;
+	}
 	while ((req = mtp_req_get(dev, &dev->intr_idle)))
 		mtp_request_free(req, dev->ep_intr);
 	mutex_unlock(&dev->read_mutex);
@@ -76,9 +76,12 @@ struct f_ncm {
 	struct sk_buff			*skb_tx_data;
 	struct sk_buff			*skb_tx_ndp;
 	u16				ndp_dgram_count;
+	u16				tx_max_dpe;
 	bool				timer_force_tx;
 	struct tasklet_struct		tx_tasklet;
 	struct hrtimer			task_timer;
+	/* how long a partly filled NTB waits, see ncm_tx_adapt_timeout() */
+	u32				tx_timeout_ns;
 
 	bool				timer_stopping;
 };
@@ -112,17 +115,23 @@ static inline unsigned ncm_bitrate(struct usb_gadget *g)
 #define NTB_DEFAULT_IN_SIZE	16384
 #define NTB_OUT_SIZE		16384
 
-/* Allocation for storing the NDP, 32 should suffice for a
- * 16k packet. This allows a maximum of 32 * 507 Byte packets to
- * be transmitted in a single 16kB skb, though when sending full size
- * packets this limit will be plenty.
- * Smaller packets are not likely to be trying to maximize the
- * throughput and will be mstly sending smaller infrequent frames.
+/* The NDP of an NTB is sized for datagrams averaging this size, so that
+ * NTBs of small frames such as TCP ACKs fill up to the negotiated NTB
+ * size rather than running out of datagram pointer entries first.
  */
-#define TX_MAX_NUM_DPE		32
+#define TX_MIN_DGRAM_SIZE	64
 
-/* Delay for the transmit to wait before sending an unfilled NTB frame. */
+/* Delay for the transmit to wait before sending an unfilled NTB frame,
+ * adapted to the traffic between the MIN and MAX bounds.
+ */
 #define TX_TIMEOUT_NSECS	300000
+#define TX_TIMEOUT_MIN_NSECS	50000
+#define TX_TIMEOUT_MAX_NSECS	1000000
+/* timer flushes with at least this many datagrams make the delay grow */
+#define TX_TIMEOUT_GROW_DGRAMS	8
+
+/* Received datagrams up to this size are copied out of the NTB */
+#define RX_COPYBREAK		256
 
 #define FORMATS_SUPPORTED	(USB_CDC_NCM_NTB16_SUPPORTED |	\
 				 USB_CDC_NCM_NTB32_SUPPORTED)
@@ -1024,6 +1033,23 @@ static struct sk_buff *package_for_tx(struct f_ncm *ncm)
 	return skb2;
 }
 
+/*
+ * Adapts how long a partly filled NTB waits for more datagrams to what the
+ * timer flushes carry: an NTB going out with a single datagram means the
+ * traffic is sparse and waiting only adds latency, one that collected many
+ * means a stream which a longer wait packs into fewer transfers.
+ */
+static void ncm_tx_adapt_timeout(struct f_ncm *ncm, unsigned dgrams)
+{
+	if (dgrams <= 1)
+		ncm->tx_timeout_ns = max_t(u32, ncm->tx_timeout_ns / 2,
+					   TX_TIMEOUT_MIN_NSECS);
+	else if (dgrams >= TX_TIMEOUT_GROW_DGRAMS)
+		ncm->tx_timeout_ns = min_t(u32, ncm->tx_timeout_ns +
+					   ncm->tx_timeout_ns / 4,
+					   TX_TIMEOUT_MAX_NSECS);
+}
+
 static struct sk_buff *ncm_wrap_ntb(struct gether *port,
 				    struct sk_buff *skb)
 {
@@ -1063,7 +1089,7 @@ static struct sk_buff *ncm_wrap_ntb(struct gether *port,
 		 * NOTE: Assume maximum align for speed of calculation.
 		 */
 		if (ncm->skb_tx_data
-		    && (ncm->ndp_dgram_count >= TX_MAX_NUM_DPE
+		    && (ncm->ndp_dgram_count >= ncm->tx_max_dpe
 		    || (ncm->skb_tx_data->len +
 		    div + rem + skb->len +
 		    ncm->skb_tx_ndp->len + ndp_align + (2 * dgram_idx_len))
@@ -1091,13 +1117,15 @@ static struct sk_buff *ncm_wrap_ntb(struct gether *port,
 			/* wHeaderLength */
 			put_unaligned_le16(opts->nth_size, ntb_data++);
 
-			/* Allocate an skb for storing the NDP,
-			 * TX_MAX_NUM_DPE should easily suffice for a
-			 * 16k packet.
+			/* Allocate an skb for storing the NDP, with
+			 * room for as many entries as datagrams of
+			 * TX_MIN_DGRAM_SIZE fit the NTB.
 			 */
+			ncm->tx_max_dpe = DIV_ROUND_UP(max_size,
+						       TX_MIN_DGRAM_SIZE);
 			ncm->skb_tx_ndp = alloc_skb((int)(opts->ndp_size
 						    + opts->dpe_size
-						    * TX_MAX_NUM_DPE),
+						    * ncm->tx_max_dpe),
 						    GFP_ATOMIC);
 			if (!ncm->skb_tx_ndp)
 				goto err;
@@ -1112,12 +1140,16 @@ static struct sk_buff *ncm_wrap_ntb(struct gether *port,
 			ncm->ndp_dgram_count = 1;
 
 			/* Note: we skip opts->next_ndp_index */
-		}
 
-		/* Delay the timer. */
-		hrtimer_start(&ncm->task_timer,
-			      ktime_set(0, TX_TIMEOUT_NSECS),
-			      HRTIMER_MODE_REL);
+			/*
+			 * Bound how long the first datagram of the NTB
+			 * waits for company; later ones don't push the
+			 * flush out any further.
+			 */
+			hrtimer_start(&ncm->task_timer,
+				      ns_to_ktime(ncm->tx_timeout_ns),
+				      HRTIMER_MODE_REL);
+		}
 
 		/* Add the datagram position entries */
 		ntb_ndp = (void *) skb_put(ncm->skb_tx_ndp, dgram_idx_len);
@@ -1143,6 +1175,7 @@ static struct sk_buff *ncm_wrap_ntb(struct gether *port,
 
 	} else if (ncm->skb_tx_data && ncm->timer_force_tx) {
 		/* If the tx was requested because of a timeout then send */
+		ncm_tx_adapt_timeout(ncm, ncm->ndp_dgram_count - 1);
 		skb2 = package_for_tx(ncm);
 		if (!skb2)
 			goto err;
@@ -1200,17 +1233,43 @@ static enum hrtimer_restart ncm_tx_timeout(struct hrtimer *data)
 	return HRTIMER_NORESTART;
 }
 
+/*
+ * Large datagrams of the page backed NTBs u_ether hands us are passed up
+ * as fragments of that page, only the Ethernet header is copied so that
+ * eth_type_trans() finds it in the linear area.  Each fragment pins the
+ * whole NTB page, so it is charged with @truesize, its share of the page.
+ */
+static struct sk_buff *ncm_rx_frag_skb(struct f_ncm *ncm, struct page *page,
+				       unsigned char *ntb, unsigned index,
+				       unsigned len, unsigned truesize)
+{
+	struct sk_buff *skb;
+
+	skb = netdev_alloc_skb_ip_align(ncm->netdev, ETH_HLEN);
+	if (!skb)
+		return NULL;
+	memcpy(skb_put(skb, ETH_HLEN), ntb + index, ETH_HLEN);
+
+	get_page(page);
+	skb_add_rx_frag(skb, 0, page, index + ETH_HLEN, len - ETH_HLEN,
+			max(truesize, len - ETH_HLEN));
+	return skb;
+}
+
 static int ncm_unwrap_ntb(struct gether *port,
 			  struct sk_buff *skb,
 			  struct sk_buff_head *list)
 {
 	struct f_ncm	*ncm = func_to_ncm(&port->func);
-	__le16		*tmp = (void *) skb->data;
+	struct page	*page = NULL;
+	unsigned char	*ntb = skb->data;
+	__le16		*tmp;
 	unsigned	index, index2;
 	int		ndp_index;
 	unsigned	dg_len, dg_len2;
 	unsigned	ndp_len;
 	unsigned	block_len;
+	unsigned	truesize;
 	struct sk_buff	*skb2;
 	int		ret = -EINVAL;
 	unsigned	ntb_max = le32_to_cpu(ntb_parameters.dwNtbOutMaxSize);
@@ -1219,12 +1278,24 @@ static int ncm_unwrap_ntb(struct gether *port,
 	unsigned	crc_len = ncm->is_crc ? sizeof(uint32_t) : 0;
 	int		dgram_counter;
 
+	/* the whole NTB is one page fragment with port->rx_frags */
+	if (skb_is_nonlinear(skb)) {
+		page = skb_frag_page(&skb_shinfo(skb)->frags[0]);
+		ntb = skb_frag_address(&skb_shinfo(skb)->frags[0]);
+	}
+	tmp = (void *)ntb;
+
+	if (skb->len < opts->nth_size) {
+		INFO(port->func.config->cdev, "Short NTB: %d\n", skb->len);
+		goto err;
+	}
+
 	/* dwSignature */
 	if (get_unaligned_le32(tmp) != opts->nth_sign) {
 		INFO(port->func.config->cdev, "Wrong NTH SIGN, skblen %d\n",
 			skb->len);
 		print_hex_dump(KERN_INFO, "HEAD:", DUMP_PREFIX_ADDRESS, 32, 1,
-			       skb->data, 32, false);
+			       ntb, 32, false);
 
 		goto err;
 	}
@@ -1242,6 +1313,15 @@ static int ncm_unwrap_ntb(struct gether *port,
 		INFO(port->func.config->cdev, "OUT size exceeded\n");
 		goto err;
 	}
+	/*
+	 * Every NDP and datagram is checked against block_len below, which
+	 * keeps them inside the transfer.
+	 */
+	if (block_len > skb->len) {
+		INFO(port->func.config->cdev, "Bad block length: %#X\n",
+		     block_len);
+		goto err;
+	}
 
 	ndp_index = get_ncm(&tmp, opts->ndp_index);
 
@@ -1264,7 +1344,7 @@ static int ncm_unwrap_ntb(struct gether *port,
 		 * walk through NDP
 		 * dwSignature
 		 */
-		tmp = (void *)(skb->data + ndp_index);
+		tmp = (void *)(ntb + ndp_index);
 		if (get_unaligned_le32(tmp) != ncm->ndp_sign) {
 			INFO(port->func.config->cdev, "Wrong NDP SIGN\n");
 			goto err;
@@ -1282,7 +1362,8 @@ static int ncm_unwrap_ntb(struct gether *port,
 		 */
 		if ((ndp_len < opts->ndp_size
 				+ 2 * 2 * (opts->dgram_item_len * 2)) ||
-				(ndp_len % opts->ndplen_align != 0)) {
+				(ndp_len % opts->ndplen_align != 0) ||
+				(ndp_len > block_len - ndp_index)) {
 			INFO(port->func.config->cdev, "Bad NDP length: %#X\n",
 			     ndp_len);
 			goto err;
@@ -1313,7 +1394,8 @@ static int ncm_unwrap_ntb(struct gether *port,
 			 * ethernet hdr + crc or larger than max frame size
 			 */
 			if ((dg_len < 14 + crc_len) ||
-					(dg_len > frame_max)) {
+					(dg_len > frame_max) ||
+					(index + dg_len > block_len)) {
 				INFO(port->func.config->cdev,
 				     "Bad dgram length: %#X\n", dg_len);
 				goto err;
@@ -1321,11 +1403,11 @@ static int ncm_unwrap_ntb(struct gether *port,
 			if (ncm->is_crc) {
 				uint32_t crc, crc2;
 
-				crc = get_unaligned_le32(skb->data +
+				crc = get_unaligned_le32(ntb +
 							 index + dg_len -
 							 crc_len);
 				crc2 = ~crc32_le(~0,
-						 skb->data + index,
+						 ntb + index,
 						 dg_len - crc_len);
 				if (crc != crc2) {
 					INFO(port->func.config->cdev,
@@ -1344,16 +1426,28 @@ static int ncm_unwrap_ntb(struct gether *port,
 				goto err;
 			}
 
-			/*
-			 * Copy the data into a new skb.
-			 * This ensures the truesize is correct
-			 */
-			skb2 = netdev_alloc_skb_ip_align(ncm->netdev,
-							 dg_len - crc_len);
-			if (skb2 == NULL)
-				goto err;
-			memcpy(skb_put(skb2, dg_len - crc_len),
-			       skb->data + index, dg_len - crc_len);
+			if (page && dg_len - crc_len > RX_COPYBREAK) {
+				/* the share of the page this datagram takes */
+				truesize = DIV_ROUND_UP((PAGE_SIZE <<
+						compound_order(page)) * dg_len,
+						block_len);
+				skb2 = ncm_rx_frag_skb(ncm, page, ntb, index,
+						       dg_len - crc_len,
+						       truesize);
+				if (skb2 == NULL)
+					goto err;
+			} else {
+				/*
+				 * Copy the data into a new skb.
+				 * This ensures the truesize is correct
+				 */
+				skb2 = netdev_alloc_skb_ip_align(ncm->netdev,
+							dg_len - crc_len);
+				if (skb2 == NULL)
+					goto err;
+				memcpy(skb_put(skb2, dg_len - crc_len),
+				       ntb + index, dg_len - crc_len);
+			}
 
 			skb_queue_tail(list, skb2);
 
@@ -1586,6 +1680,7 @@ static int ncm_bind(struct usb_configuration *c, struct usb_function *f)
 	tasklet_init(&ncm->tx_tasklet, ncm_tx_tasklet, (unsigned long) ncm);
 	hrtimer_init(&ncm->task_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 	ncm->task_timer.function = ncm_tx_timeout;
+	ncm->tx_timeout_ns = TX_TIMEOUT_NSECS;
 
 	DBG(cdev, "CDC Network: %s speed IN/%s OUT/%s NOTIFY/%s\n",
 			gadget_is_superspeed(c->cdev->gadget) ? "super" :
@@ -1783,6 +1878,7 @@ static struct usb_function *ncm_alloc(struct usb_function_instance *fi)
 	mutex_unlock(&opts->lock);
 	ncm->port.is_fixed = true;
 	ncm->port.supports_multi_frame = true;
+	ncm->port.rx_frags = true;
 
 	ncm->port.func.name = "cdc_network";
 	/* descriptors are per-instance copies */
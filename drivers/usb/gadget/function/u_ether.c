@@ -22,6 +22,7 @@
 #include <linux/ethtool.h>
 #include <linux/if_vlan.h>
 #include <linux/if_arp.h>
+#include <linux/irq_work.h>
 #include <linux/msm_rmnet.h>
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
@@ -57,8 +58,6 @@
  * blocks and still have efficient handling. */
 #define GETHER_MAX_ETH_FRAME_LEN 15412
 
-static struct workqueue_struct	*uether_wq;
-
 /* Extra buffer size to allocate for tx */
 #define EXTRA_ALLOCATION_SIZE_U_ETH	128
 
@@ -93,7 +92,11 @@ struct eth_dev {
 						struct sk_buff_head *list);
 
 	struct work_struct	work;
-	struct work_struct	rx_work;
+	struct napi_struct	napi;
+	/* schedules napi for completions outside interrupt context */
+	struct irq_work		napi_irq_work;
+	/* requests parked in rx_complete() while frames backed up */
+	unsigned int		rx_parked;
 
 	unsigned long		todo;
 	unsigned long		flags;
@@ -248,6 +251,33 @@ static void defer_kevent(struct eth_dev *dev, int flag)
 static void rx_complete(struct usb_ep *ep, struct usb_request *req);
 static void tx_complete(struct usb_ep *ep, struct usb_request *req);
 
+/*
+ * For links with gether.rx_frags: an skb whose only data is a page of at
+ * least @size bytes, which the unwrap() of the link hands out datagrams
+ * from as page fragments rather than copies.  The fragment is sized to
+ * the transfer on completion.
+ */
+static struct sk_buff *rx_alloc_page_skb(size_t size, gfp_t gfp_flags)
+{
+	unsigned int	order = get_order(size);
+	struct sk_buff	*skb;
+	struct page	*page;
+
+	page = alloc_pages(gfp_flags | __GFP_COMP | __GFP_NOWARN, order);
+	if (!page)
+		return NULL;
+
+	skb = alloc_skb(0, gfp_flags);
+	if (!skb) {
+		__free_pages(page, order);
+		return NULL;
+	}
+	skb_fill_page_desc(skb, 0, page, 0, 0);
+	skb->truesize += PAGE_SIZE << order;
+
+	return skb;
+}
+
 static int
 rx_submit(struct eth_dev *dev, struct usb_request *req, gfp_t gfp_flags)
 {
@@ -256,6 +286,7 @@ rx_submit(struct eth_dev *dev, struct usb_request *req, gfp_t gfp_flags)
 	size_t		size = 0;
 	struct usb_ep	*out;
 	unsigned long	flags;
+	bool		rx_frags;
 
 	spin_lock_irqsave(&dev->lock, flags);
 	if (dev->port_usb)
@@ -290,10 +321,14 @@ rx_submit(struct eth_dev *dev, struct usb_request *req, gfp_t gfp_flags)
 
 	if (dev->port_usb->is_fixed)
 		size = max_t(size_t, size, dev->port_usb->fixed_out_len);
+	rx_frags = dev->port_usb->rx_frags;
 	spin_unlock_irqrestore(&dev->lock, flags);
 
 	DBG(dev, "%s: size: %zd\n", __func__, size);
-	skb = alloc_skb(size, gfp_flags);
+	if (rx_frags)
+		skb = rx_alloc_page_skb(size, gfp_flags);
+	else
+		skb = alloc_skb(size, gfp_flags);
 	if (skb == NULL) {
 		DBG(dev, "no rx skb\n");
 		goto enomem;
@@ -306,7 +341,10 @@ rx_submit(struct eth_dev *dev, struct usb_request *req, gfp_t gfp_flags)
 	if (likely(!dev->no_skb_reserve))
 		skb_reserve(skb, 0);
 
-	req->buf = skb->data;
+	if (rx_frags)
+		req->buf = skb_frag_address(&skb_shinfo(skb)->frags[0]);
+	else
+		req->buf = skb->data;
 	req->length = size;
 	req->context = skb;
 
@@ -333,7 +371,15 @@ static void rx_complete(struct usb_ep *ep, struct usb_request *req)
 
 	/* normal completion */
 	case 0:
-		skb_put(skb, req->actual);
+		if (skb_is_nonlinear(skb)) {
+			/* the page of rx_alloc_page_skb() */
+			skb_frag_size_set(&skb_shinfo(skb)->frags[0],
+					  req->actual);
+			skb->len += req->actual;
+			skb->data_len += req->actual;
+		} else {
+			skb_put(skb, req->actual);
+		}
 
 		if (dev->unwrap) {
 			unsigned long	flags;
@@ -395,15 +441,33 @@ static void rx_complete(struct usb_ep *ep, struct usb_request *req)
 		}
 	} else {
 		/* rx buffers draining is delayed,defer further queuing to wq */
-		if (queue)
-			dev->rx_throttle++;
 		spin_lock(&dev->req_lock);
+		if (queue) {
+			dev->rx_throttle++;
+			dev->rx_parked++;
+		}
 		list_add(&req->list, &dev->rx_reqs);
 		spin_unlock(&dev->req_lock);
 	}
 
-	if (queue)
-		queue_work(uether_wq, &dev->rx_work);
+	/*
+	 * Some UDCs complete requests from a work item with interrupts off,
+	 * where a raised NET_RX softirq would wait for the next interrupt.
+	 */
+	if (queue) {
+		if (in_interrupt())
+			napi_schedule(&dev->napi);
+		else
+			irq_work_queue(&dev->napi_irq_work);
+	}
+}
+
+static void eth_napi_irq_work(struct irq_work *work)
+{
+	struct eth_dev	*dev = container_of(work, struct eth_dev,
+					    napi_irq_work);
+
+	napi_schedule(&dev->napi);
 }
 
 static int prealloc(struct list_head *list, struct usb_ep *ep, unsigned n)
@@ -482,7 +546,7 @@ static int alloc_requests(struct eth_dev *dev, struct gether *link, unsigned n)
 	return status;
 }
 
-static void rx_fill(struct eth_dev *dev, gfp_t gfp_flags)
+static void __rx_fill(struct eth_dev *dev, gfp_t gfp_flags, int max)
 {
 	struct usb_request	*req;
 	unsigned long		flags;
@@ -492,7 +556,7 @@ static void rx_fill(struct eth_dev *dev, gfp_t gfp_flags)
 	spin_lock_irqsave(&dev->req_lock, flags);
 	while (!list_empty(&dev->rx_reqs)) {
 		/* break the nexus of continuous completion and re-submission*/
-		if (++req_cnt > qlen(dev->gadget, dev->qmult))
+		if (++req_cnt > max)
 			break;
 
 		req = container_of(dev->rx_reqs.next,
@@ -513,6 +577,11 @@ static void rx_fill(struct eth_dev *dev, gfp_t gfp_flags)
 	spin_unlock_irqrestore(&dev->req_lock, flags);
 }
 
+static void rx_fill(struct eth_dev *dev, gfp_t gfp_flags)
+{
+	__rx_fill(dev, gfp_flags, qlen(dev->gadget, dev->qmult));
+}
+
 static __be16 ether_ip_type_trans(struct sk_buff *skb,
 	struct net_device *dev)
 {
@@ -538,18 +607,24 @@ static __be16 ether_ip_type_trans(struct sk_buff *skb,
 	return protocol;
 }
 
-static void process_rx_w(struct work_struct *work)
+/*
+ * Frames are passed up from NAPI context, so that GRO can merge the
+ * segments of a TCP stream arriving in the same NTB or burst before the
+ * stack sees them.
+ */
+static int eth_rx_poll(struct napi_struct *napi, int budget)
 {
-	struct eth_dev	*dev = container_of(work, struct eth_dev, rx_work);
+	struct eth_dev	*dev = container_of(napi, struct eth_dev, napi);
 	struct sk_buff	*skb;
-	int		status = 0;
+	unsigned long	flags;
+	unsigned int	parked;
+	int		work_done = 0;
 
-	if (!dev->port_usb)
-		return;
+	while (work_done < budget &&
+	       (skb = skb_dequeue(&dev->rx_frames))) {
+		work_done++;
 
-	while ((skb = skb_dequeue(&dev->rx_frames))) {
-		if (status < 0
-				|| ETH_HLEN > skb->len
+		if (ETH_HLEN > skb->len
 				|| skb->len > GETHER_MAX_ETH_FRAME_LEN) {
 			dev->net->stats.rx_errors++;
 			dev->net->stats.rx_length_errors++;
@@ -566,11 +641,29 @@ static void process_rx_w(struct work_struct *work)
 		dev->net->stats.rx_packets++;
 		dev->net->stats.rx_bytes += skb->len;
 
-		status = netif_rx_ni(skb);
+		napi_gro_receive(napi, skb);
 	}
 
-	if (netif_running(dev->net))
-		rx_fill(dev, GFP_KERNEL);
+	if (work_done < budget) {
+		napi_complete_done(napi, work_done);
+		/* rx_complete() may have queued more before we completed */
+		if (!skb_queue_empty(&dev->rx_frames))
+			napi_schedule(napi);
+	}
+
+	/*
+	 * Resubmit the requests parked while frames backed up.  Refilling
+	 * after an allocation failure is left to eth_work().
+	 */
+	spin_lock_irqsave(&dev->req_lock, flags);
+	parked = dev->rx_parked;
+	dev->rx_parked = 0;
+	spin_unlock_irqrestore(&dev->req_lock, flags);
+	if (parked && netif_running(dev->net) &&
+	    !test_bit(WORK_RX_MEMORY, &dev->todo))
+		__rx_fill(dev, GFP_ATOMIC, parked);
+
+	return work_done;
 }
 
 static void eth_work(struct work_struct *work)
@@ -1032,6 +1125,7 @@ static int eth_open(struct net_device *net)
 	struct gether	*link;
 
 	DBG(dev, "%s\n", __func__);
+	napi_enable(&dev->napi);
 	if (netif_carrier_ok(dev->net))
 		eth_start(dev, GFP_KERNEL);
 
@@ -1098,6 +1192,8 @@ static int eth_stop(struct net_device *net)
 	}
 	spin_unlock_irqrestore(&dev->lock, flags);
 
+	napi_disable(&dev->napi);
+
 	return 0;
 }
 
@@ -1337,7 +1433,8 @@ struct eth_dev *gether_setup_name(struct usb_gadget *g,
 	spin_lock_init(&dev->lock);
 	spin_lock_init(&dev->req_lock);
 	INIT_WORK(&dev->work, eth_work);
-	INIT_WORK(&dev->rx_work, process_rx_w);
+	netif_napi_add(net, &dev->napi, eth_rx_poll, NAPI_POLL_WEIGHT);
+	init_irq_work(&dev->napi_irq_work, eth_napi_irq_work);
 	INIT_LIST_HEAD(&dev->tx_reqs);
 	INIT_LIST_HEAD(&dev->rx_reqs);
 
@@ -1404,7 +1501,8 @@ struct net_device *gether_setup_name_default(const char *netname)
 	spin_lock_init(&dev->lock);
 	spin_lock_init(&dev->req_lock);
 	INIT_WORK(&dev->work, eth_work);
-	INIT_WORK(&dev->rx_work, process_rx_w);
+	netif_napi_add(net, &dev->napi, eth_rx_poll, NAPI_POLL_WEIGHT);
+	init_irq_work(&dev->napi_irq_work, eth_napi_irq_work);
 	INIT_LIST_HEAD(&dev->tx_reqs);
 	INIT_LIST_HEAD(&dev->rx_reqs);
 
@@ -1591,7 +1689,8 @@ void gether_cleanup(struct eth_dev *dev)
 	uether_debugfs_exit(dev);
 	unregister_netdev(dev->net);
 	flush_work(&dev->work);
-	cancel_work_sync(&dev->rx_work);
+	irq_work_sync(&dev->napi_irq_work);
+	netif_napi_del(&dev->napi);
 	free_netdev(dev->net);
 }
 EXPORT_SYMBOL_GPL(gether_cleanup);
@@ -1858,23 +1957,6 @@ static void uether_debugfs_exit(struct eth_dev *dev)
 	dev->uether_dfile = NULL;
 }
 
-static int __init gether_init(void)
-{
-	uether_wq  = create_singlethread_workqueue("uether");
-	if (!uether_wq) {
-		pr_err("%s: Unable to create workqueue: uether\n", __func__);
-		return -ENOMEM;
-	}
-	return 0;
-}
-module_init(gether_init);
-
-static void __exit gether_exit(void)
-{
-	destroy_workqueue(uether_wq);
-
-}
-module_exit(gether_exit);
 MODULE_AUTHOR("David Brownell");
 MODULE_DESCRIPTION("ethernet over USB driver");
 MODULE_LICENSE("GPL v2");
@@ -78,6 +78,8 @@ struct gether {
 	unsigned		dl_max_pkts_per_xfer;
 	bool				multi_pkt_xfer;
 	bool				supports_multi_frame;
+	/* rx buffers are pages, unwrap() may pass them up as fragments */
+	bool				rx_frags;
 	struct sk_buff			*(*wrap)(struct gether *port,
 						struct sk_buff *skb);
 	int				(*unwrap)(struct gether *port,
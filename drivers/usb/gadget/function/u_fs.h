@@ -18,6 +18,7 @@
 
 #include <linux/usb/composite.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/mutex.h>
 #include <linux/workqueue.h>
 
@@ -277,6 +278,13 @@ struct ffs_data {
 	bool no_disconnect;
 	struct work_struct reset_work;
 
+	/*
+	 * Finished AIO requests, completed to user space in batches by
+	 * aio_work so that a burst of them costs one eventfd wakeup.
+	 */
+	struct llist_head		aio_done;
+	struct work_struct		aio_work;
+
 	/*
 	 * The endpoint files, filled by ffs_epfiles_create(),
 	 * destroyed by ffs_epfiles_destroy().
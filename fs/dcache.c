@@ -85,6 +85,14 @@
 int sysctl_vfs_cache_pressure __read_mostly = 75;
 EXPORT_SYMBOL_GPL(sysctl_vfs_cache_pressure);
 
+/*
+ * Unused negative dentries are kept on their own per-superblock LRU,
+ * which the shrinkers prune before the LRU of positive dentries.  With a
+ * non zero limit, unused negative dentries making up more than that
+ * percentage of all dentries are also reclaimed right away by a worker.
+ */
+int sysctl_negative_dentry_limit __read_mostly;
+
 __cacheline_aligned_in_smp DEFINE_SEQLOCK(rename_lock);
 
 EXPORT_SYMBOL(rename_lock);
@@ -128,8 +136,7 @@ struct dentry_stat_t dentry_stat = {
 
 static DEFINE_PER_CPU(long, nr_dentry);
 static DEFINE_PER_CPU(long, nr_dentry_unused);
-
-#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
+static DEFINE_PER_CPU(long, nr_dentry_negative);
 
 /*
  * Here we resort to our own counters instead of using generic per-cpu counters
@@ -152,6 +159,17 @@ static long get_nr_dentry(void)
 	return sum < 0 ? 0 : sum;
 }
 
+static long get_nr_dentry_negative(void)
+{
+	int i;
+	long sum = 0;
+	for_each_possible_cpu(i)
+		sum += per_cpu(nr_dentry_negative, i);
+	return sum < 0 ? 0 : sum;
+}
+
+#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
+
 static long get_nr_dentry_unused(void)
 {
 	int i;
@@ -166,6 +184,7 @@ int proc_nr_dentry(struct ctl_table *table, int write, void __user *buffer,
 {
 	dentry_stat.nr_dentry = get_nr_dentry();
 	dentry_stat.nr_unused = get_nr_dentry_unused();
+	dentry_stat.nr_negative = get_nr_dentry_negative();
 	return proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
 }
 #endif
@@ -306,6 +325,8 @@ void release_dentry_name_snapshot(struct name_snapshot *name)
 }
 EXPORT_SYMBOL(release_dentry_name_snapshot);
 
+static void d_lru_retype(struct dentry *dentry);
+
 static inline void __d_set_inode_and_type(struct dentry *dentry,
 					  struct inode *inode,
 					  unsigned type_flags)
@@ -317,6 +338,7 @@ static inline void __d_set_inode_and_type(struct dentry *dentry,
 	flags &= ~(DCACHE_ENTRY_TYPE | DCACHE_FALLTHRU);
 	flags |= type_flags;
 	WRITE_ONCE(dentry->d_flags, flags);
+	d_lru_retype(dentry);
 }
 
 static inline void __d_clear_type_and_inode(struct dentry *dentry)
@@ -326,6 +348,7 @@ static inline void __d_clear_type_and_inode(struct dentry *dentry)
 	flags &= ~(DCACHE_ENTRY_TYPE | DCACHE_FALLTHRU);
 	WRITE_ONCE(dentry->d_flags, flags);
 	dentry->d_inode = NULL;
+	d_lru_retype(dentry);
 }
 
 static void dentry_free(struct dentry *dentry)
@@ -380,16 +403,44 @@ static void dentry_unlink_inode(struct dentry * dentry)
  * The per-cpu "nr_dentry_unused" counters are updated with
  * the DCACHE_LRU_LIST bit.
  *
+ * The DCACHE_NEGATIVE_LRU bit is set whenever the dentry is on
+ * the superblock's negative dentry LRU rather than its main one,
+ * and the per-cpu "nr_dentry_negative" counters follow it.
+ *
  * These helper functions make sure we always follow the
  * rules. d_lock must be held by the caller.
  */
 #define D_FLAG_VERIFY(dentry,x) WARN_ON_ONCE(((dentry)->d_flags & (DCACHE_LRU_LIST | DCACHE_SHRINK_LIST)) != (x))
+
+static void d_negative_check_limit(void);
+
+static struct list_lru *d_lru_list(struct dentry *dentry)
+{
+	if (dentry->d_flags & DCACHE_NEGATIVE_LRU)
+		return &dentry->d_sb->s_dentry_neg_lru;
+	return &dentry->d_sb->s_dentry_lru;
+}
+
+static void d_lru_clear_negative(struct dentry *dentry)
+{
+	if (dentry->d_flags & DCACHE_NEGATIVE_LRU) {
+		dentry->d_flags &= ~DCACHE_NEGATIVE_LRU;
+		this_cpu_dec(nr_dentry_negative);
+	}
+}
+
 static void d_lru_add(struct dentry *dentry)
 {
 	D_FLAG_VERIFY(dentry, 0);
 	dentry->d_flags |= DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
-	WARN_ON_ONCE(!list_lru_add(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
+	if (d_really_is_negative(dentry)) {
+		dentry->d_flags |= DCACHE_NEGATIVE_LRU;
+		/* only sample the limit every so often, it sums all cpus */
+		if (!(this_cpu_inc_return(nr_dentry_negative) & 63))
+			d_negative_check_limit();
+	}
+	WARN_ON_ONCE(!list_lru_add(d_lru_list(dentry), &dentry->d_lru));
 }
 
 static void d_lru_del(struct dentry *dentry)
@@ -397,7 +448,25 @@ static void d_lru_del(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
-	WARN_ON_ONCE(!list_lru_del(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
+	WARN_ON_ONCE(!list_lru_del(d_lru_list(dentry), &dentry->d_lru));
+	d_lru_clear_negative(dentry);
+}
+
+/*
+ * A dentry on an LRU that gained or lost its inode moves to the other
+ * LRU, so that the negative LRU only ever holds negative dentries.
+ */
+static void d_lru_retype(struct dentry *dentry)
+{
+	if ((dentry->d_flags & (DCACHE_LRU_LIST | DCACHE_SHRINK_LIST)) !=
+	    DCACHE_LRU_LIST)
+		return;
+	if (!(dentry->d_flags & DCACHE_NEGATIVE_LRU) ==
+	    !d_really_is_negative(dentry))
+		return;
+
+	d_lru_del(dentry);
+	d_lru_add(dentry);
 }
 
 static void d_shrink_del(struct dentry *dentry)
@@ -428,6 +497,7 @@ static void d_lru_isolate(struct list_lru_one *lru, struct dentry *dentry)
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
 	list_lru_isolate(lru, &dentry->d_lru);
+	d_lru_clear_negative(dentry);
 }
 
 static void d_lru_shrink_move(struct list_lru_one *lru, struct dentry *dentry,
@@ -436,6 +506,7 @@ static void d_lru_shrink_move(struct list_lru_one *lru, struct dentry *dentry,
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags |= DCACHE_SHRINK_LIST;
 	list_lru_isolate_move(lru, &dentry->d_lru, list);
+	d_lru_clear_negative(dentry);
 }
 
 /*
@@ -1129,12 +1200,69 @@ long prune_dcache_sb(struct super_block *sb, struct shrink_control *sc)
 	LIST_HEAD(dispose);
 	long freed;
 
-	freed = list_lru_shrink_walk(&sb->s_dentry_lru, sc,
+	/* negative dentries go first, the walks share sc->nr_to_scan */
+	freed = list_lru_shrink_walk(&sb->s_dentry_neg_lru, sc,
 				     dentry_lru_isolate, &dispose);
+	if (sc->nr_to_scan)
+		freed += list_lru_shrink_walk(&sb->s_dentry_lru, sc,
+					      dentry_lru_isolate, &dispose);
 	shrink_dentry_list(&dispose);
 	return freed;
 }
 
+/*
+ * Reclaim of unused negative dentries beyond sysctl_negative_dentry_limit
+ * percent of all dentries.  The excess is taken from the superblocks in
+ * turn, referenced dentries get one more pass as in the shrinkers.
+ */
+static void prune_negative_sb(struct super_block *sb, void *arg)
+{
+	unsigned long *excess = arg;
+	unsigned long nr;
+	LIST_HEAD(dispose);
+
+	if (!*excess)
+		return;
+
+	nr = min(*excess, list_lru_count(&sb->s_dentry_neg_lru));
+	if (!nr)
+		return;
+
+	*excess -= list_lru_walk(&sb->s_dentry_neg_lru, dentry_lru_isolate,
+				 &dispose, nr);
+	shrink_dentry_list(&dispose);
+}
+
+static unsigned long d_negative_excess(void)
+{
+	int limit = READ_ONCE(sysctl_negative_dentry_limit);
+	long nr_negative, allowed;
+
+	if (!limit)
+		return 0;
+
+	nr_negative = get_nr_dentry_negative();
+	allowed = get_nr_dentry() / 100 * limit;
+	return nr_negative > allowed ? nr_negative - allowed : 0;
+}
+
+static void d_negative_reclaim_workfn(struct work_struct *work)
+{
+	unsigned long excess = d_negative_excess();
+
+	if (excess)
+		iterate_supers(prune_negative_sb, &excess);
+}
+
+static DECLARE_WORK(d_negative_reclaim_work, d_negative_reclaim_workfn);
+
+static void d_negative_check_limit(void)
+{
+	if (READ_ONCE(sysctl_negative_dentry_limit) &&
+	    !work_pending(&d_negative_reclaim_work) && d_negative_excess())
+		schedule_work(&d_negative_reclaim_work);
+}
+
 static enum lru_status dentry_lru_isolate_shrink(struct list_head *item,
 		struct list_lru_one *lru, spinlock_t *lru_lock, void *arg)
 {
@@ -1168,11 +1296,14 @@ void shrink_dcache_sb(struct super_block *sb)
 	do {
 		LIST_HEAD(dispose);
 
+		list_lru_walk(&sb->s_dentry_neg_lru,
+			dentry_lru_isolate_shrink, &dispose, 1024);
 		list_lru_walk(&sb->s_dentry_lru,
 			dentry_lru_isolate_shrink, &dispose, 1024);
 		shrink_dentry_list(&dispose);
 		cond_resched();
-	} while (list_lru_count(&sb->s_dentry_lru) > 0);
+	} while (list_lru_count(&sb->s_dentry_lru) > 0 ||
+		 list_lru_count(&sb->s_dentry_neg_lru) > 0);
 }
 EXPORT_SYMBOL(shrink_dcache_sb);
 
@@ -11,6 +11,12 @@
 /* destroy all events sitting in this groups notification queue */
 extern void fsnotify_flush_notify(struct fsnotify_group *group);
 
+/* upper bound for the delay of batched event delivery */
+#define FSNOTIFY_MAX_BATCH_DELAY_MS	1000
+
+/* wakes the readers of a group once its batch delay expired */
+extern void fsnotify_batch_timeout(unsigned long data);
+
 /* protects reads of inode and vfsmount marks list */
 extern struct srcu_struct fsnotify_mark_srcu;
 
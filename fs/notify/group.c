@@ -66,6 +66,9 @@ void fsnotify_destroy_group(struct fsnotify_group *group)
 	 */
 	fsnotify_group_stop_queueing(group);
 
+	/* nothing queues events anymore, so the batch timer stays off */
+	del_timer_sync(&group->batch_timer);
+
 	/* clear all inode marks for this group, attach them to destroy_list */
 	fsnotify_detach_group_marks(group);
 
@@ -129,6 +132,8 @@ struct fsnotify_group *fsnotify_alloc_group(const struct fsnotify_ops *ops)
 	INIT_LIST_HEAD(&group->notification_list);
 	init_waitqueue_head(&group->notification_waitq);
 	group->max_events = UINT_MAX;
+	setup_timer(&group->batch_timer, fsnotify_batch_timeout,
+		    (unsigned long)group);
 
 	mutex_init(&group->mark_mutex);
 	INIT_LIST_HEAD(&group->marks_list);
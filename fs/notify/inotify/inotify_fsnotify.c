@@ -53,13 +53,60 @@ static bool event_compare(struct fsnotify_event *old_fsn,
 	return false;
 }
 
+/*
+ * Do 2 events concern the same object of the same watch?  Events on
+ * directory children are told apart by name.
+ */
+static bool event_same_object(struct fsnotify_event *old_fsn,
+			      struct fsnotify_event *new_fsn)
+{
+	struct inotify_event_info *old, *new;
+
+	old = INOTIFY_E(old_fsn);
+	new = INOTIFY_E(new_fsn);
+	return old_fsn->inode == new_fsn->inode && old->wd == new->wd &&
+	       old->name_len == new->name_len &&
+	       (!old->name_len || !strcmp(old->name, new->name));
+}
+
+/*
+ * Apps writing a file in many small chunks queue a IN_MODIFY per write,
+ * and with several files being written those aren't consecutive.  Merge
+ * a IN_MODIFY with a queued one for the same object as long as no other
+ * event for that object was queued after it, so the order of events of
+ * each object is kept.  The scan is bounded to the most recent events.
+ */
+#define INOTIFY_MERGE_WINDOW	128
+
 static int inotify_merge(struct list_head *list,
 			  struct fsnotify_event *event)
 {
 	struct fsnotify_event *last_event;
+	int window = INOTIFY_MERGE_WINDOW;
 
 	last_event = list_entry(list->prev, struct fsnotify_event, list);
-	return event_compare(last_event, event);
+	if (event_compare(last_event, event))
+		return 1;
+
+	/* events on children of a watched directory carry FS_EVENT_ON_CHILD */
+	if ((event->mask & ~FS_EVENT_ON_CHILD) != FS_MODIFY)
+		return 0;
+
+	list_for_each_entry_reverse(last_event, list, list) {
+		if (!window--)
+			break;
+		/* the watch went away in between */
+		if (last_event->mask & FS_IN_IGNORED) {
+			if (INOTIFY_E(last_event)->wd == INOTIFY_E(event)->wd)
+				return 0;
+			continue;
+		}
+		if (event_same_object(last_event, event))
+			return (last_event->mask & ~FS_EVENT_ON_CHILD) ==
+			       FS_MODIFY;
+	}
+
+	return 0;
 }
 
 int inotify_handle_event(struct fsnotify_group *group,
@@ -289,6 +289,7 @@ static long inotify_ioctl(struct file *file, unsigned int cmd,
 {
 	struct fsnotify_group *group;
 	struct fsnotify_event *fsn_event;
+	struct inotify_batch batch;
 	void __user *p;
 	int ret = -ENOTTY;
 	size_t send_len = 0;
@@ -309,6 +310,14 @@ static long inotify_ioctl(struct file *file, unsigned int cmd,
 		spin_unlock(&group->notification_lock);
 		ret = put_user(send_len, (int __user *) p);
 		break;
+	case INOTIFY_IOC_SETBATCH:
+		if (copy_from_user(&batch, p, sizeof(batch))) {
+			ret = -EFAULT;
+			break;
+		}
+		ret = fsnotify_set_batching(group, batch.max_latency_ms,
+					    batch.max_events);
+		break;
 	}
 
 	return ret;
@@ -87,6 +87,41 @@ void fsnotify_destroy_event(struct fsnotify_group *group,
 	group->ops->free_event(event);
 }
 
+static void fsnotify_wake_readers(struct fsnotify_group *group)
+{
+	wake_up(&group->notification_waitq);
+	kill_fasync(&group->fsn_fa, SIGIO, POLL_IN);
+}
+
+void fsnotify_batch_timeout(unsigned long data)
+{
+	fsnotify_wake_readers((struct fsnotify_group *)data);
+}
+
+/*
+ * Set up batched delivery for @group: readers are woken @delay_ms after
+ * the first event was queued or once @events events are queued.  A zero
+ * @delay_ms wakes readers for every event again, a zero @events only
+ * goes by the delay.
+ */
+int fsnotify_set_batching(struct fsnotify_group *group,
+			  unsigned int delay_ms, unsigned int events)
+{
+	if (delay_ms > FSNOTIFY_MAX_BATCH_DELAY_MS)
+		return -EINVAL;
+
+	spin_lock(&group->notification_lock);
+	group->batch_delay = msecs_to_jiffies(delay_ms);
+	group->batch_events = events;
+	spin_unlock(&group->notification_lock);
+
+	/* deliver what is held back under the old settings */
+	if (del_timer_sync(&group->batch_timer))
+		fsnotify_wake_readers(group);
+
+	return 0;
+}
+
 /*
  * Add an event to the group notification queue.  The group can later pull this
  * event off the queue to deal with.  The function returns 0 if the event was
@@ -133,10 +168,21 @@ int fsnotify_add_event(struct fsnotify_group *group,
 queue:
 	group->q_len++;
 	list_add_tail(&event->list, list);
+
+	/* an overflow is reported right away, it means events were lost */
+	if (group->batch_delay && event != group->overflow_event &&
+	    (!group->batch_events || group->q_len < group->batch_events)) {
+		if (!timer_pending(&group->batch_timer))
+			mod_timer(&group->batch_timer,
+				  jiffies + group->batch_delay);
+		spin_unlock(&group->notification_lock);
+		return ret;
+	}
 	spin_unlock(&group->notification_lock);
 
-	wake_up(&group->notification_waitq);
-	kill_fasync(&group->fsn_fa, SIGIO, POLL_IN);
+	if (group->batch_delay)
+		del_timer(&group->batch_timer);
+	fsnotify_wake_readers(group);
 	return ret;
 }
 
@@ -137,18 +137,40 @@ void pipe_wait(struct pipe_inode_info *pipe)
 	pipe_lock(pipe);
 }
 
+/*
+ * Released pages are kept on a small per-pipe stack so that a writer
+ * streaming through the pipe reuses the pages the reader just drained
+ * instead of going to the page allocator for every buffer.  The stack
+ * is bounded by the ring size as there can't be more pages in flight.
+ */
+static struct page *pipe_get_tmp_page(struct pipe_inode_info *pipe)
+{
+	if (pipe->nr_tmp_pages)
+		return pipe->tmp_pages[--pipe->nr_tmp_pages];
+
+	return alloc_page(GFP_HIGHUSER | __GFP_ACCOUNT);
+}
+
+static void pipe_put_tmp_page(struct pipe_inode_info *pipe, struct page *page)
+{
+	if (pipe->nr_tmp_pages < min_t(unsigned int, pipe->buffers,
+				       PIPE_TMP_PAGES))
+		pipe->tmp_pages[pipe->nr_tmp_pages++] = page;
+	else
+		put_page(page);
+}
+
 static void anon_pipe_buf_release(struct pipe_inode_info *pipe,
 				  struct pipe_buffer *buf)
 {
 	struct page *page = buf->page;
 
 	/*
-	 * If nobody else uses this page, and we don't already have a
-	 * temporary page, let's keep track of it as a one-deep
-	 * allocation cache. (Otherwise just release our reference to it)
+	 * If nobody else uses this page, keep it for the next write.
+	 * (Otherwise just release our reference to it)
 	 */
-	if (page_count(page) == 1 && !pipe->tmp_page)
-		pipe->tmp_page = page;
+	if (page_count(page) == 1)
+		pipe_put_tmp_page(pipe, page);
 	else
 		put_page(page);
 }
@@ -442,16 +464,13 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 		if (bufs < pipe->buffers) {
 			int newbuf = (pipe->curbuf + bufs) & (pipe->buffers-1);
 			struct pipe_buffer *buf = pipe->bufs + newbuf;
-			struct page *page = pipe->tmp_page;
+			struct page *page;
 			int copied;
 
-			if (!page) {
-				page = alloc_page(GFP_HIGHUSER | __GFP_ACCOUNT);
-				if (unlikely(!page)) {
-					ret = ret ? : -ENOMEM;
-					break;
-				}
-				pipe->tmp_page = page;
+			page = pipe_get_tmp_page(pipe);
+			if (unlikely(!page)) {
+				ret = ret ? : -ENOMEM;
+				break;
 			}
 			/* Always wake up, even if the copy fails. Otherwise
 			 * we lock up (O_NONBLOCK-)readers that sleep due to
@@ -461,6 +480,7 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 			do_wakeup = 1;
 			copied = copy_page_from_iter(page, 0, PAGE_SIZE, from);
 			if (unlikely(copied < PAGE_SIZE && iov_iter_count(from))) {
+				pipe_put_tmp_page(pipe, page);
 				if (!ret)
 					ret = -EFAULT;
 				break;
@@ -478,7 +498,6 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 				buf->flags = PIPE_BUF_FLAG_PACKET;
 			}
 			pipe->nrbufs = ++bufs;
-			pipe->tmp_page = NULL;
 
 			if (!iov_iter_count(from))
 				break;
@@ -706,8 +725,8 @@ void free_pipe_info(struct pipe_inode_info *pipe)
 		if (buf->ops)
 			pipe_buf_release(pipe, buf);
 	}
-	if (pipe->tmp_page)
-		__free_page(pipe->tmp_page);
+	for (i = 0; i < pipe->nr_tmp_pages; i++)
+		put_page(pipe->tmp_pages[i]);
 	kfree(pipe->bufs);
 	kfree(pipe);
 }
@@ -683,6 +683,86 @@ ssize_t splice_from_pipe(struct pipe_inode_info *pipe, struct file *out,
 	return ret;
 }
 
+/*
+ * Can pipe pages be moved into the page cache of @out?  Only regular
+ * files going through the page cache qualify, shmem and DAX manage
+ * their pages differently.
+ */
+static bool splice_can_gift(struct file *out)
+{
+	struct inode *inode = file_inode(out);
+
+	return S_ISREG(inode->i_mode) && !(out->f_flags & O_DIRECT) &&
+	       !IS_DAX(inode) && !shmem_mapping(out->f_mapping);
+}
+
+/*
+ * Move the page of @buf into the page cache of @mapping at @index.  The
+ * write that follows finds the page in the cache with the data already
+ * in place, so the filesystem sets up its blocks as for any other write
+ * and neither a page cache page is allocated nor the pipe page freed.
+ * Stealing an anonymous pipe page drops its kmemcg charge, the page
+ * cache charges it to the file like any other.  Only pages beyond EOF are
+ * gifted: a failed write then leaves nothing visible and the caller
+ * takes back what it inserted.  Returns true if the page was moved.
+ */
+static bool splice_gift_page(struct pipe_inode_info *pipe,
+			     struct pipe_buffer *buf,
+			     struct address_space *mapping, pgoff_t index)
+{
+	struct page *page = buf->page;
+
+	if (pipe_buf_steal(pipe, buf))
+		return false;
+
+	/* pages still known to another owner can't enter the page cache */
+	if (page->mapping || PageLRU(page) || page_mapped(page) ||
+	    PageSwapBacked(page) || PageCompound(page)) {
+		unlock_page(page);
+		return false;
+	}
+
+	if (add_to_page_cache_lru(page, mapping, index,
+			mapping_gfp_constraint(mapping, GFP_KERNEL)))
+		return false;
+
+	SetPageUptodate(page);
+	unlock_page(page);
+
+	/* the page cache holds its own reference from now on */
+	buf->ops = &page_cache_pipe_buf_ops;
+	buf->flags &= ~PIPE_BUF_FLAG_GIFT;
+	return true;
+}
+
+/*
+ * Take the gifted pages @start to @end that a short write didn't get to
+ * out of the page cache of @inode again.  The pipe still holds references
+ * to them, which invalidate_mapping_pages() would give up on, so they are
+ * deleted directly.  Pages somebody dirtied meanwhile or that are no
+ * longer beyond EOF are left alone.  The pipe buffers stay valid: the
+ * pages remain uptodate and simply lose their mapping.
+ */
+static void splice_ungift_pages(struct inode *inode, pgoff_t start,
+				pgoff_t end)
+{
+	struct address_space *mapping = inode->i_mapping;
+	pgoff_t index;
+
+	for (index = start; index <= end; index++) {
+		struct page *page = find_lock_page(mapping, index);
+
+		if (!page)
+			continue;
+		if (page->mapping == mapping && !PageDirty(page) &&
+		    !PageWriteback(page) && !page_mapped(page) &&
+		    page_offset(page) >= i_size_read(inode))
+			delete_from_page_cache(page);
+		unlock_page(page);
+		put_page(page);
+	}
+}
+
 /**
  * iter_file_splice_write - splice data from a pipe to a file
  * @pipe:	pipe info
@@ -710,6 +790,7 @@ iter_file_splice_write(struct pipe_inode_info *pipe, struct file *out,
 	int nbufs = pipe->buffers;
 	struct bio_vec *array = kcalloc(nbufs, sizeof(struct bio_vec),
 					GFP_KERNEL);
+	bool gift = (flags & SPLICE_F_MOVE) && splice_can_gift(out);
 	ssize_t ret;
 
 	if (unlikely(!array))
@@ -720,6 +801,7 @@ iter_file_splice_write(struct pipe_inode_info *pipe, struct file *out,
 	splice_from_pipe_begin(&sd);
 	while (sd.total_len) {
 		struct iov_iter from;
+		pgoff_t gift_start = ULONG_MAX, gift_end = 0;
 		size_t left;
 		int n, idx;
 
@@ -757,6 +839,19 @@ iter_file_splice_write(struct pipe_inode_info *pipe, struct file *out,
 				goto done;
 			}
 
+			if (gift && buf->offset == 0 && this_len == PAGE_SIZE) {
+				loff_t pos = sd.pos + sd.total_len - left;
+				pgoff_t index = pos >> PAGE_SHIFT;
+
+				if (!offset_in_page(pos) &&
+				    pos >= i_size_read(file_inode(out)) &&
+				    splice_gift_page(pipe, buf, out->f_mapping,
+						     index)) {
+					gift_start = min(gift_start, index);
+					gift_end = index;
+				}
+			}
+
 			array[n].bv_page = buf->page;
 			array[n].bv_len = this_len;
 			array[n].bv_offset = buf->offset;
@@ -766,6 +861,14 @@ iter_file_splice_write(struct pipe_inode_info *pipe, struct file *out,
 		iov_iter_bvec(&from, ITER_BVEC | WRITE, array, n,
 			      sd.total_len - left);
 		ret = vfs_iter_write(out, &from, &sd.pos);
+
+		/* drop gifted pages the write didn't get to */
+		if (gift_start <= gift_end &&
+		    sd.pos < ((loff_t)gift_end + 1) << PAGE_SHIFT)
+			splice_ungift_pages(file_inode(out),
+				max_t(pgoff_t, gift_start,
+				      DIV_ROUND_UP(sd.pos, PAGE_SIZE)),
+				gift_end);
 		if (ret <= 0)
 			break;
 
@@ -79,7 +79,8 @@ static unsigned long super_cache_scan(struct shrinker *shrink,
 		fs_objects = sb->s_op->nr_cached_objects(sb, sc);
 
 	inodes = list_lru_shrink_count(&sb->s_inode_lru, sc);
-	dentries = list_lru_shrink_count(&sb->s_dentry_lru, sc);
+	dentries = list_lru_shrink_count(&sb->s_dentry_lru, sc) +
+		   list_lru_shrink_count(&sb->s_dentry_neg_lru, sc);
 	total_objects = dentries + inodes + fs_objects + 1;
 	if (!total_objects)
 		total_objects = 1;
@@ -140,6 +141,7 @@ static unsigned long super_cache_count(struct shrinker *shrink,
 		total_objects = sb->s_op->nr_cached_objects(sb, sc);
 
 	total_objects += list_lru_shrink_count(&sb->s_dentry_lru, sc);
+	total_objects += list_lru_shrink_count(&sb->s_dentry_neg_lru, sc);
 	total_objects += list_lru_shrink_count(&sb->s_inode_lru, sc);
 
 	total_objects = vfs_pressure_ratio(total_objects);
@@ -173,6 +175,7 @@ static void destroy_super_rcu(struct rcu_head *head)
 static void destroy_super(struct super_block *s)
 {
 	list_lru_destroy(&s->s_dentry_lru);
+	list_lru_destroy(&s->s_dentry_neg_lru);
 	list_lru_destroy(&s->s_inode_lru);
 	security_sb_free(s);
 	WARN_ON(!list_empty(&s->s_mounts));
@@ -228,6 +231,8 @@ static struct super_block *alloc_super(struct file_system_type *type, int flags,
 
 	if (list_lru_init_memcg(&s->s_dentry_lru))
 		goto fail;
+	if (list_lru_init_memcg(&s->s_dentry_neg_lru))
+		goto fail;
 	if (list_lru_init_memcg(&s->s_inode_lru))
 		goto fail;
 
@@ -325,6 +330,7 @@ void deactivate_locked_super(struct super_block *s)
 		 * the lru lists right now.
 		 */
 		list_lru_destroy(&s->s_dentry_lru);
+		list_lru_destroy(&s->s_dentry_neg_lru);
 		list_lru_destroy(&s->s_inode_lru);
 
 		put_filesystem(fs);
@@ -33,6 +33,10 @@ struct cpuidle_state_usage {
 	unsigned long long	disable;
 	unsigned long long	usage;
 	unsigned long long	time; /* in US */
+	unsigned long long	hits; /* wakeups matching the timer prediction */
+	unsigned long long	misses; /* wakeups before the predicted timer */
+	unsigned long long	early; /* state was too deep for the idle time */
+	unsigned long long	late; /* a deeper state would have fit */
 };
 
 struct cpuidle_state {
@@ -59,7 +59,8 @@ struct dentry_stat_t {
 	long nr_unused;
 	long age_limit;          /* age in seconds */
 	long want_pages;         /* pages requested by system */
-	long dummy[2];
+	long nr_negative;        /* unused negative dentries */
+	long dummy;
 };
 extern struct dentry_stat_t dentry_stat;
 
@@ -210,6 +211,7 @@ struct dentry_operations {
 #define DCACHE_FALLTHRU			0x01000000 /* Fall through to lower layer */
 #define DCACHE_ENCRYPTED_NAME		0x02000000 /* Encrypted name (dir key was unavailable) */
 #define DCACHE_OP_REAL			0x04000000
+#define DCACHE_NEGATIVE_LRU		0x08000000 /* On the negative dentry LRU */
 
 #define DCACHE_PAR_LOOKUP		0x10000000 /* being looked up (with parent locked shared) */
 #define DCACHE_DENTRY_CURSOR		0x20000000
@@ -496,6 +498,7 @@ static inline bool d_is_fallthru(const struct dentry *dentry)
 
 
 extern int sysctl_vfs_cache_pressure;
+extern int sysctl_negative_dentry_limit;
 
 static inline unsigned long vfs_pressure_ratio(unsigned long val)
 {
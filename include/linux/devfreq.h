@@ -59,6 +59,23 @@ struct devfreq_dev_status {
  */
 #define DEVFREQ_FLAG_LEAST_UPPER_BOUND		0x1
 
+/* Number of log2 buckets of the governor decision latency histogram */
+#define DEVFREQ_LAT_BUCKETS	16
+
+/**
+ * struct devfreq_opp_hint - Anti-oscillation hints for an OPP
+ * @min_residency_ms:	Minimum time to stay at the OPP before a governor
+ *			request may lower the frequency.
+ * @hyst_pct:		Governor requests less than this percentage below
+ *			the OPP don't lower the frequency.
+ *
+ * Requests to raise the frequency are never held back.
+ */
+struct devfreq_opp_hint {
+	unsigned int min_residency_ms;
+	unsigned int hyst_pct;
+};
+
 /**
  * struct devfreq_dev_profile - Devfreq's user device profile
  * @initial_freq:	The operating frequency when devfreq_add_device() is
@@ -85,6 +102,8 @@ struct devfreq_dev_status {
  *			this is the time to unregister it.
  * @freq_table:	Optional list of frequencies to support statistics.
  * @max_state:	The size of freq_table.
+ * @opp_hints:	Optional initial anti-oscillation hints, indexed like
+ *		freq_table. They can be changed through sysfs later on.
  */
 struct devfreq_dev_profile {
 	unsigned long initial_freq;
@@ -98,6 +117,7 @@ struct devfreq_dev_profile {
 
 	unsigned long *freq_table;
 	unsigned int max_state;
+	const struct devfreq_opp_hint *opp_hints;
 };
 
 /**
@@ -153,6 +173,10 @@ struct devfreq_governor {
  * @trans_table:	Statistics of devfreq transitions
  * @time_in_state:	Statistics of devfreq states
  * @last_stat_updated:	The last time stat updated
+ * @opp_hints:	Anti-oscillation hints for each state of freq_table
+ * @last_trans:	The last time (in jiffies) the frequency changed
+ * @hint_holds:	Number of governor requests held back by opp_hints
+ * @lat_hist:	Histogram of the current governor's decision latency
  * @transition_notifier_list: list head of DEVFREQ_TRANSITION_NOTIFIER notifier
  *
  * This structure stores the devfreq information for a give device.
@@ -192,6 +216,12 @@ struct devfreq {
 	unsigned long *time_in_state;
 	unsigned long last_stat_updated;
 
+	/* anti-oscillation hints and governor decision statistics */
+	struct devfreq_opp_hint *opp_hints;
+	unsigned long last_trans;
+	unsigned int hint_holds;
+	unsigned int lat_hist[DEVFREQ_LAT_BUCKETS];
+
 	struct srcu_notifier_head transition_notifier_list;
 };
 
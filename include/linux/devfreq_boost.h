@@ -9,12 +9,17 @@
 
 enum df_device {
 	DEVFREQ_MSM_CPUBW,
+#ifdef CONFIG_DEVFREQ_BOOST_TEST
+	DEVFREQ_BOOST_TEST,
+#endif
 	DEVFREQ_MAX
 };
 
 #ifdef CONFIG_DEVFREQ_BOOST
 void devfreq_boost_kick(enum df_device device);
 void devfreq_boost_kick_max(enum df_device device, unsigned int duration_ms);
+void devfreq_boost_frame_start(enum df_device device);
+void devfreq_boost_frame_end(enum df_device device);
 void devfreq_register_boost_device(enum df_device device, struct devfreq *df);
 #else
 static inline
@@ -26,6 +31,14 @@ void devfreq_boost_kick_max(enum df_device device, unsigned int duration_ms)
 {
 }
 static inline
+void devfreq_boost_frame_start(enum df_device device)
+{
+}
+static inline
+void devfreq_boost_frame_end(enum df_device device)
+{
+}
+static inline
 void devfreq_register_boost_device(enum df_device device, struct devfreq *df)
 {
 }
@@ -68,6 +68,7 @@
 #define DIAG_IOCTL_HDLC_TOGGLE	38
 #define DIAG_IOCTL_QUERY_PD_LOGGING	39
 #define DIAG_IOCTL_QUERY_MD_PID	41
+#define DIAG_IOCTL_MD_RING	42
 
 /* PC Tools IDs */
 #define APQ8060_TOOLS_ID	4062
@@ -950,4 +951,38 @@ static const uint32_t log_code_last_tbl[] = {
 #define LOG_SIZE_TO_ITEMS(size)		((8*size) - 7)
 #define EVENT_COUNT_TO_BYTES(count)	((count/8) + 1)
 
+/*
+ * Memory device mode ring, set up with DIAG_IOCTL_MD_RING (argument: the
+ * size of the data area, a power of two) and mapped with mmap() of the
+ * diag device at offset 0.  The first page holds struct diag_md_ring_hdr,
+ * the data area follows it.
+ *
+ * head and tail are free running byte counts, their offset into the data
+ * area is taken modulo size.  The driver appends records and then moves
+ * head; the reader consumes the records between tail and head and then
+ * moves tail, with release semantics.  Data the reader has no room for is
+ * dropped and counted in dropped.  poll() reports POLLIN while the ring
+ * is not empty.
+ *
+ * Each record is a struct diag_md_ring_rec followed by len bytes of data
+ * and padded to DIAG_MD_RING_ALIGN.  Records do not wrap, a record with
+ * len DIAG_MD_RING_PAD fills the rest of the data area instead.
+ */
+struct diag_md_ring_hdr {
+	uint32_t head;
+	uint32_t tail;
+	uint32_t size;
+	uint32_t dropped;
+};
+
+struct diag_md_ring_rec {
+	int32_t token;		/* remote token as read() passes it, or 0 */
+	uint32_t len;
+};
+
+#define DIAG_MD_RING_ALIGN	8
+#define DIAG_MD_RING_PAD	0xFFFFFFFF
+#define DIAG_MD_RING_MIN_SIZE	(64 * 1024)
+#define DIAG_MD_RING_MAX_SIZE	(16 * 1024 * 1024)
+
 #endif
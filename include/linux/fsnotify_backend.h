@@ -14,6 +14,7 @@
 #include <linux/list.h>
 #include <linux/path.h> /* struct path */
 #include <linux/spinlock.h>
+#include <linux/timer.h>
 #include <linux/types.h>
 #include <linux/atomic.h>
 
@@ -140,6 +141,14 @@ struct fsnotify_group {
 	wait_queue_head_t notification_waitq;	/* read() on the notification file blocks on this waitq */
 	unsigned int q_len;			/* events on the queue */
 	unsigned int max_events;		/* maximum events allowed on the list */
+	/*
+	 * Batched delivery.  With a non zero batch_delay readers are woken
+	 * batch_delay jiffies after the first queued event or as soon as
+	 * batch_events events are queued, whichever comes first.
+	 */
+	unsigned long batch_delay;
+	unsigned int batch_events;
+	struct timer_list batch_timer;
 	/*
 	 * Valid fsnotify group priorities.  Events are send in order from highest
 	 * priority to lowest priority.  We default to the lowest priority.
@@ -307,6 +316,9 @@ extern int fsnotify_add_event(struct fsnotify_group *group,
 					   struct fsnotify_event *));
 /* true if the group notification queue is empty */
 extern bool fsnotify_notify_queue_is_empty(struct fsnotify_group *group);
+/* batch the wakeups of readers of the group's notification queue */
+extern int fsnotify_set_batching(struct fsnotify_group *group,
+				 unsigned int delay_ms, unsigned int events);
 /* return, but do not dequeue the first event on the notification queue */
 extern struct fsnotify_event *fsnotify_peek_first_event(struct fsnotify_group *group);
 /* return AND dequeue the first event on the notification queue */
@@ -131,8 +131,13 @@ static inline void percpu_rwsem_release(struct percpu_rw_semaphore *sem,
 {
 	lock_release(&sem->rw_sem.dep_map, 1, ip);
 #ifdef CONFIG_RWSEM_SPIN_ON_OWNER
-	if (!read)
-		sem->rw_sem.owner = NULL;
+	if (!read) {
+		unsigned long owner = (unsigned long)READ_ONCE(sem->rw_sem.owner);
+
+		/* keep the writer hand-off flag */
+		WRITE_ONCE(sem->rw_sem.owner,
+			   (struct task_struct *)(owner & RWSEM_FLAG_HANDOFF));
+	}
 #endif
 }
 
@@ -2,6 +2,7 @@
 #define _LINUX_PIPE_FS_I_H
 
 #define PIPE_DEF_BUFFERS	16
+#define PIPE_TMP_PAGES		8	/* max released pages kept for reuse */
 
 #define PIPE_BUF_FLAG_LRU	0x01	/* page is on the LRU */
 #define PIPE_BUF_FLAG_ATOMIC	0x02	/* was atomically mapped */
@@ -32,7 +33,8 @@ struct pipe_buffer {
  *	@nrbufs: the number of non-empty pipe buffers in this pipe
  *	@buffers: total number of buffers (should be a power of 2)
  *	@curbuf: the current pipe buffer entry
- *	@tmp_page: cached released page
+ *	@nr_tmp_pages: the number of pages in @tmp_pages
+ *	@tmp_pages: stack of released pages kept for reuse by writers
  *	@readers: number of current readers of this pipe
  *	@writers: number of current writers of this pipe
  *	@files: number of struct file referring this pipe (protected by ->i_lock)
@@ -54,7 +56,8 @@ struct pipe_inode_info {
 	unsigned int waiting_writers;
 	unsigned int r_counter;
 	unsigned int w_counter;
-	struct page *tmp_page;
+	unsigned int nr_tmp_pages;
+	struct page *tmp_pages[PIPE_TMP_PAGES];
 	struct fasync_struct *fasync_readers;
 	struct fasync_struct *fasync_writers;
 	struct pipe_buffer *bufs;
@@ -74,6 +74,12 @@ static inline int rwsem_is_locked(struct rw_semaphore *sem)
 #endif
 
 #ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+/*
+ * Bit of the owner field kept across owner changes, set while a writer
+ * asks for the lock to be handed to it. See kernel/locking/rwsem.h.
+ */
+#define RWSEM_FLAG_HANDOFF	(1UL << 1)
+
 #define __RWSEM_OPT_INIT(lockname) , .osq = OSQ_LOCK_UNLOCKED, .owner = NULL
 #else
 #define __RWSEM_OPT_INIT(lockname)
@@ -35,13 +35,28 @@ enum stat_item {
 	CPU_PARTIAL_FREE,	/* Refill cpu partial on free */
 	CPU_PARTIAL_NODE,	/* Refill cpu partial from node partial */
 	CPU_PARTIAL_DRAIN,	/* Drain cpu partial to node partial */
+	SHEAF_ALLOC,		/* Allocation from cpu sheaf */
+	SHEAF_FREE,		/* Free to cpu sheaf */
+	SHEAF_REFILL,		/* Refill cpu sheaf from cpu slab */
+	SHEAF_FLUSH,		/* Return objects of cpu sheaf to slabs */
 	NR_SLUB_STAT_ITEMS };
 
+/*
+ * Per cpu array of free objects, taken from and returned to the slabs in
+ * batches. Only touched by its cpu with interrupts disabled.
+ */
+struct kmem_cache_sheaf {
+	unsigned int capacity;
+	unsigned int count;
+	void *objects[];
+};
+
 struct kmem_cache_cpu {
 	void **freelist;	/* Pointer to next available object */
 	unsigned long tid;	/* Globally unique transaction id */
 	struct page *page;	/* The slab from which we are allocating */
 	struct page *partial;	/* Partially allocated frozen slabs */
+	struct kmem_cache_sheaf *sheaf;	/* Object array, if enabled */
 #ifdef CONFIG_SLUB_STATS
 	unsigned stat[NR_SLUB_STAT_ITEMS];
 #endif
@@ -69,6 +84,8 @@ struct kmem_cache {
 	int offset;		/* Free pointer offset. */
 	/* Number of per cpu partial objects to keep around */
 	unsigned int cpu_partial;
+	/* Size of the per cpu object arrays, 0 if not used */
+	unsigned int sheaf_capacity;
 	struct kmem_cache_order_objects oo;
 
 	/* Allocation and freeing of slabs */
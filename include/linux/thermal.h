@@ -29,6 +29,7 @@
 #include <linux/idr.h>
 #include <linux/device.h>
 #include <linux/workqueue.h>
+#include <linux/seqlock.h>
 #include <uapi/linux/thermal.h>
 
 #define THERMAL_TRIPS_NONE	-1
@@ -83,6 +84,7 @@
 struct thermal_zone_device;
 struct thermal_cooling_device;
 struct thermal_instance;
+struct thermal_poll_group;
 
 enum thermal_device_mode {
 	THERMAL_DEVICE_DISABLED = 0,
@@ -149,6 +151,8 @@ struct thermal_zone_device_ops {
 	int (*notify) (struct thermal_zone_device *, int,
 		       enum thermal_trip_type);
 	bool (*is_wakeable)(struct thermal_zone_device *);
+	struct device *(*get_sensor_dev)(struct thermal_zone_device *);
+	int (*get_temps)(struct thermal_zone_device **, int *, int);
 };
 
 struct thermal_cooling_device_ops {
@@ -226,6 +230,11 @@ struct thermal_attr {
  * @node:	node in thermal_tz_list (in thermal_core.c)
  * @poll_queue:	delayed work for polling
  * @notify_event: Last notification event
+ * @cache_lock:	protects @cache_temp and @cache_stamp, readers don't block
+ * @cache_temp:	last sensor temperature, before emulation
+ * @cache_stamp:	time of @cache_temp in nanoseconds, 0 if there is none
+ * @poll_group:	group of zones polled together with this one, if any
+ * @poll_node:	node in the zone list of @poll_group
  */
 struct thermal_zone_device {
 	int id;
@@ -257,6 +266,11 @@ struct thermal_zone_device {
 	struct list_head node;
 	struct delayed_work poll_queue;
 	enum thermal_notify_event notify_event;
+	seqlock_t cache_lock;
+	int cache_temp;
+	u64 cache_stamp;
+	struct thermal_poll_group *poll_group;
+	struct list_head poll_node;
 };
 
 /**
@@ -396,6 +410,9 @@ struct thermal_genl_event {
  *		   hardware.
  * @get_trip_temp: a pointer to a function that gets the trip temperature on
  *		   hardware.
+ * @get_temps: a pointer to a function that reads the temperature of several
+ *	       sensors of the same device at once. It gets the private data
+ *	       of each sensor and fills one temperature per sensor.
  */
 struct thermal_zone_of_device_ops {
 	int (*get_temp)(void *, int *);
@@ -404,6 +421,7 @@ struct thermal_zone_of_device_ops {
 	int (*set_emul_temp)(void *, int);
 	int (*set_trip_temp)(void *, int, int);
 	int (*get_trip_temp)(void *, int, int *);
+	int (*get_temps)(void **, int *, int);
 };
 
 /**
@@ -101,6 +101,9 @@ struct work_struct {
 	atomic_long_t data;
 	struct list_head entry;
 	work_func_t func;
+#ifdef CONFIG_WQ_STATS
+	u64 queued_at;		/* local_clock() when last queued */
+#endif
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map lockdep_map;
 #endif
@@ -182,6 +182,31 @@ TRACE_EVENT(thermal_device_update,
 		__get_str(thermal_zone), __entry->id, __entry->event)
 );
 
+TRACE_EVENT(thermal_poll_group,
+
+	TP_PROTO(struct device *dev, int delay, int nr_zones, bool batched),
+
+	TP_ARGS(dev, delay, nr_zones, batched),
+
+	TP_STRUCT__entry(
+		__string(sensor, dev_name(dev))
+		__field(int, delay)
+		__field(int, nr_zones)
+		__field(bool, batched)
+	),
+
+	TP_fast_assign(
+		__assign_str(sensor, dev_name(dev));
+		__entry->delay = delay;
+		__entry->nr_zones = nr_zones;
+		__entry->batched = batched;
+	),
+
+	TP_printk("sensor=%s delay=%d nr_zones=%d batched=%d",
+		__get_str(sensor), __entry->delay, __entry->nr_zones,
+		__entry->batched)
+);
+
 TRACE_EVENT(thermal_set_trip,
 
 	TP_PROTO(struct thermal_zone_device *tz),
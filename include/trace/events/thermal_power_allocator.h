@@ -81,6 +81,34 @@ TRACE_EVENT(thermal_power_allocator_pid,
 		  __entry->tz_id, __entry->err, __entry->err_integral,
 		  __entry->p, __entry->i, __entry->d, __entry->output)
 );
+
+TRACE_EVENT(thermal_power_allocator_model,
+	TP_PROTO(struct thermal_zone_device *tz, s64 a, s64 b, s64 c,
+		 unsigned int samples, s64 budget, bool fallback),
+	TP_ARGS(tz, a, b, c, samples, budget, fallback),
+	TP_STRUCT__entry(
+		__field(int,          tz_id   )
+		__field(s64,          a       )
+		__field(s64,          b       )
+		__field(s64,          c       )
+		__field(unsigned int, samples )
+		__field(s64,          budget  )
+		__field(bool,         fallback)
+	),
+	TP_fast_assign(
+		__entry->tz_id = tz->id;
+		__entry->a = a;
+		__entry->b = b;
+		__entry->c = c;
+		__entry->samples = samples;
+		__entry->budget = budget;
+		__entry->fallback = fallback;
+	),
+
+	TP_printk("thermal_zone_id=%d a=%lld b=%lld c=%lld samples=%u budget=%lld fallback=%d",
+		  __entry->tz_id, __entry->a, __entry->b, __entry->c,
+		  __entry->samples, __entry->budget, __entry->fallback)
+);
 #endif /* _TRACE_THERMAL_POWER_ALLOCATOR_H */
 
 /* This part must be outside protection */
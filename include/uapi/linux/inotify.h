@@ -10,6 +10,7 @@
 /* For O_CLOEXEC and O_NONBLOCK */
 #include <linux/fcntl.h>
 #include <linux/types.h>
+#include <linux/ioctl.h>
 
 /*
  * struct inotify_event - structure read from the inotify device for each event
@@ -70,5 +71,20 @@ struct inotify_event {
 #define IN_CLOEXEC O_CLOEXEC
 #define IN_NONBLOCK O_NONBLOCK
 
+/*
+ * struct inotify_batch - batched delivery of events
+ *
+ * Instead of waking readers for every event, wake them max_latency_ms after
+ * the first event was queued (at most 1000) or once max_events events are
+ * queued.  A zero max_latency_ms turns batching off, a zero max_events only
+ * goes by the latency.
+ */
+struct inotify_batch {
+	__u32		max_latency_ms;
+	__u32		max_events;
+};
+
+#define INOTIFY_IOC_SETBATCH	_IOW('I', 1, struct inotify_batch)
+
 
 #endif /* _UAPI_LINUX_INOTIFY_H */
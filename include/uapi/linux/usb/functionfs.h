@@ -266,6 +266,24 @@ struct usb_functionfs_event {
 
 /* Specific for functionfs */
 
+/*
+ * Keeps count requests of length bytes queued on an OUT endpoint so that
+ * the controller does not sit idle between read(2) calls; synchronous
+ * reads are then served from those requests in order as they complete.
+ * A count of zero goes back to queueing a request per read(2).  count is
+ * at most 64, length at most 1 MiB and count * length at most 4 MiB,
+ * otherwise the call fails with EINVAL.  Once the
+ * endpoint has been disabled, a read fails with ESHUTDOWN and the mode
+ * has to be set up again.
+ */
+struct usb_functionfs_prequeue {
+	__u32 count;
+	__u32 length;
+};
+
+#define	FUNCTIONFS_PREQUEUE_READS	_IOW('g', 4, \
+					     struct usb_functionfs_prequeue)
+
 /*
  * Returns reverse mapping of an interface.  Called on EP0.  If there
  * is no such interface returns -EDOM.  If function is not active
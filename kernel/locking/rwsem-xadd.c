@@ -8,6 +8,9 @@
  *
  * Optimistic spinning by Tim Chen <tim.c.chen@intel.com>
  * and Davidlohr Bueso <davidlohr@hp.com>. Based on mutexes.
+ *
+ * Reader optimistic spinning and writer lock hand-off are modelled on
+ * the work by Waiman Long <longman@redhat.com>.
  */
 #include <linux/rwsem.h>
 #include <linux/sched.h>
@@ -18,6 +21,13 @@
 
 #include "rwsem.h"
 
+/*
+ * A writer that has been sleeping at the head of the wait queue for this
+ * long sets the hand-off flag so that lock stealing by optimistic spinners
+ * cannot starve it any further.
+ */
+#define RWSEM_WAIT_TIMEOUT	DIV_ROUND_UP(HZ, 250)
+
 /*
  * Guide to the rw_semaphore's count field for common values.
  * (32-bit case illustrated, similar for 64-bit)
@@ -231,65 +241,13 @@ static void __rwsem_mark_wake(struct rw_semaphore *sem,
 	}
 }
 
-/*
- * Wait for the read lock to be granted
- */
-__visible
-struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
-{
-	long count, adjustment = -RWSEM_ACTIVE_READ_BIAS;
-	struct rwsem_waiter waiter;
-	struct task_struct *tsk = current;
-	WAKE_Q(wake_q);
-	bool is_first_waiter = false;
-
-	waiter.task = tsk;
-	waiter.type = RWSEM_WAITING_FOR_READ;
-
-	raw_spin_lock_irq(&sem->wait_lock);
-	if (list_empty(&sem->wait_list))
-		adjustment += RWSEM_WAITING_BIAS;
-
-	/* is_first_waiter == true means we are first in the queue */
-	is_first_waiter = rwsem_list_add_per_prio(&waiter, sem);
-
-	/* we're now waiting on the lock, but no longer actively locking */
-	count = atomic_long_add_return(adjustment, &sem->count);
-
-	/*
-	 * If there are no active locks, wake the front queued process(es).
-	 *
-	 * If there are no writers and we are first in the queue,
-	 * wake our own waiter to join the existing active readers !
-	 */
-	if (count == RWSEM_WAITING_BIAS ||
-	    (count > RWSEM_WAITING_BIAS &&
-	     (adjustment != -RWSEM_ACTIVE_READ_BIAS ||
-	     is_first_waiter)))
-		__rwsem_mark_wake(sem, RWSEM_WAKE_ANY, &wake_q);
-
-	raw_spin_unlock_irq(&sem->wait_lock);
-	wake_up_q(&wake_q);
-
-	/* wait to be given the lock */
-	while (true) {
-		set_task_state(tsk, TASK_UNINTERRUPTIBLE);
-		if (!waiter.task)
-			break;
-		schedule();
-	}
-
-	__set_task_state(tsk, TASK_RUNNING);
-	return sem;
-}
-EXPORT_SYMBOL(rwsem_down_read_failed);
-
 /*
  * This function must be called with the sem->wait_lock held to prevent
  * race conditions between checking the rwsem wait list and setting the
  * sem->count accordingly.
  */
-static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem)
+static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem,
+					struct rwsem_waiter *waiter)
 {
 	/*
 	 * Avoid trying to acquire write lock if count isn't RWSEM_WAITING_BIAS.
@@ -297,6 +255,15 @@ static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem)
 	if (count != RWSEM_WAITING_BIAS)
 		return false;
 
+	/*
+	 * While a hand-off is pending only the waiter at the head of the
+	 * queue may take the lock. That waiter is always woken on release
+	 * as rwsem_wake() does not defer to spinners in this state.
+	 */
+	if (rwsem_handoff_pending(sem) &&
+	    list_first_entry(&sem->wait_list, struct rwsem_waiter, list) != waiter)
+		return false;
+
 	/*
 	 * Acquire the lock by trying to set it to ACTIVE_WRITE_BIAS. If there
 	 * are other tasks on the wait list, we need to add on WAITING_BIAS.
@@ -308,6 +275,7 @@ static inline bool rwsem_try_write_lock(long count, struct rw_semaphore *sem)
 	if (atomic_long_cmpxchg_acquire(&sem->count, RWSEM_WAITING_BIAS, count)
 							== RWSEM_WAITING_BIAS) {
 		rwsem_set_owner(sem);
+		rwsem_clear_handoff(sem);
 		return true;
 	}
 
@@ -326,6 +294,9 @@ static inline bool rwsem_try_write_lock_unqueued(struct rw_semaphore *sem)
 		if (!(count == 0 || count == RWSEM_WAITING_BIAS))
 			return false;
 
+		if (rwsem_handoff_pending(sem))
+			return false;
+
 		old = atomic_long_cmpxchg_acquire(&sem->count, count,
 				      count + RWSEM_ACTIVE_WRITE_BIAS);
 		if (old == count) {
@@ -337,16 +308,39 @@ static inline bool rwsem_try_write_lock_unqueued(struct rw_semaphore *sem)
 	}
 }
 
+/*
+ * Try to acquire read lock before the reader has been put on wait queue.
+ * This only succeeds when there is neither an active writer nor any queued
+ * waiter, so a spinning reader never jumps ahead of sleeping tasks.
+ */
+static inline bool rwsem_try_read_lock_unqueued(struct rw_semaphore *sem)
+{
+	long old, count = atomic_long_read(&sem->count);
+
+	while (count >= 0) {
+		old = atomic_long_cmpxchg_acquire(&sem->count, count,
+				      count + RWSEM_ACTIVE_READ_BIAS);
+		if (old == count) {
+			rwsem_set_reader_owned(sem);
+			return true;
+		}
+
+		count = old;
+	}
+
+	return false;
+}
+
 static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem)
 {
 	struct task_struct *owner;
 	bool ret = true;
 
-	if (need_resched())
+	if (need_resched() || rwsem_handoff_pending(sem))
 		return false;
 
 	rcu_read_lock();
-	owner = READ_ONCE(sem->owner);
+	owner = rwsem_owner(sem);
 	if (!rwsem_owner_is_writer(owner)) {
 		/*
 		 * Don't spin if the rwsem is readers owned.
@@ -366,7 +360,7 @@ static inline bool rwsem_can_spin_on_owner(struct rw_semaphore *sem)
  */
 static noinline bool rwsem_spin_on_owner(struct rw_semaphore *sem)
 {
-	struct task_struct *owner = READ_ONCE(sem->owner);
+	struct task_struct *owner = rwsem_owner(sem);
 	int i = 0;
 
 	if (!rwsem_owner_is_writer(owner))
@@ -381,7 +375,7 @@ static noinline bool rwsem_spin_on_owner(struct rw_semaphore *sem)
 		 * the rcu_read_lock() ensures the memory stays valid.
 		 */
 		rcu_read_lock();
-		same_owner = sem->owner == owner;
+		same_owner = rwsem_owner(sem) == owner;
 		if (same_owner)
 			on_cpu = owner->on_cpu;
 		rcu_read_unlock();
@@ -401,10 +395,20 @@ static noinline bool rwsem_spin_on_owner(struct rw_semaphore *sem)
 	 * If there is a new owner or the owner is not set, we continue
 	 * spinning.
 	 */
-	return !rwsem_owner_is_reader(READ_ONCE(sem->owner));
+	return !rwsem_owner_is_reader(rwsem_owner(sem));
+}
+
+static bool rwsem_try_lock_unqueued(struct rw_semaphore *sem,
+				    enum rwsem_waiter_type type)
+{
+	if (type == RWSEM_WAITING_FOR_WRITE)
+		return rwsem_try_write_lock_unqueued(sem);
+
+	return rwsem_try_read_lock_unqueued(sem);
 }
 
-static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
+static bool rwsem_optimistic_spin(struct rw_semaphore *sem,
+				  enum rwsem_waiter_type type)
 {
 	bool taken = false;
 
@@ -422,24 +426,36 @@ static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 	 * lock whenever the owner changes. Spinning will be stopped when:
 	 *  1) the owning writer isn't running; or
 	 *  2) readers own the lock as we can't determine if they are
-	 *     actively running or not.
+	 *     actively running or not; or
+	 *  3) a queued writer has requested a lock hand-off.
 	 */
 	while (rwsem_spin_on_owner(sem)) {
 		/*
 		 * Try to acquire the lock
 		 */
-		if (rwsem_try_write_lock_unqueued(sem)) {
+		if (rwsem_try_lock_unqueued(sem, type)) {
 			taken = true;
 			break;
 		}
 
+		if (rwsem_handoff_pending(sem))
+			break;
+
+		/*
+		 * A reader can't take the lock while anybody is queued, and
+		 * must go and queue itself so the waiters get woken up.
+		 */
+		if (type == RWSEM_WAITING_FOR_READ &&
+		    !list_empty(&sem->wait_list))
+			break;
+
 		/*
 		 * When there's no owner, we might have preempted between the
 		 * owner acquiring the lock and setting the owner field. If
 		 * we're an RT task that will live-lock because we won't let
 		 * the owner complete.
 		 */
-		if (!sem->owner && (need_resched() || rt_task(current)))
+		if (!rwsem_owner(sem) && (need_resched() || rt_task(current)))
 			break;
 
 		/*
@@ -450,12 +466,30 @@ static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
 		 */
 		cpu_relax_lowlatency();
 	}
+
+	/*
+	 * Spinning stops as soon as readers own the lock, in which case a
+	 * spinning reader is likely to be able to join them.
+	 */
+	if (!taken && type == RWSEM_WAITING_FOR_READ)
+		taken = rwsem_try_read_lock_unqueued(sem);
+
 	osq_unlock(&sem->osq);
 done:
 	preempt_enable();
 	return taken;
 }
 
+/*
+ * Readers only spin on a writer owner when nobody is queued yet, so that
+ * spinning never lets them get ahead of the sleeping waiters.
+ */
+static inline bool rwsem_can_spin_read(struct rw_semaphore *sem)
+{
+	return list_empty(&sem->wait_list) &&
+	       rwsem_owner_is_writer(rwsem_owner(sem));
+}
+
 /*
  * Return true if the rwsem has active spinner
  */
@@ -465,7 +499,13 @@ static inline bool rwsem_has_spinner(struct rw_semaphore *sem)
 }
 
 #else
-static bool rwsem_optimistic_spin(struct rw_semaphore *sem)
+static bool rwsem_optimistic_spin(struct rw_semaphore *sem,
+				  enum rwsem_waiter_type type)
+{
+	return false;
+}
+
+static inline bool rwsem_can_spin_read(struct rw_semaphore *sem)
 {
 	return false;
 }
@@ -476,6 +516,74 @@ static inline bool rwsem_has_spinner(struct rw_semaphore *sem)
 }
 #endif
 
+/*
+ * Wait for the read lock to be granted
+ */
+__visible
+struct rw_semaphore __sched *rwsem_down_read_failed(struct rw_semaphore *sem)
+{
+	long count, adjustment = -RWSEM_ACTIVE_READ_BIAS;
+	struct rwsem_waiter waiter;
+	struct task_struct *tsk = current;
+	WAKE_Q(wake_q);
+	bool is_first_waiter = false;
+	bool first_to_wait = false;
+
+	/*
+	 * Rather than going to sleep behind a running writer, spin on it
+	 * and join the readers once it is gone. The read bias taken in the
+	 * fastpath is dropped first, it would otherwise keep the lock active
+	 * and block the writer's successors.
+	 */
+	if (rwsem_can_spin_read(sem)) {
+		atomic_long_add(-RWSEM_ACTIVE_READ_BIAS, &sem->count);
+		if (rwsem_optimistic_spin(sem, RWSEM_WAITING_FOR_READ))
+			return sem;
+		adjustment = 0;
+	}
+
+	waiter.task = tsk;
+	waiter.type = RWSEM_WAITING_FOR_READ;
+
+	raw_spin_lock_irq(&sem->wait_lock);
+	if (list_empty(&sem->wait_list)) {
+		adjustment += RWSEM_WAITING_BIAS;
+		first_to_wait = true;
+	}
+
+	/* is_first_waiter == true means we are first in the queue */
+	is_first_waiter = rwsem_list_add_per_prio(&waiter, sem);
+
+	/* we're now waiting on the lock, but no longer actively locking */
+	count = atomic_long_add_return(adjustment, &sem->count);
+
+	/*
+	 * If there are no active locks, wake the front queued process(es).
+	 *
+	 * If there are no writers and we are first in the queue,
+	 * wake our own waiter to join the existing active readers !
+	 */
+	if (count == RWSEM_WAITING_BIAS ||
+	    (count > RWSEM_WAITING_BIAS &&
+	     (first_to_wait || is_first_waiter)))
+		__rwsem_mark_wake(sem, RWSEM_WAKE_ANY, &wake_q);
+
+	raw_spin_unlock_irq(&sem->wait_lock);
+	wake_up_q(&wake_q);
+
+	/* wait to be given the lock */
+	while (true) {
+		set_task_state(tsk, TASK_UNINTERRUPTIBLE);
+		if (!waiter.task)
+			break;
+		schedule();
+	}
+
+	__set_task_state(tsk, TASK_RUNNING);
+	return sem;
+}
+EXPORT_SYMBOL(rwsem_down_read_failed);
+
 /*
  * Wait until we successfully acquire the write lock
  */
@@ -488,12 +596,13 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 	struct rw_semaphore *ret = sem;
 	WAKE_Q(wake_q);
 	bool is_first_waiter = false;
+	unsigned long timeout;
 
 	/* undo write bias from down_write operation, stop active locking */
 	count = atomic_long_sub_return(RWSEM_ACTIVE_WRITE_BIAS, &sem->count);
 
 	/* do optimistic spinning and steal lock if possible */
-	if (rwsem_optimistic_spin(sem))
+	if (rwsem_optimistic_spin(sem, RWSEM_WAITING_FOR_WRITE))
 		return sem;
 
 	/*
@@ -542,10 +651,22 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 		count = atomic_long_add_return(RWSEM_WAITING_BIAS, &sem->count);
 
 	/* wait until we successfully acquire the lock */
+	timeout = jiffies + RWSEM_WAIT_TIMEOUT;
 	set_current_state(state);
 	while (true) {
-		if (rwsem_try_write_lock(count, sem))
+		if (rwsem_try_write_lock(count, sem, &waiter))
 			break;
+
+		/*
+		 * Request a hand-off once we have been at the head of the
+		 * queue for too long, so that spinners stop stealing the lock
+		 * from under us.
+		 */
+		if (!rwsem_handoff_pending(sem) &&
+		    time_after(jiffies, timeout) &&
+		    list_first_entry(&sem->wait_list, struct rwsem_waiter,
+				     list) == &waiter)
+			rwsem_set_handoff(sem);
 		raw_spin_unlock_irq(&sem->wait_lock);
 
 		/* Block until there are no active lockers. */
@@ -569,6 +690,8 @@ __rwsem_down_write_failed_common(struct rw_semaphore *sem, int state)
 	__set_current_state(TASK_RUNNING);
 	raw_spin_lock_irq(&sem->wait_lock);
 	list_del(&waiter.list);
+	/* the next head waiter re-arms the hand-off after its own timeout */
+	rwsem_clear_handoff(sem);
 	if (list_empty(&sem->wait_list))
 		atomic_long_add(-RWSEM_WAITING_BIAS, &sem->count);
 	else
@@ -649,8 +772,11 @@ struct rw_semaphore *rwsem_wake(struct rw_semaphore *sem)
 	 * a trylock in rwsem_down_write_failed() before sleeping. IOW, if
 	 * rwsem_has_spinner() is true, it will guarantee at least one
 	 * trylock attempt on the rwsem later on.
+	 *
+	 * That doesn't hold while a hand-off is pending as the spinners then
+	 * back off, so the head waiter must always be woken up.
 	 */
-	if (rwsem_has_spinner(sem)) {
+	if (rwsem_has_spinner(sem) && !rwsem_handoff_pending(sem)) {
 		/*
 		 * The smp_rmb() here is to make sure that the spinner
 		 * state is consulted before reading the wait_lock.
@@ -1,19 +1,26 @@
 /*
- * The owner field of the rw_semaphore structure will be set to
- * RWSEM_READ_OWNED when a reader grabs the lock. A writer will clear
- * the owner field when it unlocks. A reader, on the other hand, will
- * not touch the owner field when it unlocks.
+ * The owner field of the rw_semaphore structure will be set to the
+ * task_struct of the reader with the RWSEM_READER_OWNED bit set when a
+ * reader grabs the lock. A writer will clear the owner field when it
+ * unlocks. A reader, on the other hand, will not touch the owner field
+ * when it unlocks.
  *
  * In essence, the owner field now has the following 3 states:
  *  1) 0
  *     - lock is free or the owner hasn't set the field yet
- *  2) RWSEM_READER_OWNED
+ *  2) reader task | RWSEM_READER_OWNED
  *     - lock is currently or previously owned by readers (lock is free
- *       or not set by owner yet)
+ *       or not set by owner yet). The task pointer only records the last
+ *       reader that took the lock and must never be dereferenced, as that
+ *       reader may have released the lock and exited since.
  *  3) Other non-zero value
  *     - a writer owns the lock
+ *
+ * Independently of these states, owner may carry RWSEM_FLAG_HANDOFF (see
+ * <linux/rwsem.h> and rwsem_handoff_pending()). Task pointers are at least
+ * word aligned, which leaves the two low bits free for the flags.
  */
-#define RWSEM_READER_OWNED	((struct task_struct *)1UL)
+#define RWSEM_READER_OWNED	(1UL << 0)
 
 enum rwsem_waiter_type {
 	RWSEM_WAITING_FOR_WRITE,
@@ -28,41 +35,94 @@ struct rwsem_waiter {
 
 #ifdef CONFIG_RWSEM_SPIN_ON_OWNER
 /*
- * All writes to owner are protected by WRITE_ONCE() to make sure that
- * store tearing can't happen as optimistic spinners may read and use
- * the owner value concurrently without lock. Read from owner, however,
- * may not need READ_ONCE() as long as the pointer value is only used
- * for comparison and isn't being dereferenced.
+ * The RWSEM_FLAG_HANDOFF bit of owner is set by a writer that has been
+ * sleeping at the head of the wait queue for longer than RWSEM_WAIT_TIMEOUT.
+ * While it is set, optimistic spinners and newly queued writers back off so
+ * that the lock is handed to that waiter on the next release.
+ *
+ * The flag is only written with the wait_lock held. Lock holders update
+ * the rest of owner with a plain store that carries over the flag they
+ * read, so a store racing with the waiter may drop a fresh flag or bring
+ * back a cleared one. Both are benign: the head waiter always gets the
+ * lock when it is free and re-arms the flag every time it fails to, and
+ * a stale flag only makes spinners queue up and wake the head waiter,
+ * which clears it once it owns the lock. Optimistic spinners read owner
+ * without any lock, which is fine as long as the pointer is only
+ * dereferenced under RCU.
  */
+static inline void rwsem_update_owner(struct rw_semaphore *sem,
+				      unsigned long val)
+{
+	unsigned long old = (unsigned long)READ_ONCE(sem->owner);
+
+	WRITE_ONCE(sem->owner, (struct task_struct *)
+		   (val | (old & RWSEM_FLAG_HANDOFF)));
+}
+
+/* owner without the hand-off flag */
+static inline struct task_struct *rwsem_owner(struct rw_semaphore *sem)
+{
+	return (struct task_struct *)
+		((unsigned long)READ_ONCE(sem->owner) & ~RWSEM_FLAG_HANDOFF);
+}
+
 static inline void rwsem_set_owner(struct rw_semaphore *sem)
 {
-	WRITE_ONCE(sem->owner, current);
+	rwsem_update_owner(sem, (unsigned long)current);
 }
 
 static inline void rwsem_clear_owner(struct rw_semaphore *sem)
 {
-	WRITE_ONCE(sem->owner, NULL);
+	rwsem_update_owner(sem, 0);
 }
 
 static inline void rwsem_set_reader_owned(struct rw_semaphore *sem)
 {
+	unsigned long owner = (unsigned long)current | RWSEM_READER_OWNED;
+
 	/*
 	 * We check the owner value first to make sure that we will only
 	 * do a write to the rwsem cacheline when it is really necessary
 	 * to minimize cacheline contention.
 	 */
-	if (sem->owner != RWSEM_READER_OWNED)
-		WRITE_ONCE(sem->owner, RWSEM_READER_OWNED);
+	if ((unsigned long)rwsem_owner(sem) != owner)
+		rwsem_update_owner(sem, owner);
 }
 
 static inline bool rwsem_owner_is_writer(struct task_struct *owner)
 {
-	return owner && owner != RWSEM_READER_OWNED;
+	return owner && !((unsigned long)owner & RWSEM_READER_OWNED);
 }
 
 static inline bool rwsem_owner_is_reader(struct task_struct *owner)
 {
-	return owner == RWSEM_READER_OWNED;
+	return (unsigned long)owner & RWSEM_READER_OWNED;
+}
+
+static inline bool rwsem_handoff_pending(struct rw_semaphore *sem)
+{
+	return (unsigned long)READ_ONCE(sem->owner) & RWSEM_FLAG_HANDOFF;
+}
+
+/* called with the wait_lock held */
+static inline void rwsem_mod_handoff(struct rw_semaphore *sem, bool set)
+{
+	unsigned long old = (unsigned long)READ_ONCE(sem->owner);
+	unsigned long new = set ? old | RWSEM_FLAG_HANDOFF :
+				  old & ~RWSEM_FLAG_HANDOFF;
+
+	if (new != old)
+		WRITE_ONCE(sem->owner, (struct task_struct *)new);
+}
+
+static inline void rwsem_set_handoff(struct rw_semaphore *sem)
+{
+	rwsem_mod_handoff(sem, true);
+}
+
+static inline void rwsem_clear_handoff(struct rw_semaphore *sem)
+{
+	rwsem_mod_handoff(sem, false);
 }
 #else
 static inline void rwsem_set_owner(struct rw_semaphore *sem)
@@ -76,6 +136,19 @@ static inline void rwsem_clear_owner(struct rw_semaphore *sem)
 static inline void rwsem_set_reader_owned(struct rw_semaphore *sem)
 {
 }
+
+static inline bool rwsem_handoff_pending(struct rw_semaphore *sem)
+{
+	return false;
+}
+
+static inline void rwsem_set_handoff(struct rw_semaphore *sem)
+{
+}
+
+static inline void rwsem_clear_handoff(struct rw_semaphore *sem)
+{
+}
 #endif
 
 #ifdef CONFIG_RWSEM_PRIO_AWARE
@@ -860,13 +860,56 @@ static inline struct timer_base *get_timer_base(u32 tflags)
 }
 
 #ifdef CONFIG_NO_HZ_COMMON
+#ifdef CONFIG_SMP
+/*
+ * Timer migration hierarchy.
+ *
+ * A CPU which stops its tick hands its non-pinned timers over to an awake
+ * CPU, looking in its own cluster first and then system wide, and new
+ * non-pinned timers are queued the same way. The lowest numbered awake CPU
+ * is picked at each level so that the housekeeping timers end up on as few
+ * CPUs as possible and the others, eventually whole clusters, can stay in
+ * deep idle.
+ *
+ * The idle state of the remote bases is read locklessly. A stale value only
+ * results in a less than optimal target, never in a lost timer.
+ */
+static int tmigr_find_awake(unsigned int cpu, const struct cpumask *mask)
+{
+	int i;
+
+	for_each_cpu_and(i, mask, cpu_online_mask) {
+		if (i == cpu || cpu_isolated(i))
+			continue;
+		if (!READ_ONCE(per_cpu(timer_bases[BASE_STD].is_idle, i)))
+			return i;
+	}
+	return nr_cpu_ids;
+}
+
+static unsigned int tmigr_target_cpu(unsigned int cpu)
+{
+	int target;
+
+	if (!READ_ONCE(per_cpu(timer_bases[BASE_STD].is_idle, cpu)))
+		return cpu;
+
+	target = tmigr_find_awake(cpu, topology_core_cpumask(cpu));
+	if (target >= nr_cpu_ids)
+		target = tmigr_find_awake(cpu, cpu_online_mask);
+
+	return target < nr_cpu_ids ? target : cpu;
+}
+#endif
+
 static inline struct timer_base *
 get_target_base(struct timer_base *base, unsigned tflags)
 {
 #ifdef CONFIG_SMP
 	if ((tflags & TIMER_PINNED) || !base->migration_enabled)
 		return get_timer_this_cpu_base(tflags);
-	return get_timer_cpu_base(tflags, get_nohz_timer_target());
+	return get_timer_cpu_base(tflags,
+				  tmigr_target_cpu(get_nohz_timer_target()));
 #else
 	return get_timer_this_cpu_base(tflags);
 #endif
@@ -1116,6 +1159,9 @@ EXPORT_SYMBOL(add_timer);
  * @timer: the timer to be added
  * @cpu: the CPU to start it on
  *
+ * The timer is marked TIMER_PINNED, so it is not handed to another CPU
+ * when @cpu goes idle.
+ *
  * This is not very scalable on SMP. Double adds are not possible.
  */
 void add_timer_on(struct timer_list *timer, int cpu)
@@ -1142,6 +1188,7 @@ void add_timer_on(struct timer_list *timer, int cpu)
 		WRITE_ONCE(timer->flags,
 			   (timer->flags & ~TIMER_BASEMASK) | cpu);
 	}
+	timer->flags |= TIMER_PINNED;
 	forward_timer_base(base);
 
 	debug_activate(timer, timer->expires);
@@ -1513,6 +1560,66 @@ bool check_pending_deferrable_timers(int cpu)
 	}
 	return false;
 }
+
+/*
+ * tmigr_handoff - Hand the non-pinned timers of an idle base over
+ * @base - The BASE_STD base of the current CPU, locked and marked idle
+ *
+ * Moves the non-pinned timers to an awake CPU picked by the timer migration
+ * hierarchy. The target base is only trylocked: an idle entry never waits
+ * for a remote CPU, and two CPUs handing off to each other, or racing with
+ * the hotplug migration, cannot deadlock. On contention the timers simply
+ * stay where they are.
+ *
+ * Returns true when at least one timer was moved.
+ */
+static bool tmigr_handoff(struct timer_base *base)
+{
+	struct timer_base *new_base;
+	struct timer_list *timer;
+	struct hlist_node *n;
+	unsigned int cpu, idx;
+	bool moved = false;
+
+	if (!base->migration_enabled || cpu_isolated(base->cpu))
+		return false;
+
+	cpu = tmigr_target_cpu(base->cpu);
+	if (cpu == base->cpu)
+		return false;
+
+	new_base = per_cpu_ptr(&timer_bases[BASE_STD], cpu);
+	if (!spin_trylock(&new_base->lock))
+		return false;
+
+	/* The target might have gone idle since it was picked */
+	if (new_base->is_idle)
+		goto out;
+
+	forward_timer_base(new_base);
+
+	for (idx = find_first_bit(base->pending_map, WHEEL_SIZE);
+	     idx < WHEEL_SIZE;
+	     idx = find_next_bit(base->pending_map, WHEEL_SIZE, idx + 1)) {
+		hlist_for_each_entry_safe(timer, n, base->vectors + idx, entry) {
+			if (timer->flags & TIMER_PINNED)
+				continue;
+
+			detach_if_pending(timer, base, false);
+			timer->flags = (timer->flags & ~TIMER_BASEMASK) | cpu;
+			internal_add_timer(new_base, timer);
+			moved = true;
+		}
+	}
+out:
+	spin_unlock(&new_base->lock);
+	return moved;
+}
+#else
+static inline bool tmigr_handoff(struct timer_base *base)
+{
+	return false;
+}
 #endif
 
 /**
@@ -1569,6 +1676,19 @@ u64 get_next_timer_interrupt(unsigned long basej, u64 basem)
 		if ((expires - basem) > TICK_NSEC) {
 			base->must_forward_clk = true;
 			base->is_idle = true;
+
+			/*
+			 * Hand the non-pinned timers to an awake CPU and
+			 * sleep until the first remaining (pinned) one.
+			 */
+			if (tmigr_handoff(base)) {
+				nextevt = __next_timer_interrupt(base);
+				base->next_expiry = nextevt;
+				expires = KTIME_MAX;
+				if (nextevt != base->clk + NEXT_TIMER_MAX_DELTA)
+					expires = basem +
+						(u64)(nextevt - basej) * TICK_NSEC;
+			}
 		}
 	}
 	spin_unlock(&base->lock);
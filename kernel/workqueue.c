@@ -52,6 +52,8 @@
 #include <linux/delay.h>
 #include <linux/nmi.h>
 #include <linux/kvm_para.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "workqueue_internal.h"
 
@@ -194,6 +196,24 @@ struct worker_pool {
 	struct rcu_head		rcu;
 } ____cacheline_aligned_in_smp;
 
+/*
+ * Per-pool_workqueue statistics. These can be monitored through
+ * debugfs workqueue/stats. Times are in nsecs.
+ */
+enum pool_workqueue_stats {
+	PWQ_STAT_STARTED,	/* work items started execution */
+	PWQ_STAT_COMPLETED,	/* work items completed execution */
+	PWQ_STAT_QUEUE_TIME,	/* queue-to-start time, needs CONFIG_WQ_STATS */
+	PWQ_STAT_QUEUE_MAX,	/* longest queue-to-start time */
+	PWQ_STAT_EXEC_TIME,	/* execution wall time */
+	PWQ_STAT_EXEC_MAX,	/* longest execution wall time */
+	PWQ_STAT_CPU_TIME,	/* CPU time consumed */
+	PWQ_STAT_CPU_INTENSIVE,	/* wq_cpu_intensive_thresh_us violations */
+	PWQ_STAT_AUTO_INTENSIVE, /* executions auto-marked CPU intensive */
+
+	PWQ_NR_STATS,
+};
+
 /*
  * The per-pool workqueue.  While queued, the lower WORK_STRUCT_FLAG_BITS
  * of work_struct->data are used for flags and the remaining high bits
@@ -214,6 +234,8 @@ struct pool_workqueue {
 	struct list_head	pwqs_node;	/* WR: node on wq->pwqs */
 	struct list_head	mayday_node;	/* MD: node on wq->maydays */
 
+	u64			stats[PWQ_NR_STATS]; /* L: see above */
+
 	/*
 	 * Release of unbound pwq is punted to system_wq.  See put_pwq()
 	 * and pwq_unbound_release_workfn() for details.  pool_workqueue
@@ -326,6 +348,16 @@ static bool wq_debug_force_rr_cpu = false;
 #endif
 module_param_named(debug_force_rr_cpu, wq_debug_force_rr_cpu, bool, 0644);
 
+/*
+ * A concurrency managed work item which consumes more CPU time than this
+ * blocks every other concurrency managed work item on its CPU while it
+ * runs. Its function is reported, and later executions of it are marked
+ * CPU_INTENSIVE automatically. 0 disables the detection.
+ */
+static unsigned long wq_cpu_intensive_thresh_us = 10000;
+module_param_named(cpu_intensive_thresh_us, wq_cpu_intensive_thresh_us,
+		   ulong, 0644);
+
 /* the per-cpu worker pools */
 static DEFINE_PER_CPU_SHARED_ALIGNED(struct worker_pool [NR_STD_WORKER_POOLS], cpu_worker_pools);
 
@@ -1328,6 +1360,9 @@ static void insert_work(struct pool_workqueue *pwq, struct work_struct *work,
 
 	/* we own @work, set data and link */
 	set_work_pwq(work, pwq, extra_flags);
+#ifdef CONFIG_WQ_STATS
+	work->queued_at = local_clock();
+#endif
 	list_add_tail(&work->entry, head);
 	get_pwq(pwq);
 
@@ -2027,6 +2062,96 @@ static bool manage_workers(struct worker *worker)
 	return true;
 }
 
+/*
+ * Work functions which exceeded wq_cpu_intensive_thresh_us. Entries are
+ * never removed, so lookups only need to be protected against concurrent
+ * insertion, which the RCU list primitives take care of.
+ */
+#define WCI_MAX_ENTS 128
+
+struct wci_ent {
+	work_func_t		func;
+	atomic64_t		cnt;
+	struct hlist_node	hash_node;
+};
+
+static struct wci_ent wci_ents[WCI_MAX_ENTS];
+static int wci_nr_ents;
+static DEFINE_RAW_SPINLOCK(wci_lock);
+static DEFINE_HASHTABLE(wci_hash, ilog2(WCI_MAX_ENTS));
+
+static struct wci_ent *wci_find_ent(work_func_t func)
+{
+	struct wci_ent *ent;
+
+	hash_for_each_possible_rcu(wci_hash, ent, hash_node,
+				   (unsigned long)func) {
+		if (ent->func == func)
+			return ent;
+	}
+	return NULL;
+}
+
+/*
+ * Record that @func hogged the CPU. Reporting starts with the first
+ * violation and backs off exponentially.
+ */
+static void wq_cpu_intensive_report(work_func_t func)
+{
+	struct wci_ent *ent;
+	u64 cnt;
+
+restart:
+	ent = wci_find_ent(func);
+	if (ent) {
+		cnt = atomic64_inc_return(&ent->cnt);
+		if (is_power_of_2(cnt))
+			pr_warn("workqueue: %pf hogged CPU for >%luus %llu times, marked CPU_INTENSIVE, consider switching to WQ_UNBOUND or WQ_CPU_INTENSIVE\n",
+				ent->func, wq_cpu_intensive_thresh_us, cnt);
+		return;
+	}
+
+	/*
+	 * @func is a new violation. Allocate a new entry for it. If
+	 * wci_ents[] is exhausted, something went really wrong and we
+	 * probably made enough noise already.
+	 */
+	if (wci_nr_ents >= WCI_MAX_ENTS)
+		return;
+
+	raw_spin_lock(&wci_lock);
+
+	if (wci_nr_ents >= WCI_MAX_ENTS) {
+		raw_spin_unlock(&wci_lock);
+		return;
+	}
+
+	if (wci_find_ent(func)) {
+		raw_spin_unlock(&wci_lock);
+		goto restart;
+	}
+
+	ent = &wci_ents[wci_nr_ents];
+	ent->func = func;
+	atomic64_set(&ent->cnt, 0);
+	hash_add_rcu(wci_hash, &ent->hash_node, (unsigned long)func);
+
+	/* publish the initialized entry to wq_cpu_intensive_show() */
+	smp_wmb();
+	WRITE_ONCE(wci_nr_ents, wci_nr_ents + 1);
+
+	raw_spin_unlock(&wci_lock);
+
+	goto restart;
+}
+
+/* Whether @func has been caught hogging the CPU before. */
+static bool wq_cpu_intensive_known(work_func_t func)
+{
+	return READ_ONCE(wci_nr_ents) && wq_cpu_intensive_thresh_us &&
+	       wci_find_ent(func);
+}
+
 /**
  * process_one_work - process single work
  * @worker: self
@@ -2050,6 +2175,8 @@ __acquires(&pool->lock)
 	bool cpu_intensive = pwq->wq->flags & WQ_CPU_INTENSIVE;
 	int work_color;
 	struct worker *collision;
+	bool concurrency_managed;
+	u64 start_clock, start_runtime, exec_time, cpu_time;
 #ifdef CONFIG_LOCKDEP
 	/*
 	 * It is permissible to free the struct work_struct from
@@ -2088,6 +2215,30 @@ __acquires(&pool->lock)
 
 	list_del_init(&work->entry);
 
+	start_clock = local_clock();
+	start_runtime = current->se.sum_exec_runtime;
+	pwq->stats[PWQ_STAT_STARTED]++;
+#ifdef CONFIG_WQ_STATS
+	if (start_clock > work->queued_at) {
+		u64 queue_time = start_clock - work->queued_at;
+
+		pwq->stats[PWQ_STAT_QUEUE_TIME] += queue_time;
+		if (queue_time > pwq->stats[PWQ_STAT_QUEUE_MAX])
+			pwq->stats[PWQ_STAT_QUEUE_MAX] = queue_time;
+	}
+#endif
+
+	/*
+	 * A concurrency managed work function which hogged the CPU before
+	 * is treated as CPU intensive so that it doesn't stall the other
+	 * work items of this pool again.
+	 */
+	if (!cpu_intensive && !(worker->flags & WORKER_NOT_RUNNING) &&
+	    wq_cpu_intensive_known(worker->current_func)) {
+		cpu_intensive = true;
+		pwq->stats[PWQ_STAT_AUTO_INTENSIVE]++;
+	}
+
 	/*
 	 * CPU intensive works don't participate in concurrency management.
 	 * They're the scheduler's responsibility.  This takes @worker out
@@ -2149,12 +2300,29 @@ __acquires(&pool->lock)
 	 */
 	cond_resched();
 
+	exec_time = local_clock() - start_clock;
+	cpu_time = current->se.sum_exec_runtime - start_runtime;
+
 	spin_lock_irq(&pool->lock);
 
+	concurrency_managed = !(worker->flags & WORKER_NOT_RUNNING);
+
 	/* clear cpu intensive status */
 	if (unlikely(cpu_intensive))
 		worker_clr_flags(worker, WORKER_CPU_INTENSIVE);
 
+	pwq->stats[PWQ_STAT_COMPLETED]++;
+	pwq->stats[PWQ_STAT_EXEC_TIME] += exec_time;
+	if (exec_time > pwq->stats[PWQ_STAT_EXEC_MAX])
+		pwq->stats[PWQ_STAT_EXEC_MAX] = exec_time;
+	pwq->stats[PWQ_STAT_CPU_TIME] += cpu_time;
+
+	if (concurrency_managed && wq_cpu_intensive_thresh_us &&
+	    cpu_time >= wq_cpu_intensive_thresh_us * NSEC_PER_USEC) {
+		pwq->stats[PWQ_STAT_CPU_INTENSIVE]++;
+		wq_cpu_intensive_report(worker->current_func);
+	}
+
 	/* tag the worker for identification in schedule() */
 	worker->last_func = worker->current_func;
 
@@ -5405,6 +5573,120 @@ static void workqueue_sysfs_unregister(struct workqueue_struct *wq)
 static void workqueue_sysfs_unregister(struct workqueue_struct *wq)	{ }
 #endif	/* CONFIG_SYSFS */
 
+#ifdef CONFIG_DEBUG_FS
+/*
+ * debugfs workqueue/stats shows the execution statistics of all
+ * workqueues, aggregated over their pool_workqueues, and
+ * workqueue/cpu_intensive the work functions caught hogging the CPU.
+ */
+static int wq_stats_show(struct seq_file *m, void *v)
+{
+	struct workqueue_struct *wq;
+	struct pool_workqueue *pwq;
+	u64 stats[PWQ_NR_STATS];
+	unsigned long flags;
+	int i;
+
+	seq_printf(m, "%-24s %10s %10s %12s %12s %12s %12s %12s %8s %8s\n",
+		   "workqueue", "started", "completed", "queue_avg_us",
+		   "queue_max_us", "exec_avg_us", "exec_max_us", "cpu_us",
+		   "hogs", "auto_ci");
+
+	rcu_read_lock_sched();
+
+	list_for_each_entry_rcu(wq, &workqueues, list) {
+		memset(stats, 0, sizeof(stats));
+
+		for_each_pwq(pwq, wq) {
+			spin_lock_irqsave(&pwq->pool->lock, flags);
+			for (i = 0; i < PWQ_NR_STATS; i++) {
+				if (i == PWQ_STAT_QUEUE_MAX ||
+				    i == PWQ_STAT_EXEC_MAX)
+					stats[i] = max(stats[i], pwq->stats[i]);
+				else
+					stats[i] += pwq->stats[i];
+			}
+			spin_unlock_irqrestore(&pwq->pool->lock, flags);
+		}
+
+		if (!stats[PWQ_STAT_STARTED])
+			continue;
+
+		seq_printf(m, "%-24s %10llu %10llu %12llu %12llu %12llu %12llu %12llu %8llu %8llu\n",
+			   wq->name, stats[PWQ_STAT_STARTED],
+			   stats[PWQ_STAT_COMPLETED],
+			   div64_u64(stats[PWQ_STAT_QUEUE_TIME],
+				     stats[PWQ_STAT_STARTED] * NSEC_PER_USEC),
+			   div_u64(stats[PWQ_STAT_QUEUE_MAX], NSEC_PER_USEC),
+			   div64_u64(stats[PWQ_STAT_EXEC_TIME],
+				     max_t(u64, stats[PWQ_STAT_COMPLETED], 1) *
+				     NSEC_PER_USEC),
+			   div_u64(stats[PWQ_STAT_EXEC_MAX], NSEC_PER_USEC),
+			   div_u64(stats[PWQ_STAT_CPU_TIME], NSEC_PER_USEC),
+			   stats[PWQ_STAT_CPU_INTENSIVE],
+			   stats[PWQ_STAT_AUTO_INTENSIVE]);
+	}
+
+	rcu_read_unlock_sched();
+
+	return 0;
+}
+
+static int wq_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, wq_stats_show, NULL);
+}
+
+static const struct file_operations wq_stats_fops = {
+	.open		= wq_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int wq_cpu_intensive_show(struct seq_file *m, void *v)
+{
+	int i, nr_ents = READ_ONCE(wci_nr_ents);
+
+	/* pairs with the insertion in wq_cpu_intensive_report() */
+	smp_rmb();
+
+	for (i = 0; i < nr_ents; i++)
+		seq_printf(m, "%pf %llu\n", wci_ents[i].func,
+			   (u64)atomic64_read(&wci_ents[i].cnt));
+
+	return 0;
+}
+
+static int wq_cpu_intensive_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, wq_cpu_intensive_show, NULL);
+}
+
+static const struct file_operations wq_cpu_intensive_fops = {
+	.open		= wq_cpu_intensive_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init wq_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("workqueue", NULL);
+	if (IS_ERR_OR_NULL(dir))
+		return -ENOMEM;
+
+	debugfs_create_file("stats", 0444, dir, NULL, &wq_stats_fops);
+	debugfs_create_file("cpu_intensive", 0444, dir, NULL,
+			    &wq_cpu_intensive_fops);
+
+	return 0;
+}
+late_initcall(wq_debugfs_init);
+#endif	/* CONFIG_DEBUG_FS */
+
 /*
  * Workqueue watchdog.
  *
@@ -8,6 +8,9 @@
 #include <linux/types.h>
 #include <linux/module.h>
 #include <linux/crc-ccitt.h>
+#include <asm/unaligned.h>
+
+#include "crc_ccitt_table.h"
 
 /*
  * This mysterious table is just the CRC of each possible byte. It can be
@@ -51,14 +54,30 @@ u16 const crc_ccitt_table[256] = {
 };
 EXPORT_SYMBOL(crc_ccitt_table);
 
+#define T(row, x)	crc_ccitt_table_slice[(row) - 1][(x) & 0xff]
+
 /**
  *	crc_ccitt - recompute the CRC for the data buffer
  *	@crc: previous CRC value
  *	@buffer: data pointer
  *	@len: number of bytes in the buffer
+ *
+ *	Eight bytes are folded in per step using the tables generated by
+ *	gen_crc_ccitt_table, where entry x of row n is the CRC of byte x
+ *	followed by n zero bytes (slice-by-8).
  */
 u16 crc_ccitt(u16 crc, u8 const *buffer, size_t len)
 {
+	while (len >= 8) {
+		u32 lo = get_unaligned_le32(buffer) ^ crc;
+		u32 hi = get_unaligned_le32(buffer + 4);
+
+		crc = T(7, lo) ^ T(6, lo >> 8) ^ T(5, lo >> 16) ^ T(4, lo >> 24) ^
+		      T(3, hi) ^ T(2, hi >> 8) ^ T(1, hi >> 16) ^
+		      crc_ccitt_table[hi >> 24];
+		buffer += 8;
+		len -= 8;
+	}
 	while (len--)
 		crc = crc_ccitt_byte(crc, *buffer++);
 	return crc;
@@ -0,0 +1,56 @@
+/*
+ * Generates the additional tables crc_ccitt() uses to process eight bytes
+ * per step (slice-by-8).  Row 0, the CRC of each byte value, is the
+ * exported crc_ccitt_table[] of crc-ccitt.c; row n here holds the CRC of
+ * each byte value followed by n zero bytes.
+ */
+#include <stdio.h>
+#include <inttypes.h>
+
+#define CRC_CCITT_POLY		0x8408	/* x^16 + x^12 + x^5 + 1, LSB first */
+#define CRC_CCITT_ROWS		8
+#define ENTRIES_PER_LINE	8
+
+static uint16_t crc_ccitt_table[CRC_CCITT_ROWS][256];
+
+static void crc_ccitt_init(void)
+{
+	unsigned i, j;
+	uint16_t crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC_CCITT_POLY : 0);
+		crc_ccitt_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		crc = crc_ccitt_table[0][i];
+		for (j = 1; j < CRC_CCITT_ROWS; j++) {
+			crc = crc_ccitt_table[0][crc & 0xff] ^ (crc >> 8);
+			crc_ccitt_table[j][i] = crc;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int i, j;
+
+	crc_ccitt_init();
+
+	printf("/* this file is generated - do not edit */\n\n");
+	printf("static const u16 ____cacheline_aligned "
+	       "crc_ccitt_table_slice[%d][256] = {", CRC_CCITT_ROWS - 1);
+	for (j = 1; j < CRC_CCITT_ROWS; j++) {
+		printf("{");
+		for (i = 0; i < 256; i++) {
+			printf("%s0x%4.4x", i % ENTRIES_PER_LINE ? ", " :
+			       i ? ",\n\t" : "\n\t", crc_ccitt_table[j][i]);
+		}
+		printf("},\n");
+	}
+	printf("};\n");
+
+	return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * mm/percpu-stats.c - percpu allocator debugfs statistics
+ *
+ * This file is released under the GPLv2.
+ *
+ * Exposes the allocation info the first chunk was set up with, the
+ * global allocator counters including an allocation latency histogram
+ * and, for each chunk, how fragmented its free space is.  The per chunk
+ * figures are computed by walking the allocation bitmap when the file
+ * is read, so reading it is not cheap on machines with many chunks.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+
+#include "percpu-internal.h"
+
+#define P(X, Y) \
+	seq_printf(m, "  %-20s: %12lld\n", X, (long long int)Y)
+
+struct percpu_stats pcpu_stats;
+struct pcpu_alloc_info pcpu_stats_ai;
+
+/*
+ * Prints out chunk state.  Free regions are found by walking the
+ * allocation bitmap, the hidden start and end offsets of the first
+ * chunk are allocated in it and thus not counted.
+ */
+static void chunk_map_stats(struct seq_file *m, struct pcpu_chunk *chunk)
+{
+	int map_bits = pcpu_chunk_map_bits(chunk);
+	int rs, re, nr_regions = 0, max_free = 0;
+	u64 sum_frag = 0;
+
+	rs = find_next_zero_bit(chunk->alloc_map, map_bits, 0);
+	while (rs < map_bits) {
+		re = find_next_bit(chunk->alloc_map, map_bits, rs + 1);
+		nr_regions++;
+		max_free = max(max_free, re - rs);
+		rs = find_next_zero_bit(chunk->alloc_map, map_bits, re + 1);
+	}
+	/* free space outside of the largest free region */
+	if (nr_regions)
+		sum_frag = (u64)chunk->free_bytes -
+			   (u64)max_free * PCPU_MIN_ALLOC_SIZE;
+
+	P("nr_alloc", chunk->nr_alloc);
+	P("max_alloc_size", chunk->max_alloc_size);
+	P("empty_pop_pages", chunk->nr_empty_pop_pages);
+	P("nr_populated", chunk->nr_populated);
+	P("first_bit", chunk->first_bit);
+	P("free_bytes", chunk->free_bytes);
+	P("contig_bytes", chunk->contig_bits * PCPU_MIN_ALLOC_SIZE);
+	P("max_free_bytes", max_free * PCPU_MIN_ALLOC_SIZE);
+	P("free_regions", nr_regions);
+	P("sum_frag", sum_frag);
+
+	seq_putc(m, '\n');
+}
+
+static int percpu_stats_show(struct seq_file *m, void *v)
+{
+	struct percpu_stats stats;
+	struct pcpu_chunk *chunk;
+	int slot, b;
+
+	spin_lock_irq(&pcpu_lock);
+	stats = pcpu_stats;
+
+#define PL(X) \
+	seq_printf(m, "  %-20s: %12lld\n", #X, (long long int)pcpu_stats_ai.X)
+
+	seq_printf(m,
+			"Percpu Memory Statistics\n"
+			"Allocation Info:\n"
+			"----------------------------------------\n");
+	PL(unit_size);
+	PL(static_size);
+	PL(reserved_size);
+	PL(dyn_size);
+	PL(atom_size);
+	PL(alloc_size);
+	seq_putc(m, '\n');
+
+#undef PL
+
+#define PU(X) \
+	seq_printf(m, "  %-20s: %12llu\n", #X, (unsigned long long)stats.X)
+
+	seq_printf(m,
+			"Global Stats:\n"
+			"----------------------------------------\n");
+	PU(nr_alloc);
+	PU(nr_dealloc);
+	PU(nr_cur_alloc);
+	PU(nr_max_alloc);
+	PU(nr_chunks);
+	PU(nr_max_chunks);
+	PU(min_alloc_size);
+	PU(max_alloc_size);
+	PU(nr_alloc_fail);
+	PU(nr_pop_pages);
+	PU(nr_depop_pages);
+	P("empty_pop_pages", pcpu_nr_empty_pop_pages);
+	P("lat_max_us", div_u64(stats.lat_max_ns, NSEC_PER_USEC));
+	seq_putc(m, '\n');
+
+#undef PU
+
+	seq_printf(m,
+			"Allocation Latency:\n"
+			"----------------------------------------\n");
+	for (b = 0; b < PCPU_STATS_LAT_BUCKETS; b++)
+		seq_printf(m, "  < %8lu us        : %12llu\n", 1UL << b,
+			   (unsigned long long)stats.lat[b]);
+	seq_putc(m, '\n');
+
+	seq_printf(m,
+			"Per Chunk Stats:\n"
+			"----------------------------------------\n");
+
+	if (pcpu_reserved_chunk) {
+		seq_puts(m, "Chunk: <- Reserved Chunk\n");
+		chunk_map_stats(m, pcpu_reserved_chunk);
+	}
+
+	for (slot = 0; slot < pcpu_nr_slots; slot++) {
+		list_for_each_entry(chunk, &pcpu_slot[slot], list) {
+			if (chunk == pcpu_first_chunk)
+				seq_puts(m, "Chunk: <- First Chunk\n");
+			else
+				seq_puts(m, "Chunk:\n");
+			chunk_map_stats(m, chunk);
+		}
+	}
+
+	spin_unlock_irq(&pcpu_lock);
+
+	return 0;
+}
+
+static int percpu_stats_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, percpu_stats_show, NULL);
+}
+
+static const struct file_operations percpu_stats_fops = {
+	.open		= percpu_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init init_percpu_stats_debugfs(void)
+{
+	debugfs_create_file("percpu_stats", 0444, NULL, NULL,
+			&percpu_stats_fops);
+
+	return 0;
+}
+
+late_initcall(init_percpu_stats_debugfs);
@@ -1816,6 +1816,10 @@ static inline void *acquire_slab(struct kmem_cache *s,
 
 static void put_cpu_partial(struct kmem_cache *s, struct page *page, int drain);
 static inline bool pfmemalloc_match(struct page *page, gfp_t gfpflags);
+static void *sheaf_alloc(struct kmem_cache *s, gfp_t gfpflags);
+static bool sheaf_free(struct kmem_cache *s, struct page *page, void *object);
+static void sheaf_flush(struct kmem_cache *s, struct kmem_cache_sheaf *sheaf,
+			unsigned int count);
 
 /*
  * Try to allocate a partial slab from a specific node.
@@ -2318,6 +2322,11 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
 
 	if (likely(c)) {
+		struct kmem_cache_sheaf *sheaf = READ_ONCE(c->sheaf);
+
+		if (sheaf)
+			sheaf_flush(s, sheaf, sheaf->count);
+
 		if (c->page)
 			flush_slab(s, c);
 
@@ -2336,8 +2345,9 @@ static bool has_cpu_slab(int cpu, void *info)
 {
 	struct kmem_cache *s = info;
 	struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
+	struct kmem_cache_sheaf *sheaf = READ_ONCE(c->sheaf);
 
-	return c->page || c->partial;
+	return c->page || c->partial || (sheaf && sheaf->count);
 }
 
 static void flush_all(struct kmem_cache *s)
@@ -2689,6 +2699,12 @@ static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 	s = slab_pre_alloc_hook(s, gfpflags);
 	if (!s)
 		return NULL;
+
+	if (READ_ONCE(s->sheaf_capacity) && node == NUMA_NO_NODE) {
+		object = sheaf_alloc(s, gfpflags);
+		if (object)
+			goto out;
+	}
 redo:
 	/*
 	 * Must read kmem_cache cpu data via this cpu ptr. Preemption is
@@ -2757,6 +2773,7 @@ static __always_inline void *slab_alloc_node(struct kmem_cache *s,
 		stat(s, ALLOC_FASTPATH);
 	}
 
+out:
 	if (unlikely(gfpflags & __GFP_ZERO) && object)
 		memset(object, 0, s->object_size);
 
@@ -3017,6 +3034,8 @@ static __always_inline void slab_free(struct kmem_cache *s, struct page *page,
 	 */
 	if (s->flags & SLAB_KASAN && !(s->flags & SLAB_TYPESAFE_BY_RCU))
 		return;
+	if (!tail && READ_ONCE(s->sheaf_capacity) && sheaf_free(s, page, head))
+		return;
 	do_slab_free(s, page, head, tail, cnt, addr);
 }
 
@@ -3215,6 +3234,265 @@ int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
 }
 EXPORT_SYMBOL(kmem_cache_alloc_bulk);
 
+/*
+ * Per cpu sheaves: arrays of free objects in front of the cpu slab.
+ *
+ * Frees go to the sheaf of the current cpu whatever slab the object came
+ * from, and allocations are served from it until it runs empty. It is then
+ * refilled with half its capacity from the cpu slab in one go, and the
+ * older half of a full sheaf is returned to the slabs the same way. This
+ * keeps remote frees and the node list_lock off the common path of busy
+ * caches. Sheaves are opt-in per cache through "slub_sheaves=" or the
+ * sheaf_capacity sysfs file.
+ */
+#define SHEAF_DEFAULT_CAPACITY	32
+#define SHEAF_MAX_CAPACITY	256
+
+static char *slub_sheaves;
+static DEFINE_MUTEX(sheaf_mutex);
+
+static int __init setup_slub_sheaves(char *str)
+{
+	slub_sheaves = str;
+	return 1;
+}
+
+__setup("slub_sheaves=", setup_slub_sheaves);
+
+/*
+ * Objects sitting in a sheaf have been through the free hooks and get
+ * the allocation hooks when handed out again, but per object debugging
+ * and memcg accounting expect every object to go back to its slab.
+ */
+static bool sheaves_supported(struct kmem_cache *s)
+{
+	return !kmem_cache_debug(s) && is_root_cache(s) &&
+	       !(s->flags & SLAB_ACCOUNT);
+}
+
+/* Called with interrupts disabled, never enables them. */
+static unsigned int sheaf_refill(struct kmem_cache *s,
+				 struct kmem_cache_sheaf *sheaf, gfp_t gfpflags)
+{
+	struct kmem_cache_cpu *c = this_cpu_ptr(s->cpu_slab);
+	unsigned int batch = max(sheaf->capacity / 2, 1U);
+	void *object;
+
+	/*
+	 * ___slab_alloc() reenables interrupts for blocking allocations,
+	 * so leave those to the regular slowpath. No pfmemalloc objects
+	 * either, the sheaf hands them out to anyone.
+	 */
+	gfpflags &= ~(__GFP_DIRECT_RECLAIM | __GFP_NOFAIL);
+	gfpflags |= __GFP_NOWARN | __GFP_NOMEMALLOC;
+
+	while (sheaf->count < batch) {
+		object = c->freelist;
+		/* Same as in ___slab_alloc() */
+		if (object && unlikely(!pfmemalloc_match(c->page, gfpflags))) {
+			deactivate_slab(s, c->page, c->freelist);
+			c->page = NULL;
+			c->freelist = NULL;
+			object = NULL;
+		}
+		if (unlikely(!object)) {
+			/* Same as in kmem_cache_alloc_bulk() */
+			c->tid = next_tid(c->tid);
+			object = ___slab_alloc(s, gfpflags, NUMA_NO_NODE,
+					       _RET_IP_, c);
+			if (!object)
+				break;
+		} else {
+			c->freelist = get_freepointer(s, object);
+		}
+		sheaf->objects[sheaf->count++] = object;
+	}
+	c->tid = next_tid(c->tid);
+
+	stat(s, SHEAF_REFILL);
+	return sheaf->count;
+}
+
+static void *sheaf_alloc(struct kmem_cache *s, gfp_t gfpflags)
+{
+	struct kmem_cache_sheaf *sheaf;
+	unsigned long flags;
+	void *object = NULL;
+
+	local_irq_save(flags);
+	sheaf = this_cpu_read(s->cpu_slab->sheaf);
+	if (unlikely(!sheaf))
+		goto out;
+
+	if (unlikely(!sheaf->count) && !sheaf_refill(s, sheaf, gfpflags))
+		goto out;
+
+	object = sheaf->objects[--sheaf->count];
+	stat(s, SHEAF_ALLOC);
+out:
+	local_irq_restore(flags);
+	return object;
+}
+
+static bool sheaf_free(struct kmem_cache *s, struct page *page, void *object)
+{
+	struct kmem_cache_sheaf *sheaf;
+	unsigned long flags;
+	bool ret = false;
+
+	if (unlikely(page_to_nid(page) != numa_mem_id() ||
+		     PageSlabPfmemalloc(page)))
+		return false;
+
+	local_irq_save(flags);
+	sheaf = this_cpu_read(s->cpu_slab->sheaf);
+	if (likely(sheaf)) {
+		if (unlikely(sheaf->count == sheaf->capacity))
+			sheaf_flush(s, sheaf, sheaf->capacity / 2);
+		sheaf->objects[sheaf->count++] = object;
+		stat(s, SHEAF_FREE);
+		ret = true;
+	}
+	local_irq_restore(flags);
+	return ret;
+}
+
+/*
+ * Return the @count oldest objects of @sheaf to their slabs. The caller
+ * owns the sheaf: it runs on its cpu with interrupts disabled, or the
+ * sheaf is detached or belongs to a dead cpu.
+ */
+static void sheaf_flush(struct kmem_cache *s, struct kmem_cache_sheaf *sheaf,
+			unsigned int count)
+{
+	struct detached_freelist df;
+	size_t size = count;
+
+	if (!count)
+		return;
+
+	do {
+		size = build_detached_freelist(s, size, sheaf->objects, &df);
+		if (unlikely(!df.page))
+			continue;
+
+		do_slab_free(df.s, df.page, df.freelist, df.tail, df.cnt,
+			     _RET_IP_);
+	} while (likely(size));
+
+	sheaf->count -= count;
+	memmove(sheaf->objects, sheaf->objects + count,
+		sheaf->count * sizeof(void *));
+	stat(s, SHEAF_FLUSH);
+}
+
+static void sheaves_disable(struct kmem_cache *s)
+{
+	struct kmem_cache_sheaf *sheaf, **sheaves;
+	int cpu;
+
+	WRITE_ONCE(s->sheaf_capacity, 0);
+
+	/*
+	 * Detach all the sheaves first so that a single grace period covers
+	 * them. Without memory for that, wait for each cpu in turn.
+	 */
+	sheaves = kcalloc(nr_cpu_ids, sizeof(*sheaves), GFP_KERNEL);
+
+	for_each_possible_cpu(cpu) {
+		sheaf = xchg(&per_cpu_ptr(s->cpu_slab, cpu)->sheaf, NULL);
+		if (!sheaf)
+			continue;
+
+		if (sheaves) {
+			sheaves[cpu] = sheaf;
+			continue;
+		}
+
+		/* The cpu only uses its sheaf with interrupts disabled */
+		synchronize_sched();
+		sheaf_flush(s, sheaf, sheaf->count);
+		kfree(sheaf);
+	}
+
+	if (!sheaves)
+		return;
+
+	synchronize_sched();
+	for_each_possible_cpu(cpu) {
+		sheaf = sheaves[cpu];
+		if (sheaf) {
+			sheaf_flush(s, sheaf, sheaf->count);
+			kfree(sheaf);
+		}
+	}
+	kfree(sheaves);
+}
+
+static int sheaves_enable(struct kmem_cache *s, unsigned int capacity)
+{
+	struct kmem_cache_sheaf *sheaf;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		sheaf = kzalloc_node(sizeof(*sheaf) + capacity * sizeof(void *),
+				     GFP_KERNEL, cpu_to_node(cpu));
+		if (!sheaf) {
+			sheaves_disable(s);
+			return -ENOMEM;
+		}
+
+		sheaf->capacity = capacity;
+		smp_store_release(&per_cpu_ptr(s->cpu_slab, cpu)->sheaf, sheaf);
+	}
+
+	WRITE_ONCE(s->sheaf_capacity, capacity);
+	return 0;
+}
+
+static int sheaves_set_capacity(struct kmem_cache *s, unsigned int capacity)
+{
+	int err = 0;
+
+	mutex_lock(&sheaf_mutex);
+	if (capacity != s->sheaf_capacity) {
+		if (s->sheaf_capacity)
+			sheaves_disable(s);
+		if (capacity)
+			err = sheaves_enable(s, capacity);
+	}
+	mutex_unlock(&sheaf_mutex);
+
+	return err;
+}
+
+static bool slub_sheaves_match(const char *name)
+{
+	const char *p = slub_sheaves;
+	size_t len = strlen(name);
+
+	while (p && *p) {
+		if (!strncmp(p, name, len) && (p[len] == ',' || !p[len]))
+			return true;
+		p = strchr(p, ',');
+		if (p)
+			p++;
+	}
+
+	return false;
+}
+
+/* Enable sheaves on @s if "slub_sheaves=" names it as @name */
+static void sheaves_setup(struct kmem_cache *s, const char *name)
+{
+	if (!slub_sheaves || s->sheaf_capacity || !sheaves_supported(s) ||
+	    !slub_sheaves_match(name))
+		return;
+
+	if (sheaves_set_capacity(s, SHEAF_DEFAULT_CAPACITY))
+		pr_err("SLUB: Unable to enable sheaves for %s\n", name);
+}
+
 
 /*
  * Object placement in a slab is made very easy because we always start at
@@ -3743,6 +4021,7 @@ int __kmem_cache_shutdown(struct kmem_cache *s)
 	int node;
 	struct kmem_cache_node *n;
 
+	sheaves_set_capacity(s, 0);
 	flush_all(s);
 	/* Attempt to free all objects */
 	for_each_kmem_cache_node(s, node, n) {
@@ -4239,6 +4518,10 @@ __kmem_cache_alias(const char *name, size_t size, size_t align,
 	if (s) {
 		s->refcount++;
 
+		/* Before sysfs is up, slab_sysfs_init() does this */
+		if (slab_state > UP)
+			sheaves_setup(s, name);
+
 		/*
 		 * Adjust the object sizes so that we clear
 		 * the complete object on kzalloc.
@@ -4273,6 +4556,7 @@ int __kmem_cache_create(struct kmem_cache *s, unsigned long flags)
 	if (slab_state <= UP)
 		return 0;
 
+	sheaves_setup(s, s->name);
 	memcg_propagate_slab_attrs(s);
 	err = sysfs_slab_add(s);
 	if (err)
@@ -4977,6 +5261,60 @@ static ssize_t cpu_partial_store(struct kmem_cache *s, const char *buf,
 }
 SLAB_ATTR(cpu_partial);
 
+static ssize_t sheaf_capacity_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%u\n", s->sheaf_capacity);
+}
+
+static ssize_t sheaf_capacity_store(struct kmem_cache *s, const char *buf,
+				    size_t length)
+{
+	unsigned int objects;
+	int err;
+
+	err = kstrtouint(buf, 10, &objects);
+	if (err)
+		return err;
+	if (objects > SHEAF_MAX_CAPACITY ||
+	    (objects && !sheaves_supported(s)))
+		return -EINVAL;
+
+	err = sheaves_set_capacity(s, objects);
+	if (err)
+		return err;
+	return length;
+}
+SLAB_ATTR(sheaf_capacity);
+
+static ssize_t sheaf_objects_show(struct kmem_cache *s, char *buf)
+{
+	struct kmem_cache_sheaf *sheaf;
+	unsigned long sum = 0;
+	int cpu, len;
+
+	/* Sheaves are freed after a sched grace period */
+	preempt_disable();
+	for_each_online_cpu(cpu) {
+		sheaf = READ_ONCE(per_cpu_ptr(s->cpu_slab, cpu)->sheaf);
+		if (sheaf)
+			sum += READ_ONCE(sheaf->count);
+	}
+
+	len = sprintf(buf, "%lu", sum);
+
+#ifdef CONFIG_SMP
+	for_each_online_cpu(cpu) {
+		sheaf = READ_ONCE(per_cpu_ptr(s->cpu_slab, cpu)->sheaf);
+		if (sheaf && sheaf->count && len < PAGE_SIZE - 20)
+			len += sprintf(buf + len, " C%d=%u", cpu,
+				       READ_ONCE(sheaf->count));
+	}
+#endif
+	preempt_enable();
+	return len + sprintf(buf + len, "\n");
+}
+SLAB_ATTR_RO(sheaf_objects);
+
 static ssize_t ctor_show(struct kmem_cache *s, char *buf)
 {
 	if (!s->ctor)
@@ -5378,6 +5716,10 @@ STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
 STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
 STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
 STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+STAT_ATTR(SHEAF_ALLOC, sheaf_alloc);
+STAT_ATTR(SHEAF_FREE, sheaf_free);
+STAT_ATTR(SHEAF_REFILL, sheaf_refill);
+STAT_ATTR(SHEAF_FLUSH, sheaf_flush);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -5387,6 +5729,8 @@ static struct attribute *slab_attrs[] = {
 	&order_attr.attr,
 	&min_partial_attr.attr,
 	&cpu_partial_attr.attr,
+	&sheaf_capacity_attr.attr,
+	&sheaf_objects_attr.attr,
 	&objects_attr.attr,
 	&objects_partial_attr.attr,
 	&partial_attr.attr,
@@ -5445,6 +5789,10 @@ static struct attribute *slab_attrs[] = {
 	&cpu_partial_free_attr.attr,
 	&cpu_partial_node_attr.attr,
 	&cpu_partial_drain_attr.attr,
+	&sheaf_alloc_attr.attr,
+	&sheaf_free_attr.attr,
+	&sheaf_refill_attr.attr,
+	&sheaf_flush_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
@@ -5791,6 +6139,7 @@ static int __init slab_sysfs_init(void)
 	slab_state = FULL;
 
 	list_for_each_entry(s, &slab_caches, list) {
+		sheaves_setup(s, s->name);
 		err = sysfs_slab_add(s);
 		if (err)
 			pr_err("SLUB: Unable to add boot slab %s to sysfs\n",
@@ -5801,6 +6150,7 @@ static int __init slab_sysfs_init(void)
 		struct saved_alias *al = alias_list;
 
 		alias_list = alias_list->next;
+		sheaves_setup(al->s, al->name);
 		err = sysfs_slab_alias(al->s, al->name);
 		if (err)
 			pr_err("SLUB: Unable to add boot slab alias %s to sysfs\n",
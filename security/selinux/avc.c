@@ -23,6 +23,11 @@
 #include <linux/skbuff.h>
 #include <linux/percpu.h>
 #include <linux/list.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
 #include <net/sock.h>
 #include <linux/un.h>
 #include <net/af_unix.h>
@@ -35,8 +40,11 @@
 #include "classmap.h"
 
 #define AVC_CACHE_SLOTS			512
+#define AVC_CACHE_MAX_SLOTS		16384
 #define AVC_DEF_CACHE_THRESHOLD		512
 #define AVC_CACHE_RECLAIM		16
+#define AVC_RULES_PER_NODE		16
+#define AVC_FRONT_SLOTS			64
 
 #ifdef CONFIG_SECURITY_SELINUX_AVC_STATS
 #define avc_cache_stats_incr(field)	this_cpu_inc(avc_cache_stats.field)
@@ -54,7 +62,7 @@ struct avc_entry {
 
 struct avc_node {
 	struct avc_entry	ae;
-	struct hlist_node	list; /* anchored in avc_cache->slots[i] */
+	struct hlist_node	list; /* anchored in avc_table->slots[i].head */
 	struct rcu_head		rhead;
 };
 
@@ -68,14 +76,44 @@ struct avc_xperms_node {
 	struct list_head xpd_head; /* list head of extended_perms_decision */
 };
 
+struct avc_slot {
+	struct hlist_head	head;	/* head for avc_node->list */
+	spinlock_t		lock;	/* lock for writes */
+};
+
+struct avc_table {
+	unsigned int		size;	/* number of slots, a power of two */
+	struct avc_slot		slots[];
+};
+
 struct avc_cache {
-	struct hlist_head	slots[AVC_CACHE_SLOTS]; /* head for avc_node->list */
-	spinlock_t		slots_lock[AVC_CACHE_SLOTS]; /* lock for writes */
+	struct avc_table __rcu	*table;
+	struct mutex		table_mutex;	/* serializes resizes and flushes */
+	unsigned int		target_size;	/* table size the worker moves to */
+	struct work_struct	work;		/* background reclaim and resize */
 	atomic_t		lru_hint;	/* LRU hint for reclaim scan */
 	atomic_t		active_nodes;
+	atomic_t		generation;	/* invalidates the front caches */
 	u32			latest_notif;	/* latest revocation notification */
 };
 
+/*
+ * Per-CPU direct-mapped copies of recent decisions, checked by
+ * avc_has_perm_noaudit() before the hash table. An entry is only good
+ * while its generation matches the one of the cache, which is bumped
+ * whenever a cached decision is flushed or changed.
+ */
+struct avc_front_entry {
+	u32			ssid;
+	u32			tsid;
+	u16			tclass;
+	u32			generation;
+	struct av_decision	avd;
+};
+
+static DEFINE_PER_CPU(struct avc_front_entry [AVC_FRONT_SLOTS],
+		      avc_front_cache);
+
 struct avc_callback_node {
 	int (*callback) (u32 event);
 	u32 events;
@@ -88,34 +126,96 @@ DEFINE_PER_CPU(struct avc_cache_stats, avc_cache_stats) = { 0 };
 
 struct selinux_avc {
 	unsigned int avc_cache_threshold;
+	bool avc_cache_threshold_set;	/* set through selinuxfs */
 	struct avc_cache avc_cache;
 };
 
 static struct selinux_avc selinux_avc;
 
+static void avc_cache_work(struct work_struct *work);
+
+static struct avc_table *avc_alloc_table(unsigned int size)
+{
+	struct avc_table *table;
+	unsigned int i;
+
+	table = kvzalloc(sizeof(*table) + size * sizeof(table->slots[0]),
+			 GFP_KERNEL);
+	if (!table)
+		return NULL;
+
+	table->size = size;
+	for (i = 0; i < size; i++) {
+		INIT_HLIST_HEAD(&table->slots[i].head);
+		spin_lock_init(&table->slots[i].lock);
+	}
+	return table;
+}
+
 void selinux_avc_init(struct selinux_avc **avc)
 {
-	int i;
+	struct avc_table *table;
+
+	table = avc_alloc_table(AVC_CACHE_SLOTS);
+	if (!table)
+		panic("SELinux: Unable to allocate the AVC hash table\n");
 
 	selinux_avc.avc_cache_threshold = AVC_DEF_CACHE_THRESHOLD;
-	for (i = 0; i < AVC_CACHE_SLOTS; i++) {
-		INIT_HLIST_HEAD(&selinux_avc.avc_cache.slots[i]);
-		spin_lock_init(&selinux_avc.avc_cache.slots_lock[i]);
-	}
+	RCU_INIT_POINTER(selinux_avc.avc_cache.table, table);
+	mutex_init(&selinux_avc.avc_cache.table_mutex);
+	selinux_avc.avc_cache.target_size = AVC_CACHE_SLOTS;
+	INIT_WORK(&selinux_avc.avc_cache.work, avc_cache_work);
 	atomic_set(&selinux_avc.avc_cache.active_nodes, 0);
 	atomic_set(&selinux_avc.avc_cache.lru_hint, 0);
+	/* Generation 0 would match the zeroed front cache entries */
+	atomic_set(&selinux_avc.avc_cache.generation, 1);
 	*avc = &selinux_avc;
 }
 
 unsigned int avc_get_cache_threshold(struct selinux_avc *avc)
 {
-	return avc->avc_cache_threshold;
+	return READ_ONCE(avc->avc_cache_threshold);
+}
+
+/*
+ * The table is sized for a load factor of one at the threshold. Resizing
+ * and trimming the cache down to the new threshold is left to the worker.
+ */
+static void avc_resize_cache(struct selinux_avc *avc,
+			     unsigned int cache_threshold)
+{
+	unsigned int size;
+
+	size = clamp_t(unsigned int, cache_threshold, AVC_CACHE_SLOTS,
+		       AVC_CACHE_MAX_SLOTS);
+
+	WRITE_ONCE(avc->avc_cache_threshold, cache_threshold);
+	WRITE_ONCE(avc->avc_cache.target_size, roundup_pow_of_two(size));
+	queue_work(system_unbound_wq, &avc->avc_cache.work);
 }
 
 void avc_set_cache_threshold(struct selinux_avc *avc,
 			     unsigned int cache_threshold)
 {
-	avc->avc_cache_threshold = cache_threshold;
+	WRITE_ONCE(avc->avc_cache_threshold_set, true);
+	avc_resize_cache(avc, cache_threshold);
+}
+
+/**
+ * avc_ss_size_hint - Size the cache for a newly loaded policy.
+ * @rules: number of type enforcement rules in the policy
+ *
+ * Scales the cache threshold, and the hash table with it, to the size of
+ * the policy. A threshold written to selinuxfs takes precedence.
+ */
+void avc_ss_size_hint(struct selinux_avc *avc, u32 rules)
+{
+	if (READ_ONCE(avc->avc_cache_threshold_set))
+		return;
+
+	avc_resize_cache(avc, clamp_t(u32, rules / AVC_RULES_PER_NODE,
+				      AVC_DEF_CACHE_THRESHOLD,
+				      AVC_CACHE_MAX_SLOTS));
 }
 
 static struct avc_callback_node *avc_callbacks;
@@ -124,9 +224,84 @@ static struct kmem_cache *avc_xperms_data_cachep;
 static struct kmem_cache *avc_xperms_decision_cachep;
 static struct kmem_cache *avc_xperms_cachep;
 
-static inline int avc_hash(u32 ssid, u32 tsid, u16 tclass)
+static inline struct avc_table *avc_cache_table(struct selinux_avc *avc)
+{
+	return rcu_dereference(avc->avc_cache.table);
+}
+
+static inline int avc_hash(struct avc_table *table,
+			   u32 ssid, u32 tsid, u16 tclass)
+{
+	return jhash_3words(ssid, tsid, tclass, 0) & (table->size - 1);
+}
+
+static inline u32 avc_front_generation(struct selinux_avc *avc)
+{
+	u32 generation = atomic_read(&avc->avc_cache.generation);
+
+	/* Pairs with avc_front_invalidate() */
+	smp_rmb();
+	return generation;
+}
+
+/*
+ * Called after the decisions that went stale are unlinked, so that a
+ * lookup that still found one of them also saw the old generation.
+ */
+static void avc_front_invalidate(struct selinux_avc *avc)
+{
+	smp_mb__before_atomic();
+	atomic_inc(&avc->avc_cache.generation);
+}
+
+/* Must be called with interrupts disabled */
+static inline struct avc_front_entry *avc_front_slot(u32 ssid, u32 tsid,
+						     u16 tclass)
+{
+	int hvalue = jhash_3words(ssid, tsid, tclass, 0) &
+		     (AVC_FRONT_SLOTS - 1);
+
+	return this_cpu_ptr(&avc_front_cache[hvalue]);
+}
+
+static bool avc_front_lookup(u32 ssid, u32 tsid, u16 tclass, u32 generation,
+			     struct av_decision *avd)
 {
-	return (ssid ^ (tsid<<2) ^ (tclass<<4)) & (AVC_CACHE_SLOTS - 1);
+	struct avc_front_entry *fe;
+	unsigned long flags;
+	bool hit = false;
+
+	/* Interrupts off, as softirqs check permissions too */
+	local_irq_save(flags);
+	fe = avc_front_slot(ssid, tsid, tclass);
+	if (fe->generation == generation && fe->ssid == ssid &&
+	    fe->tsid == tsid && fe->tclass == tclass) {
+		memcpy(avd, &fe->avd, sizeof(*avd));
+		hit = true;
+	}
+	local_irq_restore(flags);
+
+	if (hit)
+		avc_cache_stats_incr(front_hits);
+	else
+		avc_cache_stats_incr(front_misses);
+	return hit;
+}
+
+static void avc_front_fill(u32 ssid, u32 tsid, u16 tclass, u32 generation,
+			   struct av_decision *avd)
+{
+	struct avc_front_entry *fe;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	fe = avc_front_slot(ssid, tsid, tclass);
+	fe->ssid = ssid;
+	fe->tsid = tsid;
+	fe->tclass = tclass;
+	fe->generation = generation;
+	memcpy(&fe->avd, avd, sizeof(fe->avd));
+	local_irq_restore(flags);
 }
 #ifdef CONFIG_AUDIT
 /**
@@ -224,16 +399,19 @@ void __init avc_init(void)
 
 int avc_get_hash_stats(struct selinux_avc *avc, char *page)
 {
-	int i, chain_len, max_chain_len, slots_used;
+	int i, chain_len, max_chain_len, slots_used, size;
+	struct avc_table *table;
 	struct avc_node *node;
 	struct hlist_head *head;
 
 	rcu_read_lock();
 
+	table = avc_cache_table(avc);
+	size = table->size;
 	slots_used = 0;
 	max_chain_len = 0;
-	for (i = 0; i < AVC_CACHE_SLOTS; i++) {
-		head = &avc->avc_cache.slots[i];
+	for (i = 0; i < size; i++) {
+		head = &table->slots[i].head;
 		if (!hlist_empty(head)) {
 			slots_used++;
 			chain_len = 0;
@@ -249,7 +427,7 @@ int avc_get_hash_stats(struct selinux_avc *avc, char *page)
 	return scnprintf(page, PAGE_SIZE, "entries: %d\nbuckets used: %d/%d\n"
 			 "longest chain: %d\n",
 			 atomic_read(&avc->avc_cache.active_nodes),
-			 slots_used, AVC_CACHE_SLOTS, max_chain_len);
+			 slots_used, size, max_chain_len);
 }
 
 /*
@@ -538,44 +716,128 @@ static void avc_node_replace(struct selinux_avc *avc,
 	atomic_dec(&avc->avc_cache.active_nodes);
 }
 
-static inline int avc_reclaim_node(struct selinux_avc *avc)
+static int avc_reclaim_node(struct selinux_avc *avc)
 {
+	struct avc_table *table;
 	struct avc_node *node;
 	int hvalue, try, ecx;
 	unsigned long flags;
-	struct hlist_head *head;
-	spinlock_t *lock;
+	struct avc_slot *slot;
 
-	for (try = 0, ecx = 0; try < AVC_CACHE_SLOTS; try++) {
+	rcu_read_lock();
+	table = avc_cache_table(avc);
+	for (try = 0, ecx = 0; try < table->size; try++) {
 		hvalue = atomic_inc_return(&avc->avc_cache.lru_hint) &
-			(AVC_CACHE_SLOTS - 1);
-		head = &avc->avc_cache.slots[hvalue];
-		lock = &avc->avc_cache.slots_lock[hvalue];
+			(table->size - 1);
+		slot = &table->slots[hvalue];
 
-		if (!spin_trylock_irqsave(lock, flags))
+		if (!spin_trylock_irqsave(&slot->lock, flags))
 			continue;
 
-		rcu_read_lock();
-		hlist_for_each_entry(node, head, list) {
+		hlist_for_each_entry(node, &slot->head, list) {
 			avc_node_delete(avc, node);
 			avc_cache_stats_incr(reclaims);
 			ecx++;
 			if (ecx >= AVC_CACHE_RECLAIM) {
-				rcu_read_unlock();
-				spin_unlock_irqrestore(lock, flags);
+				spin_unlock_irqrestore(&slot->lock, flags);
 				goto out;
 			}
 		}
-		rcu_read_unlock();
-		spin_unlock_irqrestore(lock, flags);
+		spin_unlock_irqrestore(&slot->lock, flags);
 	}
 out:
+	rcu_read_unlock();
 	return ecx;
 }
 
+/*
+ * Move a node of a table that is no longer published to the current one,
+ * unless the current one picked up the same entry in the meantime.
+ */
+static bool avc_rehash_node(struct avc_table *table, struct avc_node *node)
+{
+	struct avc_slot *slot;
+	struct avc_node *pos;
+	unsigned long flags;
+	bool moved = true;
+
+	slot = &table->slots[avc_hash(table, node->ae.ssid, node->ae.tsid,
+				      node->ae.tclass)];
+
+	spin_lock_irqsave(&slot->lock, flags);
+	hlist_for_each_entry(pos, &slot->head, list) {
+		if (pos->ae.ssid == node->ae.ssid &&
+		    pos->ae.tsid == node->ae.tsid &&
+		    pos->ae.tclass == node->ae.tclass) {
+			moved = false;
+			goto out;
+		}
+	}
+	hlist_add_head_rcu(&node->list, &slot->head);
+out:
+	spin_unlock_irqrestore(&slot->lock, flags);
+	return moved;
+}
+
+static void avc_resize_table(struct selinux_avc *avc, unsigned int size)
+{
+	struct avc_table *old, *new;
+	struct avc_node *node;
+	struct hlist_node *tmp;
+	unsigned int i;
+
+	mutex_lock(&avc->avc_cache.table_mutex);
+	old = rcu_dereference_protected(avc->avc_cache.table,
+			lockdep_is_held(&avc->avc_cache.table_mutex));
+	if (old->size == size)
+		goto out;
+
+	new = avc_alloc_table(size);
+	if (!new)
+		goto out;
+
+	rcu_assign_pointer(avc->avc_cache.table, new);
+
+	/*
+	 * The table is only reached under rcu_read_lock(), so nobody
+	 * looks at the old one or its nodes past the grace period. The
+	 * table mutex keeps avc_flush() out until they are all moved.
+	 */
+	synchronize_rcu();
+
+	for (i = 0; i < old->size; i++) {
+		hlist_for_each_entry_safe(node, tmp, &old->slots[i].head,
+					  list) {
+			hlist_del(&node->list);
+			if (!avc_rehash_node(new, node))
+				avc_node_kill(avc, node);
+		}
+		cond_resched();
+	}
+	kvfree(old);
+out:
+	mutex_unlock(&avc->avc_cache.table_mutex);
+}
+
+static void avc_cache_work(struct work_struct *work)
+{
+	struct selinux_avc *avc = container_of(work, struct selinux_avc,
+					       avc_cache.work);
+
+	avc_resize_table(avc, READ_ONCE(avc->avc_cache.target_size));
+
+	while (atomic_read(&avc->avc_cache.active_nodes) >
+	       READ_ONCE(avc->avc_cache_threshold)) {
+		if (!avc_reclaim_node(avc))
+			break;
+		cond_resched();
+	}
+}
+
 static struct avc_node *avc_alloc_node(struct selinux_avc *avc)
 {
 	struct avc_node *node;
+	unsigned int active, threshold;
 
 	node = kmem_cache_zalloc(avc_node_cachep, GFP_NOWAIT | __GFP_NOWARN);
 	if (!node)
@@ -584,9 +846,18 @@ static struct avc_node *avc_alloc_node(struct selinux_avc *avc)
 	INIT_HLIST_NODE(&node->list);
 	avc_cache_stats_incr(allocations);
 
-	if (atomic_inc_return(&avc->avc_cache.active_nodes) >
-	    avc->avc_cache_threshold)
-		avc_reclaim_node(avc);
+	active = atomic_inc_return(&avc->avc_cache.active_nodes);
+	threshold = READ_ONCE(avc->avc_cache_threshold);
+	if (unlikely(active > threshold)) {
+		/*
+		 * Trimming the cache is left to the worker, unless it
+		 * falls behind by more than half the threshold.
+		 */
+		if (active > threshold + threshold / 2 + AVC_CACHE_RECLAIM)
+			avc_reclaim_node(avc);
+		else
+			queue_work(system_unbound_wq, &avc->avc_cache.work);
+	}
 
 out:
 	return node;
@@ -603,12 +874,13 @@ static void avc_node_populate(struct avc_node *node, u32 ssid, u32 tsid, u16 tcl
 static inline struct avc_node *avc_search_node(struct selinux_avc *avc,
 					       u32 ssid, u32 tsid, u16 tclass)
 {
+	struct avc_table *table = avc_cache_table(avc);
 	struct avc_node *node, *ret = NULL;
 	int hvalue;
 	struct hlist_head *head;
 
-	hvalue = avc_hash(ssid, tsid, tclass);
-	head = &avc->avc_cache.slots[hvalue];
+	hvalue = avc_hash(table, ssid, tsid, tclass);
+	head = &table->slots[hvalue].head;
 	hlist_for_each_entry_rcu(node, head, list) {
 		if (ssid == node->ae.ssid &&
 		    tclass == node->ae.tclass &&
@@ -703,19 +975,20 @@ static struct avc_node *avc_insert(struct selinux_avc *avc,
 
 	node = avc_alloc_node(avc);
 	if (node) {
+		struct avc_table *table = avc_cache_table(avc);
 		struct hlist_head *head;
 		spinlock_t *lock;
 		int rc = 0;
 
-		hvalue = avc_hash(ssid, tsid, tclass);
+		hvalue = avc_hash(table, ssid, tsid, tclass);
 		avc_node_populate(node, ssid, tsid, tclass, avd);
 		rc = avc_xperms_populate(node, xp_node);
 		if (rc) {
 			kmem_cache_free(avc_node_cachep, node);
 			return NULL;
 		}
-		head = &avc->avc_cache.slots[hvalue];
-		lock = &avc->avc_cache.slots_lock[hvalue];
+		head = &table->slots[hvalue].head;
+		lock = &table->slots[hvalue].lock;
 
 		spin_lock_irqsave(lock, flag);
 		hlist_for_each_entry(pos, head, list) {
@@ -868,6 +1141,7 @@ static int avc_update_node(struct selinux_avc *avc,
 	int hvalue, rc = 0;
 	unsigned long flag;
 	struct avc_node *pos, *node, *orig = NULL;
+	struct avc_table *table;
 	struct hlist_head *head;
 	spinlock_t *lock;
 
@@ -878,10 +1152,11 @@ static int avc_update_node(struct selinux_avc *avc,
 	}
 
 	/* Lock the target slot */
-	hvalue = avc_hash(ssid, tsid, tclass);
+	table = avc_cache_table(avc);
+	hvalue = avc_hash(table, ssid, tsid, tclass);
 
-	head = &avc->avc_cache.slots[hvalue];
-	lock = &avc->avc_cache.slots_lock[hvalue];
+	head = &table->slots[hvalue].head;
+	lock = &table->slots[hvalue].lock;
 
 	spin_lock_irqsave(lock, flag);
 
@@ -942,6 +1217,7 @@ static int avc_update_node(struct selinux_avc *avc,
 		break;
 	}
 	avc_node_replace(avc, node, orig);
+	avc_front_invalidate(avc);
 out_unlock:
 	spin_unlock_irqrestore(lock, flag);
 out:
@@ -953,15 +1229,19 @@ static int avc_update_node(struct selinux_avc *avc,
  */
 static void avc_flush(struct selinux_avc *avc)
 {
+	struct avc_table *table;
 	struct hlist_head *head;
 	struct avc_node *node;
 	spinlock_t *lock;
 	unsigned long flag;
 	int i;
 
-	for (i = 0; i < AVC_CACHE_SLOTS; i++) {
-		head = &avc->avc_cache.slots[i];
-		lock = &avc->avc_cache.slots_lock[i];
+	mutex_lock(&avc->avc_cache.table_mutex);
+	table = rcu_dereference_protected(avc->avc_cache.table,
+			lockdep_is_held(&avc->avc_cache.table_mutex));
+	for (i = 0; i < table->size; i++) {
+		head = &table->slots[i].head;
+		lock = &table->slots[i].lock;
 
 		spin_lock_irqsave(lock, flag);
 		/*
@@ -974,6 +1254,9 @@ static void avc_flush(struct selinux_avc *avc)
 		rcu_read_unlock();
 		spin_unlock_irqrestore(lock, flag);
 	}
+	mutex_unlock(&avc->avc_cache.table_mutex);
+
+	avc_front_invalidate(avc);
 }
 
 /**
@@ -1153,17 +1436,25 @@ inline int avc_has_perm_noaudit(struct selinux_state *state,
 	struct avc_node *node;
 	struct avc_xperms_node xp_node;
 	int rc = 0;
-	u32 denied;
+	u32 denied, generation;
 
 	BUG_ON(!requested);
 
 	rcu_read_lock();
 
-	node = avc_lookup(state->avc, ssid, tsid, tclass);
-	if (unlikely(!node))
-		node = avc_compute_av(state, ssid, tsid, tclass, avd, &xp_node);
-	else
-		memcpy(avd, &node->ae.avd, sizeof(*avd));
+	generation = avc_front_generation(state->avc);
+	if (!avc_front_lookup(ssid, tsid, tclass, generation, avd)) {
+		node = avc_lookup(state->avc, ssid, tsid, tclass);
+		if (unlikely(!node))
+			node = avc_compute_av(state, ssid, tsid, tclass, avd,
+					      &xp_node);
+		else
+			memcpy(avd, &node->ae.avd, sizeof(*avd));
+
+		/* Only decisions that made it into the cache are copied */
+		if (node)
+			avc_front_fill(ssid, tsid, tclass, generation, avd);
+	}
 
 	denied = requested & ~(avd->allowed);
 	if (unlikely(denied))
@@ -38,6 +38,8 @@ struct avc_cache_stats {
 	unsigned int allocations;
 	unsigned int reclaims;
 	unsigned int frees;
+	unsigned int front_hits;
+	unsigned int front_misses;
 };
 
 /*
@@ -10,6 +10,7 @@
 
 struct selinux_avc;
 int avc_ss_reset(struct selinux_avc *avc, u32 seqno);
+void avc_ss_size_hint(struct selinux_avc *avc, u32 rules);
 
 /* Class/perm mapping support */
 struct security_class_mapping {
@@ -6,6 +6,7 @@
 #ifndef _SS_SERVICES_H_
 #define _SS_SERVICES_H_
 
+#include <linux/seqlock.h>
 #include "policydb.h"
 
 /* Mapping for a single class */
@@ -21,12 +22,23 @@ struct selinux_map {
 	u16 size; /* array size of mapping */
 };
 
-struct selinux_ss {
+/*
+ * A loaded policy: the policydb, the SID table built for it and the class
+ * mapping. Readers access it under rcu_read_lock(), a policy load builds
+ * a complete new one and swaps it in. Boolean changes update the
+ * conditional rules in place under bools_lock.
+ */
+struct selinux_policy {
 	struct sidtab *sidtab;
 	struct policydb policydb;
-	rwlock_t policy_rwlock;
-	u32 latest_granting;
 	struct selinux_map map;
+	u32 latest_granting;
+	seqlock_t bools_lock;
+};
+
+struct selinux_ss {
+	struct selinux_policy __rcu *policy;
+	struct mutex policy_mutex;
 	struct page *status_page;
 	struct mutex status_lock;
 };
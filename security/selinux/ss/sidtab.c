@@ -30,6 +30,7 @@ int sidtab_init(struct sidtab *s)
 
 	s->count = 0;
 	s->convert = NULL;
+	s->frozen = false;
 	hash_init(s->context_to_sid);
 
 	spin_lock_init(&s->lock);
@@ -254,6 +255,11 @@ int sidtab_context_to_sid(struct sidtab *s, struct context *context,
 	if (*sid)
 		goto out_unlock;
 
+	/* the policy was replaced, the caller must retry with the new one */
+	rc = -ESTALE;
+	if (unlikely(s->frozen))
+		goto out_unlock;
+
 	count = s->count;
 	convert = s->convert;
 
@@ -437,6 +443,26 @@ int sidtab_convert(struct sidtab *s, struct sidtab_convert_params *params)
 	return 0;
 }
 
+/*
+ * Stop adding entries to a table whose policy is being replaced. Entries
+ * added to it from here on would not make it into the converted table, so
+ * sidtab_context_to_sid() fails with -ESTALE instead. The new policy must
+ * be published before sidtab_freeze_end() so the retry finds it.
+ */
+void sidtab_freeze_begin(struct sidtab *s, unsigned long *flags)
+	__acquires(&s->lock)
+{
+	spin_lock_irqsave(&s->lock, *flags);
+	s->frozen = true;
+	s->convert = NULL;
+}
+
+void sidtab_freeze_end(struct sidtab *s, unsigned long *flags)
+	__releases(&s->lock)
+{
+	spin_unlock_irqrestore(&s->lock, *flags);
+}
+
 static void sidtab_destroy_tree(union sidtab_entry_inner entry, u32 level)
 {
 	u32 i;
@@ -0,0 +1,286 @@
+/*
+ * lpm-replay: replay recorded idle periods through the lpm-levels wakeup
+ * predictor and compare it against timer-only level selection.
+ *
+ * The state file describes the cpu levels, shallowest first, one per line:
+ *
+ *	<name> <min_residency_us> <latency_us> <ss_power> <energy_overhead>
+ *
+ * The trace file holds one idle period per line:
+ *
+ *	<timer_sleep_us> <measured_us>
+ *
+ * where timer_sleep_us is the sleep length the governor saw on entry (the
+ * sleep_us field of the cpu_power_select tracepoint) and measured_us the
+ * time actually spent idle (derived from cpu_idle_enter/cpu_idle_exit).
+ *
+ * For each policy the harness reports the energy spent (ss_power * time
+ * plus energy_overhead per entry) and the exit latency regret: the exit
+ * latency paid in periods that ended before the chosen level broke even.
+ *
+ * The predictor mirrors lpm_cpuidle_predict() and lpm_cpuidle_reflect()
+ * in drivers/cpuidle/lpm-levels.c and must be kept in sync with them.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#define NR_LPM_LEVELS 8
+#define PRED_PULSE 1024
+#define PRED_DECAY_SHIFT 3
+#define PRED_INTERVALS 8
+#define DEFAULT_TIMER_ADD 100
+
+struct level {
+	char name[32];
+	uint32_t min_residency;
+	uint32_t latency_us;
+	uint32_t ss_power;
+	uint32_t energy_overhead;
+};
+
+struct pred_bin {
+	uint32_t hits;
+	uint32_t misses;
+};
+
+struct cpu_history {
+	struct pred_bin bins[NR_LPM_LEVELS];
+	uint32_t intervals[PRED_INTERVALS];
+	int interval_idx;
+};
+
+struct result {
+	const char *policy;
+	double energy;
+	uint64_t regret_us;
+	unsigned long entries;
+	unsigned long too_deep;
+	unsigned long too_shallow;
+};
+
+static struct level levels[NR_LPM_LEVELS];
+static int nlevels;
+static uint32_t tmr_add = DEFAULT_TIMER_ADD;
+
+static int pred_bin(uint32_t duration_us)
+{
+	int i, bin = 0;
+
+	for (i = 1; i < nlevels; i++) {
+		if (duration_us < levels[i].min_residency)
+			break;
+		bin = i;
+	}
+
+	return bin;
+}
+
+static uint32_t predict(struct cpu_history *h, uint32_t sleep_us)
+{
+	uint32_t early = 0, max_early = 0, sum = 0, predicted;
+	int i, timer_bin, early_bin = 0, count = 0;
+
+	timer_bin = pred_bin(sleep_us);
+	if (!timer_bin)
+		return 0;
+
+	for (i = 0; i < timer_bin; i++) {
+		early += h->bins[i].misses;
+		if (h->bins[i].misses > max_early) {
+			max_early = h->bins[i].misses;
+			early_bin = i;
+		}
+	}
+
+	if (early <= h->bins[timer_bin].hits + h->bins[timer_bin].misses)
+		return 0;
+
+	for (i = 0; i < PRED_INTERVALS; i++) {
+		uint32_t interval = h->intervals[i];
+
+		if (interval && interval < levels[timer_bin].min_residency) {
+			sum += interval;
+			count++;
+		}
+	}
+
+	if (count > PRED_INTERVALS / 2)
+		predicted = sum / count;
+	else
+		predicted = levels[early_bin + 1].min_residency - 1;
+
+	return predicted ? predicted : 1;
+}
+
+static void reflect(struct cpu_history *h, uint32_t sleep_us,
+		    uint32_t measured_us)
+{
+	int i, timer_bin = pred_bin(sleep_us), bin = pred_bin(measured_us);
+
+	for (i = 0; i < nlevels; i++) {
+		h->bins[i].hits -= h->bins[i].hits >> PRED_DECAY_SHIFT;
+		h->bins[i].misses -= h->bins[i].misses >> PRED_DECAY_SHIFT;
+	}
+
+	if (bin >= timer_bin)
+		h->bins[timer_bin].hits += PRED_PULSE;
+	else
+		h->bins[bin].misses += PRED_PULSE;
+
+	h->intervals[h->interval_idx] = measured_us;
+	h->interval_idx = (h->interval_idx + 1) % PRED_INTERVALS;
+}
+
+/* Account one stay of @duration_us in level @idx. */
+static void account(struct result *r, int idx, uint32_t duration_us)
+{
+	int ideal = pred_bin(duration_us);
+
+	r->entries++;
+	r->energy += (double)levels[idx].ss_power * duration_us +
+		levels[idx].energy_overhead;
+
+	if (idx > ideal) {
+		r->too_deep++;
+		r->regret_us += levels[idx].latency_us;
+	} else if (idx < ideal) {
+		r->too_shallow++;
+	}
+}
+
+static void replay_timer(struct result *r, uint32_t sleep_us,
+			 uint32_t measured_us)
+{
+	account(r, pred_bin(sleep_us), measured_us);
+}
+
+static void replay_predict(struct result *r, struct cpu_history *h,
+			   uint32_t sleep_us, uint32_t measured_us)
+{
+	uint32_t predicted = predict(h, sleep_us);
+	uint32_t htime;
+	int idx = pred_bin(sleep_us);
+
+	if (!predicted || pred_bin(predicted) >= idx) {
+		account(r, idx, measured_us);
+		reflect(h, sleep_us, measured_us);
+		return;
+	}
+
+	/*
+	 * A shallower level was picked and the history timer armed. If the
+	 * CPU is still idle when it fires, it is a miss: re-enter for the
+	 * rest of the period by the timer alone.
+	 */
+	htime = predicted + tmr_add;
+	idx = pred_bin(predicted);
+	if (measured_us < htime || htime >= sleep_us) {
+		account(r, idx, measured_us);
+		reflect(h, sleep_us, measured_us);
+		return;
+	}
+
+	account(r, idx, htime);
+	reflect(h, sleep_us, sleep_us);
+	account(r, pred_bin(sleep_us - htime), measured_us - htime);
+}
+
+static int read_levels(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[256];
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f) && nlevels < NR_LPM_LEVELS) {
+		struct level *l = &levels[nlevels];
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "%31s %u %u %u %u", l->name, &l->min_residency,
+			   &l->latency_us, &l->ss_power,
+			   &l->energy_overhead) != 5) {
+			fprintf(stderr, "%s: malformed level: %s", path, line);
+			fclose(f);
+			return -1;
+		}
+		nlevels++;
+	}
+
+	fclose(f);
+	return nlevels ? 0 : -1;
+}
+
+static void print_result(struct result *r)
+{
+	printf("%-8s entries %8lu energy %14.0f regret_us %10llu too_deep %8lu too_shallow %8lu\n",
+	       r->policy, r->entries, r->energy,
+	       (unsigned long long)r->regret_us, r->too_deep, r->too_shallow);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t tmr_add_us] <levels-file> <trace-file>\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct result timer = { .policy = "timer" };
+	struct result pred = { .policy = "predict" };
+	struct cpu_history history;
+	uint32_t sleep_us, measured_us;
+	FILE *trace;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		switch (opt) {
+		case 't':
+			tmr_add = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (argc - optind != 2)
+		usage(argv[0]);
+
+	if (read_levels(argv[optind]))
+		return 1;
+
+	trace = fopen(argv[optind + 1], "r");
+	if (!trace) {
+		perror(argv[optind + 1]);
+		return 1;
+	}
+
+	memset(&history, 0, sizeof(history));
+	while (fscanf(trace, "%u %u", &sleep_us, &measured_us) == 2) {
+		if (measured_us > sleep_us)
+			measured_us = sleep_us;
+		replay_timer(&timer, sleep_us, measured_us);
+		replay_predict(&pred, &history, sleep_us, measured_us);
+	}
+	fclose(trace);
+
+	print_result(&timer);
+	print_result(&pred);
+
+	return 0;
+}
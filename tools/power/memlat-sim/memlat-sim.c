@@ -0,0 +1,414 @@
+/*
+ * memlat-sim: feed memory latency monitor counter samples through the
+ * bw_memlat devfreq governor and compare it against the mem_latency and
+ * bandwidth votes acting independently on the same bus.
+ *
+ * The map file is the qcom,core-dev-table of the device, one entry per
+ * line, with the core frequency in MHz and the bus vote in MBps:
+ *
+ *	<core_mhz> <dev_mbps>
+ *
+ * The optional levels file lists the bus frequency table in MBps, lowest
+ * first, one per line. Votes are rounded up to the next level the way
+ * devfreq picks an OPP. Without it votes are used as is.
+ *
+ * The trace file holds one sample per line, with one group of counters per
+ * monitored core as reported by the arm-memlat-mon get_cnt() callback:
+ *
+ *	<sample_us> <freq_mhz> <inst> <mem> <stall_pct> [<freq_mhz> ...]
+ *
+ * A synthetic trace can be generated with -g <pattern>, where pattern is
+ * one of steady, burst, ramp or noise.
+ *
+ * For each policy the harness reports the number of vote changes, the
+ * average vote and the samples where the vote was below the bandwidth that
+ * was actually used. The governor logic mirrors memlat_lat_vote() and
+ * devfreq_bw_memlat_get_freq() in drivers/devfreq/governor_memlat.c and
+ * must be kept in sync with them.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#define MAX_CORES		8
+#define MAX_MAP			32
+#define MAX_LEVELS		32
+#define MEMLAT_LINE_SIZE	64
+
+struct core_stats {
+	unsigned long freq;
+	unsigned long inst_count;
+	unsigned long mem_count;
+	unsigned long stall_pct;
+};
+
+struct core_dev_map {
+	unsigned int core_mhz;
+	unsigned int target_freq;
+};
+
+struct tunables {
+	unsigned int ratio_ceil;
+	unsigned int stall_floor;
+	unsigned int io_percent;
+	unsigned int hyst_pct;
+	unsigned int down_count;
+	unsigned int ramp_pct;
+};
+
+struct combined {
+	unsigned long prev_bw;
+	unsigned long vote;
+	unsigned int down_cnt;
+	bool rising;
+};
+
+struct result {
+	const char *policy;
+	unsigned long prev;
+	unsigned long changes;
+	unsigned long under;
+	unsigned long long sum;
+};
+
+static struct core_dev_map map[MAX_MAP];
+static int nmap;
+static unsigned long levels[MAX_LEVELS];
+static int nlevels;
+static struct tunables tun = {
+	.ratio_ceil = 10,
+	.stall_floor = 0,
+	.io_percent = 80,
+	.hyst_pct = 10,
+	.down_count = 3,
+	.ramp_pct = 50,
+};
+
+static unsigned long core_to_dev_freq(unsigned long coref)
+{
+	int i;
+
+	for (i = 0; i < nmap - 1 && map[i].core_mhz < coref; i++)
+		;
+	return nmap ? map[i].target_freq : 0;
+}
+
+static unsigned long lat_vote(struct core_stats *cs, int ncores)
+{
+	unsigned long max_freq = 0;
+	unsigned int ratio;
+	int i;
+
+	for (i = 0; i < ncores; i++) {
+		ratio = cs[i].inst_count;
+		if (cs[i].mem_count)
+			ratio /= cs[i].mem_count;
+
+		if (!cs[i].inst_count || !cs[i].freq)
+			continue;
+
+		if (ratio <= tun.ratio_ceil &&
+		    cs[i].stall_pct >= tun.stall_floor &&
+		    cs[i].freq > max_freq)
+			max_freq = cs[i].freq;
+	}
+
+	return max_freq ? core_to_dev_freq(max_freq) : 0;
+}
+
+static unsigned long bw_mbps(struct core_stats *cs, int ncores,
+			     unsigned long us)
+{
+	unsigned long long bytes = 0;
+	int i;
+
+	for (i = 0; i < ncores; i++)
+		bytes += (unsigned long long)cs[i].mem_count * MEMLAT_LINE_SIZE;
+
+	return bytes / (us ? us : 1);
+}
+
+static unsigned long combined_vote(struct combined *c, unsigned long lat,
+				   unsigned long bw)
+{
+	unsigned long req = bw * 100 / tun.io_percent;
+	unsigned long pred = req, target;
+
+	if (req > c->prev_bw && c->rising)
+		pred += (req - c->prev_bw) * tun.ramp_pct / 100;
+	c->rising = req > c->prev_bw;
+	c->prev_bw = req;
+
+	target = lat > pred ? lat : pred;
+
+	if (target >= c->vote) {
+		c->vote = target;
+		c->down_cnt = 0;
+	} else if (target * 100 < c->vote * (100 - tun.hyst_pct)) {
+		if (++c->down_cnt >= tun.down_count) {
+			c->vote = target;
+			c->down_cnt = 0;
+		}
+	} else {
+		c->down_cnt = 0;
+	}
+
+	return c->vote;
+}
+
+static unsigned long to_level(unsigned long vote)
+{
+	int i;
+
+	if (!nlevels)
+		return vote;
+
+	for (i = 0; i < nlevels - 1 && levels[i] < vote; i++)
+		;
+	return levels[i];
+}
+
+static void account(struct result *r, unsigned long vote, unsigned long used)
+{
+	vote = to_level(vote);
+	if (vote != r->prev)
+		r->changes++;
+	r->prev = vote;
+	r->sum += vote;
+	if (vote < used)
+		r->under++;
+}
+
+static int read_map(const char *path)
+{
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (nmap < MAX_MAP &&
+	       fscanf(f, "%u %u", &map[nmap].core_mhz,
+		      &map[nmap].target_freq) == 2)
+		nmap++;
+
+	fclose(f);
+	return nmap ? 0 : -1;
+}
+
+static int read_levels(const char *path)
+{
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (nlevels < MAX_LEVELS && fscanf(f, "%lu", &levels[nlevels]) == 1)
+		nlevels++;
+
+	fclose(f);
+	return 0;
+}
+
+static int parse_sample(char *line, unsigned long *us, struct core_stats *cs)
+{
+	int ncores = 0, n;
+	char *p = line;
+
+	if (sscanf(p, "%lu%n", us, &n) != 1)
+		return 0;
+	p += n;
+
+	while (ncores < MAX_CORES &&
+	       sscanf(p, "%lu %lu %lu %lu%n", &cs[ncores].freq,
+		      &cs[ncores].inst_count, &cs[ncores].mem_count,
+		      &cs[ncores].stall_pct, &n) == 4) {
+		p += n;
+		ncores++;
+	}
+
+	return ncores;
+}
+
+/*
+ * Synthetic traces, 10ms samples on a single core. Memory bound phases run
+ * at a low instructions per miss ratio and high stall percentage.
+ */
+static int generate(const char *pattern, int samples)
+{
+	unsigned long mem, inst, stall, freq;
+	int i;
+
+	srand(1);
+
+	for (i = 0; i < samples; i++) {
+		if (!strcmp(pattern, "steady")) {
+			mem = 150000;
+		} else if (!strcmp(pattern, "burst")) {
+			mem = (i / 5) % 2 ? 600000 : 20000;
+		} else if (!strcmp(pattern, "ramp")) {
+			mem = 10000 + (unsigned long)(i % 100) * 8000;
+		} else if (!strcmp(pattern, "noise")) {
+			mem = 150000 + rand() % 300000;
+		} else {
+			fprintf(stderr, "unknown pattern %s\n", pattern);
+			return 1;
+		}
+
+		freq = mem > 300000 ? 1401 : 1036;
+		inst = mem > 300000 ? mem * 5 : mem * 40;
+		stall = mem > 300000 ? 40 : 5;
+		printf("10000 %lu %lu %lu %lu\n", freq, inst, mem, stall);
+	}
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-v] [-l levels] [-H hyst_pct] [-d down_count]\n"
+		"          [-r ramp_pct] [-i io_percent] [-R ratio_ceil]\n"
+		"          [-s stall_floor] <map> [trace]\n"
+		"       %s -g steady|burst|ramp|noise [-n samples]\n",
+		prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct result res[] = {
+		{ .policy = "independent" },
+		{ .policy = "bw_memlat" },
+	};
+	struct core_stats cs[MAX_CORES];
+	struct combined c = { 0 };
+	const char *pattern = NULL;
+	unsigned long us, lat, bw, used, samples = 0, ind_vote = 0;
+	bool verbose = false;
+	int opt, ncores, nsamples = 1000;
+	char line[1024];
+	FILE *trace = stdin;
+	unsigned int i;
+
+	while ((opt = getopt(argc, argv, "vl:H:d:r:i:R:s:g:n:")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = true;
+			break;
+		case 'l':
+			if (read_levels(optarg))
+				return 1;
+			break;
+		case 'H':
+			tun.hyst_pct = atoi(optarg);
+			break;
+		case 'd':
+			tun.down_count = atoi(optarg);
+			break;
+		case 'r':
+			tun.ramp_pct = atoi(optarg);
+			break;
+		case 'i':
+			tun.io_percent = atoi(optarg);
+			break;
+		case 'R':
+			tun.ratio_ceil = atoi(optarg);
+			break;
+		case 's':
+			tun.stall_floor = atoi(optarg);
+			break;
+		case 'g':
+			pattern = optarg;
+			break;
+		case 'n':
+			nsamples = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (pattern)
+		return generate(pattern, nsamples);
+
+	if (optind >= argc || !tun.io_percent) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (read_map(argv[optind])) {
+		fprintf(stderr, "%s: no map entries\n", argv[optind]);
+		return 1;
+	}
+
+	if (optind + 1 < argc) {
+		trace = fopen(argv[optind + 1], "r");
+		if (!trace) {
+			perror(argv[optind + 1]);
+			return 1;
+		}
+	}
+
+	if (verbose)
+		printf("sample,lat_vote,bw_mbps,independent,bw_memlat\n");
+
+	while (fgets(line, sizeof(line), trace)) {
+		ncores = parse_sample(line, &us, cs);
+		if (!ncores)
+			continue;
+
+		lat = lat_vote(cs, ncores);
+		bw = bw_mbps(cs, ncores, us);
+
+		/*
+		 * The vote made at the end of a sample serves the next one,
+		 * so it is checked against the bandwidth used in that one.
+		 */
+		used = bw;
+		if (samples) {
+			account(&res[0], ind_vote, used);
+			account(&res[1], c.vote, used);
+		}
+
+		/* Independent governors: the bus takes the max of both */
+		ind_vote = bw * 100 / tun.io_percent;
+		if (lat > ind_vote)
+			ind_vote = lat;
+
+		combined_vote(&c, lat, bw);
+
+		if (verbose)
+			printf("%lu,%lu,%lu,%lu,%lu\n", samples, lat, bw,
+			       to_level(ind_vote), to_level(c.vote));
+		samples++;
+	}
+
+	if (trace != stdin)
+		fclose(trace);
+
+	if (samples < 2) {
+		fprintf(stderr, "not enough samples\n");
+		return 1;
+	}
+
+	printf("%-12s %8s %10s %8s\n", "policy", "changes", "avg_mbps",
+	       "under");
+	for (i = 0; i < sizeof(res) / sizeof(res[0]); i++)
+		printf("%-12s %8lu %10llu %8lu\n", res[i].policy,
+		       res[i].changes, res[i].sum / (samples - 1),
+		       res[i].under);
+
+	return 0;
+}
@@ -0,0 +1,307 @@
+/*
+ * avc-bench: measure the throughput of security server lookups that miss
+ * the AVC, with one thread per CPU.
+ *
+ * Each operation is a selinuxfs transaction that goes straight to the
+ * security server without consulting the AVC:
+ *
+ *	access	security_compute_av_user() on <scon> <tcon> <class>
+ *	create	security_transition_sid_user() on the same triple
+ *
+ * Both also map the two contexts to SIDs, so every operation takes three
+ * trips into the loaded policy. With -r the policy is reloaded from
+ * /sys/fs/selinux/policy every <ms> milliseconds meanwhile, which shows
+ * how long lookups stall behind a policy load.
+ *
+ * The contexts default to the one of the calling process and the class
+ * to "process". Reloading the policy needs the load_policy permission.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SELINUXFS	"/sys/fs/selinux"
+#define MAX_THREADS	256
+#define LAT_BUCKETS	24
+
+struct worker {
+	pthread_t thread;
+	unsigned long ops;
+	unsigned long errors;
+	uint64_t max_ns;
+	unsigned long lat[LAT_BUCKETS];
+};
+
+static struct worker workers[MAX_THREADS];
+static char request[1024];
+static const char *node = SELINUXFS "/access";
+static volatile bool stop;
+static unsigned long reloads;
+static uint64_t reload_max_ns;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int read_file(const char *path, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len <= 0)
+		return -1;
+
+	buf[len] = 0;
+	buf[strcspn(buf, "\n")] = 0;
+	return 0;
+}
+
+static int one_op(void)
+{
+	char answer[256];
+	int fd, rc = 0;
+
+	fd = open(node, O_RDWR);
+	if (fd < 0)
+		return -1;
+	if (write(fd, request, strlen(request)) < 0 ||
+	    read(fd, answer, sizeof(answer)) <= 0)
+		rc = -1;
+	close(fd);
+	return rc;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t start, delta;
+	int b;
+
+	while (!stop) {
+		start = now_ns();
+		if (one_op()) {
+			w->errors++;
+			continue;
+		}
+		delta = now_ns() - start;
+
+		if (delta > w->max_ns)
+			w->max_ns = delta;
+		for (b = 0; b < LAT_BUCKETS - 1 && (delta >> 10) >> b; b++)
+			;
+		w->lat[b]++;
+		w->ops++;
+	}
+
+	return NULL;
+}
+
+static void *reload_fn(void *arg)
+{
+	unsigned int interval_ms = *(unsigned int *)arg;
+	size_t size = 0, len = 0;
+	char *policy = NULL, *tmp;
+	uint64_t start, delta;
+	ssize_t n;
+	int fd;
+
+	fd = open(SELINUXFS "/policy", O_RDONLY);
+	if (fd < 0) {
+		perror(SELINUXFS "/policy");
+		return NULL;
+	}
+	do {
+		if (len == size) {
+			size = size ? size * 2 : 1 << 20;
+			tmp = realloc(policy, size);
+			if (!tmp) {
+				close(fd);
+				free(policy);
+				return NULL;
+			}
+			policy = tmp;
+		}
+		n = read(fd, policy + len, size - len);
+		if (n > 0)
+			len += n;
+	} while (n > 0);
+	close(fd);
+
+	while (!stop) {
+		usleep(interval_ms * 1000);
+
+		fd = open(SELINUXFS "/load", O_WRONLY);
+		if (fd < 0) {
+			perror(SELINUXFS "/load");
+			break;
+		}
+		start = now_ns();
+		n = write(fd, policy, len);
+		delta = now_ns() - start;
+		close(fd);
+		if (n != (ssize_t)len) {
+			perror("policy load");
+			break;
+		}
+
+		if (delta > reload_max_ns)
+			reload_max_ns = delta;
+		reloads++;
+	}
+
+	free(policy);
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t threads] [-d seconds] [-m access|create]\n"
+		"          [-s scontext] [-T tcontext] [-c class] [-r reload_ms]\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	char scon[256] = "", tcon[256] = "", path[256], index[16];
+	const char *class = "process", *mode = "access";
+	unsigned int threads, seconds = 5, reload_ms = 0;
+	unsigned long ops = 0, errors = 0, lat[LAT_BUCKETS] = { 0 };
+	unsigned long seen, p99 = 0;
+	uint64_t max_ns = 0;
+	pthread_t reloader;
+	unsigned int i;
+	int opt, b;
+
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "t:d:m:s:T:c:r:")) != -1) {
+		switch (opt) {
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 'm':
+			mode = optarg;
+			break;
+		case 's':
+			snprintf(scon, sizeof(scon), "%s", optarg);
+			break;
+		case 'T':
+			snprintf(tcon, sizeof(tcon), "%s", optarg);
+			break;
+		case 'c':
+			class = optarg;
+			break;
+		case 'r':
+			reload_ms = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!threads || threads > MAX_THREADS) {
+		fprintf(stderr, "threads must be between 1 and %d\n",
+			MAX_THREADS);
+		return 1;
+	}
+
+	if (!strcmp(mode, "create")) {
+		node = SELINUXFS "/create";
+	} else if (strcmp(mode, "access")) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!*scon && read_file("/proc/self/attr/current", scon,
+				sizeof(scon))) {
+		perror("/proc/self/attr/current");
+		return 1;
+	}
+	if (!*tcon)
+		snprintf(tcon, sizeof(tcon), "%s", scon);
+
+	snprintf(path, sizeof(path), SELINUXFS "/class/%s/index", class);
+	if (read_file(path, index, sizeof(index))) {
+		perror(path);
+		return 1;
+	}
+	snprintf(request, sizeof(request), "%s %s %s", scon, tcon, index);
+
+	if (one_op()) {
+		perror(node);
+		return 1;
+	}
+
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i])) {
+			fprintf(stderr, "can't start thread %u\n", i);
+			return 1;
+		}
+	if (reload_ms && pthread_create(&reloader, NULL, reload_fn,
+					&reload_ms)) {
+		fprintf(stderr, "can't start reload thread\n");
+		return 1;
+	}
+
+	sleep(seconds);
+	stop = true;
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ops += workers[i].ops;
+		errors += workers[i].errors;
+		if (workers[i].max_ns > max_ns)
+			max_ns = workers[i].max_ns;
+		for (b = 0; b < LAT_BUCKETS; b++)
+			lat[b] += workers[i].lat[b];
+	}
+	if (reload_ms)
+		pthread_join(reloader, NULL);
+
+	for (b = 0, seen = 0; b < LAT_BUCKETS; b++) {
+		seen += lat[b];
+		if (seen * 100 >= ops * 99) {
+			p99 = 1UL << b;
+			break;
+		}
+	}
+
+	printf("mode %s, %u threads, %u s\n", mode, threads, seconds);
+	printf("ops/s      %lu\n", ops / (seconds ? seconds : 1));
+	printf("ops/s/thr  %lu\n", ops / (seconds ? seconds : 1) / threads);
+	printf("p99 us   < %lu\n", p99);
+	printf("max us     %llu\n", (unsigned long long)max_ns / 1000);
+	printf("errors     %lu\n", errors);
+	if (reload_ms)
+		printf("reloads    %lu, max %llu ms\n", reloads,
+		       (unsigned long long)reload_max_ns / 1000000);
+
+	return 0;
+}
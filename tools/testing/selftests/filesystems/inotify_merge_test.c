@@ -0,0 +1,156 @@
+/*
+ * IN_MODIFY coalescing through a directory watch.
+ *
+ * Writes to two files in a watched directory are interleaved; each file
+ * should be reported modified once.  A IN_ATTRIB in between must keep
+ * the following IN_MODIFY of that file apart, so the order of events of
+ * each file is kept.
+ *
+ * This program is released under the GPL v2.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define MAX_EVENTS	16
+
+struct expect {
+	const char *name;
+	unsigned int mask;
+};
+
+static char dir[] = "/tmp/inotify_merge.XXXXXX";
+
+static int open_file(const char *name)
+{
+	char path[64];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	return fd;
+}
+
+static void do_write(int fd)
+{
+	if (write(fd, "x", 1) != 1) {
+		perror("write");
+		exit(1);
+	}
+}
+
+static void do_chmod(const char *name, mode_t mode)
+{
+	char path[64];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if (chmod(path, mode)) {
+		perror(path);
+		exit(1);
+	}
+}
+
+/* read all queued events and compare them with @exp */
+static int check(int ifd, const char *test, const struct expect *exp,
+		 int nr)
+{
+	char buf[MAX_EVENTS * (sizeof(struct inotify_event) + 16)];
+	struct inotify_event *ev;
+	ssize_t len;
+	char *p;
+	int i = 0;
+
+	len = read(ifd, buf, sizeof(buf));
+	if (len < 0 && errno != EAGAIN) {
+		perror("read");
+		exit(1);
+	}
+
+	for (p = buf; len > 0 && p < buf + len;
+	     p += sizeof(*ev) + ev->len, i++) {
+		ev = (struct inotify_event *)p;
+		if (i >= nr || strcmp(ev->name, exp[i].name) ||
+		    ev->mask != exp[i].mask) {
+			printf("%s: [FAIL] unexpected event %d: %s 0x%x\n",
+			       test, i, ev->len ? ev->name : "",
+			       ev->mask);
+			return 1;
+		}
+	}
+
+	if (i != nr) {
+		printf("%s: [FAIL] %d events, expected %d\n", test, i, nr);
+		return 1;
+	}
+
+	printf("%s: [OK]\n", test);
+	return 0;
+}
+
+int main(void)
+{
+	static const struct expect interleaved[] = {
+		{ "a", IN_MODIFY },
+		{ "b", IN_MODIFY },
+	};
+	static const struct expect attrib[] = {
+		{ "a", IN_MODIFY },
+		{ "b", IN_MODIFY },
+		{ "a", IN_ATTRIB },
+		{ "a", IN_MODIFY },
+	};
+	char path[64];
+	int ifd, a, b, ret = 0;
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	a = open_file("a");
+	b = open_file("b");
+
+	ifd = inotify_init1(IN_NONBLOCK);
+	if (ifd < 0) {
+		perror("inotify_init1");
+		return 1;
+	}
+	if (inotify_add_watch(ifd, dir, IN_MODIFY | IN_ATTRIB) < 0) {
+		perror("inotify_add_watch");
+		return 1;
+	}
+
+	do_write(a);
+	do_write(b);
+	do_write(a);
+	do_write(b);
+	ret |= check(ifd, "interleaved writes", interleaved, 2);
+
+	do_write(a);
+	do_write(b);
+	do_chmod("a", 0600);
+	do_write(a);
+	do_write(b);
+	ret |= check(ifd, "writes around chmod", attrib, 4);
+
+	close(ifd);
+	close(a);
+	close(b);
+	snprintf(path, sizeof(path), "%s/a", dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/b", dir);
+	unlink(path);
+	rmdir(dir);
+
+	return ret;
+}
@@ -0,0 +1,156 @@
+/*
+ * Page faults against mmap()/mprotect() in the same process.
+ *
+ * The faulting threads take mmap_sem for read on every fault, the mapping
+ * thread takes it for write the way a JIT does when it maps and protects
+ * code.  The rate of both is printed, which shows how well rw_semaphore
+ * spinning and writer hand-off do on mmap_sem.
+ *
+ *	fault-mmap-bench [-t threads] [-s seconds] [-m mb]
+ *
+ * This program is released under the GPL v2.
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define JIT_PAGES	16
+
+static volatile int stop;
+static size_t region_size;
+static long page_size;
+static int seconds = 10;
+
+struct faulter {
+	pthread_t thread;
+	unsigned long long faults;
+};
+
+static void *fault_loop(void *arg)
+{
+	struct faulter *f = arg;
+	char *p;
+	size_t off;
+
+	p = mmap(NULL, region_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		err(1, "mmap region");
+
+	while (!stop) {
+		for (off = 0; off < region_size && !stop; off += page_size) {
+			p[off] = 1;
+			f->faults++;
+		}
+		/* drop the pages so that the next pass faults them again */
+		if (madvise(p, region_size, MADV_DONTNEED))
+			err(1, "madvise");
+	}
+
+	munmap(p, region_size);
+	return NULL;
+}
+
+static unsigned long long jit_loop(void)
+{
+	size_t len = JIT_PAGES * page_size;
+	unsigned long long ops = 0;
+	char *p;
+
+	while (!stop) {
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			err(1, "mmap jit");
+		memset(p, 0xc3, page_size);
+		if (mprotect(p, len, PROT_READ | PROT_EXEC))
+			err(1, "mprotect");
+		munmap(p, len);
+		ops += 3;
+	}
+
+	return ops;
+}
+
+static void *timer(void *arg)
+{
+	sleep(seconds);
+	stop = 1;
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	int nr_threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	unsigned long long faults = 0, ops;
+	struct faulter *f;
+	pthread_t stopper;
+	int mb = 16;
+	double start, secs;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "t:s:m:")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'm':
+			mb = atoi(optarg);
+			break;
+		default:
+			errx(1, "usage: %s [-t threads] [-s seconds] [-m mb]",
+			     argv[0]);
+		}
+	}
+	if (nr_threads < 1)
+		nr_threads = 1;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	region_size = (size_t)mb << 20;
+
+	f = calloc(nr_threads, sizeof(*f));
+	if (!f)
+		err(1, "calloc");
+
+	start = now();
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&f[i].thread, NULL, fault_loop, &f[i]))
+			errx(1, "pthread_create");
+
+	if (pthread_create(&stopper, NULL, timer, NULL))
+		errx(1, "pthread_create");
+
+	/* the main thread plays the JIT */
+	ops = jit_loop();
+	secs = now() - start;
+	pthread_join(stopper, NULL);
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(f[i].thread, NULL);
+		faults += f[i].faults;
+	}
+
+	printf("%d faulting threads, %.1f s\n", nr_threads, secs);
+	printf("faults:         %12.0f/s\n", faults / secs);
+	printf("mmap/mprotect:  %12.0f/s\n", ops / secs);
+
+	free(f);
+	return 0;
+}
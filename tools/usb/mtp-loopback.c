@@ -0,0 +1,303 @@
+/*
+ * mtp-loopback: MTP gadget file transfer throughput without a separate host
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ * The gadget and the host side run on the same machine, which needs a
+ * board with both a hardware UDC and a USB host port, the two connected
+ * with a cable.  Bind the MTP function to the UDC through configfs:
+ *
+ *	cd /config/usb_gadget && mkdir g1 && cd g1
+ *	echo 0x18d1 > idVendor && echo 0x4ee1 > idProduct
+ *	mkdir functions/mtp.gs0 configs/b.1
+ *	ln -s functions/mtp.gs0 configs/b.1
+ *	ls /sys/class/udc > UDC
+ *
+ * The zero-copy send path is only taken when the UDC supports
+ * scatter-gather (gadget->sg_supported, e.g. dwc3), otherwise the numbers
+ * are those of the copying path.  The same goes for a software UDC such
+ * as dummy_hcd, which does no scatter-gather and is not part of this
+ * tree.  Comparing runs with the mtp_zero_copy module parameter set and
+ * cleared shows what the zero-copy path gains.
+ *
+ * Make sure no MTP daemon holds /dev/mtp_usb, then run
+ *
+ *	mtp-loopback -d /dev/bus/usb/BBB/DDD -f /data/file [-s bytes]
+ *
+ * The program plays both roles: one thread drives the gadget through the
+ * MTP_SEND_FILE and MTP_RECEIVE_FILE ioctls on /dev/mtp_usb, the other
+ * one is the host and moves the data over usbfs.  The rate of each
+ * direction is printed as seen by the gadget side.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <linux/usbdevice_fs.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/f_mtp.h>
+
+#define DEFAULT_SIZE	(256 << 20)
+#define BULK_CHUNK	(1 << 20)
+#define BULK_TIMEOUT	5000	/* ms */
+
+struct bench {
+	const char *mtp_path;
+	const char *usb_path;
+	const char *file_path;
+	long long size;
+	int iface;
+
+	int mtp_fd;
+	int usb_fd;
+	int file_fd;
+	unsigned char ep_in, ep_out;
+	unsigned int maxpacket;
+};
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Find the bulk endpoints of the MTP interface in the descriptors usbfs
+ * returns on read: the device descriptor followed by the configurations.
+ */
+static void find_endpoints(struct bench *b)
+{
+	unsigned char buf[4096];
+	ssize_t len;
+	int pos, cur = -1, pick = -1;
+
+	len = read(b->usb_fd, buf, sizeof(buf));
+	if (len < 0)
+		die("read descriptors");
+
+	for (pos = 0; pos + 2 <= len && buf[pos]; pos += buf[pos]) {
+		if (buf[pos + 1] == USB_DT_INTERFACE) {
+			struct usb_interface_descriptor *id = (void *)&buf[pos];
+
+			if (pick >= 0)
+				break;
+			cur = id->bInterfaceNumber;
+			if (b->iface >= 0 ? cur == b->iface :
+			    id->bInterfaceClass == USB_CLASS_VENDOR_SPEC ||
+			    id->bInterfaceClass == USB_CLASS_STILL_IMAGE) {
+				pick = cur;
+				b->ep_in = b->ep_out = 0;
+			}
+		} else if (buf[pos + 1] == USB_DT_ENDPOINT && pick == cur &&
+			   pick >= 0) {
+			struct usb_endpoint_descriptor *ed = (void *)&buf[pos];
+
+			if ((ed->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) !=
+			    USB_ENDPOINT_XFER_BULK)
+				continue;
+			if (ed->bEndpointAddress & USB_DIR_IN)
+				b->ep_in = ed->bEndpointAddress;
+			else
+				b->ep_out = ed->bEndpointAddress;
+			b->maxpacket = ed->wMaxPacketSize & 0x7ff;
+		}
+	}
+
+	if (pick < 0 || !b->ep_in || !b->ep_out) {
+		fprintf(stderr, "%s: no MTP interface found\n", b->usb_path);
+		exit(1);
+	}
+	b->iface = pick;
+}
+
+static int bulk(struct bench *b, unsigned char ep, void *data, size_t len)
+{
+	struct usbdevfs_bulktransfer bt = {
+		.ep = ep,
+		.len = len,
+		.timeout = BULK_TIMEOUT,
+		.data = data,
+	};
+
+	return ioctl(b->usb_fd, USBDEVFS_BULK, &bt);
+}
+
+/* host side of MTP_SEND_FILE: read the data phase off the IN endpoint */
+static void *host_read(void *arg)
+{
+	struct bench *b = arg;
+	char *buf = malloc(BULK_CHUNK);
+	long long total = 0;
+	int ret = BULK_CHUNK;
+
+	if (!buf)
+		die("malloc");
+	while (total < b->size) {
+		ret = bulk(b, b->ep_in, buf, BULK_CHUNK);
+		if (ret < 0)
+			die("bulk in");
+		total += ret;
+		if (ret < BULK_CHUNK)
+			break;
+	}
+	/* a transfer ending on a packet boundary is terminated by a ZLP */
+	if (!(b->size % b->maxpacket) && ret == BULK_CHUNK)
+		bulk(b, b->ep_in, buf, BULK_CHUNK);
+
+	if (total != b->size)
+		fprintf(stderr, "host read %lld of %lld bytes\n",
+			total, b->size);
+	free(buf);
+	return NULL;
+}
+
+/* host side of MTP_RECEIVE_FILE: write the data phase to the OUT endpoint */
+static void *host_write(void *arg)
+{
+	struct bench *b = arg;
+	char *buf = malloc(BULK_CHUNK);
+	long long total = 0;
+
+	if (!buf)
+		die("malloc");
+	memset(buf, 0x5a, BULK_CHUNK);
+	while (total < b->size) {
+		size_t len = b->size - total;
+		int ret;
+
+		if (len > BULK_CHUNK)
+			len = BULK_CHUNK;
+		ret = bulk(b, b->ep_out, buf, len);
+		if (ret < 0)
+			die("bulk out");
+		total += ret;
+	}
+	/*
+	 * The gadget's last read is a full mtp_rx_req_len (1M by default)
+	 * buffer, which a transfer ending on a packet boundary inside it
+	 * has to terminate with a ZLP.
+	 */
+	if (!(b->size % b->maxpacket) && b->size % BULK_CHUNK)
+		bulk(b, b->ep_out, buf, 0);
+
+	free(buf);
+	return NULL;
+}
+
+static void run(struct bench *b, const char *name, unsigned long code,
+		void *(*host)(void *))
+{
+	struct mtp_file_range mfr = {
+		.fd = b->file_fd,
+		.offset = 0,
+		.length = b->size,
+	};
+	pthread_t thread;
+	double start, secs;
+	int ret;
+
+	if (pthread_create(&thread, NULL, host, b))
+		die("pthread_create");
+
+	start = now();
+	ret = ioctl(b->mtp_fd, code, &mfr);
+	secs = now() - start;
+	if (ret < 0)
+		die(name);
+	pthread_join(thread, NULL);
+
+	printf("%-8s %lld bytes in %.3f s: %.1f MB/s\n", name, b->size,
+	       secs, b->size / secs / (1 << 20));
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s -d /dev/bus/usb/BBB/DDD -f file [-s size]\n"
+		"          [-i interface] [-m /dev/mtp_usb]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b = {
+		.mtp_path = "/dev/mtp_usb",
+		.size = DEFAULT_SIZE,
+		.iface = -1,
+	};
+	struct stat st;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:f:s:i:m:")) != -1) {
+		switch (opt) {
+		case 'd':
+			b.usb_path = optarg;
+			break;
+		case 'f':
+			b.file_path = optarg;
+			break;
+		case 's':
+			b.size = strtoll(optarg, NULL, 0);
+			break;
+		case 'i':
+			b.iface = atoi(optarg);
+			break;
+		case 'm':
+			b.mtp_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!b.usb_path || !b.file_path || b.size <= 0)
+		usage(argv[0]);
+
+	b.mtp_fd = open(b.mtp_path, O_RDWR);
+	if (b.mtp_fd < 0)
+		die(b.mtp_path);
+	b.usb_fd = open(b.usb_path, O_RDWR);
+	if (b.usb_fd < 0)
+		die(b.usb_path);
+	find_endpoints(&b);
+	if (ioctl(b.usb_fd, USBDEVFS_CLAIMINTERFACE, &b.iface) < 0)
+		die("claim interface");
+
+	/* receive first, so that the file to send then is in the page cache */
+	b.file_fd = open(b.file_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (b.file_fd < 0)
+		die(b.file_path);
+	run(&b, "receive", MTP_RECEIVE_FILE, host_write);
+
+	if (fstat(b.file_fd, &st) < 0)
+		die("fstat");
+	if (st.st_size != b.size)
+		fprintf(stderr, "received file has %lld of %lld bytes\n",
+			(long long)st.st_size, b.size);
+	run(&b, "send", MTP_SEND_FILE, host_read);
+
+	close(b.file_fd);
+	close(b.usb_fd);
+	close(b.mtp_fd);
+	return 0;
+}